@@ -0,0 +1,60 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bios.h"
+#include "bus.h"
+#include "hash.h"
+
+bios_image *bios_open(const char *path, u64 expected_hash)
+{
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || st.st_size < BIOS_SIZE)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  u8 *data = mmap(NULL, BIOS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+
+  if (data == MAP_FAILED)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  const u64 hash = hash64(data, BIOS_SIZE);
+
+  bios_image *bios = malloc(sizeof(bios_image));
+
+  if (!bios || (expected_hash && hash != expected_hash))
+  {
+    free(bios);
+    munmap(data, BIOS_SIZE);
+    close(fd);
+    return NULL;
+  }
+
+  *bios = (bios_image){ data, hash, fd };
+
+  return bios;
+}
+
+void bios_close(bios_image *bios)
+{
+  if (!bios)
+    return;
+
+  munmap((void *)bios->data, BIOS_SIZE);
+  close(bios->fd);
+
+  free(bios);
+}
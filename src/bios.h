@@ -0,0 +1,21 @@
+#pragma once
+#include "typedef.h"
+
+// BIOS ROM image shared by the machines of the process
+// The file is mapped read only once and hashed once (bios_open). Machines point their
+// BIOS region at the mapping (map_bios, see bus.h); with fastmem the file is mapped into
+// their reservation as well. Every instance, and other processes through the page cache,
+// use the same physical pages.
+
+typedef struct
+{
+  const u8 *data; // BIOS_SIZE bytes, PROT_READ
+  u64 hash;       // hash64 of the image
+  int fd;
+}bios_image;
+
+// Map the image: NULL when it is missing, shorter than 512 KBytes or does not match
+// expected_hash (0 = accept any image)
+bios_image *bios_open(const char *path, u64 expected_hash);
+
+void bios_close(bios_image *bios);
@@ -0,0 +1,111 @@
+#include "block.h"
+#include "machine.h"
+
+bool is_branch(instr_handler handler)
+{
+  return handler == beq  || handler == bne || handler == blez || handler == bgtz ||
+         handler == bcondz || handler == j || handler == jal  || handler == jr   ||
+         handler == jalr;
+}
+
+bool ends_block(instr_handler handler)
+{
+  return handler == syscall || handler == break_ || handler == mtc0 || handler == rfe;
+}
+
+u32 build_block(code_page *cp, u32 index, u32 pc)
+{
+  u32 count = 0;
+
+  while (index + count < PAGE_INSTRUCTIONS)
+  {
+    instruction *instr = &cp->instrs[index + count];
+
+    if (!instr->handler)
+      decode_instr(instr, peek32(pc + count * 4));
+
+    count++;
+
+    if (ends_block(instr->handler))
+      break;
+
+    if (is_branch(instr->handler))
+    {
+      // the delay slot belongs to the block unless it starts the next page
+      if (index + count < PAGE_INSTRUCTIONS)
+      {
+        instruction *slot = &cp->instrs[index + count];
+
+        if (!slot->handler)
+          decode_instr(slot, peek32(pc + count * 4));
+
+        count++;
+      }
+
+      break;
+    }
+  }
+
+  cp->blocks[index].count = count;
+
+  return count;
+}
+
+// Dispatch the instructions of a block, returns how many were executed
+static u32 run_block(R3000 *cpu, const instruction *instr, u32 count)
+{
+  const instruction *end = instr + count;
+
+  u32 pc = cpu->pc;
+
+  for (; instr != end; instr++)
+  {
+    execute_instr(cpu, instr);
+
+    pc += 4;
+
+    // an exception moved pc to its vector
+    if (cpu->pc != pc && instr + 1 != end)
+      return count - (end - instr) + 1;
+  }
+
+  return count;
+}
+
+static inline void run(R3000 *cpu, u64 deadline, bool stop_at_pc, u32 stop)
+{
+  while (cpu->cycles < deadline && cpu->cycles < psx->sched.deadline)
+  {
+    if (stop_at_pc && cpu->pc == stop)
+      return;
+
+    check_interrupt(cpu);
+
+    code_page *cp = (cpu->pc & 0x3) ? NULL : fetch_code_page(region_memory(cpu->pc));
+
+    if (!cp)
+    {
+      step_cpu(cpu);
+      continue;
+    }
+
+    const u32 index = (cpu->pc & PAGE_MASK) >> 2;
+
+    if (!cp->blocks[index].count)
+      build_block(cp, index, cpu->pc);
+
+    const u32 pc = cpu->pc;
+
+    cpu->cycles += fetch_cycles(pc, run_block(cpu, &cp->instrs[index], cp->blocks[index].count));
+  }
+}
+
+void run_blocks(R3000 *cpu, u64 deadline)
+{
+  run(cpu, deadline, false, 0);
+}
+
+void run_blocks_to(R3000 *cpu, u64 deadline, u32 stop)
+{
+  run(cpu, deadline, true, stop);
+}
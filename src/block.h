@@ -0,0 +1,22 @@
+#pragma once
+#include "cpu.h"
+#include "decode.h"
+
+// Basic block cached interpreter
+// A block runs from its entry up to a branch/jump plus its delay slot, an instruction
+// that leaves the sequential flow (SYSCALL, BREAK) or may unmask an interrupt (MTC0, RFE),
+// or the end of the 4 KByte code page. The predecoded instructions of the block are
+// dispatched back to back; cycles and interrupts are accounted once per block.
+
+bool is_branch(instr_handler handler);
+
+bool ends_block(instr_handler handler);
+
+// Decode the block starting at index of the page, returns its length
+u32 build_block(code_page *cp, u32 index, u32 pc);
+
+// Run blocks until cpu->cycles reaches the deadline or event_deadline (the last block may overshoot it)
+void run_blocks(R3000 *cpu, u64 deadline);
+
+// Same, also returning at the first block boundary where cpu->pc is stop
+void run_blocks_to(R3000 *cpu, u64 deadline, u32 stop);
@@ -0,0 +1,137 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "boot.h"
+#include "block.h"
+#include "machine.h"
+#include "state.h"
+
+// Machine state at the shell entry (see state.h)
+typedef struct boot_snapshot
+{
+  u64 bios_hash;
+
+  struct boot_snapshot *next;
+
+  u32 size;
+  u8 state[];
+}boot_snapshot;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static boot_snapshot *cache;
+
+bool boot_to_shell(void)
+{
+  R3000 *cpu = &psx->cpu;
+
+  machine_reset();
+
+  // the jump to the shell ends a block, SHELL_ENTRY starts a page
+  while (cpu->pc != SHELL_ENTRY)
+  {
+    if (cpu->cycles >= BOOT_CYCLE_LIMIT)
+      return false;
+
+    run_blocks_to(cpu, BOOT_CYCLE_LIMIT, SHELL_ENTRY);
+
+    if (cpu->cycles >= psx->sched.deadline)
+      run_events(cpu);
+  }
+
+  return true;
+}
+
+static void snapshot_path(char *path, u32 size, const char *dir, u64 bios_hash)
+{
+  snprintf(path, size, "%s/boot-%016llx.state", dir, (unsigned long long)bios_hash);
+}
+
+// Load the snapshot of the BIOS kept in dir, false when there is none that fits
+static bool load_snapshot(const char *dir, u64 bios_hash)
+{
+  char path[4096];
+
+  snapshot_path(path, sizeof(path), dir, bios_hash);
+
+  FILE *file = fopen(path, "rb");
+
+  if (!file)
+    return false;
+
+  const bool loaded = state_load(fileno(file));
+
+  fclose(file);
+
+  return loaded;
+}
+
+// Keep the state of the bound machine as the snapshot of the BIOS in dir, written aside
+// and renamed so the processes sharing dir never see half a state
+static void save_snapshot(const char *dir, u64 bios_hash)
+{
+  char path[4096];
+  char temp[4096 + 8];
+
+  snapshot_path(path, sizeof(path), dir, bios_hash);
+  snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+
+  const int fd = mkstemp(temp);
+  FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+
+  if (!file)
+  {
+    if (fd >= 0)
+      remove(temp);
+    return;
+  }
+
+  const bool saved = state_save(fileno(file));
+
+  if (fclose(file) || !saved || rename(temp, path))
+    remove(temp);
+}
+
+bool fast_boot(const bios_image *bios, const char *dir)
+{
+  bool booted = true;
+
+  // the first machine of a BIOS boots while the others wait for its snapshot
+  pthread_mutex_lock(&cache_lock);
+
+  boot_snapshot *s = cache;
+
+  while (s && s->bios_hash != bios->hash)
+    s = s->next;
+
+  if (s)
+  {
+    booted = state_restore(s->state, s->size);
+  }
+  else
+  {
+    // a file of another state version is booted again and replaced
+    const bool loaded = dir && load_snapshot(dir, bios->hash);
+
+    if (!loaded && (booted = boot_to_shell()) && dir)
+      save_snapshot(dir, bios->hash);
+
+    const u32 size = state_size();
+
+    s = booted ? malloc(sizeof(boot_snapshot) + size) : NULL;
+
+    if (s)
+    {
+      s->size = state_capture(s->state, size);
+      s->bios_hash = bios->hash;
+      s->next = cache;
+
+      cache = s;
+    }
+  }
+
+  pthread_mutex_unlock(&cache_lock);
+
+  return booted;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "bios.h"
+#include "scheduler.h"
+
+// Fast boot
+// After initialising the kernel the BIOS copies the shell (boot logo, memory card
+// manager, CD-ROM boot) to SHELL_ENTRY and jumps there. boot_to_shell() runs the BIOS
+// up to that jump and stops, before the animation; an executable loaded at this point
+// replaces the shell.
+//
+// The machine state at the shell entry only depends on the BIOS image, so fast_boot()
+// captures it once per BIOS hash and restores it into the later machines of the
+// process instead of running the kernel initialisation again. Given a directory, the
+// snapshot is also kept there as a save state (boot-<hash>.state), so a fresh process
+// starts from it as well; a file of another state version is booted again and replaced.
+// The boot runs on the block interpreter and stops at the block boundary reaching the
+// shell entry.
+
+#define SHELL_ENTRY 0x80030000
+
+#define BOOT_CYCLE_LIMIT (30ull * CPU_CLOCK) // give up after 30 emulated seconds
+
+// Run the bound machine from reset to the shell entry, false when it is not reached
+bool boot_to_shell(void);
+
+// boot_to_shell() through the per BIOS snapshot cache, also kept in dir (NULL = this process only)
+bool fast_boot(const bios_image *bios, const char *dir);
@@ -1,4 +1,12 @@
-#include "bus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "fastmem.h"
+#include "decode.h"
+#include "irq.h"
+#include "timer.h"
 /*
 
 I/O Map
@@ -262,308 +270,786 @@ Coprocessor Registers
 
 // kseg1 0xA000 0000 – BFFF FFFF (512 Mbytes): these addresses are
 // mapped into physical addresses by stripping off the leading three
+// bits, mapping them contiguously into the low 512 Mbytes of physical memory.
 
-u32 region_memory(u32 addr)
+// Backing used when the fastmem reservation is not available
+typedef struct
 {
-  const u32 memory[8] =
-      {
+  u8 ram[0x400 * 0x400 * 2];
+  u8 scratchpad[PAGE_SIZE];
+}bus_storage;
 
-          0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, // kuseg (2GB)
-          0x7FFFFFFF,                                     // kseg0 (512MB)
-          0x1FFFFFFF,                                     // kseg1 (512MB)
-          0xFFFFFFFF, 0xFFFFFFFF,                         // kseg2 (1GB)
+const u32 region_mask[8] =
+    {
 
-      };
+        0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, // kuseg (2GB)
+        0x7FFFFFFF,                                     // kseg0 (512MB)
+        0x1FFFFFFF,                                     // kseg1 (512MB)
+        0xFFFFFFFF, 0xFFFFFFFF,                         // kseg2 (1GB)
 
-  return addr & memory[addr] >> 29;
-}
+    };
 
-u32 fix_addresses(u32 addr, u32 index, u32 size, u32 offset)
+u32 region_memory(u32 addr)
 {
+  return addr & region_mask[addr >> 29];
+}
 
-  if (index <= addr + size && addr < index + size)
-    return offset = addr - index;
+u8 *bus_fastmem(void)
+{
+  return psx ? psx->bus.fastmem : NULL;
+}
 
-  return 0;
+u8 *bus_load_cycles(u32 size)
+{
+  return psx->bus.load_cycles[size >> 1];
 }
 
-u8 read8(u32 addr) // OK
+u8 *bus_ram(void)
 {
-  addr = region_memory(addr);
+  return psx->bus.ram;
+}
 
-  u32 offset = 0;
+bool fix_addresses(u32 addr, u32 index, u32 size, u32 *offset)
+{
 
-  if (fix_addresses(addr, RAM_ADDR, RAM_SIZE_2MB, offset)) // RAM // 2 MB
-  {
-    return var.ram[offset];
-  }
-  else if (fix_addresses(addr, BIOS_ADDR, BIOS_SIZE, offset)) // BIOS Region (default 512 Kbytes, max 4 MBytes)
-  {
-  }
-  else if (fix_addresses(addr, EXPANSION_REGION1_ADDR, EXPANSION_REGION1_SIZE, offset)) // Expansion Region 1
-  {
-  }
-  else if (fix_addresses(addr, EXPANSION_REGION2_ADDR, EXPANSION_REGION2_SIZE, offset)) // Expansion Region 2 (default 128 bytes, max 8 KBytes)
+  if (index <= addr && addr < index + size)
   {
+    *offset = addr - index;
+    return true;
   }
 
-  else if (fix_addresses(addr, CD_ROM_ADDR, CD_ROM_SIZE, offset)) // CDROM Registers (Address.Read/Write.Index)
-  {
-  }
-  else if (fix_addresses(addr, DMA_REG_ADDR, DMA_REG_SIZE, offset)) // DMA Registers
-  {
-  }
+  return false;
+}
+
+// Host loads/stores on the page backing (the host is little endian like the R3000A)
+
+static inline u16 load16(const u8 *ptr)
+{
+  u16 value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+static inline u32 load32(const u8 *ptr)
+{
+  u32 value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
 
-  else if (fix_addresses(addr, JOYPAD_ADDR, JOYPAD_SIZE, offset)) // Peripheral I/O Ports
+static inline void store16(u8 *ptr, u16 value)
+{
+  memcpy(ptr, &value, sizeof(value));
+}
+
+static inline void store32(u8 *ptr, u32 value)
+{
+  memcpy(ptr, &value, sizeof(value));
+}
+
+static void map_pages(u32 addr, u32 size, u8 *read, u8 *write, u32 mirror_mask)
+{
+  for (u32 offset = 0; offset < size; offset += PAGE_SIZE)
   {
+    const u32 page = (addr + offset) >> PAGE_SHIFT;
+
+    psx->bus.page_read[page]  = read  ? read  + (offset & mirror_mask) : NULL;
+    psx->bus.page_write[page] = write ? write + (offset & mirror_mask) : NULL;
   }
-  else if (fix_addresses(addr, SIO_ADDR, SIO_SIZE, offset)) // Peripheral I/O Ports
+}
+
+static void map_io(u32 addr, u32 size, u8 region)
+{
+  for (u32 offset = 0; offset < size; offset += PAGE_SIZE)
+    psx->bus.page_io[(addr + offset) >> PAGE_SHIFT] = region;
+}
+
+void map_bios(const bios_image *bios)
+{
+  psx->bus.bios = (u8 *)bios->data;
+  psx->bus.bios_hash = bios->hash;
+
+  map_pages(BIOS_ADDR, BIOS_SIZE, psx->bus.bios, NULL, BIOS_SIZE - 1);
+
+  // not aliased: the region keeps faulting into io_read() and bios_read() serves it
+  if (psx->bus.fastmem && !fastmem_map_bios(&psx->bus, bios->fd))
+    printf("fastmem: BIOS not mapped, its loads take the slow path\n");
+
+  // the BIOS pages may be decoded already
+  flush_decode_cache();
+}
+
+bool init_bus(bool fastmem)
+{
+  if (!fastmem || !fastmem_init(&psx->bus))
   {
+    bus_storage *storage = calloc(1, sizeof(bus_storage));
+
+    if (!storage)
+      return false;
+
+    psx->bus.fastmem = NULL;
+    psx->bus.ram = storage->ram;
+    psx->bus.scratchpad = storage->scratchpad;
   }
-  else if (fix_addresses(addr, SCRATCHPAD_ADDR, SCRATCHPAD_SIZE, offset)) // Scratchpad  1F800000h 400h Scratchpad (1K Fast RAM) (Data Cache mapped to fixed address)
+
+  memset(psx->bus.page_read, 0, sizeof(psx->bus.page_read));
+  memset(psx->bus.page_write, 0, sizeof(psx->bus.page_write));
+  memset(psx->bus.page_io, IO_UNMAPPED, sizeof(psx->bus.page_io));
+
+  // 1F801060h RAM_SIZE (usually 00000B88h; 2MB RAM mirrored in first 8MB)
+  map_pages(RAM_ADDR, RAM_SIZE_8MB, psx->bus.ram, psx->bus.ram, RAM_SIZE_2MB - 1);
+
+  // 1F800000h 400h Scratchpad (1K Fast RAM) (Data Cache mapped to fixed address)
+  // smaller than a page: the whole page is backed so it stays a plain load / store,
+  // 1F800400h..1F800FFFh are not connected on the hardware and not part of the state
+  map_pages(SCRATCHPAD_ADDR, PAGE_SIZE, psx->bus.scratchpad, psx->bus.scratchpad, PAGE_MASK);
+
+  // 1FC00000h 80000h BIOS ROM (512Kbytes) (Reset Entrypoint at BFC00000h)
+  // reads as open bus until map_bios()
+  psx->bus.bios = NULL;
+  map_io(BIOS_ADDR, BIOS_SIZE, IO_BIOS);
+
+  map_io(EXPANSION_REGION1_ADDR, EXPANSION_REGION1_SIZE, IO_EXPANSION1);
+  map_io(MEMORY_CONTROL1_ADDR, PAGE_SIZE, IO_HARDWARE);
+  map_io(EXPANSION_REGION2_ADDR, PAGE_SIZE, IO_EXPANSION2);
+  map_io(EXPANSION_REGION3_ADDR, EXPANSION_REGION3_SIZE, IO_EXPANSION3);
+
+  // fixed wait states, the programmable ones come from reset_memory_control()
+  memset(psx->bus.load_cycles, 0, sizeof(psx->bus.load_cycles));
+
+  for (u32 size = 0; size < 3; size++)
   {
+    memset(psx->bus.load_cycles[size] + (RAM_ADDR >> PAGE_SHIFT), RAM_LOAD_CYCLES, RAM_SIZE_8MB >> PAGE_SHIFT);
+
+    psx->bus.load_cycles[size][MEMORY_CONTROL1_ADDR >> PAGE_SHIFT] = IO_LOAD_CYCLES;
   }
+
+  reset_memory_control();
+
+  return true;
+}
+
+void shutdown_bus(void)
+{
+  if (psx->bus.fastmem)
+    fastmem_shutdown(&psx->bus);
   else
-  {
+    free(psx->bus.ram); // start of the bus_storage
 
-    printf("ERROR UNKNOWN READ ADDR 8-bit 0x%x \n", addr);
+  psx->bus.ram = NULL;
+}
 
-    assert(0);
-  }
+static inline bool is_dirty(u32 offset)
+{
+  const u32 page = offset >> PAGE_SHIFT;
+
+  return (psx->bus.dirty_bitmap[page >> 5] >> (page & 31)) & 1;
 }
 
-u16 read16(u32 addr) // OK
+void protect_code_page(u32 addr, bool protect)
 {
-  addr = region_memory(addr);
+  const u32 offset = addr & (RAM_SIZE_2MB - 1) & ~PAGE_MASK;
 
-  u32 offset = 0;
+  if ((psx->bus.track_dirty && !is_dirty(offset)) || psx->bus.isolated)
+    protect = true;
 
-  if (fix_addresses(addr, RAM_ADDR, RAM_SIZE_2MB, offset)) // RAM // 2 MB
-  {
-    return var.ram[offset];
-  }
-  else if (fix_addresses(addr, BIOS_ADDR, BIOS_SIZE, offset)) // BIOS Region (default 512 Kbytes, max 4 MBytes)
+  for (u32 mirror = 0; mirror < RAM_SIZE_8MB; mirror += RAM_SIZE_2MB)
   {
+    const u32 page = (RAM_ADDR + mirror + offset) >> PAGE_SHIFT;
 
+    psx->bus.page_write[page] = protect ? NULL : psx->bus.ram + offset;
+    psx->bus.page_io[page] = protect ? IO_CODE : IO_UNMAPPED;
   }
-  else if (fix_addresses(addr, SPU_CONTROL_ADDR, SPU_SIZE, offset)) // SPU
-  {
 
-  }
-  else if (fix_addresses(addr, EXPANSION_REGION1_ADDR, EXPANSION_REGION1_SIZE, offset)) // Expansion Region 1
-  {
+  if (psx->bus.fastmem)
+    fastmem_protect(&psx->bus, offset, protect);
+}
 
-  }
-  else if (fix_addresses(addr, IRQ_CONTROL_ADDR, IRQ_CONTROL_SIZE, offset)) // Interrupt Control
-  {
+// Trap every RAM page, or release them but the code pages (see protect_code_page)
+static void protect_ram_pages(void)
+{
+  for (u32 page = 0; page < RAM_PAGES; page++)
+    protect_code_page(page << PAGE_SHIFT, is_code_page(page << PAGE_SHIFT));
+}
 
-  }
-  else if (fix_addresses(addr, TIMER_ADDR, TIMER_SIZE, offset)) // Timers (aka Root counters)
-  {
+void track_dirty_pages(bool track)
+{
+  psx->bus.track_dirty = track;
 
-  }
-  else if (fix_addresses(addr, JOYPAD_ADDR, JOYPAD_SIZE, offset)) // Peripheral I/O Ports
-  {
-  }
-  else if (fix_addresses(addr, SIO_ADDR, SIO_SIZE, offset)) // Peripheral I/O Ports
-  {
-  }
-  else if (fix_addresses(addr, SCRATCHPAD_ADDR, SCRATCHPAD_SIZE, offset)) // Scratchpad  1F800000h 400h Scratchpad (1K Fast RAM) (Data Cache mapped to fixed address)
-  {
-  }
-  else
+  memset(psx->bus.dirty_bitmap, 0, sizeof(psx->bus.dirty_bitmap));
+
+  protect_ram_pages();
+}
+
+void isolate_cache(bool isolate)
+{
+  if (psx->bus.isolated == isolate)
+    return;
+
+  psx->bus.isolated = isolate;
+
+  protect_ram_pages();
+}
+
+void clean_dirty_pages(void)
+{
+  for (u32 i = 0; i < RAM_PAGES / 32; i++)
   {
+    u32 bits = psx->bus.dirty_bitmap[i];
 
-    printf("ERROR READ ADDR 16-bit 0x%x \n", addr);
+    psx->bus.dirty_bitmap[i] = 0;
 
-    assert(0);
+    while (bits && psx->bus.track_dirty)
+    {
+      protect_code_page((i * 32 + __builtin_ctz(bits)) << PAGE_SHIFT, true);
+
+      bits &= bits - 1;
+    }
   }
 }
 
-u32 read32(u32 addr) // OK
+void mark_dirty_range(u32 addr, u32 size)
 {
-  addr = region_memory(addr);
+  if (!size)
+    return;
 
-  u32 offset = 0;
+  const u32 first = (addr & (RAM_SIZE_2MB - 1)) >> PAGE_SHIFT;
+  const u32 count = size >= RAM_SIZE_2MB ? RAM_PAGES : (((addr & PAGE_MASK) + size - 1) >> PAGE_SHIFT) + 1;
 
-  if (fix_addresses(addr, RAM_ADDR, RAM_SIZE_2MB, offset)) // RAM // 2 MB
-  {
-    return var.ram[offset];
-  }
-  else if (fix_addresses(addr, BIOS_ADDR, BIOS_SIZE, offset)) // BIOS Region (default 512 Kbytes, max 4 MBytes)
+  for (u32 i = 0; i < count && i < RAM_PAGES; i++)
   {
+    const u32 page = (first + i) % RAM_PAGES;
+
+    psx->bus.dirty_bitmap[page >> 5] |= 1u << (page & 31);
   }
-  else if (fix_addresses(addr, EXPANSION_REGION1_ADDR, EXPANSION_REGION1_SIZE, offset)) // Expansion Region 1
+}
+
+void reset_memory_control(void)
+{
+  static const u32 power_on[MEMCTRL_COUNT] =
   {
-  }
+    0x1F000000, 0x1F802000, 0x0013243F, 0x00003022, 0x0013243F,
+    0x200931E1, 0x00020843, 0x00070777, 0x00031125,
+  };
+
+  memcpy(psx->bus.mem_control, power_on, sizeof(power_on));
+
+  update_wait_states();
+}
+
+/*
+Delay/Size register
+
+  0-3   Write Delay        (00h..0Fh=01h..10h Cycles)
+  4-7   Read Delay         (00h..0Fh=01h..10h Cycles)
+  8     Recovery Period    (0=No, 1=Yes, uses COM0 timings)
+  9     Hold Period        (0=No, 1=Yes, uses COM1 timings)
+  10    Floating Period    (0=No, 1=Yes, uses COM2 timings)
+  11    Pre-strobe Period  (0=No, 1=Yes, uses COM3 timings)
+  12    Data Bus-width     (0=8bits, 1=16bits)
 
-  else if (fix_addresses(addr, IRQ_CONTROL_ADDR, IRQ_CONTROL_SIZE, offset)) // Interrupt Control
+COM_DELAY: COM0..COM3 in bits 0-3, 4-7, 8-11, 12-15
+
+The first access of a load pays the whole delay, the following ones (a halfword or a
+word over the 8-bit bus, a word over the 16-bit bus) the sequential delay.
+*/
+static void region_cycles(u32 delay, u32 com, u8 *cycles)
+{
+  const s32 com0 = com & 0xf;
+  const s32 com2 = (com >> 8) & 0xf;
+  const s32 com3 = (com >> 12) & 0xf;
+
+  const s32 access = (delay >> 4) & 0xf;
+
+  s32 first = 0, seq = 0, min = 0;
+
+  if (delay & (1 << 8))
   {
+    first += com0 - 1;
+    seq += com0 - 1;
   }
-  else if (fix_addresses(addr, TIMER_ADDR, TIMER_SIZE, offset)) // Timers (aka Root counters)
+
+  if (delay & (1 << 10))
   {
+    first += com2;
+    seq += com2;
   }
-  
-  else if (fix_addresses(addr, DMA_REG_ADDR, DMA_REG_SIZE, offset)) // DMA Registers
+
+  if (delay & (1 << 11))
+    min = com3;
+
+  if (first < 6)
+    first++;
+
+  first += access + 2;
+  seq += access + 2;
+
+  if (first < min + 6)
+    first = min + 6;
+
+  if (seq < min + 2)
+    seq = min + 2;
+
+  const bool bus16 = delay & (1 << 12);
+
+  const s32 access_cycles[3] =
   {
-  }
+    first,
+    bus16 ? first : first + seq,
+    bus16 ? first + seq : first + seq * 3,
+  };
+
+  // the instruction itself is the first cycle
+  for (u32 size = 0; size < 3; size++)
+    cycles[size] = access_cycles[size] > 1 ? access_cycles[size] - 1 : 0;
+}
+
+static void set_region_cycles(u32 addr, u32 size, u32 delay)
+{
+  u8 cycles[3];
 
-  else if (fix_addresses(addr, GPU_REG_ADDR, GPU_REG_SIZE, offset)) // GPU Registers
+  region_cycles(psx->bus.mem_control[delay], psx->bus.mem_control[MEMCTRL_COM_DELAY], cycles);
+
+  for (u32 width = 0; width < 3; width++)
+    memset(psx->bus.load_cycles[width] + (addr >> PAGE_SHIFT), cycles[width], (size + PAGE_MASK) >> PAGE_SHIFT);
+}
+
+void update_wait_states(void)
+{
+  set_region_cycles(BIOS_ADDR, BIOS_SIZE, MEMCTRL_BIOS_DELAY);
+  set_region_cycles(EXPANSION_REGION1_ADDR, EXPANSION_REGION1_SIZE, MEMCTRL_EXP1_DELAY);
+  set_region_cycles(EXPANSION_REGION2_ADDR, PAGE_SIZE, MEMCTRL_EXP2_DELAY);
+  set_region_cycles(EXPANSION_REGION3_ADDR, EXPANSION_REGION3_SIZE, MEMCTRL_EXP3_DELAY);
+
+  // SPU and CDROM share the I/O page with the other ports: their handlers add these
+  region_cycles(psx->bus.mem_control[MEMCTRL_SPU_DELAY], psx->bus.mem_control[MEMCTRL_COM_DELAY], psx->bus.spu_cycles);
+  region_cycles(psx->bus.mem_control[MEMCTRL_CD_DELAY], psx->bus.mem_control[MEMCTRL_COM_DELAY], psx->bus.cdrom_cycles);
+}
+
+static inline u32 load_cycles(u32 addr, u32 size)
+{
+  return psx->bus.load_cycles[size >> 1][(addr >> PAGE_SHIFT) & (PAGE_COUNT - 1)];
+}
+
+u32 fetch_cycles(u32 pc, u32 count)
+{
+  const u32 addr = region_memory(pc);
+
+  if (!count)
+    return 0;
+
+  if (pc >> 29 == 5 || !(psx->bus.cache.control & CACHE_CODE_ENABLE))
+    return count * (1 + load_cycles(addr, 4));
+
+  u32 cycles = count;
+
+  const u32 end = addr + count * 4;
+
+  for (u32 line = addr & ~(ICACHE_LINE_SIZE - 1); line < end; line += ICACHE_LINE_SIZE)
   {
+    u32 *tag = &psx->bus.cache.tag[(line >> ICACHE_LINE_SHIFT) & (ICACHE_LINES - 1)];
+
+    if (*tag == line)
+      continue;
+
+    // miss: the first word of the line, then one cycle per word of the burst
+    *tag = line;
+
+    cycles += load_cycles(line, 4) + ICACHE_LINE_SIZE / 4 - 1;
   }
-  else if (fix_addresses(addr, MDEC_REG_ADDR, MDEC_REG_SIZE, offset)) // MDEC Registers
-  {}
 
-  else if (fix_addresses(addr, SCRATCHPAD_ADDR, SCRATCHPAD_SIZE, offset)) // Scratchpad  1F800000h 400h Scratchpad (1K Fast RAM) (Data Cache mapped to fixed address)
+  return cycles;
+}
+
+void reset_cache(void)
+{
+  psx->bus.cache.control = 0;
+
+  memset(psx->bus.cache.tag, 0xff, sizeof(psx->bus.cache.tag));
+
+  isolate_cache(false);
+}
+
+// MMIO handlers (slow path), size is the access width in bytes
+
+static u32 unmapped_read(u32 addr, u32 size)
+{
+  printf("ERROR UNKNOWN READ ADDR %d-bit 0x%x \n", size * 8, addr);
+
+  assert(0);
+
+  return 0;
+}
+
+static void unmapped_write(u32 addr, u32 value, u32 size)
+{
+  printf("ERROR UNKNOWN WRITE ADDR %d-bit 0x%x \n", size * 8, addr);
+
+  assert(0);
+}
+
+static u32 bios_read(u32 addr, u32 size)
+{
+  // No ROM yet, the bus floats high
+  if (!psx->bus.bios)
+    return 0xFFFFFFFF >> (32 - size * 8);
+
+  const u8 *ptr = psx->bus.bios + (addr & (BIOS_SIZE - 1));
+
+  switch (size)
   {
+  case 1:  return *ptr;
+  case 2:  return load16(ptr);
+  default: return load32(ptr);
   }
-  else
-  {
+}
 
-    printf("ERROR READ ADDR 32-bit 0x%x \n", addr);
+static void bios_write(u32 addr, u32 value, u32 size)
+{
+  // BIOS Region is a ROM
+}
 
-    assert(0);
-  }
+static u32 expansion1_read(u32 addr, u32 size)
+{
+  // Nothing connected to the Expansion Port, the bus floats high
+  return 0xFFFFFFFF >> (32 - size * 8);
 }
 
-void write8(u32 addr, u8 value)
+static void expansion_write(u32 addr, u32 value, u32 size)
 {
-  addr = region_memory(addr);
+}
+
+static u32 expansion2_read(u32 addr, u32 size)
+{
+  return 0;
+}
+
+static u32 expansion3_read(u32 addr, u32 size)
+{
+  return 0;
+}
 
+static u32 hardware_read(u32 addr, u32 size)
+{
   u32 offset = 0;
 
-  if (fix_addresses(addr, RAM_ADDR, RAM_SIZE_2MB, offset)) // RAM // 2 MB
+  if (fix_addresses(addr, MEMORY_CONTROL1_ADDR, MEMORY_CONTROL1_SIZE, &offset)) // Memory Control 1
   {
-    var.ram[offset] = value;
+    return psx->bus.mem_control[offset >> 2];
   }
-  else if (fix_addresses(addr, EXPANSION_REGION2_ADDR, EXPANSION_REGION2_SIZE, offset)) // Expansion Region 2 (default 128 bytes, max 8 KBytes)
+  else if (fix_addresses(addr, JOYPAD_ADDR, JOYPAD_SIZE, &offset)) // Peripheral I/O Ports
   {
+    return pad_read(offset, size);
   }
-  else if (fix_addresses(addr, CD_ROM_ADDR, CD_ROM_SIZE, offset)) // CDROM Registers (Address.Read/Write.Index)
+  else if (fix_addresses(addr, SIO_ADDR, SIO_SIZE, &offset)) // Peripheral I/O Ports
   {
   }
-  else if (fix_addresses(addr, DMA_REG_ADDR, DMA_REG_SIZE, offset)) // DMA Registers
+  else if (fix_addresses(addr, MEMORY_CONTROL2_ADDR, MEMORY_CONTROL2_SIZE, &offset)) // Memory Control 2
   {
   }
-  else if (fix_addresses(addr, JOYPAD_ADDR, JOYPAD_SIZE, offset)) // Peripheral I/O Ports
+  else if (fix_addresses(addr, IRQ_CONTROL_ADDR, IRQ_CONTROL_SIZE, &offset)) // Interrupt Control
   {
+    return irq_read(offset);
   }
-  else if (fix_addresses(addr, SCRATCHPAD_ADDR, SCRATCHPAD_SIZE, offset)) // Scratchpad  1F800000h 400h Scratchpad (1K Fast RAM) (Data Cache mapped to fixed address)
+  else if (fix_addresses(addr, DMA_REG_ADDR, DMA_REG_SIZE, &offset)) // DMA Registers
   {
   }
-  else
+  else if (fix_addresses(addr, TIMER_ADDR, TIMER_SIZE, &offset)) // Timers (aka Root counters)
   {
-
-    printf("ERROR UNKNOWN WRITE ADDR 8-bit 0x%x \n", addr);
-
-    assert(0);
+    return timer_read(offset);
   }
-}
-
-void write16(u32 addr, u16 value)
-{
-  addr = region_memory(addr);
-
-  u32 offset = 0;
-
-  if (fix_addresses(addr, RAM_ADDR, RAM_SIZE_2MB, offset)) // RAM // 2 MB
-  {
-    var.ram[offset] = value;
-  }
-  else if (fix_addresses(addr, SPU_CONTROL_ADDR, SPU_SIZE, offset)) // SPU
+  else if (fix_addresses(addr, CD_ROM_ADDR, CD_ROM_SIZE, &offset)) // CDROM Registers (Address.Read/Write.Index)
   {
+    psx->cpu.cycles += psx->bus.cdrom_cycles[size >> 1];
   }
-  else if (fix_addresses(addr, IRQ_CONTROL_ADDR, IRQ_CONTROL_SIZE, offset)) // Interrupt Control
+  else if (fix_addresses(addr, GPU_REG_ADDR, GPU_REG_SIZE, &offset)) // GPU Registers
   {
+    return gpu_read(offset & 4);
   }
-  else if (fix_addresses(addr, TIMER_ADDR, TIMER_SIZE, offset)) // Timers (aka Root counters)
+  else if (fix_addresses(addr, MDEC_REG_ADDR, MDEC_REG_SIZE, &offset)) // MDEC Registers
   {
   }
-  else if (fix_addresses(addr, JOYPAD_ADDR, JOYPAD_SIZE, offset)) // Peripheral I/O Ports
-  {
-  }
-  else if (fix_addresses(addr, SIO_ADDR, SIO_SIZE, offset)) // Peripheral I/O Ports
-  {
-  }
-  else if (fix_addresses(addr, SCRATCHPAD_ADDR, SCRATCHPAD_SIZE, offset)) // Scratchpad  1F800000h 400h Scratchpad (1K Fast RAM) (Data Cache mapped to fixed address)
+  else if (fix_addresses(addr, SPU_CONTROL_ADDR, SPU_SIZE, &offset)) // SPU Control Registers
   {
+    psx->cpu.cycles += psx->bus.spu_cycles[size >> 1];
   }
   else
   {
-
-    printf("ERROR WRITE ADDR 16-bit 0x%x \n", addr);
-
-    assert(0);
+    return unmapped_read(addr, size);
   }
+
+  return 0;
 }
 
-void write32(u32 addr, u32 value)
+static void hardware_write(u32 addr, u32 value, u32 size)
 {
-  addr = region_memory(addr);
-
   u32 offset = 0;
 
-  if (fix_addresses(addr, RAM_ADDR, RAM_SIZE_2MB, offset)) // RAM // 2 MB
+  if (fix_addresses(addr, MEMORY_CONTROL1_ADDR, MEMORY_CONTROL1_SIZE, &offset)) // Memory Control 1
   {
-    var.ram[addr] = value;
+    psx->bus.mem_control[offset >> 2] = value;
+
+    if (offset >> 2 >= MEMCTRL_EXP1_DELAY)
+      update_wait_states();
   }
-  else if (fix_addresses(addr, BIOS_ADDR, BIOS_SIZE, offset)) // BIOS Region (default 512 Kbytes, max 4 MBytes)
+  else if (fix_addresses(addr, JOYPAD_ADDR, JOYPAD_SIZE, &offset)) // Peripheral I/O Ports
   {
+    pad_write(offset, value, size);
   }
-  else if (fix_addresses(addr, SPU_CONTROL_ADDR, SPU_SIZE, offset)) // SPU
+  else if (fix_addresses(addr, SIO_ADDR, SIO_SIZE, &offset)) // Peripheral I/O Ports
   {
   }
-  else if (fix_addresses(addr, MEMORY_CONTROL1_ADDR, MEMORY_CONTROL1_SIZE, offset)) // Memory Control 1
+  else if (fix_addresses(addr, MEMORY_CONTROL2_ADDR, MEMORY_CONTROL2_SIZE, &offset)) // Memory Control 2
   {
   }
-  else if (fix_addresses(addr, MEMORY_CONTROL2_ADDR, MEMORY_CONTROL2_SIZE, offset)) // Memory Control 2
+  else if (fix_addresses(addr, IRQ_CONTROL_ADDR, IRQ_CONTROL_SIZE, &offset)) // Interrupt Control
   {
+    irq_write(offset, value, size);
   }
-  else if (fix_addresses(addr, MEMORY_CONTROL3_ADDR, MEMORY_CONTROL3_SIZE, offset)) // Memory Control 3 (Cache Control)
+  else if (fix_addresses(addr, DMA_REG_ADDR, DMA_REG_SIZE, &offset)) // DMA Registers
   {
   }
-  else if (fix_addresses(addr, EXPANSION_REGION1_ADDR, EXPANSION_REGION1_SIZE, offset)) // Expansion Region 1
+  else if (fix_addresses(addr, TIMER_ADDR, TIMER_SIZE, &offset)) // Timers (aka Root counters)
   {
+    timer_write(offset, value, size);
   }
-  else if (fix_addresses(addr, EXPANSION_REGION2_ADDR, EXPANSION_REGION2_SIZE, offset)) // Expansion Region 2 (default 128 bytes, max 8 KBytes)
+  else if (fix_addresses(addr, CD_ROM_ADDR, CD_ROM_SIZE, &offset)) // CDROM Registers (Address.Read/Write.Index)
   {
   }
-  else if (fix_addresses(addr, IRQ_CONTROL_ADDR, IRQ_CONTROL_SIZE, offset)) // Interrupt Control
+  else if (fix_addresses(addr, GPU_REG_ADDR, GPU_REG_SIZE, &offset)) // GPU Registers
   {
+    gpu_write(offset & 4, value);
   }
-  else if (fix_addresses(addr, TIMER_ADDR, TIMER_SIZE, offset)) // Timers (aka Root counters)
+  else if (fix_addresses(addr, MDEC_REG_ADDR, MDEC_REG_SIZE, &offset)) // MDEC Registers
   {
   }
-  else if (fix_addresses(addr, CD_ROM_ADDR, CD_ROM_SIZE, offset)) // CDROM Registers (Address.Read/Write.Index)
+  else if (fix_addresses(addr, SPU_CONTROL_ADDR, SPU_SIZE, &offset)) // SPU Control Registers
   {
   }
-  else if (fix_addresses(addr, GPU_REG_ADDR, GPU_REG_SIZE, offset)) // GPU Registers
+  else
   {
+    unmapped_write(addr, value, size);
   }
-  else if (fix_addresses(addr, MDEC_REG_ADDR, MDEC_REG_SIZE, offset)) // MDEC Registers
+}
+
+static u32 code_read(u32 addr, u32 size)
+{
+  const u8 *ptr = psx->bus.ram + (addr & (RAM_SIZE_2MB - 1));
+
+  switch (size)
   {
+  case 1:  return *ptr;
+  case 2:  return load16(ptr);
+  default: return load32(ptr);
   }
-  else if (fix_addresses(addr, SPU_CONTROL_ADDR, SPU_SIZE, offset)) // SPU Control Registers
+}
+
+// Store into a trapped RAM page: drop its decoded instructions, mark it dirty and give
+// the page its fast path back. Isolated, the store goes to the cache instead.
+static void code_write(u32 addr, u32 value, u32 size)
+{
+  if (psx->bus.isolated)
   {
+    if (psx->bus.cache.control & CACHE_TAG_TEST)
+      psx->bus.cache.tag[(addr >> ICACHE_LINE_SHIFT) & (ICACHE_LINES - 1)] = ICACHE_INVALID;
+
+    return;
   }
-  else if (fix_addresses(addr, DMA_REG_ADDR, DMA_REG_SIZE, offset)) // DMA Registers
+
+  mark_dirty_range(addr, 1);
+
+  invalidate_code_page(addr);
+
+  // clean page trapped for the dirty tracking only
+  if (!psx->bus.page_write[(addr & (RAM_SIZE_2MB - 1)) >> PAGE_SHIFT])
+    protect_code_page(addr, false);
+
+  u8 *ptr = psx->bus.ram + (addr & (RAM_SIZE_2MB - 1));
+
+  switch (size)
   {
+  case 1:  *ptr = value;          break;
+  case 2:  store16(ptr, value);   break;
+  default: store32(ptr, value);   break;
   }
+}
+
+typedef struct
+{
+  u32  (*read)(u32 addr, u32 size);
+  void (*write)(u32 addr, u32 value, u32 size);
+} io_handler;
 
-  else if (fix_addresses(addr, JOYPAD_ADDR, JOYPAD_SIZE, offset)) // Peripheral I/O Ports
+static const io_handler io_handlers[] =
+{
+  [IO_UNMAPPED]   = { unmapped_read,   unmapped_write  },
+  [IO_BIOS]       = { bios_read,       bios_write      },
+  [IO_EXPANSION1] = { expansion1_read, expansion_write },
+  [IO_HARDWARE]   = { hardware_read,   hardware_write  },
+  [IO_EXPANSION2] = { expansion2_read, expansion_write },
+  [IO_EXPANSION3] = { expansion3_read, expansion_write },
+  [IO_CODE]       = { code_read,       code_write      },
+};
+
+u32 io_read(u32 addr, u32 size)
+{
+  u32 offset = 0;
+
+  if (addr >> PAGE_SHIFT < PAGE_COUNT)
+    return io_handlers[psx->bus.page_io[addr >> PAGE_SHIFT]].read(addr, size);
+
+  if (fix_addresses(addr, MEMORY_CONTROL3_ADDR, MEMORY_CONTROL3_SIZE, &offset)) // Memory Control 3 (Cache Control)
+    return psx->bus.cache.control;
+
+  return unmapped_read(addr, size);
+}
+
+void io_write(u32 addr, u32 value, u32 size)
+{
+  u32 offset = 0;
+
+  if (addr >> PAGE_SHIFT < PAGE_COUNT)
+    io_handlers[psx->bus.page_io[addr >> PAGE_SHIFT]].write(addr, value, size);
+
+  else if (fix_addresses(addr, MEMORY_CONTROL3_ADDR, MEMORY_CONTROL3_SIZE, &offset)) // Memory Control 3 (Cache Control)
+  {
+    psx->bus.cache.control = value;
+  }
+  else
+    unmapped_write(addr, value, size);
+}
+
+// Fast path: with fastmem the access is a single host load/store (MMIO faults into
+// io_read/io_write). Otherwise one shift, one load of the page entry and the host
+// access; only MMIO pages (entry == NULL) fall back to the handlers above.
+
+u8 read8(u32 addr)
+{
+  addr = region_memory(addr);
+
+  psx->cpu.cycles += load_cycles(addr, 1);
+
+  if (psx->bus.fastmem)
+    return fastmem_read8(psx->bus.fastmem, addr);
+
+  const u32 page = addr >> PAGE_SHIFT;
+
+  if (page < PAGE_COUNT && psx->bus.page_read[page])
+    return psx->bus.page_read[page][addr & PAGE_MASK];
+
+  return io_read(addr, 1);
+}
+
+u16 read16(u32 addr)
+{
+  addr = region_memory(addr);
+
+  psx->cpu.cycles += load_cycles(addr, 2);
+
+  if (psx->bus.fastmem)
+    return fastmem_read16(psx->bus.fastmem, addr);
+
+  const u32 page = addr >> PAGE_SHIFT;
+
+  if (page < PAGE_COUNT && psx->bus.page_read[page])
+    return load16(psx->bus.page_read[page] + (addr & PAGE_MASK));
+
+  return io_read(addr, 2);
+}
+
+u32 read32(u32 addr)
+{
+  psx->cpu.cycles += load_cycles(region_memory(addr), 4);
+
+  return peek32(addr);
+}
+
+u32 peek32(u32 addr)
+{
+  addr = region_memory(addr);
+
+  if (psx->bus.fastmem)
+    return fastmem_read32(psx->bus.fastmem, addr);
+
+  const u32 page = addr >> PAGE_SHIFT;
+
+  if (page < PAGE_COUNT && psx->bus.page_read[page])
+    return load32(psx->bus.page_read[page] + (addr & PAGE_MASK));
+
+  return io_read(addr, 4);
+}
+
+void write8(u32 addr, u8 value)
+{
+  addr = region_memory(addr);
+
+  if (psx->bus.fastmem)
   {
+    fastmem_write8(psx->bus.fastmem, addr, value);
+    return;
   }
-  else if (fix_addresses(addr, SIO_ADDR, SIO_SIZE, offset)) // Peripheral I/O Ports
+
+  const u32 page = addr >> PAGE_SHIFT;
+
+  if (page < PAGE_COUNT && psx->bus.page_write[page])
+    psx->bus.page_write[page][addr & PAGE_MASK] = value;
+  else
+    io_write(addr, value, 1);
+}
+
+void write16(u32 addr, u16 value)
+{
+  addr = region_memory(addr);
+
+  if (psx->bus.fastmem)
   {
+    fastmem_write16(psx->bus.fastmem, addr, value);
+    return;
   }
-  else if (fix_addresses(addr, SCRATCHPAD_ADDR, SCRATCHPAD_SIZE, offset)) // Scratchpad  1F800000h 400h Scratchpad (1K Fast RAM) (Data Cache mapped to fixed address)
+
+  const u32 page = addr >> PAGE_SHIFT;
+
+  if (page < PAGE_COUNT && psx->bus.page_write[page])
+    store16(psx->bus.page_write[page] + (addr & PAGE_MASK), value);
+  else
+    io_write(addr, value, 2);
+}
+
+void write32(u32 addr, u32 value)
+{
+  addr = region_memory(addr);
+
+  if (psx->bus.fastmem)
   {
+    fastmem_write32(psx->bus.fastmem, addr, value);
+    return;
   }
+
+  const u32 page = addr >> PAGE_SHIFT;
+
+  if (page < PAGE_COUNT && psx->bus.page_write[page])
+    store32(psx->bus.page_write[page] + (addr & PAGE_MASK), value);
   else
+    io_write(addr, value, 4);
+}
+
+void dma_write_ram(u32 addr, const void *data, u32 size)
+{
+  mark_dirty_range(addr, size);
+  invalidate_code_range(addr, size);
+
+  const u8 *src = data;
+
+  while (size)
   {
+    const u32 offset = addr & (RAM_SIZE_2MB - 1);
+    const u32 chunk = (size < RAM_SIZE_2MB - offset) ? size : RAM_SIZE_2MB - offset;
 
-    printf("ERROR WRITE ADDR 32-bit 0x%x \n", addr);
+    memcpy(psx->bus.ram + offset, src, chunk);
 
-    assert(0);
+    src += chunk;
+    addr += chunk;
+    size -= chunk;
   }
-}
\ No newline at end of file
+}
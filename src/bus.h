@@ -1,5 +1,6 @@
  #pragma once
  #include "typedef.h"
+#include "bios.h"
 
 // BIOS Region (default 512 Kbytes, max 4 MBytes)
 #define BIOS_ADDR 0x1FC00000
@@ -12,7 +13,7 @@
 
 // Scratchpad
 #define SCRATCHPAD_ADDR 0x1F800000
-#define SCRATCHPAD_SIZE KB
+#define SCRATCHPAD_SIZE 0x400 // 1 KB
 
 //Expansion Region 1
 #define EXPANSION_REGION1_ADDR  0x1F000000 
@@ -82,24 +83,166 @@ static const int MB = (0x400 * 0x400); // 1 MB (megabyte) in Byte 1.048.576
 static const int GB = (0x400 * 0x400 * 0x400);  // 1 GB (gigabyte) in Byte 1.073.741.824
 
 
+// Fastmem page table
+// The physical address space left by region_memory() (512 MBytes) is split in 4 KByte pages.
+// Every page points straight at host memory (RAM, BIOS, Scratchpad) or is NULL and
+// carries the index of the MMIO handler that owns it.
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (1 << PAGE_SHIFT)
+#define PAGE_MASK  (PAGE_SIZE - 1)
+#define PAGE_COUNT (0x20000000 >> PAGE_SHIFT)
+
+#define RAM_PAGES (0x200000 >> PAGE_SHIFT) // 2 MBytes
+
+// Wait states
+// A load costs the cycles of its region on top of the instruction: main RAM and the I/O
+// ports a fixed time, the Scratchpad none, the BIOS ROM and the Expansion Regions what
+// their Delay/Size register of Memory Control 1 (with COM_DELAY) programs. The costs are
+// kept per page and per access width in load_cycles, rebuilt when the registers are
+// written. Stores go through the write buffer and cost nothing.
+#define RAM_LOAD_CYCLES 6
+#define IO_LOAD_CYCLES  2
+
+enum MEMORY_CONTROL1
+{
+  MEMCTRL_EXP1_BASE  = 0, // 1F801000h Expansion 1 Base Address
+  MEMCTRL_EXP2_BASE  = 1, // 1F801004h Expansion 2 Base Address
+  MEMCTRL_EXP1_DELAY = 2, // 1F801008h Expansion 1 Delay/Size
+  MEMCTRL_EXP3_DELAY = 3, // 1F80100Ch Expansion 3 Delay/Size
+  MEMCTRL_BIOS_DELAY = 4, // 1F801010h BIOS ROM Delay/Size
+  MEMCTRL_SPU_DELAY  = 5, // 1F801014h SPU_DELAY Delay/Size
+  MEMCTRL_CD_DELAY   = 6, // 1F801018h CDROM_DELAY Delay/Size
+  MEMCTRL_EXP2_DELAY = 7, // 1F80101Ch Expansion 2 Delay/Size
+  MEMCTRL_COM_DELAY  = 8, // 1F801020h COM_DELAY / COMMON_DELAY
+  MEMCTRL_COUNT
+};
+
+enum IO_REGION
+{
+  IO_UNMAPPED   = 0, // Bus error
+  IO_BIOS       = 1, // BIOS ROM (writes are ignored)
+  IO_EXPANSION1 = 2, // Expansion Region 1
+  IO_HARDWARE   = 3, // 1F801000h I/O Ports (Memory Control, DMA, Timers, CDROM, GPU, MDEC, SPU ...)
+  IO_EXPANSION2 = 4, // Expansion Region 2
+  IO_EXPANSION3 = 5, // Expansion Region 3
+  IO_CODE       = 6, // RAM page with trapped stores: decoded instructions (stores invalidate
+                     // them), clean page while the dirty pages are tracked
+};
+
+// Instruction cache
+// 4 KBytes in 256 lines of 16 bytes (4 instructions), tagged with the physical address
+// of the line. Only the tags are kept: instructions are always decoded from memory and
+// the cache only decides what a fetch costs. A hit is one compare of the tag, a miss
+// fills the whole line.
+#define ICACHE_LINES      256
+#define ICACHE_LINE_SHIFT 4
+#define ICACHE_LINE_SIZE  (1 << ICACHE_LINE_SHIFT)
+#define ICACHE_INVALID    0xFFFFFFFF // tag of an invalid line (never a line address)
+
+// FFFE0130h Cache Control
+#define CACHE_TAG_TEST       (1 << 2)  // isolated stores invalidate the line they hit
+#define CACHE_CODE_ENABLE    (1 << 11) // kuseg / kseg0 fetches go through the cache
+#define CACHE_CONTROL_KERNEL 0x0001E988 // as the BIOS kernel leaves it
+
+typedef struct
+{
+  u32 control;           // FFFE0130h Cache Control
+  u32 tag[ICACHE_LINES]; // physical address of the line, ICACHE_INVALID when not valid
+}icache;
+
 typedef struct 
 {
-    u8 ram[(0x400 * 0x400) * 2];
+    u8 *ram;        // 2 MBytes
+
+    u8 *bios;       // 512 KBytes, the shared read only image (NULL = not loaded)
+
+    u64 bios_hash;  // hash of the image (see bios.h), 0 = not loaded
+
+    u8 *scratchpad; // only the first 1 KByte is used, the rest pads the page
+
+    u8 *fastmem;    // 4 GBytes host reservation (see fastmem.h), NULL = page table only
+
+    u8 *page_read[PAGE_COUNT];  // host pointer of the page, NULL = MMIO
+
+    u8 *page_write[PAGE_COUNT]; // host pointer of the page, NULL = MMIO / read only
+
+    u8 page_io[PAGE_COUNT];     // IO_REGION handler used when the page is NULL
+
+    bool track_dirty;               // trap the first store into a clean RAM page
+    u32 dirty_bitmap[RAM_PAGES / 32]; // RAM pages written since clean_dirty_pages()
+
+    u32 mem_control[MEMCTRL_COUNT]; // Memory Control 1 registers (saved with the state)
+
+    u8 load_cycles[3][PAGE_COUNT];  // wait states of a byte / halfword / word load
+    u8 spu_cycles[3];               // SPU and CDROM accesses, on top of the I/O page
+    u8 cdrom_cycles[3];
+
+    icache cache;                   // saved with the state
+
+    bool isolated;                  // SR.Isc: the RAM stores go to the cache
 
 }Memory;
 
-static Memory var;
+bool init_bus(bool fastmem); // map the bus of the bound machine (see machine.h)
 
-u32 fix_addresses(u32 addr ,u32 index,u32 size,u32 offset); // offeset index
+void shutdown_bus(void);
 
+// Point the BIOS region at the shared image (see bios.h)
+void map_bios(const bios_image *bios);
+
+// Trap (protect = true) or release the stores into the RAM page of addr and its mirrors;
+// a clean page stays trapped while the dirty pages are tracked
+void protect_code_page(u32 addr, bool protect);
+
+// Dirty page tracking (see rewind.h)
+// While tracked, every clean RAM page is trapped like a code page: its first store goes
+// through io_write() whatever the access path (page table, fastmem, recompiled code),
+// sets its bit in dirty_bitmap and releases the page, later stores run at full speed.
+void track_dirty_pages(bool track);
+
+void clean_dirty_pages(void); // mark every RAM page clean (and trap them again)
+
+void mark_dirty_range(u32 addr, u32 size); // physical RAM range written behind the bus
+
+void reset_memory_control(void); // power-on Delay/Size values
+
+void update_wait_states(void); // rebuild load_cycles from mem_control
+
+// Cycles of count instructions fetched in sequence from pc: kuseg / kseg0 go through the
+// instruction cache (when enabled), kseg1 is uncached and reads every instruction from
+// its region
+u32 fetch_cycles(u32 pc, u32 count);
+
+void reset_cache(void); // cache disabled, every line invalid, not isolated
+
+// Cache isolation (SR.Isc, see mtc0)
+// While isolated every RAM page is trapped like a code page, so the stores of every
+// access path reach io_write() and go to the cache instead of RAM: with the Tag Test
+// mode of Cache Control they invalidate their line (how the BIOS flushes the cache),
+// otherwise they write cache data, which is not kept.
+void isolate_cache(bool isolate);
+
+// MMIO handlers, size is the access width in bytes
+u32  io_read(u32 addr, u32 size);
+void io_write(u32 addr, u32 value, u32 size);
+
+bool fix_addresses(u32 addr ,u32 index,u32 size,u32 *offset); // offeset index
+
+// CPU loads, the wait states of the region go to the cycles of the bound machine
 u8  read8(u32 addr);
 u16 read16(u32 addr);
 u32 read32(u32 addr);
 
+u32 peek32(u32 addr); // same without the wait states (instruction decode)
+
 void write8(u32 addr,u8 value);
 void write16(u32 addr,u16 value);
 void write32(u32 addr,u32 value);
 
+// DMA into RAM (physical address, wraps inside the 2 MBytes): bypasses the page table,
+// the decoded pages it covers are dropped through code_bitmap
+void dma_write_ram(u32 addr, const void *data, u32 size);
+
  
  // KSEG0 contains kernel code and data, but is unmapped. Translations are direct.
  
@@ -109,4 +252,12 @@ void write32(u32 addr,u32 value);
  
  // Implication is that the page tables are kept in VIRTUAL memory!
 
- u32 region_memory(u32 addr); // kuseg / kseg0 / kseg1 / kseg2
\ No newline at end of file
+ u32 region_memory(u32 addr); // kuseg / kseg0 / kseg1 / kseg2
+
+extern const u32 region_mask[8]; // region_memory() mask, indexed by addr >> 29
+
+u8 *bus_ram(void); // 2 MBytes main RAM
+
+u8 *bus_load_cycles(u32 size); // wait states of the loads of size bytes, per page (see load_cycles)
+
+u8 *bus_fastmem(void); // base of the fastmem reservation, NULL when the page table is used
@@ -1,34 +1,50 @@
+#include <string.h>
+
 #include "cpu.h"
+#include "decode.h"
+#include "irq.h"
 
 void reset_cpu(R3000 *cpu)
 {
-  cpu = (R3000*)malloc(sizeof(R3000));
+  memset(cpu, 0, sizeof(R3000));
 
 /*
 Assertion of the Reset signal causes an exception
 that transfers control to the special vector at virtual
 address 0xbfc0_0000 (The start of the BIOS)
 */
-  cpu->pc = 0xbfc00000;
+  set_pc(cpu, 0xbfc00000);
  
   cpu->hi = 0;
  
   cpu->lo = 0;
+
+  cpu->m_cop0_sr.boot_exception = 1;
+
+  cpu->m_cop0_prid = 0x00000002; // R3000A
 }
 
+// gpr_reg[0] is never written (see set_gpr), so R0 reads back as 0 without fixing it up here
 u32 gpr(R3000 *cpu, u8 index) // General Purpose Register
 {
-   cpu->gpr_reg[0] = 0x00000000;
-
    return cpu->gpr_reg[index];
 }
 
-u32 set_gpr(R3000 *cpu, u8 index, u8 v)
+u32 set_gpr(R3000 *cpu, u8 index, u32 v)
 {
-  cpu->gpr_reg[0] = 0x00000000;
+  // A write in the load delay slot wins over the pending load of the same register
+  if (cpu->slot_cur.reg == index)
+  {
+    cpu->slot_cur.reg = 0;
+
+    cpu->slot_cur.cur = 0;
+  }
+
+  cpu->gpr_reg[index] = v;
 
-  return cpu->gpr_reg[index] = v;
+  cpu->gpr_reg[0] = 0x00000000;
 
+  return v;
 }
 
 // 6-bit operation code
@@ -43,43 +59,45 @@ u32 function(R3000 *cpu)
   return (cpu->opcode & 0x3f);
 }
 
+// The operand helpers read the fields predecoded in cpu->instr (see decode_instr)
+
 // Register source
 u32 rs(R3000 *cpu)
 {
-  return gpr(cpu, (cpu->opcode >> 21) & 0x1f);
+  return gpr(cpu, cpu->instr->rs);
 }
 
 // Register target
 u32 rt(R3000 *cpu)
 {
-  return gpr(cpu, (cpu->opcode >> 16) & 0x1f);
+  return gpr(cpu, cpu->instr->rt);
 }
 
 // Register destination
 u32 rd(R3000 *cpu)
 {
-  return gpr(cpu, (cpu->opcode >> 11) & 0x1f);
+  return gpr(cpu, cpu->instr->rd);
 }
 
-u32 set_rs(R3000 *cpu, u8 value)
+u32 set_rs(R3000 *cpu, u32 value)
 {
-  return set_gpr(cpu, rs(cpu), value);
+  return set_gpr(cpu, cpu->instr->rs, value);
 }
 
-u32 set_rt(R3000 *cpu, u8 value)
+u32 set_rt(R3000 *cpu, u32 value)
 {
-  return set_gpr(cpu, rt(cpu), value);
+  return set_gpr(cpu, cpu->instr->rt, value);
 }
 
-u32 set_rd(R3000 *cpu, u8 value)
+u32 set_rd(R3000 *cpu, u32 value)
 {
-  return set_gpr(cpu, rd(cpu), value);
+  return set_gpr(cpu, cpu->instr->rd, value);
 }
 
 // 5-bit shift amount
 u32 shift(R3000 *cpu)
 {
-  return (cpu->opcode >> 6) & 0x1f;
+  return cpu->instr->shift;
 }
 
 // 16-bit immediate, branch displacement or address
@@ -87,7 +105,7 @@ u32 shift(R3000 *cpu)
 
 u32 imm16(R3000 *cpu)
 {
-  return (cpu->opcode & 0xffff);
+  return (cpu->instr->imm & 0xffff);
 }
 
 // 16-bit immediate, branch displacement or address
@@ -95,7 +113,7 @@ u32 imm16(R3000 *cpu)
 
 s32 imm16sign(R3000 *cpu)
 {
-  return ((s16)cpu->opcode & 0xffff);
+  return cpu->instr->imm;
 }
 
 // Immediate 20
@@ -173,12 +191,14 @@ cpu->m_cop0_cause.excode = cause; // ACTIVE EXCEPTION
 /////////////////////////////////////////////////////////////////////////
 
 // REVERSE RFE FOR STATUS 
-cpu->m_cop0_sr.interrupt_disable  = cpu->m_cop0_sr.current_kernel_mode;
+cpu->m_cop0_sr.interrupt_disable  = cpu->m_cop0_sr.prev_interrupt;
 
 cpu->m_cop0_sr.old_kernel   = cpu->m_cop0_sr.prev_kernel;
 
 cpu->m_cop0_sr.prev_interrupt  =  cpu->m_cop0_sr.interrupt_enable;
 
+cpu->m_cop0_sr.prev_kernel = cpu->m_cop0_sr.current_kernel_mode;
+
 cpu->m_cop0_sr.interrupt_enable = false;
 
 cpu->m_cop0_sr.current_kernel_mode = KERNEL;
@@ -264,7 +284,7 @@ void add(R3000 *cpu) // Add Word
 
   u32 res = rs(cpu) + rt(cpu);
 
-  if (~((rs(cpu) ^ rt(cpu)) & (rs(cpu) ^ res) & 0x80000000) == 0)
+  if (~(rs(cpu) ^ rt(cpu)) & (rs(cpu) ^ res) & 0x80000000)
   {
     signalException(cpu,Overflow);
     return;
@@ -279,7 +299,7 @@ void addi(R3000 *cpu) // Add Immediate Word
 {
   u32 res = rs(cpu) + imm16sign(cpu);
 
-  if (~((rs(cpu) ^ rt(cpu)) & (rs(cpu) ^ res) & 0x80000000) == 0)
+  if (~(rs(cpu) ^ imm16sign(cpu)) & (rs(cpu) ^ res) & 0x80000000)
   {
     signalException(cpu,Overflow);
     return;
@@ -315,7 +335,7 @@ void div_(R3000 *cpu) // Divide Word
 
     cpu->hi = sign_rs;
   }
-  else if ((u32)sign_rt == 0x80000000 && (u32)sign_rt == 0xffffffff)
+  else if ((u32)sign_rs == 0x80000000 && (u32)sign_rt == 0xffffffff)
   {
 
     cpu->lo = 0x80000000;
@@ -400,7 +420,7 @@ void slti(R3000 *cpu) // Set on Less Than Immediate
 
 void sltiu(R3000 *cpu) // Set on Less Than Immediate Unsigned
 {
-  if (rs(cpu) < (u16)imm16sign(cpu))
+  if (rs(cpu) < (u32)imm16sign(cpu))
   {
     set_rt(cpu, 1);
   }
@@ -428,7 +448,7 @@ void sub(R3000 *cpu) // Subtract Word
 {
   u32 res = rs(cpu) - rt(cpu);
 
-  if (~((rs(cpu) ^ rt(cpu)) & (rs(cpu) ^ res) & 0x80000000) == 0)
+  if ((rs(cpu) ^ rt(cpu)) & (rs(cpu) ^ res) & 0x80000000)
   {
     signalException(cpu,Overflow);
     return;
@@ -451,15 +471,18 @@ void bcondz(R3000 *cpu) // Unconditional Branch
 
   cpu->delay_slot = true;
 
-  bool target = rt(cpu) & 0x01;
+  // rt field: bit0 selects BGEZ/BLTZ, 10h/11h are the "and link" forms (others mirror them)
+  bool target = cpu->instr->rt & 0x01;
 
-  s16 offset = (imm16sign(cpu) << 2);
+  bool link = (cpu->instr->rt & 0x1e) == 0x10;
+
+  s32 offset = (imm16sign(cpu) << 2);
  
   bool condition;
   
   if(target)
   {
-    // BGTZ
+    // BGEZ
     condition = (s32)rs(cpu) >= 0; 
   }else
   {
@@ -467,13 +490,8 @@ void bcondz(R3000 *cpu) // Unconditional Branch
     condition = (s32)rs(cpu) < 0; 
   }
 
-  // BLTZAL
-  if(!condition)
-  set_gpr(cpu,31,cpu->next_pc);
-  
-
-  // BLTZAL
-  if(condition)
+  // BLTZAL / BGEZAL link even when the branch is not taken
+  if(link)
   set_gpr(cpu,31,cpu->next_pc);
   
 
@@ -487,7 +505,7 @@ void bcondz(R3000 *cpu) // Unconditional Branch
 // Table 3-2 CPU Branch and Jump Instructions
 void beq(R3000 *cpu) // Branch on Equal
 {
-  s16 offset = (imm16sign(cpu) << 2);
+  s32 offset = (imm16sign(cpu) << 2);
   
   cpu->delay_slot = true;
   
@@ -502,7 +520,7 @@ void beq(R3000 *cpu) // Branch on Equal
 
 void bgtz(R3000 *cpu) // Branch on Greater Than or Equal to Zero
 {
-  s16 offset = (imm16sign(cpu) << 2);
+  s32 offset = (imm16sign(cpu) << 2);
    
   cpu->delay_slot = true;
 
@@ -517,7 +535,7 @@ void bgtz(R3000 *cpu) // Branch on Greater Than or Equal to Zero
 
 void blez(R3000 *cpu) // Branch on Less Than or Equal to Zero
 {
-  s16 offset = (imm16sign(cpu) << 2);
+  s32 offset = (imm16sign(cpu) << 2);
    
   cpu->delay_slot = true;
 
@@ -532,7 +550,7 @@ void blez(R3000 *cpu) // Branch on Less Than or Equal to Zero
 
 void bne(R3000 *cpu) // Branch on Not Equal
 {
-  s16 offset = (imm16sign(cpu) << 2);
+  s32 offset = (imm16sign(cpu) << 2);
    
   cpu->delay_slot = true;
 
@@ -544,11 +562,13 @@ void bne(R3000 *cpu) // Branch on Not Equal
   }
 }
 
+// cpu->pc already points at the delay slot, the jump keeps its upper 4 bits
+
 void j(R3000 *cpu) // Jump
 {
   cpu->delay_slot = true;
 
-  jump_addr(cpu, (cpu->next_pc & 0xf0000000) | (target(cpu) << 2));
+  jump_addr(cpu, (cpu->pc & 0xf0000000) | (target(cpu) << 2));
 }
 
 void jal(R3000 *cpu) // Jump and Link
@@ -557,18 +577,28 @@ void jal(R3000 *cpu) // Jump and Link
     
   set_gpr(cpu,31,cpu->next_pc); 
 
-  jump_addr(cpu, (cpu->next_pc & 0xf0000000) | (target(cpu) << 2));
+  jump_addr(cpu, (cpu->pc & 0xf0000000) | (target(cpu) << 2));
 
 }
 
 void jalr(R3000 *cpu) // Jump and Link Register
-{}
+{
+    cpu->delay_slot = true;
+
+    const u32 addr = rs(cpu);
+
+    set_rd(cpu, cpu->next_pc);
+
+    jump_addr(cpu, addr);
+}
 
 void jr(R3000 *cpu) // Jump Register
 {
     cpu->delay_slot = true;
     
     const u32 addr = rs(cpu);
+
+    jump_addr(cpu, addr);
   
 }
 // Table 3-3 CPU Instruction Control Instructions
@@ -579,29 +609,65 @@ void nop(R3000 *cpu) // No Operation
 
 // Table 3-4 CPU Load, Store, and Memory Control Instructions
 
+// Loads go through the load delay slot (JumpDelaySlot): the loaded value is only
+// visible to the instruction after the next one.
+
 void lb(R3000 *cpu) // Load byte
 {
-   set_rt(cpu,(s8)read8(rs(cpu) + imm16sign(cpu)));
+   JumpDelaySlot(cpu,cpu->instr->rt,(s8)read8(rs(cpu) + imm16sign(cpu)));
 }
 
 void lbu(R3000 *cpu) // Load byte Unsigned
 {
-  set_rt(cpu,read8(rs(cpu) + imm16sign(cpu)));
+  JumpDelaySlot(cpu,cpu->instr->rt,read8(rs(cpu) + imm16sign(cpu)));
 }
 
 void lh(R3000 *cpu) // Load Halfword
 {
-  set_rt(cpu,(s16)read16(rs(cpu) + imm16sign(cpu)));
+  u32 addr = rs(cpu) + imm16sign(cpu);
+
+  if (addr & 0x1)
+  {
+    load_update_badvaddr(cpu,addr);
+    return;
+  }
+
+  JumpDelaySlot(cpu,cpu->instr->rt,(s16)read16(addr));
 }
 
 void lhu(R3000 *cpu) // Load Halfword Unsigned
 {
-  set_rt(cpu,read16(rs(cpu) + imm16sign(cpu)));
+  u32 addr = rs(cpu) + imm16sign(cpu);
+
+  if (addr & 0x1)
+  {
+    load_update_badvaddr(cpu,addr);
+    return;
+  }
+
+  JumpDelaySlot(cpu,cpu->instr->rt,read16(addr));
 }
 
 void lw(R3000 *cpu) // Load Word
 {
-  set_rt(cpu,(s32)read32(rs(cpu) + imm16sign(cpu)));
+  u32 addr = rs(cpu) + imm16sign(cpu);
+
+  if (addr & 0x3)
+  {
+    load_update_badvaddr(cpu,addr);
+    return;
+  }
+
+  JumpDelaySlot(cpu,cpu->instr->rt,read32(addr));
+}
+
+// LWL/LWR merge with a load still in flight on the same register instead of the stale value
+static u32 rt_pending(R3000 *cpu)
+{
+  if (cpu->slot_cur.reg == cpu->instr->rt)
+    return cpu->slot_cur.cur;
+
+  return rt(cpu);
 }
 
 void lwl(R3000 *cpu) // Load Word Left
@@ -612,17 +678,19 @@ void lwl(R3000 *cpu) // Load Word Left
   
   u32 aligned_addr = addr & 0x3; 
 
+  u32 cur = rt_pending(cpu);
+
   u32 val;
 
   switch (aligned_addr) // load aligned addr
   {
-  case 0: val = (rt(cpu) & 0x00ffffff) | (mem << 24); break;
-  case 1: val = (rt(cpu) & 0x0000ffff) | (mem << 16); break;
-  case 2: val = (rt(cpu) & 0x000000ff) | (mem << 8);  break;
-  case 3: val = (rt(cpu) & 0x00000000) |  mem; break;
+  case 0: val = (cur & 0x00ffffff) | (mem << 24); break;
+  case 1: val = (cur & 0x0000ffff) | (mem << 16); break;
+  case 2: val = (cur & 0x000000ff) | (mem << 8);  break;
+  case 3: val = (cur & 0x00000000) |  mem; break;
   }
   
-  set_rt(cpu,val);
+  JumpDelaySlot(cpu,cpu->instr->rt,val);
 
 }
 
@@ -634,18 +702,20 @@ void lwr(R3000 *cpu) // Load Word Right
   
   u32 aligned_addr = (addr & 0x3); 
 
+  u32 cur = rt_pending(cpu);
+
   u32 val;
  
   switch (aligned_addr)
   {
   
-  case 0: val = (rt(cpu) & 0x00000000) | (mem);       break;
-  case 1: val = (rt(cpu) & 0xff000000) | (mem >> 8);  break;
-  case 2: val = (rt(cpu) & 0xffff0000) | (mem >> 16); break;
-  case 3: val = (rt(cpu) & 0xffffff00) | (mem >> 24); break;
+  case 0: val = (cur & 0x00000000) | (mem);       break;
+  case 1: val = (cur & 0xff000000) | (mem >> 8);  break;
+  case 2: val = (cur & 0xffff0000) | (mem >> 16); break;
+  case 3: val = (cur & 0xffffff00) | (mem >> 24); break;
   }
   
-  set_rt(cpu,val);
+  JumpDelaySlot(cpu,cpu->instr->rt,val);
 
 }
 
@@ -656,15 +726,29 @@ void sb(R3000 *cpu)  // To store a byte to memory
 
 void sh(R3000 *cpu)  // Store Halfword
 {
-  
-  write16(rs(cpu) + imm16sign(cpu),(rt(cpu) & 0xffff));
+  u32 addr = rs(cpu) + imm16sign(cpu);
+
+  if (addr & 0x1)
+  {
+    write_update_badvaddr(cpu,addr);
+    return;
+  }
+
+  write16(addr,(rt(cpu) & 0xffff));
 
 }
 
 void sw(R3000 *cpu)  // Store Word
 {
+  u32 addr = rs(cpu) + imm16sign(cpu);
+
+  if (addr & 0x3)
+  {
+    write_update_badvaddr(cpu,addr);
+    return;
+  }
 
-  write32(rs(cpu) + imm16sign(cpu),rt(cpu));
+  write32(addr,rt(cpu));
 
 }
 
@@ -672,7 +756,7 @@ void swl(R3000 *cpu) // Store Word Left
 {
   u32 addr = (rs(cpu) + imm16sign(cpu)); // (EffAddr)
   
-  u32 mem = read32(addr & ~0x3);
+  u32 mem = peek32(addr & ~0x3); // merged on the host, the R3000 does not read
   
   u32 aligned_addr = addr & 0x3; 
 
@@ -694,7 +778,7 @@ void swr(R3000 *cpu) // Store Word Right
 {
   u32 addr = (rs(cpu) + imm16sign(cpu)); // (EffAddr)
   
-  u32 mem = read32(addr & ~0x3);
+  u32 mem = peek32(addr & ~0x3); // merged on the host, the R3000 does not read
   
   u32 aligned_addr = addr & 0x3; 
 
@@ -728,13 +812,13 @@ void andi(R3000 *cpu) // And Immediate
 
 void lui(R3000 *cpu) // Load Upper Immediate
 {
-  u16 res = imm16(cpu) << 16;
+  u32 res = imm16(cpu) << 16;
   set_rt(cpu, res);
 }
 
 void nor(R3000 *cpu) // Not Or
 {
-  u32 res = ~rs(cpu) | rt(cpu);
+  u32 res = ~(rs(cpu) | rt(cpu));
   set_rd(cpu, res);
 }
 
@@ -848,16 +932,9 @@ void break_(R3000 *cpu)
 {
 
 //   COP0 Break    80000040h     BFC00140h   (Debug Break)
-  
-  if (BreakPoint)
-  {
-      
-    cpu->m_cop0_dcic  |= 1;
-    
-    set_pc(cpu,0x80000040);
+// The BREAK opcode jumps to the normal exception handler at 80000080h (not 80000040h).
 
-  }
-  
+  signalException(cpu,BreakPoint);
 
 }
 
@@ -867,20 +944,20 @@ void break_(R3000 *cpu)
 void mfc0(R3000 *cpu)
 {
 
-switch (rd(cpu))
+switch (cpu->instr->rd)
 {
-case BPC:      JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_bpc);             break;
-case BDA:      JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_bda);             break;
-case JUMPDEST: JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_jmptest);         break;
-case DCIC:     JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_dcic);            break;
-case BadVaddr: JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_badvaddr);        break; 
-case BDAM:     JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_bdam);            break;    
-case BPCM:     JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_bpcm);            break;     
-case SR:       JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_sr.word);         break;   
-case CAUSE:    JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_cause.word);      break;    
-case EPC:      JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_epc);             break;   
-case PRID:     JumpDelaySlot(cpu,rt(cpu),cpu->m_cop0_prid);            break;    
-default: printf("unhandled cop0  write %d \n",rd(cpu)); break;
+case BPC:      JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_bpc);             break;
+case BDA:      JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_bda);             break;
+case JUMPDEST: JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_jmptest);         break;
+case DCIC:     JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_dcic);            break;
+case BadVaddr: JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_badvaddr);        break; 
+case BDAM:     JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_bdam);            break;    
+case BPCM:     JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_bpcm);            break;     
+case SR:       JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_sr.word);         break;   
+case CAUSE:    JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_cause.word);      break;    
+case EPC:      JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_epc);             break;   
+case PRID:     JumpDelaySlot(cpu,cpu->instr->rt,cpu->m_cop0_prid);            break;    
+default: printf("unhandled cop0  write %d \n",cpu->instr->rd); break;
 }
 
 
@@ -895,7 +972,7 @@ default: printf("unhandled cop0  write %d \n",rd(cpu)); break;
 void mtc0(R3000 *cpu)
 {
 
-switch (rd(cpu)) {
+switch (cpu->instr->rd) {
 case BPC:      cpu->m_cop0_bpc     = rt(cpu);       break;
 case BDA:      cpu->m_cop0_bda     = rt(cpu);       break;
 case JUMPDEST: break; // Read Only        
@@ -903,11 +980,11 @@ case DCIC:     cpu->m_cop0_dcic    = rt(cpu);       break;
 case BadVaddr: break; // Read Only 
 case BDAM:     cpu->m_cop0_bdam    = rt(cpu);       break;    
 case BPCM:     cpu->m_cop0_bpcm    = rt(cpu);       break;     
-case SR:       cpu->m_cop0_sr.word = rt(cpu);       break;   
-case CAUSE:    cpu->m_cop0_cause.word  = cpu->m_cop0_cause.word >> 8 & ~0x1ff | rt(cpu) >> 8 & 0x1ff; break; // Read Only    
+case SR:       cpu->m_cop0_sr.word = rt(cpu); isolate_cache(cpu->m_cop0_sr.isolate_cache); break;
+case CAUSE:    cpu->m_cop0_cause.word  = (cpu->m_cop0_cause.word & ~0x300) | (rt(cpu) & 0x300); break; // Read Only, except Bit8-9    
 case EPC:      break; // Read Only 
 case PRID:     break; // Read Only   
-default: printf("unhandled cop0 read %d \n",rd(cpu)); break;
+default: printf("unhandled cop0 read %d \n",cpu->instr->rd); break;
 
 }
 
@@ -934,7 +1011,7 @@ cpu->m_cop0_sr.prev_kernel      = cpu->m_cop0_sr.old_kernel;
 
 
 
-void cop0(R3000 *cpu) 
+instr_handler decode_cop0(u32 opcode)
 {
 
 // System Control Co-processor (COP0) Instructions
@@ -962,17 +1039,15 @@ Coprocessor Opcode/Parameter Encoding
 */
 
 
-switch (rs(cpu))
+switch ((opcode >> 21) & 0x1f) // rs field
 {
-case 0b0000:  mfc0(cpu); break;
-case 0b100:   mtc0(cpu); break;
-case 0b10000: rfe(cpu); break;
+case 0b0000:  return mfc0;
+case 0b100:   return mtc0;
+case 0b10000: return rfe;
 
 default:
-  break;
+  return nop;
 }
-  
-  
 
 }
 
@@ -980,7 +1055,44 @@ default:
 
 void cop2(R3000 *cpu) // Coprocessor Operation to Coprocessor 2
 {
- // gte not implemented  
+  gte_execute(&cpu->gte, cpu->instr->opcode & 0x1ffffff, subpixel_active()); // imm25
+}
+
+void mfc2(R3000 *cpu) // Move From Coprocessor 2 (data register)
+{
+  JumpDelaySlot(cpu,cpu->instr->rt,gte_read(&cpu->gte,cpu->instr->rd));
+}
+
+void cfc2(R3000 *cpu) // Move Control From Coprocessor 2
+{
+  JumpDelaySlot(cpu,cpu->instr->rt,gte_read(&cpu->gte,cpu->instr->rd + 32));
+}
+
+void mtc2(R3000 *cpu) // Move To Coprocessor 2 (data register)
+{
+  gte_write(&cpu->gte,cpu->instr->rd,rt(cpu));
+}
+
+void ctc2(R3000 *cpu) // Move Control To Coprocessor 2
+{
+  gte_write(&cpu->gte,cpu->instr->rd + 32,rt(cpu));
+}
+
+instr_handler decode_cop2(u32 opcode)
+{
+  if (opcode & (1 << 25)) // COP2 imm25
+    return cop2;
+
+  switch ((opcode >> 21) & 0x1f) // rs field
+  {
+  case 0b0000: return mfc2;
+  case 0b0010: return cfc2;
+  case 0b0100: return mtc2;
+  case 0b0110: return ctc2;
+
+  default:
+    return nop;
+  }
 }
 
 
@@ -988,175 +1100,259 @@ void cop2(R3000 *cpu) // Coprocessor Operation to Coprocessor 2
 void lwc2(R3000 *cpu) // Load Word to Coprocessor 2
 {  
   u32 addr = rs(cpu) + imm16sign(cpu);
-  
-  u32 mem = read32(addr); 
-
-  u32 reg_dest = rt(cpu);
 
+  if (addr & 0x3)
+  {
+    load_update_badvaddr(cpu,addr);
+    return;
+  }
 
-  
+  gte_write(&cpu->gte,cpu->instr->rt,read32(addr));
 }
 
 void swc2(R3000 *cpu) // Store Word from Coprocessor 2
 {  
   u32 addr = (rs(cpu) + imm16sign(cpu));
 
+  if (addr & 0x3)
+  {
+    write_update_badvaddr(cpu,addr);
+    return;
+  }
+
+  write32(addr,gte_read(&cpu->gte,cpu->instr->rt));
 }
 
 
-void execute_cpu(R3000 *cpu)
+// Decoding picks the handler once per instruction; execution then goes straight
+// through instruction.handler (see step_cpu).
+
+void decode_instr(instruction *instr, u32 opcode)
 {
+  instr->opcode = opcode;
+
+  instr->rs = (opcode >> 21) & 0x1f;
+
+  instr->rt = (opcode >> 16) & 0x1f;
+
+  instr->rd = (opcode >> 11) & 0x1f;
+
+  instr->shift = (opcode >> 6) & 0x1f;
 
-  switch (opcode(cpu))
+  instr->imm = (s16)(opcode & 0xffff);
+
+  instr->handler = decode_primary(opcode);
+}
+
+instr_handler decode_primary(u32 opcode)
+{
+
+  switch ((opcode >> 26) & 0x3f)
   {
-  case 0x00: special(cpu);  break; //   00h=SPECIAL
-  case 0x01: bcondz(cpu); break; //   01h=BcondZ
-  case 0x02: j(cpu);     break; //   02h=J
-  case 0x03: jal(cpu);   break; //   03h=JAL
-  case 0x04: beq(cpu);   break; // 04h=BEQ
-  case 0x05: bne(cpu);   break; // 05h=BNE
-  case 0x06: blez(cpu);  break; // 06h=BLEZ
-  case 0x07: bgtz(cpu);  break; // 07h=BGTZ
-  case 0x08: addi(cpu);  break; // 08h=ADDI
-  case 0x09: addiu(cpu); break; // 09h=ADDIU
-  case 0x0a: slti(cpu);  break; // 0Ah=SLTI
-  case 0x0b: sltiu(cpu); break; // 0Bh=SLTIU
-  case 0x0c: andi(cpu);  break; // 0Ch=ANDI
-  case 0x0d: ori(cpu);   break; // 0Dh=ORI
-  case 0x0e: xori(cpu);  break; // 0Eh=XORI
-  case 0x0f: lui(cpu);   break; // 0Fh=LUI
-  case 0x10: cop0(cpu);  break; // 10h=COP0
+  case 0x00: return decode_special(opcode); //   00h=SPECIAL
+  case 0x01: return bcondz; //   01h=BcondZ
+  case 0x02: return j; //   02h=J
+  case 0x03: return jal; //   03h=JAL
+  case 0x04: return beq; // 04h=BEQ
+  case 0x05: return bne; // 05h=BNE
+  case 0x06: return blez; // 06h=BLEZ
+  case 0x07: return bgtz; // 07h=BGTZ
+  case 0x08: return addi; // 08h=ADDI
+  case 0x09: return addiu; // 09h=ADDIU
+  case 0x0a: return slti; // 0Ah=SLTI
+  case 0x0b: return sltiu; // 0Bh=SLTIU
+  case 0x0c: return andi; // 0Ch=ANDI
+  case 0x0d: return ori; // 0Dh=ORI
+  case 0x0e: return xori; // 0Eh=XORI
+  case 0x0f: return lui; // 0Fh=LUI
+  case 0x10: return decode_cop0(opcode); // 10h=COP0
   // case 0b1000000000: mfc0(cpu); break; // mfc0
   // case 0b1000000100: mtc0(cpu); break; // mtc0
   // case 0b1000010000: rfe(cpu);  break; // rfe
-  case 0x11: break; //   11h=COP1
-  case 0x12: cop2(cpu);  break; // 12h=COP2
-  case 0x13: break; // 13h=COP3
-  case 0x14: break; // 14h=N/A
-  case 0x15: break; // 15h=N/A
-  case 0x16: break; // 16h=N/A
-  case 0x17: break; // 17h=N/A
-  case 0x18: break; // 18h=N/A
-  case 0x19: break; // 19h=N/A
-  case 0x1a: break; // 1Ah=N/A 
-  case 0x1b: break; // 1Bh=N/A 
-  case 0x1c: break; // 1Ch=N/A 
-  case 0x1d: break; // 1Dh=N/A 
-  case 0x1e: break; // 1Eh=N/A 
-  case 0x1f: break; // 1Fh=N/A 
-
-  case 0x20: lb(cpu);  break; // 20h=LB 
-  case 0x21: lh(cpu);  break; // 21h=LH 
-  case 0x22: lwl(cpu); break; // 22h=LWL 
-  case 0x23: lw(cpu);  break; // 23h=LW 
-  case 0x24: lbu(cpu); break; // 24h=LBU
-  case 0x25: lhu(cpu); break; // 25h=LHU
-  case 0x26: lwr(cpu); break; // 26h=LWR
-  case 0x27: break; // 27h=N/A
-  case 0x28: sb(cpu); break;   // 28h=SB
-  case 0x29: sh(cpu); break;   // 29h=SH
-  case 0x2a: swl(cpu); break;  // 2Ah=SWL
-  case 0x2b: sw(cpu); break;   // 2Bh=SW 
-  case 0x2c: break;  // 2Ch=N/A
-  case 0x2d: break;  // 2Dh=N/A
-  case 0x2e: swr(cpu); break;  // 2Eh=SWR
-  case 0x2f: break;  // 2Fh=N/0
-  case 0x30: break; // 30h=LWC0
-  case 0x31: break; // 31h=LWC1
-  case 0x32: lwc2(cpu); break; // 32h=LWC2 
-  case 0x33: break; // 33h=LWC3
-  case 0x34: break; // 34h=N/A 
-  case 0x35: break; // 35h=N/A 
-  case 0x36: break; // 36h=N/A 
-  case 0x37: break; // 37h=N/A 
-  case 0x38: break; // 38h=SWC0
-  case 0x39: break; // 39h=SWC1
-  case 0x3a:swc2(cpu); break; // 3Ah=SWC2
-  case 0x3b: break; // 3Bh=SWC3
-  case 0x3c: break; // 3ch=N/A
-  case 0x3d: break; // 3Dh=N/A
-  case 0x3e: break; // 3eh=N/A
-  case 0x3f: break; // 3fh=N/A
+  case 0x11: return nop; //   11h=COP1
+  case 0x12: return decode_cop2(opcode); // 12h=COP2
+  case 0x13: return nop; // 13h=COP3
+  case 0x14: return nop; // 14h=N/A
+  case 0x15: return nop; // 15h=N/A
+  case 0x16: return nop; // 16h=N/A
+  case 0x17: return nop; // 17h=N/A
+  case 0x18: return nop; // 18h=N/A
+  case 0x19: return nop; // 19h=N/A
+  case 0x1a: return nop; // 1Ah=N/A 
+  case 0x1b: return nop; // 1Bh=N/A 
+  case 0x1c: return nop; // 1Ch=N/A 
+  case 0x1d: return nop; // 1Dh=N/A 
+  case 0x1e: return nop; // 1Eh=N/A 
+  case 0x1f: return nop; // 1Fh=N/A 
+
+  case 0x20: return lb; // 20h=LB 
+  case 0x21: return lh; // 21h=LH 
+  case 0x22: return lwl; // 22h=LWL 
+  case 0x23: return lw; // 23h=LW 
+  case 0x24: return lbu; // 24h=LBU
+  case 0x25: return lhu; // 25h=LHU
+  case 0x26: return lwr; // 26h=LWR
+  case 0x27: return nop; // 27h=N/A
+  case 0x28: return sb;   // 28h=SB
+  case 0x29: return sh;   // 29h=SH
+  case 0x2a: return swl;  // 2Ah=SWL
+  case 0x2b: return sw;   // 2Bh=SW 
+  case 0x2c: return nop;  // 2Ch=N/A
+  case 0x2d: return nop;  // 2Dh=N/A
+  case 0x2e: return swr;  // 2Eh=SWR
+  case 0x2f: return nop;  // 2Fh=N/0
+  case 0x30: return nop; // 30h=LWC0
+  case 0x31: return nop; // 31h=LWC1
+  case 0x32: return lwc2; // 32h=LWC2 
+  case 0x33: return nop; // 33h=LWC3
+  case 0x34: return nop; // 34h=N/A 
+  case 0x35: return nop; // 35h=N/A 
+  case 0x36: return nop; // 36h=N/A 
+  case 0x37: return nop; // 37h=N/A 
+  case 0x38: return nop; // 38h=SWC0
+  case 0x39: return nop; // 39h=SWC1
+  case 0x3a: return swc2; // 3Ah=SWC2
+  case 0x3b: return nop; // 3Bh=SWC3
+  case 0x3c: return nop; // 3ch=N/A
+  case 0x3d: return nop; // 3Dh=N/A
+  case 0x3e: return nop; // 3eh=N/A
+  case 0x3f: return nop; // 3fh=N/A
   
-  default: printf("error opcode 0x%02.x",opcode(cpu));
-    break;
+  default: printf("error opcode 0x%02x",(opcode >> 26) & 0x3f);
+    return nop;
   }
 }
 
-void special(R3000 *cpu)
+instr_handler decode_special(u32 opcode)
 {
-  switch (function(cpu))
+  switch (opcode & 0x3f)
   {
-  case 0x00:sll(cpu);  break; // 00h=SLL
-  case 0x01: break; // 01h=N/A
-  case 0x02:srl(cpu);  break; // 02h=SRL
-  case 0x03:sra(cpu);  break; // 03h=SRA
-  case 0x04:sllv(cpu); break; // 04h=SLLV
-  case 0x05: break; // 05h=N/A 
-  case 0x06:srlv(cpu); break; // 06h=SRLV
-  case 0x07:srav(cpu); break; // 07h=SRAV
-  case 0x08:jr(cpu);   break; // 08h=JR
-  case 0x09:jalr(cpu); break; // 09h=JALR 
-  case 0x0a: break; // 0Ah=N/A  
-  case 0x0b: break; // 0Bh=N/A 
-  case 0x0c:syscall(cpu); break; // 0Ch=SYSCALL
-  case 0x0d:break_(cpu); break; // 0Dh=BREAK
-  case 0x0e: break; // 0Eh=N/A
-  case 0x0f: break; // 0Fh=N/A
-  case 0x10:mfhi(cpu); break; // 10h=MFHI
-  case 0x11:mthi(cpu); break; // 11h=MTHI 
-  case 0x12:mflo(cpu); break; // 12h=MFLO
-  case 0x13:mtlo(cpu); break; // 13h=MTLO
-  case 0x14: break; // 14h=N/A
-  case 0x15: break; // 15h=N/A
-  case 0x16: break; // 16h=N/A
-  case 0x17: break; // 17h=N/A
-  case 0x18:mult(cpu);  break; // 18h=MULT
-  case 0x19:multu(cpu); break; // 19h=MULTU 
-  case 0x1a:div_(cpu);   break; // 1Ah=DIV
-  case 0x1b:divu(cpu);  break; // 1Bh=DIVU
-  case 0x1c: break; // 1Ch=N/A
-  case 0x1d: break; // 1Dh=N/A
-  case 0x1e: break; // 1Eh=N/A
-  case 0x1f: break; // 1Fh=N/A
-  case 0x20:add(cpu);  break; // 20h=ADD  
-  case 0x21:addu(cpu); break; // 21h=ADDU 
-  case 0x22:sub(cpu);  break; // 22h=SUB  
-  case 0x23:subu(cpu); break; // 23h=SUBU 
-  case 0x24:and_(cpu); break; // 24h=AND  
-  case 0x25:or_(cpu);   break; // 25h=OR   
-  case 0x26:xor_(cpu);  break; // 26h=XOR  
-  case 0x27:nor(cpu);  break; // 27h=NOR  
-  case 0x28: break; // 28h=N/A  
-  case 0x29: break; // 29h=N/A  
-  case 0x2a:slt(cpu);  break; // 2Ah=SLT  
-  case 0x2b:sltu(cpu); break; // 2Bh=SLTU 
-  case 0x2c: break; // 2Ch=N/A  
-  case 0x2d: break; // 2Dh=N/A  
-  case 0x2e: break; // 2Eh=N/A  
-  case 0x2f: break; // 2Fh=N/A  
-  case 0x30: break; // 30h=N/A  
-  case 0x31: break; // 31h=N/A
-  case 0x32: break; // 32h=N/A
-  case 0x33: break; // 33h=N/A
-  case 0x34: break; // 34h=N/A
-  case 0x35: break; // 35h=N/A
-  case 0x36: break; // 36h=N/A
-  case 0x37: break; // 37h=N/A      
-  case 0x38: break; // 38h=N/A
-  case 0x39: break; // 39h=N/A
-  case 0x3a: break; // 3Ah=N/A
-  case 0x3b: break; // 3Bh=N/A   
-  case 0x3c: break; // 3Ch=N/A
-  case 0x3d: break; // 3Dh=N/A
-  case 0x3e: break; // 3Eh=N/A
-  case 0x3f: break; // 3Fh=N/A     
-
-  default:printf("error function 0x%02.x",function(cpu));
-    break;
+  case 0x00: return sll; // 00h=SLL
+  case 0x01: return nop; // 01h=N/A
+  case 0x02: return srl; // 02h=SRL
+  case 0x03: return sra; // 03h=SRA
+  case 0x04: return sllv; // 04h=SLLV
+  case 0x05: return nop; // 05h=N/A 
+  case 0x06: return srlv; // 06h=SRLV
+  case 0x07: return srav; // 07h=SRAV
+  case 0x08: return jr; // 08h=JR
+  case 0x09: return jalr; // 09h=JALR 
+  case 0x0a: return nop; // 0Ah=N/A  
+  case 0x0b: return nop; // 0Bh=N/A 
+  case 0x0c: return syscall; // 0Ch=SYSCALL
+  case 0x0d: return break_; // 0Dh=BREAK
+  case 0x0e: return nop; // 0Eh=N/A
+  case 0x0f: return nop; // 0Fh=N/A
+  case 0x10: return mfhi; // 10h=MFHI
+  case 0x11: return mthi; // 11h=MTHI 
+  case 0x12: return mflo; // 12h=MFLO
+  case 0x13: return mtlo; // 13h=MTLO
+  case 0x14: return nop; // 14h=N/A
+  case 0x15: return nop; // 15h=N/A
+  case 0x16: return nop; // 16h=N/A
+  case 0x17: return nop; // 17h=N/A
+  case 0x18: return mult; // 18h=MULT
+  case 0x19: return multu; // 19h=MULTU 
+  case 0x1a: return div_; // 1Ah=DIV
+  case 0x1b: return divu; // 1Bh=DIVU
+  case 0x1c: return nop; // 1Ch=N/A
+  case 0x1d: return nop; // 1Dh=N/A
+  case 0x1e: return nop; // 1Eh=N/A
+  case 0x1f: return nop; // 1Fh=N/A
+  case 0x20: return add; // 20h=ADD  
+  case 0x21: return addu; // 21h=ADDU 
+  case 0x22: return sub; // 22h=SUB  
+  case 0x23: return subu; // 23h=SUBU 
+  case 0x24: return and_; // 24h=AND  
+  case 0x25: return or_; // 25h=OR   
+  case 0x26: return xor_; // 26h=XOR  
+  case 0x27: return nor; // 27h=NOR  
+  case 0x28: return nop; // 28h=N/A  
+  case 0x29: return nop; // 29h=N/A  
+  case 0x2a: return slt; // 2Ah=SLT  
+  case 0x2b: return sltu; // 2Bh=SLTU 
+  case 0x2c: return nop; // 2Ch=N/A  
+  case 0x2d: return nop; // 2Dh=N/A  
+  case 0x2e: return nop; // 2Eh=N/A  
+  case 0x2f: return nop; // 2Fh=N/A  
+  case 0x30: return nop; // 30h=N/A  
+  case 0x31: return nop; // 31h=N/A
+  case 0x32: return nop; // 32h=N/A
+  case 0x33: return nop; // 33h=N/A
+  case 0x34: return nop; // 34h=N/A
+  case 0x35: return nop; // 35h=N/A
+  case 0x36: return nop; // 36h=N/A
+  case 0x37: return nop; // 37h=N/A      
+  case 0x38: return nop; // 38h=N/A
+  case 0x39: return nop; // 39h=N/A
+  case 0x3a: return nop; // 3Ah=N/A
+  case 0x3b: return nop; // 3Bh=N/A   
+  case 0x3c: return nop; // 3Ch=N/A
+  case 0x3d: return nop; // 3Dh=N/A
+  case 0x3e: return nop; // 3Eh=N/A
+  case 0x3f: return nop; // 3Fh=N/A     
+
+  default:printf("error function 0x%02x",opcode & 0x3f);
+    return nop;
   }
 }
 
+// Execute cpu->opcode without going through the decode cache
+void execute_cpu(R3000 *cpu)
+{
+  instruction instr;
+
+  decode_instr(&instr, cpu->opcode);
+
+  cpu->instr = &instr;
+
+  instr.handler(cpu);
+}
+
+void step_cpu(R3000 *cpu)
+{
+  cpu->cycles += fetch_cycles(cpu->pc, 1);
+
+  if (cpu->pc & 0x3)
+  {
+    cpu->pc_exception = cpu->pc;
+
+    cpu->branch_delay_slot_saved = cpu->delay_slot;
+
+    cpu->delay_slot = false;
+
+    load_update_badvaddr(cpu, cpu->pc);
+    return;
+  }
+
+  execute_instr(cpu, fetch_instruction(cpu->pc));
+}
+
+// Interrupts are taken between instructions: when the next one sits in a branch
+// delay slot EPC points back at the branch (see signalException).
+bool check_interrupt(R3000 *cpu)
+{
+  // CAUSE bit 10 follows I_STAT & I_MASK
+  if (irq_pending())
+    cpu->m_cop0_cause.interrupt_pending |= 0x04;
+  else
+    cpu->m_cop0_cause.interrupt_pending &= ~0x04;
+
+  if (!cpu->m_cop0_sr.interrupt_enable)
+    return false;
+
+  if (!(cpu->m_cop0_sr.interrupt_mask & cpu->m_cop0_cause.interrupt_pending))
+    return false;
+
+  cpu->branch_delay_slot_saved = cpu->delay_slot;
+
+  cpu->delay_slot = false;
+
+  signalException(cpu, Interrupt);
+
+  return true;
+}
+
 char *namereg(u8 index)
 {
   char *string = malloc(sizeof(char) * 100);
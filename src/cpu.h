@@ -2,6 +2,7 @@
  
 #include "typedef.h"
 #include "bus.h" 
+#include "gte.h"
 
 
 typedef struct 
@@ -83,6 +84,26 @@ enum COP0
   // cop0r32-r63 - N/A - None such (Control regs)
 };
 
+struct CPU;
+
+typedef void (*instr_handler)(struct CPU *cpu);
+
+// Predecoded instruction: the handler plus every field already extracted from the opcode
+typedef struct
+{
+  instr_handler handler;
+
+  u32 opcode; // raw opcode
+
+  s32 imm;    // 16-bit immediate, sign extended
+
+  u8 rs;      // register source index
+  u8 rt;      // register target index
+  u8 rd;      // register destination index
+  u8 shift;   // 5-bit shift amount
+
+}instruction;
+
 enum MODE
 {
   KERNEL = 0, // Kernel Mode
@@ -126,6 +147,8 @@ u32 hi,lo; // Multiply/divide results, may be changed by subroutines
 
 u32 opcode;
 
+const instruction *instr; // decoded form of opcode
+
 bool delay_slot;
 
 delay slot_next;
@@ -151,6 +174,10 @@ bool branch_delay_slot_saved;
 
 bool branch_taken_saved;
 
+u64 cycles; // CPU clock cycles elapsed since reset
+
+gte_state gte; // COP2
+
 
 }R3000;
 
@@ -188,9 +215,21 @@ char* namereg(u8 index);
 
 void reset_cpu(R3000 *cpu);
 
-void execute_cpu(R3000 *cpu);
+void step_cpu(R3000 *cpu); // fetch, execute and retire one instruction
+
+bool check_interrupt(R3000 *cpu); // take a pending interrupt, true when the exception was raised
+
+void execute_cpu(R3000 *cpu); // execute cpu->opcode without going through the decode cache
+
+void decode_instr(instruction *instr, u32 opcode);
+
+instr_handler decode_primary(u32 opcode);
+
+instr_handler decode_special(u32 opcode);
+
+instr_handler decode_cop0(u32 opcode);
 
-void special(R3000 *cpu);
+instr_handler decode_cop2(u32 opcode);
 
 u32 opcode(R3000 *cpu); // aka op prim
 
@@ -226,13 +265,13 @@ u32 target(R3000 *cpu); // aka imm26
 
 u32 gpr(R3000 *cpu, u8 index);
 
-u32 set_gpr(R3000 *cpu, u8 index,u8 v);
+u32 set_gpr(R3000 *cpu, u8 index,u32 v);
 
-u32 set_rs(R3000 *cpu,u8 value);
+u32 set_rs(R3000 *cpu,u32 value);
 
-u32 set_rt(R3000 *cpu,u8 value);
+u32 set_rt(R3000 *cpu,u32 value);
 
-u32 set_rd(R3000 *cpu,u8 value);
+u32 set_rd(R3000 *cpu,u32 value);
 
 
 void jump_addr(R3000 *cpu,u32 addr);
@@ -321,13 +360,16 @@ void break_(R3000 *cpu);  // Breakpoint
 
 
 // Table 3-19 Coprocessor Execute Instructions
-void cop0(R3000 *cpu);
 void mfc0(R3000 *cpu);
 void mtc0(R3000 *cpu);
 void rfe(R3000 *cpu);
 
 
 void cop2(R3000 *cpu); // Coprocessor Operation to Coprocessor 2
+void mfc2(R3000 *cpu); // Move From Coprocessor 2
+void cfc2(R3000 *cpu); // Move Control From Coprocessor 2
+void mtc2(R3000 *cpu); // Move To Coprocessor 2
+void ctc2(R3000 *cpu); // Move Control To Coprocessor 2
 
 
 // Table 3-20 Coprocessor Load and Store Instructions
@@ -355,3 +397,43 @@ HALFWORD           1      2 u8s (16 bits)
 u8               0      1 u8 (8 bits)
 
 */
+
+
+// Retire the load issued by the previous instruction and move the one issued by
+// the current instruction into its delay slot.
+static inline void retire_load(R3000 *cpu)
+{
+  // reg 0 when no load is pending
+  cpu->gpr_reg[cpu->slot_cur.reg] = cpu->slot_cur.cur;
+
+  cpu->gpr_reg[0] = 0x00000000;
+
+  cpu->slot_cur = cpu->slot_next;
+
+  cpu->slot_next.reg = 0;
+
+  cpu->slot_next.cur = 0;
+}
+
+// Execute one predecoded instruction at cpu->pc: advance the branch delay pipeline,
+// run the handler and retire the load issued by the previous instruction.
+static inline void execute_instr(R3000 *cpu, const instruction *instr)
+{
+  cpu->pc_exception = cpu->pc;
+
+  cpu->branch_delay_slot_saved = cpu->delay_slot;
+
+  cpu->delay_slot = false;
+
+  cpu->instr = instr;
+
+  cpu->opcode = instr->opcode;
+
+  cpu->pc = cpu->next_pc;
+
+  cpu->next_pc += 4;
+
+  instr->handler(cpu);
+
+  retire_load(cpu);
+}
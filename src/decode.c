@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "machine.h"
+
+// Physical address -> cache page, -1 when the region is not cached
+static inline s32 code_page_index(u32 addr)
+{
+  if (addr < RAM_SIZE_8MB)
+    return (addr & (RAM_SIZE_2MB - 1)) >> PAGE_SHIFT;
+
+  if (addr - BIOS_ADDR < BIOS_SIZE)
+    return CODE_RAM_PAGES + ((addr - BIOS_ADDR) >> PAGE_SHIFT);
+
+  return -1;
+}
+
+static code_page *alloc_page(decode_cache *dc)
+{
+  if (dc->free_count == 0)
+    return calloc(1, sizeof(code_page));
+
+  code_page *cp = dc->free_pages[--dc->free_count];
+
+  memset(cp, 0, sizeof(code_page));
+
+  return cp;
+}
+
+static void retire_page(decode_cache *dc, s32 page)
+{
+  dc->free_pages[dc->free_count++] = dc->pages[page];
+
+  dc->pages[page] = NULL;
+
+  if (page < CODE_RAM_PAGES)
+    dc->code_bitmap[page >> 5] &= ~(1u << (page & 31));
+}
+
+code_page *fetch_code_page(u32 addr)
+{
+  decode_cache *dc = &psx->decode;
+
+  const s32 page = code_page_index(addr);
+
+  if (page < 0)
+    return NULL;
+
+  code_page *cp = dc->pages[page];
+
+  if (!cp)
+  {
+    if (page < CODE_RAM_PAGES && (dc->thrash_bitmap[page >> 5] >> (page & 31)) & 1)
+    {
+      if (sched_now() < dc->thrash_until[page])
+        return NULL;
+
+      dc->thrash_bitmap[page >> 5] &= ~(1u << (page & 31));
+      dc->strikes[page] = 0;
+    }
+
+    cp = alloc_page(dc);
+
+    dc->pages[page] = cp;
+
+    if (page < CODE_RAM_PAGES)
+    {
+      dc->code_bitmap[page >> 5] |= 1u << (page & 31);
+      dc->cached_at[page] = sched_now();
+
+      protect_code_page(addr, true);
+    }
+  }
+
+  return cp;
+}
+
+const instruction *fetch_instruction(u32 pc)
+{
+  decode_cache *dc = &psx->decode;
+
+  code_page *cp = fetch_code_page(region_memory(pc));
+
+  if (!cp)
+  {
+    decode_instr(&dc->uncached, peek32(pc));
+
+    return &dc->uncached;
+  }
+
+  instruction *instr = &cp->instrs[(pc & PAGE_MASK) >> 2];
+
+  if (!instr->handler)
+    decode_instr(instr, peek32(pc));
+
+  return instr;
+}
+
+bool is_code_page(u32 addr)
+{
+  const u32 page = (addr & (RAM_SIZE_2MB - 1)) >> PAGE_SHIFT;
+
+  return (psx->decode.code_bitmap[page >> 5] >> (page & 31)) & 1;
+}
+
+void invalidate_code_page(u32 addr)
+{
+  decode_cache *dc = &psx->decode;
+
+  const s32 page = code_page_index(addr & (RAM_SIZE_2MB - 1));
+
+  if (!dc->pages[page])
+    return;
+
+  retire_page(dc, page);
+
+  protect_code_page(addr, false);
+
+  const u64 now = sched_now();
+
+  if (now - dc->cached_at[page] < THRASH_WINDOW)
+  {
+    if (++dc->strikes[page] >= THRASH_LIMIT)
+    {
+      dc->thrash_bitmap[page >> 5] |= 1u << (page & 31);
+      dc->thrash_until[page] = now + THRASH_DECAY;
+    }
+  }
+  else
+  {
+    dc->strikes[page] = 0;
+  }
+}
+
+void invalidate_code_range(u32 addr, u32 size)
+{
+  decode_cache *dc = &psx->decode;
+
+  if (!size)
+    return;
+
+  const u32 first = (addr & (RAM_SIZE_2MB - 1)) >> PAGE_SHIFT;
+
+  u32 count = ((addr & PAGE_MASK) + size + PAGE_MASK) >> PAGE_SHIFT;
+
+  if (count > CODE_RAM_PAGES)
+    count = CODE_RAM_PAGES;
+
+  for (u32 i = 0; i < count; i++)
+  {
+    const u32 page = (first + i) & (CODE_RAM_PAGES - 1);
+
+    // no code in the rest of these 32 pages
+    if (!dc->code_bitmap[page >> 5])
+    {
+      i += 31 - (page & 31);
+      continue;
+    }
+
+    if ((dc->code_bitmap[page >> 5] >> (page & 31)) & 1)
+      invalidate_code_page(page << PAGE_SHIFT);
+  }
+}
+
+void flush_decode_cache(void)
+{
+  decode_cache *dc = &psx->decode;
+
+  for (s32 page = 0; page < CODE_PAGE_COUNT; page++)
+  {
+    if (!dc->pages[page])
+      continue;
+
+    if (page < CODE_RAM_PAGES)
+      protect_code_page(page << PAGE_SHIFT, false);
+
+    retire_page(dc, page);
+  }
+
+  memset(dc->thrash_bitmap, 0, sizeof(dc->thrash_bitmap));
+  memset(dc->strikes, 0, sizeof(dc->strikes));
+}
+
+void free_decode_cache(void)
+{
+  decode_cache *dc = &psx->decode;
+
+  flush_decode_cache();
+
+  while (dc->free_count)
+    free(dc->free_pages[--dc->free_count]);
+}
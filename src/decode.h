@@ -0,0 +1,74 @@
+#pragma once
+#include "cpu.h"
+
+// Predecoded instruction cache
+// Instructions are decoded once (see decode_instr) and kept per 4 KByte page of
+// physical RAM / BIOS, so mirrors and kseg0/kseg1 aliases share the same entries.
+// RAM pages holding decoded instructions are write protected on the bus
+// (protect_code_page): the first store into one drops the whole page. They are also
+// marked in code_bitmap, which range writes that bypass the bus (DMA) test instead.
+//
+// A RAM page dropped THRASH_LIMIT times in a row, each time less than THRASH_WINDOW
+// cycles after it was cached, is rewritten faster than it is worth caching (data sharing
+// a page with code, self-modifying loops): it stays uncached, every fetch decodes from
+// RAM, for THRASH_DECAY cycles and is then cached again with no strikes. A page that
+// lived longer (an overlay loaded once it has run for a while) clears its strikes.
+
+#define CODE_RAM_PAGES    (0x200000 >> PAGE_SHIFT)  // 2 MBytes RAM
+#define CODE_BIOS_PAGES   (0x80000 >> PAGE_SHIFT)   // 512 KBytes BIOS
+#define CODE_PAGE_COUNT   (CODE_RAM_PAGES + CODE_BIOS_PAGES)
+#define PAGE_INSTRUCTIONS (PAGE_SIZE / 4)
+
+#define THRASH_LIMIT  8
+#define THRASH_WINDOW 20000   // cycles between caching the page and dropping it
+#define THRASH_DECAY  1000000 // cycles left uncached (about two frames)
+
+// Basic block starting at an instruction of the page (see block.c)
+typedef struct
+{
+  u16 count;  // instructions in the block, 0 = not discovered yet
+
+  void *code; // native code of the block (see rec.h), NULL = not translated
+}block;
+
+typedef struct
+{
+  instruction instrs[PAGE_INSTRUCTIONS];
+
+  block blocks[PAGE_INSTRUCTIONS];
+
+}code_page;
+
+typedef struct
+{
+  code_page *pages[CODE_PAGE_COUNT];
+
+  // Pages dropped by a store are recycled instead of freed: the store may come from
+  // an instruction of the same page that is still executing.
+  code_page *free_pages[CODE_PAGE_COUNT];
+  u32 free_count;
+
+  instruction uncached; // fetch outside RAM / BIOS and from thrashing pages
+
+  u32 code_bitmap[CODE_RAM_PAGES / 32]; // RAM pages with decoded instructions
+
+  // Thrash detection (RAM pages only)
+  u32 thrash_bitmap[CODE_RAM_PAGES / 32]; // pages left uncached
+  u64 cached_at[CODE_RAM_PAGES];          // cycle the page was last cached
+  u64 thrash_until[CODE_RAM_PAGES];       // cycle an uncached page is cached again
+  u8 strikes[CODE_RAM_PAGES];
+}decode_cache;
+
+code_page *fetch_code_page(u32 addr); // physical address, NULL when the region is not cached
+
+const instruction *fetch_instruction(u32 pc);
+
+bool is_code_page(u32 addr); // physical RAM address
+
+void invalidate_code_page(u32 addr); // physical RAM address, gives the page its fast path back
+
+void invalidate_code_range(u32 addr, u32 size); // physical RAM range, wraps inside the 2 MBytes
+
+void flush_decode_cache(void);
+
+void free_decode_cache(void); // flush and release the page memory
@@ -0,0 +1,235 @@
+#pragma once
+#include "typedef.h"
+
+// Minimal AArch64 instruction encoder used by the recompiler.
+// Only the forms the recompiler needs: 32-bit ALU on registers, [base + scaled imm12]
+// memory operands, pc relative branches and absolute calls through x16.
+
+enum ARM64_REG
+{
+  ARM64_FP = 29, ARM64_LR = 30,
+  ARM64_ZR = 31, // wzr / xzr in ALU operands
+  ARM64_SP = 31, // sp as a base register and in ADD / SUB (immediate)
+};
+
+enum ARM64_COND
+{
+  A64_EQ = 0x0, A64_NE = 0x1, A64_HS = 0x2, A64_LO = 0x3, A64_VS = 0x6, A64_VC = 0x7,
+  A64_GE = 0xa, A64_LT = 0xb, A64_GT = 0xc, A64_LE = 0xd,
+};
+
+// Data processing (register), 32-bit: op Wd, Wn, Wm
+enum ARM64_ALU
+{
+  A64_ADD  = 0x0b000000, A64_SUB  = 0x4b000000, A64_ADDS = 0x2b000000, A64_SUBS = 0x6b000000,
+  A64_AND  = 0x0a000000, A64_ORR  = 0x2a000000, A64_EOR  = 0x4a000000, A64_ORN  = 0x2a200000,
+  A64_ANDS = 0x6a000000,
+  A64_LSLV = 0x1ac02000, A64_LSRV = 0x1ac02400, A64_ASRV = 0x1ac02800,
+};
+
+typedef struct
+{
+  u32 *start;
+  u32 *ptr;
+  u32 *end;
+} arm64_code;
+
+static inline void a64_emit(arm64_code *c, u32 instr)
+{
+  *c->ptr++ = instr;
+}
+
+static inline void a64_alu(arm64_code *c, u32 op, u8 d, u8 n, u8 m)
+{
+  a64_emit(c, op | (m << 16) | (n << 5) | d);
+}
+
+// cmp Wn, Wm
+static inline void a64_cmp(arm64_code *c, u8 n, u8 m)
+{
+  a64_alu(c, A64_SUBS, ARM64_ZR, n, m);
+}
+
+// mov Wd, Wm
+static inline void a64_mov(arm64_code *c, u8 d, u8 m)
+{
+  if (d != m)
+    a64_alu(c, A64_ORR, d, ARM64_ZR, m);
+}
+
+// mov Xd, Xm
+static inline void a64_mov64(arm64_code *c, u8 d, u8 m)
+{
+  a64_emit(c, 0xaa0003e0 | (m << 16) | d);
+}
+
+// mov Wd, #imm32 (movz + movk)
+static inline void a64_mov_imm(arm64_code *c, u8 d, u32 imm)
+{
+  if ((imm & 0xffff) || !imm)
+  {
+    a64_emit(c, 0x52800000 | ((imm & 0xffff) << 5) | d);            // movz Wd, #lo
+
+    if (imm >> 16)
+      a64_emit(c, 0x72a00000 | ((imm >> 16) << 5) | d);             // movk Wd, #hi, lsl #16
+  }
+  else
+  {
+    a64_emit(c, 0x52a00000 | ((imm >> 16) << 5) | d);               // movz Wd, #hi, lsl #16
+  }
+}
+
+// mov Xd, #imm64 (movz + movk)
+static inline void a64_mov_imm64(arm64_code *c, u8 d, u64 imm)
+{
+  a64_emit(c, 0xd2800000 | ((imm & 0xffff) << 5) | d);              // movz Xd, #imm16
+
+  for (u32 hw = 1; hw < 4; hw++)
+  {
+    const u32 part = (imm >> (hw * 16)) & 0xffff;
+
+    if (part)
+      a64_emit(c, 0xf2800000 | (hw << 21) | (part << 5) | d);       // movk Xd, #imm16, lsl #(hw * 16)
+  }
+}
+
+// add Wd, Wn, #imm12
+static inline void a64_add_imm(arm64_code *c, u8 d, u8 n, u32 imm)
+{
+  assert(imm < 4096);
+
+  a64_emit(c, 0x11000000 | (imm << 10) | (n << 5) | d);
+}
+
+// add / sub Xd|sp, Xn|sp, #imm12
+static inline void a64_add_imm64(arm64_code *c, u8 d, u8 n, s32 imm)
+{
+  assert(imm > -4096 && imm < 4096);
+
+  a64_emit(c, (imm < 0 ? 0xd1000000 : 0x91000000) | ((imm < 0 ? -imm : imm) << 10) | (n << 5) | d);
+}
+
+// ldr Wt, [Xn|sp, #offset]
+static inline void a64_load(arm64_code *c, u8 t, u8 n, u32 offset)
+{
+  assert(!(offset & 3) && offset < 16384);
+
+  a64_emit(c, 0xb9400000 | ((offset / 4) << 10) | (n << 5) | t);
+}
+
+// str Wt, [Xn|sp, #offset]
+static inline void a64_store(arm64_code *c, u8 t, u8 n, u32 offset)
+{
+  assert(!(offset & 3) && offset < 16384);
+
+  a64_emit(c, 0xb9000000 | ((offset / 4) << 10) | (n << 5) | t);
+}
+
+// str Xt, [Xn|sp, #offset]
+static inline void a64_store64(arm64_code *c, u8 t, u8 n, u32 offset)
+{
+  assert(!(offset & 7) && offset < 32768);
+
+  a64_emit(c, 0xf9000000 | ((offset / 8) << 10) | (n << 5) | t);
+}
+
+// strb Wt, [Xn|sp, #offset]
+static inline void a64_store8(arm64_code *c, u8 t, u8 n, u32 offset)
+{
+  assert(offset < 4096);
+
+  a64_emit(c, 0x39000000 | (offset << 10) | (n << 5) | t);
+}
+
+// str Wt, [Xn, Xm, lsl #2]
+static inline void a64_store_index(arm64_code *c, u8 t, u8 n, u8 m)
+{
+  a64_emit(c, 0xb8207800 | (m << 16) | (n << 5) | t);
+}
+
+// stp Xt1, Xt2, [sp, #offset]! / [sp, #offset]
+static inline void a64_stp(arm64_code *c, u8 t1, u8 t2, s32 offset, bool pre_index)
+{
+  a64_emit(c, (pre_index ? 0xa9800000 : 0xa9000000) | (((offset / 8) & 0x7f) << 15) | (t2 << 10) | (ARM64_SP << 5) | t1);
+}
+
+// ldp Xt1, Xt2, [sp], #offset / [sp, #offset]
+static inline void a64_ldp(arm64_code *c, u8 t1, u8 t2, s32 offset, bool post_index)
+{
+  a64_emit(c, (post_index ? 0xa8c00000 : 0xa9400000) | (((offset / 8) & 0x7f) << 15) | (t2 << 10) | (ARM64_SP << 5) | t1);
+}
+
+// csel Wd, Wn, Wm, cond
+static inline void a64_csel(arm64_code *c, u8 d, u8 n, u8 m, u8 cond)
+{
+  a64_emit(c, 0x1a800000 | (m << 16) | (cond << 12) | (n << 5) | d);
+}
+
+// cset Wd, cond (csinc Wd, wzr, wzr, !cond)
+static inline void a64_cset(arm64_code *c, u8 d, u8 cond)
+{
+  a64_emit(c, 0x1a800400 | (ARM64_ZR << 16) | ((cond ^ 1) << 12) | (ARM64_ZR << 5) | d);
+}
+
+// smull / umull Xd, Wn, Wm
+static inline void a64_mull(arm64_code *c, u8 d, u8 n, u8 m, bool sign)
+{
+  a64_emit(c, (sign ? 0x9b207c00 : 0x9ba07c00) | (m << 16) | (n << 5) | d);
+}
+
+// lsr Xd, Xn, #32
+static inline void a64_high32(arm64_code *c, u8 d, u8 n)
+{
+  a64_emit(c, 0xd360fc00 | (n << 5) | d);
+}
+
+// sxtb / sxth / uxtb / uxth Wd, Wn
+static inline void a64_extend(arm64_code *c, u8 d, u8 n, bool sign, bool half)
+{
+  a64_emit(c, (sign ? 0x13000000 : 0x53000000) | (half ? 0x3c00 : 0x1c00) | (n << 5) | d);
+}
+
+// blr Xn
+static inline void a64_call_reg(arm64_code *c, u8 n)
+{
+  a64_emit(c, 0xd63f0000 | (n << 5));
+}
+
+// call an absolute address through x16
+static inline void a64_call(arm64_code *c, const void *func)
+{
+  a64_mov_imm64(c, 16, (u64)func);
+  a64_call_reg(c, 16);
+}
+
+static inline void a64_ret(arm64_code *c)
+{
+  a64_emit(c, 0xd65f03c0);
+}
+
+// b.cond, returns the instruction to patch
+static inline u32 *a64_bcond(arm64_code *c, u8 cond)
+{
+  a64_emit(c, 0x54000000 | cond);
+
+  return c->ptr - 1;
+}
+
+// b, returns the instruction to patch
+static inline u32 *a64_b(arm64_code *c)
+{
+  a64_emit(c, 0x14000000);
+
+  return c->ptr - 1;
+}
+
+// Point a b / b.cond at the current position
+static inline void a64_patch_here(arm64_code *c, u32 *at)
+{
+  const s32 offset = (s32)(c->ptr - at);
+
+  if ((*at & 0xfc000000) == 0x14000000)
+    *at |= offset & 0x3ffffff;
+  else
+    *at |= (offset & 0x7ffff) << 5;
+}
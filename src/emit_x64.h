@@ -0,0 +1,381 @@
+#pragma once
+#include "typedef.h"
+
+// Minimal x86-64 instruction encoder used by the recompiler.
+// Only the forms the recompiler needs: 32-bit ALU on registers, [base + disp32]
+// memory operands, rel32 branches and absolute calls through rax.
+
+enum X64_REG
+{
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R8  = 8, R9  = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+};
+
+enum X64_COND
+{
+  CC_O = 0x0, CC_NO = 0x1, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+  CC_S = 0x8, CC_NS = 0x9, CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf,
+};
+
+// Group 1 ALU operations (/digit of 81h, the reg <- r/m form is opcode digit * 8 + 3)
+enum X64_ALU
+{
+  ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7,
+};
+
+// Group 2 shifts (/digit of C1h / D3h)
+enum X64_SHIFT
+{
+  SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7,
+};
+
+typedef struct
+{
+  u8 *start;
+  u8 *ptr;
+  u8 *end;
+} x64_code;
+
+static inline void emit8(x64_code *c, u8 value)
+{
+  *c->ptr++ = value;
+}
+
+static inline void emit32(x64_code *c, u32 value)
+{
+  emit8(c, value);
+  emit8(c, value >> 8);
+  emit8(c, value >> 16);
+  emit8(c, value >> 24);
+}
+
+static inline void emit64(x64_code *c, u64 value)
+{
+  emit32(c, (u32)value);
+  emit32(c, (u32)(value >> 32));
+}
+
+static inline void emit_rex(x64_code *c, bool w, u8 reg, u8 index, u8 base, bool force)
+{
+  const u8 rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+
+  if (rex != 0x40 || force)
+    emit8(c, rex);
+}
+
+// ModRM for reg, [base + disp32]
+static inline void emit_modrm_mem(x64_code *c, u8 reg, u8 base, s32 disp)
+{
+  emit8(c, 0x80 | ((reg & 7) << 3) | (base & 7));
+
+  if ((base & 7) == RSP)
+    emit8(c, 0x24); // SIB: no index, base = rsp/r12
+
+  emit32(c, disp);
+}
+
+// ModRM + SIB for reg, [base + index * 4 + disp32]
+static inline void emit_modrm_index(x64_code *c, u8 reg, u8 base, u8 index, s32 disp)
+{
+  emit8(c, 0x84 | ((reg & 7) << 3));
+  emit8(c, 0x80 | ((index & 7) << 3) | (base & 7));
+  emit32(c, disp);
+}
+
+static inline void emit_modrm_reg(x64_code *c, u8 reg, u8 rm)
+{
+  emit8(c, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op r32, r/m32 (register form), op is the reg <- r/m opcode
+static inline void emit_op_rr(x64_code *c, u8 op, u8 dst, u8 src)
+{
+  emit_rex(c, false, dst, 0, src, false);
+  emit8(c, op);
+  emit_modrm_reg(c, dst, src);
+}
+
+static inline void emit_op_rm(x64_code *c, u8 op, bool w, u8 reg, u8 base, s32 disp)
+{
+  emit_rex(c, w, reg, 0, base, false);
+  emit8(c, op);
+  emit_modrm_mem(c, reg, base, disp);
+}
+
+// mov r32, r32
+static inline void emit_mov_rr(x64_code *c, u8 dst, u8 src)
+{
+  if (dst != src)
+    emit_op_rr(c, 0x8b, dst, src);
+}
+
+// mov r64, r64
+static inline void emit_mov_rr64(x64_code *c, u8 dst, u8 src)
+{
+  emit_rex(c, true, dst, 0, src, false);
+  emit8(c, 0x8b);
+  emit_modrm_reg(c, dst, src);
+}
+
+// mov r32, imm32
+static inline void emit_mov_ri(x64_code *c, u8 dst, u32 imm)
+{
+  if (imm == 0)
+  {
+    emit_op_rr(c, 0x33, dst, dst); // xor r32, r32
+    return;
+  }
+
+  emit_rex(c, false, 0, 0, dst, false);
+  emit8(c, 0xb8 + (dst & 7));
+  emit32(c, imm);
+}
+
+// mov r64, imm64
+static inline void emit_mov_ri64(x64_code *c, u8 dst, u64 imm)
+{
+  emit_rex(c, true, 0, 0, dst, false);
+  emit8(c, 0xb8 + (dst & 7));
+  emit64(c, imm);
+}
+
+// mov r32, [base + disp32]
+static inline void emit_load(x64_code *c, u8 dst, u8 base, s32 disp)
+{
+  emit_op_rm(c, 0x8b, false, dst, base, disp);
+}
+
+// mov [base + disp32], r32
+static inline void emit_store(x64_code *c, u8 base, s32 disp, u8 src)
+{
+  emit_op_rm(c, 0x89, false, src, base, disp);
+}
+
+// mov byte [base + disp32], r8
+static inline void emit_store8(x64_code *c, u8 base, s32 disp, u8 src)
+{
+  emit_rex(c, false, src, 0, base, src >= RSP);
+  emit8(c, 0x88);
+  emit_modrm_mem(c, src, base, disp);
+}
+
+// mov r64, [base + disp32]
+static inline void emit_load64(x64_code *c, u8 dst, u8 base, s32 disp)
+{
+  emit_op_rm(c, 0x8b, true, dst, base, disp);
+}
+
+// mov [base + disp32], r64
+static inline void emit_store64(x64_code *c, u8 base, s32 disp, u8 src)
+{
+  emit_op_rm(c, 0x89, true, src, base, disp);
+}
+
+// mov dword [base + disp32], imm32
+static inline void emit_store_imm(x64_code *c, u8 base, s32 disp, u32 imm)
+{
+  emit_rex(c, false, 0, 0, base, false);
+  emit8(c, 0xc7);
+  emit_modrm_mem(c, 0, base, disp);
+  emit32(c, imm);
+}
+
+// mov byte [base + disp32], imm8
+static inline void emit_store8_imm(x64_code *c, u8 base, s32 disp, u8 imm)
+{
+  emit_rex(c, false, 0, 0, base, false);
+  emit8(c, 0xc6);
+  emit_modrm_mem(c, 0, base, disp);
+  emit8(c, imm);
+}
+
+// alu r32, r32
+static inline void emit_alu_rr(x64_code *c, u8 alu, u8 dst, u8 src)
+{
+  emit_op_rr(c, alu * 8 + 3, dst, src);
+}
+
+// alu r32, imm32
+static inline void emit_alu_ri(x64_code *c, u8 alu, u8 dst, u32 imm)
+{
+  emit_rex(c, false, 0, 0, dst, false);
+
+  if ((s32)imm == (s8)imm)
+  {
+    emit8(c, 0x83);
+    emit_modrm_reg(c, alu, dst);
+    emit8(c, imm);
+  }
+  else
+  {
+    emit8(c, 0x81);
+    emit_modrm_reg(c, alu, dst);
+    emit32(c, imm);
+  }
+}
+
+// alu r32, [base + disp32]
+static inline void emit_alu_rm(x64_code *c, u8 alu, u8 dst, u8 base, s32 disp)
+{
+  emit_op_rm(c, alu * 8 + 3, false, dst, base, disp);
+}
+
+// alu r32, [base + index * 4 + disp32]
+static inline void emit_alu_rm_index(x64_code *c, u8 alu, u8 dst, u8 base, u8 index, s32 disp)
+{
+  emit_rex(c, false, dst, index, base, false);
+  emit8(c, alu * 8 + 3);
+  emit_modrm_index(c, dst, base, index, disp);
+}
+
+// mov [base + index * 4 + disp32], r32
+static inline void emit_store_index(x64_code *c, u8 base, u8 index, s32 disp, u8 src)
+{
+  emit_rex(c, false, src, index, base, false);
+  emit8(c, 0x89);
+  emit_modrm_index(c, src, base, index, disp);
+}
+
+// test r32, r32
+static inline void emit_test_rr(x64_code *c, u8 a, u8 b)
+{
+  emit_op_rr(c, 0x85, b, a);
+}
+
+// test r32, imm32
+static inline void emit_test_ri(x64_code *c, u8 dst, u32 imm)
+{
+  emit_rex(c, false, 0, 0, dst, false);
+  emit8(c, 0xf7);
+  emit_modrm_reg(c, 0, dst);
+  emit32(c, imm);
+}
+
+// not r32
+static inline void emit_not(x64_code *c, u8 dst)
+{
+  emit_rex(c, false, 0, 0, dst, false);
+  emit8(c, 0xf7);
+  emit_modrm_reg(c, 2, dst);
+}
+
+// shift r32, imm8
+static inline void emit_shift_ri(x64_code *c, u8 shift, u8 dst, u8 imm)
+{
+  emit_rex(c, false, 0, 0, dst, false);
+  emit8(c, 0xc1);
+  emit_modrm_reg(c, shift, dst);
+  emit8(c, imm);
+}
+
+// shift r32, cl
+static inline void emit_shift_rcl(x64_code *c, u8 shift, u8 dst)
+{
+  emit_rex(c, false, 0, 0, dst, false);
+  emit8(c, 0xd3);
+  emit_modrm_reg(c, shift, dst);
+}
+
+// setcc r8 + movzx r32, r8
+static inline void emit_setcc(x64_code *c, u8 cond, u8 dst)
+{
+  emit_rex(c, false, 0, 0, dst, dst >= RSP);
+  emit8(c, 0x0f);
+  emit8(c, 0x90 + cond);
+  emit_modrm_reg(c, 0, dst);
+
+  emit_rex(c, false, dst, 0, dst, dst >= RSP);
+  emit8(c, 0x0f);
+  emit8(c, 0xb6);
+  emit_modrm_reg(c, dst, dst);
+}
+
+// cmovcc r32, r32
+static inline void emit_cmov(x64_code *c, u8 cond, u8 dst, u8 src)
+{
+  emit_rex(c, false, dst, 0, src, false);
+  emit8(c, 0x0f);
+  emit8(c, 0x40 + cond);
+  emit_modrm_reg(c, dst, src);
+}
+
+// mul / imul r32 (edx:eax = eax * src)
+static inline void emit_mul(x64_code *c, u8 src, bool sign)
+{
+  emit_rex(c, false, 0, 0, src, false);
+  emit8(c, 0xf7);
+  emit_modrm_reg(c, sign ? 5 : 4, src);
+}
+
+// movsx/movzx r32, r8/r16
+static inline void emit_extend(x64_code *c, u8 dst, u8 src, bool sign, bool half)
+{
+  emit_rex(c, false, dst, 0, src, !half && src >= RSP);
+  emit8(c, 0x0f);
+  emit8(c, (sign ? 0xbe : 0xb6) + half);
+  emit_modrm_reg(c, dst, src);
+}
+
+static inline void emit_push(x64_code *c, u8 reg)
+{
+  emit_rex(c, false, 0, 0, reg, false);
+  emit8(c, 0x50 + (reg & 7));
+}
+
+static inline void emit_pop(x64_code *c, u8 reg)
+{
+  emit_rex(c, false, 0, 0, reg, false);
+  emit8(c, 0x58 + (reg & 7));
+}
+
+// add/sub rsp, imm32
+static inline void emit_rsp_adjust(x64_code *c, s32 value)
+{
+  emit8(c, 0x48);
+  emit8(c, 0x81);
+  emit_modrm_reg(c, value < 0 ? ALU_SUB : ALU_ADD, RSP);
+  emit32(c, value < 0 ? -value : value);
+}
+
+static inline void emit_ret(x64_code *c)
+{
+  emit8(c, 0xc3);
+}
+
+// call an absolute address through rax
+static inline void emit_call(x64_code *c, const void *func)
+{
+  emit_mov_ri64(c, RAX, (u64)func);
+  emit8(c, 0xff);
+  emit_modrm_reg(c, 2, RAX);
+}
+
+// jcc rel32, returns the rel32 field to patch
+static inline u8 *emit_jcc(x64_code *c, u8 cond)
+{
+  emit8(c, 0x0f);
+  emit8(c, 0x80 + cond);
+  emit32(c, 0);
+
+  return c->ptr - 4;
+}
+
+// jmp rel32, returns the rel32 field to patch
+static inline u8 *emit_jmp(x64_code *c)
+{
+  emit8(c, 0xe9);
+  emit32(c, 0);
+
+  return c->ptr - 4;
+}
+
+// Point a rel32 field at the current position
+static inline void patch_here(x64_code *c, u8 *rel)
+{
+  const s32 offset = (s32)(c->ptr - (rel + 4));
+
+  rel[0] = offset;
+  rel[1] = offset >> 8;
+  rel[2] = offset >> 16;
+  rel[3] = offset >> 24;
+}
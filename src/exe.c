@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exe.h"
+#include "machine.h"
+
+static inline u32 word(const u8 *data, u32 offset)
+{
+  u32 value;
+  memcpy(&value, data + offset, sizeof(value));
+  return value;
+}
+
+bool parse_exe(const u8 *data, u32 size, exe_header *header)
+{
+  if (size < EXE_HEADER_SIZE || memcmp(data, "PS-X EXE", 8) != 0)
+    return false;
+
+  header->pc        = word(data, 0x10);
+  header->gp        = word(data, 0x14);
+  header->addr      = word(data, 0x18);
+  header->size      = word(data, 0x1c);
+  header->bss_addr  = word(data, 0x28);
+  header->bss_size  = word(data, 0x2c);
+  header->sp_base   = word(data, 0x30);
+  header->sp_offset = word(data, 0x34);
+
+  // some tools pad the header only: load what the file has
+  if (header->size > size - EXE_HEADER_SIZE)
+    header->size = size - EXE_HEADER_SIZE;
+
+  return header->size <= RAM_SIZE_2MB && header->bss_size <= RAM_SIZE_2MB;
+}
+
+bool load_exe(R3000 *cpu, const u8 *data, u32 size)
+{
+  exe_header header;
+
+  if (!parse_exe(data, size, &header))
+    return false;
+
+  dma_write_ram(region_memory(header.addr), data + EXE_HEADER_SIZE, header.size);
+
+  if (header.bss_size)
+  {
+    u8 *zero = calloc(1, header.bss_size);
+
+    if (!zero)
+      return false;
+
+    dma_write_ram(region_memory(header.bss_addr), zero, header.bss_size);
+
+    free(zero);
+  }
+
+  set_gpr(cpu, 28, header.gp);
+
+  if (header.sp_base)
+  {
+    set_gpr(cpu, 29, header.sp_base + header.sp_offset);
+    set_gpr(cpu, 30, header.sp_base + header.sp_offset);
+  }
+
+  // start clean: no pending load or branch from the code that was running
+  cpu->slot_cur = (delay){ 0 };
+  cpu->slot_next = (delay){ 0 };
+  cpu->delay_slot = false;
+
+  // without a BIOS nobody enabled the instruction cache
+  if (!psx->bus.bios)
+    psx->bus.cache.control = CACHE_CONTROL_KERNEL;
+
+  set_pc(cpu, header.pc);
+
+  return true;
+}
+
+u8 *read_exe(const char *path, u32 *size)
+{
+  FILE *file = fopen(path, "rb");
+
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+
+  const long length = ftell(file);
+
+  fseek(file, 0, SEEK_SET);
+
+  exe_header header;
+
+  u8 *data = (length > 0) ? malloc(length) : NULL;
+
+  if (data && (fread(data, 1, length, file) != (size_t)length || !parse_exe(data, length, &header)))
+  {
+    free(data);
+    data = NULL;
+  }
+
+  fclose(file);
+
+  *size = length;
+
+  return data;
+}
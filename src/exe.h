@@ -0,0 +1,42 @@
+#pragma once
+#include "cpu.h"
+
+// PS-X EXE loader
+// 000h-007h ASCII ID "PS-X EXE"
+// 010h      Initial PC
+// 014h      Initial GP/R28
+// 018h      Destination Address in RAM
+// 01Ch      Filesize (must be N*800h) (excluding 800h-byte header)
+// 028h      Memfill Start Address (BSS, zerofilled when size is nonzero)
+// 02Ch      Memfill Size in bytes
+// 030h      Initial SP/R29 & FP/R30 Base (used when nonzero)
+// 034h      Initial SP/R29 & FP/R30 Offset, added to above Base
+// 800h      Code/Data (loaded to the destination address and up)
+//
+// The payload goes straight into RAM through dma_write_ram() (decoded pages it covers
+// are dropped) and the registers are set like the BIOS Exec function would. Load at
+// the shell entry (see boot.h) to keep the BIOS kernel, or into a machine at reset to
+// run without any BIOS.
+
+#define EXE_HEADER_SIZE 0x800
+
+typedef struct
+{
+  u32 pc;
+  u32 gp;
+  u32 addr;      // destination
+  u32 size;
+  u32 bss_addr;
+  u32 bss_size;
+  u32 sp_base;
+  u32 sp_offset;
+}exe_header;
+
+// Parse the header of an image of size bytes, false when it is not a PS-X EXE
+bool parse_exe(const u8 *data, u32 size, exe_header *header);
+
+// Copy the image into the RAM of the bound machine and start the cpu at its entry
+bool load_exe(R3000 *cpu, const u8 *data, u32 size);
+
+// Read a PS-X EXE file (malloc'd, shared by every machine that loads it), NULL when it is not one
+u8 *read_exe(const char *path, u32 *size);
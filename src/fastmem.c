@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "fastmem.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <pthread.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static struct sigaction old_action;
+
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+
+static bool handler_installed;
+
+// Host instructions emitted by the fastmem_read/write helpers
+typedef struct
+{
+  u8 code[4];
+  u8 length;
+  u8 size;
+  bool write;
+} fastmem_access;
+
+static const fastmem_access accesses[] =
+{
+  { { 0x0F, 0xB6, 0x04, 0x11 }, 4, 1, false }, // movzbl (%rcx,%rdx), %eax
+  { { 0x0F, 0xB7, 0x04, 0x11 }, 4, 2, false }, // movzwl (%rcx,%rdx), %eax
+  { { 0x8B, 0x04, 0x11 },       3, 4, false }, // movl   (%rcx,%rdx), %eax
+  { { 0x88, 0x04, 0x11 },       3, 1, true  }, // movb   %al, (%rcx,%rdx)
+  { { 0x66, 0x89, 0x04, 0x11 }, 4, 2, true  }, // movw   %ax, (%rcx,%rdx)
+  { { 0x89, 0x04, 0x11 },       3, 4, true  }, // movl   %eax, (%rcx,%rdx)
+};
+
+static void fastmem_handler(int sig, siginfo_t *info, void *context)
+{
+  ucontext_t *uc = (ucontext_t *)context;
+  greg_t *gregs = uc->uc_mcontext.gregs;
+
+  const u8 *fault = (const u8 *)info->si_addr;
+  const u8 *rip = (const u8 *)gregs[REG_RIP];
+
+  // the reservation of the machine running on the faulting thread
+  const u8 *base = bus_fastmem();
+
+  if (base && fault >= base && fault < base + FASTMEM_RESERVE_SIZE && (u8 *)gregs[REG_RCX] == base)
+  {
+    for (u32 i = 0; i < sizeof(accesses) / sizeof(accesses[0]); i++)
+    {
+      const fastmem_access *access = &accesses[i];
+
+      if (memcmp(rip, access->code, access->length) != 0)
+        continue;
+
+      const u32 addr = (u32)gregs[REG_RDX];
+      const u32 mask = 0xFFFFFFFF >> (32 - access->size * 8);
+
+      if (access->write)
+        io_write(addr, (u32)gregs[REG_RAX] & mask, access->size);
+      else
+        gregs[REG_RAX] = io_read(addr, access->size) & mask;
+
+      gregs[REG_RIP] += access->length;
+
+      return;
+    }
+  }
+
+  // Not a guest MMIO access: hand it to whoever was there before us
+  if (old_action.sa_flags & SA_SIGINFO)
+  {
+    old_action.sa_sigaction(sig, info, context);
+  }
+  else if (old_action.sa_handler != SIG_DFL && old_action.sa_handler != SIG_IGN)
+  {
+    old_action.sa_handler(sig);
+  }
+  else
+  {
+    signal(SIGSEGV, SIG_DFL); // returning re-executes the access and crashes normally
+  }
+}
+
+static void install_handler(void)
+{
+  struct sigaction action;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = fastmem_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+
+  handler_installed = sigaction(SIGSEGV, &action, &old_action) == 0;
+}
+
+static bool fastmem_map(u8 *addr, u32 size, int fd, u32 offset, int prot)
+{
+  return mmap(addr, size, prot, MAP_SHARED | MAP_FIXED, fd, offset) != MAP_FAILED;
+}
+
+bool fastmem_init(Memory *mem)
+{
+  if (sysconf(_SC_PAGESIZE) != PAGE_SIZE)
+    return false;
+
+  const int fd = memfd_create("psx-memory", MFD_CLOEXEC);
+
+  if (fd < 0)
+    return false;
+
+  u8 *backing = MAP_FAILED;
+  u8 *base = MAP_FAILED;
+
+  if (ftruncate(fd, FASTMEM_BACKING_SIZE) < 0)
+    goto fail;
+
+  backing = mmap(NULL, FASTMEM_BACKING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (backing == MAP_FAILED)
+    goto fail;
+
+  base = mmap(NULL, FASTMEM_RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (base == MAP_FAILED)
+    goto fail;
+
+  // 1F801060h RAM_SIZE (usually 00000B88h; 2MB RAM mirrored in first 8MB)
+  for (u32 mirror = 0; mirror < RAM_SIZE_8MB; mirror += RAM_SIZE_2MB)
+  {
+    if (!fastmem_map(base + RAM_ADDR + mirror, RAM_SIZE_2MB, fd, FASTMEM_RAM_OFFSET, PROT_READ | PROT_WRITE))
+      goto fail;
+  }
+
+  if (!fastmem_map(base + SCRATCHPAD_ADDR, PAGE_SIZE, fd, FASTMEM_SCRATCHPAD_OFFSET, PROT_READ | PROT_WRITE))
+    goto fail;
+
+  // one handler for every machine of the process
+  pthread_once(&handler_once, install_handler);
+
+  if (!handler_installed)
+    goto fail;
+
+  close(fd);
+
+  mem->ram = backing + FASTMEM_RAM_OFFSET;
+  mem->scratchpad = backing + FASTMEM_SCRATCHPAD_OFFSET;
+  mem->fastmem = base;
+
+  return true;
+
+fail:
+  if (base != MAP_FAILED)
+    munmap(base, FASTMEM_RESERVE_SIZE);
+
+  if (backing != MAP_FAILED)
+    munmap(backing, FASTMEM_BACKING_SIZE);
+
+  close(fd);
+
+  return false;
+}
+
+void fastmem_shutdown(Memory *mem)
+{
+  if (!mem->fastmem)
+    return;
+
+  munmap(mem->fastmem, FASTMEM_RESERVE_SIZE);
+  munmap(mem->ram - FASTMEM_RAM_OFFSET, FASTMEM_BACKING_SIZE);
+
+  mem->fastmem = NULL;
+  mem->ram = NULL;
+  mem->scratchpad = NULL;
+  mem->bios = NULL;
+}
+
+bool fastmem_map_bios(Memory *mem, int fd)
+{
+  u8 *addr = mem->fastmem + BIOS_ADDR;
+
+  // BIOS is a ROM, stores fault into io_write() and get dropped there
+  if (fastmem_map(addr, BIOS_SIZE, fd, 0, PROT_READ))
+    return true;
+
+  // drop what a previous image left there, loads then fault into io_read() as well
+  mmap(addr, BIOS_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+  return false;
+}
+
+void fastmem_protect(Memory *mem, u32 offset, bool protect)
+{
+  const int prot = protect ? PROT_READ : PROT_READ | PROT_WRITE;
+
+  for (u32 mirror = 0; mirror < RAM_SIZE_8MB; mirror += RAM_SIZE_2MB)
+    mprotect(mem->fastmem + RAM_ADDR + mirror + offset, PAGE_SIZE, prot);
+}
+
+#else
+
+bool fastmem_init(Memory *mem)
+{
+  return false;
+}
+
+void fastmem_shutdown(Memory *mem)
+{
+}
+
+bool fastmem_map_bios(Memory *mem, int fd)
+{
+  return false;
+}
+
+void fastmem_protect(Memory *mem, u32 offset, bool protect)
+{
+}
+
+#endif
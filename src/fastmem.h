@@ -0,0 +1,83 @@
+#pragma once
+#include "bus.h"
+
+// Host virtual memory fastmem
+//
+// A 4 GByte host range is reserved and the backing of RAM (plus the three mirrors of
+// the 8 MByte window), Scratchpad and BIOS is aliased at its physical offset through
+// a memfd. After region_memory() a guest access is a single host load/store at
+// base + addr. MMIO pages stay unmapped: the fault is caught by a SIGSEGV handler
+// that emulates the access through io_read()/io_write() and resumes after it.
+//
+// Only the access forms below are recognized by the handler, so the registers are
+// fixed: base in rcx, guest address in rdx, data in eax.
+
+// Layout of the shared backing (memfd); the BIOS is mapped from its file (see bios.h)
+#define FASTMEM_RAM_OFFSET        0
+#define FASTMEM_SCRATCHPAD_OFFSET (FASTMEM_RAM_OFFSET + 0x200000)
+#define FASTMEM_BACKING_SIZE      (FASTMEM_SCRATCHPAD_OFFSET + PAGE_SIZE)
+
+#define FASTMEM_RESERVE_SIZE 0x100000000ULL
+
+bool fastmem_init(Memory *mem);
+
+void fastmem_shutdown(Memory *mem);
+
+// Map the BIOS image file read only at BIOS_ADDR (until then the region faults into io_read),
+// false when it cannot: the region is left unmapped
+bool fastmem_map_bios(Memory *mem, int fd);
+
+// Make the RAM page at offset (and its mirrors) read only, so stores fault into io_write()
+void fastmem_protect(Memory *mem, u32 offset, bool protect);
+
+#if defined(__x86_64__)
+
+static inline u8 fastmem_read8(u8 *base, u32 addr)
+{
+  u32 value;
+  __asm__ volatile("movzbl (%%rcx,%%rdx), %%eax" : "=a"(value) : "c"(base), "d"((u64)addr) : "memory");
+  return value;
+}
+
+static inline u16 fastmem_read16(u8 *base, u32 addr)
+{
+  u32 value;
+  __asm__ volatile("movzwl (%%rcx,%%rdx), %%eax" : "=a"(value) : "c"(base), "d"((u64)addr) : "memory");
+  return value;
+}
+
+static inline u32 fastmem_read32(u8 *base, u32 addr)
+{
+  u32 value;
+  __asm__ volatile("movl (%%rcx,%%rdx), %%eax" : "=a"(value) : "c"(base), "d"((u64)addr) : "memory");
+  return value;
+}
+
+static inline void fastmem_write8(u8 *base, u32 addr, u8 value)
+{
+  __asm__ volatile("movb %%al, (%%rcx,%%rdx)" : : "a"(value), "c"(base), "d"((u64)addr) : "memory");
+}
+
+static inline void fastmem_write16(u8 *base, u32 addr, u16 value)
+{
+  __asm__ volatile("movw %%ax, (%%rcx,%%rdx)" : : "a"(value), "c"(base), "d"((u64)addr) : "memory");
+}
+
+static inline void fastmem_write32(u8 *base, u32 addr, u32 value)
+{
+  __asm__ volatile("movl %%eax, (%%rcx,%%rdx)" : : "a"(value), "c"(base), "d"((u64)addr) : "memory");
+}
+
+#else
+
+// fastmem_init() always fails on these hosts, the bus never gets here
+
+static inline u8  fastmem_read8(u8 *base, u32 addr)  { return 0; }
+static inline u16 fastmem_read16(u8 *base, u32 addr) { return 0; }
+static inline u32 fastmem_read32(u8 *base, u32 addr) { return 0; }
+
+static inline void fastmem_write8(u8 *base, u32 addr, u8 value)   {}
+static inline void fastmem_write16(u8 *base, u32 addr, u16 value) {}
+static inline void fastmem_write32(u8 *base, u32 addr, u32 value) {}
+
+#endif
@@ -0,0 +1,588 @@
+#include <string.h>
+
+#include "machine.h"
+
+#define DOT_GPU_CYCLES 8
+
+// GPU cycles = CPU cycles * 11 / 7
+#define DOT_NUM 11
+#define DOT_DEN (7 * DOT_GPU_CYCLES)
+
+
+static void vblank(R3000 *cpu, u64 deadline)
+{
+  psx->gpu.frames++;
+
+  subpixel_reset(&psx->subpixel);
+
+  irq_raise(IRQ_VBLANK);
+
+  sched_add(EVENT_VBLANK, deadline + FRAME_CYCLES);
+}
+
+void gpu_timing_init(u64 now)
+{
+  psx->gpu.frames = 0;
+  psx->gpu.start = now;
+
+  sched_set_handler(EVENT_VBLANK, vblank);
+
+  sched_add(EVENT_VBLANK, now + FRAME_CYCLES);
+}
+
+u64 gpu_frames(void)
+{
+  return psx->gpu.frames;
+}
+
+u64 gpu_hblanks(u64 cycle)
+{
+  return (cycle - psx->gpu.start) / SCANLINE_CYCLES;
+}
+
+u64 gpu_hblank_cycle(u64 hblanks)
+{
+  return psx->gpu.start + hblanks * SCANLINE_CYCLES;
+}
+
+u64 gpu_dots(u64 cycle)
+{
+  return (cycle - psx->gpu.start) * DOT_NUM / DOT_DEN;
+}
+
+u64 gpu_dot_cycle(u64 dots)
+{
+  return psx->gpu.start + (dots * DOT_DEN + DOT_NUM - 1) / DOT_NUM;
+}
+
+// GPUSTAT
+#define STAT_TEXPAGE      0x000001FF // 0-8   texture page X/Y, semi-transparency, depth (E1h.0-8)
+#define STAT_DRAW_MODE    0x000007FF // 0-10  E1h.0-10 (dither, drawing to display area)
+#define STAT_DITHER       (1 << 9)
+#define STAT_SET_MASK     (1 << 11)
+#define STAT_CHECK_MASK   (1 << 12)
+#define STAT_FIELD        (1 << 13)  // interlace field (always 1 when not interlaced)
+#define STAT_TEXTURE_OFF  (1 << 15)  // E1h.11
+#define STAT_DISPLAY_MODE 0x007F4000 // 14, 16-22 GP1(08h)
+#define STAT_480_LINES    (1 << 19)
+#define STAT_INTERLACE    (1 << 22)
+#define STAT_DISPLAY_OFF  (1 << 23)
+#define STAT_IRQ          (1 << 24)
+#define STAT_DMA_REQUEST  (1 << 25)
+#define STAT_READY_CMD    (1 << 26)
+#define STAT_READY_READ   (1 << 27)  // VRAM to CPU data
+#define STAT_READY_DMA    (1 << 28)
+#define STAT_DMA_SHIFT    29         // 29-30 DMA direction
+#define STAT_ODD_LINE     (1u << 31)
+
+#define POLYLINE_END 0x50005000 // 5xxx5xxxh
+
+static inline s32 sign_extend11(u32 value)
+{
+  return (s32)(value << 21) >> 21;
+}
+
+// Words of the packet started by a command (the first segment of a polyline)
+static u32 packet_size(u8 op)
+{
+  switch (op >> 5)
+  {
+  case 1: // polygon
+  {
+    const u32 vertices = (op & 0x08) ? 4 : 3;
+    const u32 words = 1 + ((op & 0x04) ? 1 : 0) + ((op & 0x10) ? 1 : 0);
+
+    return vertices * words + ((op & 0x10) ? 0 : 1);
+  }
+  case 2: return (op & 0x10) ? 4 : 3;                                               // line
+  case 3: return 2 + ((op & 0x04) ? 1 : 0) + (((op >> 3) & 3) == 0 ? 1 : 0);         // rectangle
+  case 4: return 4;                                                                 // VRAM to VRAM
+  case 5: case 6: return 3;                                                         // CPU <-> VRAM
+  default: return op == 0x02 ? 3 : 1;
+  }
+}
+
+static raster_vertex make_vertex(const gpu_state *gpu, u32 position, u32 color, subpixel_cache *subpixel)
+{
+  const s16 x = sign_extend11(position), y = sign_extend11(position >> 16);
+
+  raster_vertex v = { (x + gpu->offset_x) * (1 << RASTER_SUBPIXEL_BITS), (y + gpu->offset_y) * (1 << RASTER_SUBPIXEL_BITS),
+                      color, color >> 8, color >> 16, 0, 0 };
+
+  s32 precise_x, precise_y;
+
+  if (subpixel && subpixel_lookup(subpixel, x, y, &precise_x, &precise_y))
+  {
+    v.x = (precise_x >> (16 - RASTER_SUBPIXEL_BITS)) + gpu->offset_x * (1 << RASTER_SUBPIXEL_BITS);
+    v.y = (precise_y >> (16 - RASTER_SUBPIXEL_BITS)) + gpu->offset_y * (1 << RASTER_SUBPIXEL_BITS);
+  }
+
+  return v;
+}
+
+// Texture page (E1h / polygon texpage attribute) and CLUT attribute of a primitive
+static void set_texture(raster_mode *mode, u32 page, u32 clut)
+{
+  mode->depth = (page >> 7) & 3;
+  mode->page_x = (page & 0xF) * 64;
+  mode->page_y = ((page >> 4) & 1) * 256;
+  mode->clut_x = (clut & 0x3F) * 16;
+  mode->clut_y = (clut >> 6) & 0x1FF;
+}
+
+static void draw_polygon(gpu_state *gpu)
+{
+  const u8 op = gpu->op;
+  const bool shaded = op & 0x10, textured = op & 0x04;
+
+  const u32 vertices = (op & 0x08) ? 4 : 3;
+  const u32 stride = (shaded ? 2 : 1) + (textured ? 1 : 0);
+
+  subpixel_cache *subpixel = subpixel_active();
+
+  raster_vertex v[4];
+  u32 uv[4] = { 0 };
+
+  for (u32 i = 0; i < vertices; i++)
+  {
+    // flat: color, vertex (uv), vertex (uv) ...; Gouraud: color, vertex (uv), color, vertex (uv) ...
+    const u32 *p = &gpu->packet[i * stride + 1];
+    const u32 color = shaded ? p[-1] : gpu->packet[0];
+
+    v[i] = make_vertex(gpu, p[0], color, subpixel);
+
+    if (textured)
+    {
+      uv[i] = p[1];
+      v[i].u = uv[i];
+      v[i].v = uv[i] >> 8;
+    }
+  }
+
+  raster_mode mode = { shaded, textured, textured && (op & 0x01), false, BLEND_OFF };
+
+  u32 page = gpu->stat;
+
+  // the texpage attribute of the polygon replaces the draw mode
+  if (textured)
+  {
+    page = uv[1] >> 16;
+
+    gpu->stat = (gpu->stat & ~STAT_TEXPAGE) | (page & STAT_TEXPAGE);
+
+    set_texture(&mode, page, uv[0] >> 16);
+  }
+
+  if (op & 0x02)
+    mode.blend = (page >> 5) & 3;
+
+  mode.dither = (gpu->stat & STAT_DITHER) && (shaded || (textured && !mode.raw));
+
+  // the sub-pixel cache is only read here, on the CPU thread
+  for (u32 i = 0; i + 2 < vertices; i++)
+  {
+    gpu_job job = { JOB_TRIANGLE, gpu->env, mode };
+
+    memcpy(job.v, v + i, sizeof(job.v));
+
+    gpu_submit(&job);
+  }
+}
+
+static void draw_rectangle(gpu_state *gpu)
+{
+  const u8 op = gpu->op;
+  const bool textured = op & 0x04;
+
+  const raster_vertex v = make_vertex(gpu, gpu->packet[1], gpu->packet[0], NULL);
+  const u32 uv = textured ? gpu->packet[2] : 0;
+
+  raster_vertex origin = v;
+
+  origin.u = uv;
+  origin.v = uv >> 8;
+
+  s32 w, h;
+
+  switch ((op >> 3) & 3)
+  {
+  case 0:
+  {
+    const u32 size = gpu->packet[textured ? 3 : 2];
+
+    w = size & 0x3FF;
+    h = (size >> 16) & 0x1FF;
+    break;
+  }
+  case 1:  w = h = 1;  break;
+  case 2:  w = h = 8;  break;
+  default: w = h = 16; break;
+  }
+
+  raster_mode mode = { false, textured, textured && (op & 0x01), false, BLEND_OFF };
+
+  if (textured)
+    set_texture(&mode, gpu->stat, uv >> 16);
+
+  if (op & 0x02)
+    mode.blend = (gpu->stat >> 5) & 3;
+
+  gpu_job job = { JOB_RECTANGLE, gpu->env, mode };
+
+  job.rectangle.origin = origin;
+  job.rectangle.w = w;
+  job.rectangle.h = h;
+  job.rectangle.flip_u = gpu->flip_x;
+  job.rectangle.flip_v = gpu->flip_y;
+
+  gpu_submit(&job);
+}
+
+static void draw_line(gpu_state *gpu)
+{
+  const u8 op = gpu->op;
+  const bool shaded = op & 0x10;
+
+  // flat: color, vertex, vertex; Gouraud: color, vertex, color, vertex
+  const u32 *end = shaded ? &gpu->packet[2] : &gpu->packet[1];
+
+  const raster_vertex a = make_vertex(gpu, gpu->packet[1], gpu->packet[0], NULL);
+  const raster_vertex b = make_vertex(gpu, end[1], shaded ? end[0] : gpu->packet[0], NULL);
+
+  raster_mode mode = { shaded, false, false, (gpu->stat & STAT_DITHER) && shaded, BLEND_OFF };
+
+  if (op & 0x02)
+    mode.blend = (gpu->stat >> 5) & 3;
+
+  gpu_job job = { JOB_LINE, gpu->env, mode };
+
+  job.v[0] = a;
+  job.v[1] = b;
+
+  gpu_submit(&job);
+
+  if (!(op & 0x08))
+    return;
+
+  // polyline: the end is the start of the next segment
+  if (shaded)
+    gpu->packet[0] = gpu->packet[2];
+
+  gpu->packet[1] = end[1];
+
+  gpu->count = 2;
+  gpu->size = packet_size(op);
+  gpu->polyline = true;
+}
+
+static void start_transfer(gpu_state *gpu, u8 transfer)
+{
+  gpu->transfer = transfer;
+  gpu->x = gpu->packet[1] & 0x3FF;
+  gpu->y = (gpu->packet[1] >> 16) & 0x1FF;
+  gpu->w = ((gpu->packet[2] - 1) & 0x3FF) + 1;
+  gpu->h = (((gpu->packet[2] >> 16) - 1) & 0x1FF) + 1;
+  gpu->pixel = 0;
+}
+
+// Position of the next pixel of the transfer
+static void transfer_pixel(gpu_state *gpu, u32 *x, u32 *y)
+{
+  *x = (gpu->x + gpu->pixel % gpu->w) & (VRAM_WIDTH - 1);
+  *y = (gpu->y + gpu->pixel / gpu->w) & (VRAM_HEIGHT - 1);
+
+  if (++gpu->pixel == (u32)gpu->w * gpu->h)
+    gpu->transfer = TRANSFER_NONE;
+}
+
+static void store_pixel(gpu_state *gpu, u16 value)
+{
+  if (gpu->transfer != TRANSFER_TO_VRAM)
+    return;
+
+  u32 x, y;
+
+  transfer_pixel(gpu, &x, &y);
+
+  gpu_submit_pixel(x, y, value, &gpu->env);
+}
+
+static u16 load_pixel(gpu_state *gpu)
+{
+  if (gpu->transfer != TRANSFER_FROM_VRAM)
+    return 0;
+
+  u32 x, y;
+
+  transfer_pixel(gpu, &x, &y);
+
+  return gpu->vram[y][x];
+}
+
+static void draw_mode(gpu_state *gpu, u32 value)
+{
+  gpu->stat = (gpu->stat & ~(STAT_DRAW_MODE | STAT_TEXTURE_OFF)) | (value & STAT_DRAW_MODE) | ((value & 0x800) << 4);
+
+  gpu->flip_x = (value >> 12) & 1;
+  gpu->flip_y = (value >> 13) & 1;
+}
+
+static void environment(gpu_state *gpu, u32 value)
+{
+  switch (value >> 24)
+  {
+  case 0xE1: // Draw Mode setting (aka "Texpage")
+    draw_mode(gpu, value);
+    break;
+
+  case 0xE2: // Texture Window setting, in 8 pixel steps
+  {
+    const u32 mask_x = value & 0x1F, mask_y = (value >> 5) & 0x1F;
+
+    gpu->window = value & 0xFFFFF;
+    gpu->env.mask_u = mask_x * 8;
+    gpu->env.mask_v = mask_y * 8;
+    gpu->env.offset_u = ((value >> 10) & mask_x) * 8;
+    gpu->env.offset_v = ((value >> 15) & mask_y) * 8;
+    break;
+  }
+  case 0xE3: // Set Drawing Area top left (X1,Y1)
+    gpu->area_tl = value & 0xFFFFF;
+    gpu->env.left = value & 0x3FF;
+    gpu->env.top = (value >> 10) & 0x1FF;
+    break;
+
+  case 0xE4: // Set Drawing Area bottom right (X2,Y2)
+    gpu->area_br = value & 0xFFFFF;
+    gpu->env.right = value & 0x3FF;
+    gpu->env.bottom = (value >> 10) & 0x1FF;
+    break;
+
+  case 0xE5: // Set Drawing Offset (X,Y)
+    gpu->offset = value & 0x3FFFFF;
+    gpu->offset_x = sign_extend11(value);
+    gpu->offset_y = sign_extend11(value >> 11);
+    break;
+
+  case 0xE6: // Mask Bit Setting
+    gpu->env.set_mask = value & 1;
+    gpu->env.check_mask = (value >> 1) & 1;
+    gpu->stat = (gpu->stat & ~(STAT_SET_MASK | STAT_CHECK_MASK)) | ((value & 3) << 11);
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void execute_packet(gpu_state *gpu)
+{
+  const u32 *p = gpu->packet;
+
+  gpu->size = 0;
+
+  switch (gpu->op >> 5)
+  {
+  case 1: draw_polygon(gpu);   break;
+  case 2: draw_line(gpu);      break;
+  case 3: draw_rectangle(gpu); break;
+
+  case 4: // VRAM to VRAM
+  {
+    gpu_job job = { JOB_COPY, gpu->env };
+
+    job.copy.src_x = p[1] & 0x3FF;
+    job.copy.src_y = (p[1] >> 16) & 0x1FF;
+    job.copy.dst_x = p[2] & 0x3FF;
+    job.copy.dst_y = (p[2] >> 16) & 0x1FF;
+    job.copy.w = p[3] & 0xFFFF;
+    job.copy.h = p[3] >> 16;
+
+    gpu_submit(&job);
+    break;
+  }
+
+  case 5: start_transfer(gpu, TRANSFER_TO_VRAM);   break;
+  case 6: start_transfer(gpu, TRANSFER_FROM_VRAM); break;
+
+  case 7: environment(gpu, p[0]); break;
+
+  default:
+    if (gpu->op == 0x02) // Fill Rectangle in VRAM (24-bit color)
+    {
+      gpu_job job = { JOB_FILL };
+
+      job.fill.x = p[1] & 0xFFFF;
+      job.fill.y = p[1] >> 16;
+      job.fill.w = p[2] & 0xFFFF;
+      job.fill.h = p[2] >> 16;
+      job.fill.color = ((p[0] >> 3) & 0x1F) | ((p[0] >> 6) & 0x3E0) | ((p[0] >> 9) & 0x7C00);
+
+      gpu_submit(&job);
+    }
+    else if (gpu->op == 0x1F) // Interrupt Request (IRQ1)
+    {
+      gpu->stat |= STAT_IRQ;
+      irq_raise(IRQ_GPU);
+    }
+    break;
+  }
+}
+
+static void gp0(gpu_state *gpu, u32 value)
+{
+  if (gpu->transfer == TRANSFER_TO_VRAM)
+  {
+    store_pixel(gpu, value);
+    store_pixel(gpu, value >> 16);
+    return;
+  }
+
+  // the terminator takes the place of the next color (Gouraud) or vertex
+  if (gpu->polyline && gpu->count == 2 && (value & 0xF000F000) == POLYLINE_END)
+  {
+    gpu->size = 0;
+    gpu->polyline = false;
+    return;
+  }
+
+  if (!gpu->size)
+  {
+    gpu->op = value >> 24;
+    gpu->size = packet_size(gpu->op);
+    gpu->count = 0;
+  }
+
+  gpu->packet[gpu->count++] = value;
+
+  if (gpu->count == gpu->size)
+    execute_packet(gpu);
+}
+
+static void reset_command_buffer(gpu_state *gpu)
+{
+  gpu->size = 0;
+  gpu->count = 0;
+  gpu->polyline = false;
+  gpu->transfer = TRANSFER_NONE;
+}
+
+static void gp1(gpu_state *gpu, u32 value)
+{
+  switch ((value >> 24) & 0x3F)
+  {
+  case 0x00: // Reset GPU
+    gpu->stat = STAT_DISPLAY_OFF;
+
+    for (u32 op = 0xE1; op <= 0xE6; op++)
+      environment(gpu, op << 24);
+
+    gpu->display_start = 0;
+    gpu->h_range = 0xC60260; // 200h..C00h
+    gpu->v_range = 0x040010; // 10h..100h
+
+    reset_command_buffer(gpu);
+    break;
+
+  case 0x01: // Reset Command Buffer
+    reset_command_buffer(gpu);
+    break;
+
+  case 0x02: // Acknowledge GPU Interrupt (IRQ1)
+    gpu->stat &= ~STAT_IRQ;
+    break;
+
+  case 0x03: // Display Enable
+    gpu->stat = (gpu->stat & ~STAT_DISPLAY_OFF) | ((value & 1) << 23);
+    break;
+
+  case 0x04: // DMA Direction / Data Request
+    gpu->stat = (gpu->stat & ~(3u << STAT_DMA_SHIFT)) | ((value & 3) << STAT_DMA_SHIFT);
+    break;
+
+  case 0x05: gpu->display_start = value & 0x7FFFF;  break; // Start of Display area (in VRAM)
+  case 0x06: gpu->h_range = value & 0xFFFFFF;       break; // Horizontal Display range (on Screen)
+  case 0x07: gpu->v_range = value & 0xFFFFF;        break; // Vertical Display range (on Screen)
+
+  case 0x08: // Display mode
+    gpu->stat = (gpu->stat & ~STAT_DISPLAY_MODE) | ((value & 0x3F) << 17) | ((value & 0x40) << 10) | ((value & 0x80) << 7);
+    break;
+
+  case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
+  case 0x18: case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E: case 0x1F: // Get GPU Info
+    switch (value & 7)
+    {
+    case 2: gpu->read = gpu->window;  break;
+    case 3: gpu->read = gpu->area_tl; break;
+    case 4: gpu->read = gpu->area_br; break;
+    case 5: gpu->read = gpu->offset;  break;
+    case 7: gpu->read = 2;            break; // GPU Type
+    default: break;
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+static u32 gpu_status(const gpu_state *gpu)
+{
+  u32 stat = gpu->stat | STAT_READY_CMD | STAT_READY_DMA;
+
+  if (gpu->transfer == TRANSFER_FROM_VRAM)
+    stat |= STAT_READY_READ;
+
+  switch ((stat >> STAT_DMA_SHIFT) & 3)
+  {
+  case 1: stat |= STAT_DMA_REQUEST; break;                                   // FIFO not full
+  case 2: stat |= (stat & STAT_READY_DMA) ? STAT_DMA_REQUEST : 0; break;     // CPU to GP0
+  case 3: stat |= (stat & STAT_READY_READ) ? STAT_DMA_REQUEST : 0; break;    // GPUREAD to CPU
+  default: break;
+  }
+
+  // interlaced, the field follows the frame; bit 31 too in 480 lines, otherwise the line
+  const bool interlaced = stat & STAT_INTERLACE;
+  const bool odd_frame = gpu_frames() & 1;
+
+  if (!interlaced || odd_frame)
+    stat |= STAT_FIELD;
+
+  if (interlaced && (stat & STAT_480_LINES) ? odd_frame : (gpu_hblanks(psx->cpu.cycles) & 1))
+    stat |= STAT_ODD_LINE;
+
+  return stat;
+}
+
+void gpu_reset(void)
+{
+  gp1(&psx->render, 0);
+}
+
+u32 gpu_read(u32 offset)
+{
+  gpu_state *gpu = &psx->render;
+
+  if (offset)
+    return gpu_status(gpu);
+
+  if (gpu->transfer == TRANSFER_FROM_VRAM)
+  {
+    gpu_sync(); // the jobs drawn so far are in VRAM
+
+    const u32 lo = load_pixel(gpu);
+    const u32 hi = load_pixel(gpu);
+
+    gpu->read = lo | hi << 16;
+  }
+
+  return gpu->read;
+}
+
+void gpu_write(u32 offset, u32 value)
+{
+  if (offset)
+    gp1(&psx->render, value);
+  else
+    gp0(&psx->render, value);
+}
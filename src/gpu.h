@@ -0,0 +1,98 @@
+#pragma once
+#include "cpu.h"
+#include "raster.h"
+
+// GPU video timing (NTSC)
+// The GPU clock is 53.693175MHz; a scanline is 3413 GPU cycles and a frame 263 scanlines.
+// Only the frame boundary is an event (EVENT_VBLANK, see scheduler.h): VBlank raises IRQ0.
+
+#define GPU_CLOCK 53693175 // Hz
+
+#define SCANLINE_CYCLES 2153 // 3413 GPU cycles in CPU cycles (2152.86)
+#define FRAME_SCANLINES 263
+#define FRAME_CYCLES    (SCANLINE_CYCLES * FRAME_SCANLINES)
+
+typedef struct
+{
+  u64 frames;
+  u64 start;  // cycle of gpu_timing_init
+}video_timing;
+
+// Start the video timing at cycle now, the first VBlank comes one frame later
+void gpu_timing_init(u64 now);
+
+u64 gpu_frames(void); // VBlanks since gpu_timing_init
+
+// Video clocks seen by the root counters, counted from gpu_timing_init: the number of
+// clocks elapsed at a cycle and the first cycle a clock count is reached.
+// The dotclock assumes the 320 pixels mode (8 GPU cycles per dot).
+u64 gpu_hblanks(u64 cycle);
+u64 gpu_hblank_cycle(u64 hblanks);
+u64 gpu_dots(u64 cycle);
+u64 gpu_dot_cycle(u64 dots);
+
+// GPU registers
+// 1F801810h GP0 (W) rendering and VRAM access packets / GPUREAD (R)
+// 1F801814h GP1 (W) display control / GPUSTAT (R)
+//
+// GP0 words are gathered until the packet is complete, then it is drawn by the software
+// rasterizer (raster.h), at once or on the rasterizer thread (gpu_thread.h); the GPU is
+// always ready for commands and drawing takes no time. CPU to VRAM data (A0h) goes to
+// VRAM as it arrives, VRAM to CPU data (C0h) is read through GPUREAD. Polygon vertices
+// found in the sub-pixel cache (see subpixel.h) are drawn at their un-rounded position.
+//
+// GP0 Commands
+//   00h,03h..1Eh NOP         02h Fill VRAM          1Fh IRQ1
+//   20h..3Fh Polygons        bit4 Gouraud, bit3 quad, bit2 textured, bit1 semi, bit0 raw
+//   40h..5Fh Lines           bit4 Gouraud, bit3 polyline (ends with 5xxx5xxxh), bit1 semi
+//   60h..7Fh Rectangles      bit3-4 size (variable, 1x1, 8x8, 16x16), bit2 textured, ...
+//   80h VRAM to VRAM         A0h CPU to VRAM        C0h VRAM to CPU
+//   E1h Draw Mode            E2h Texture Window     E3h/E4h Drawing Area   E5h Offset
+//   E6h Mask Bit Setting
+
+enum GPU_TRANSFER
+{
+  TRANSFER_NONE,
+  TRANSFER_TO_VRAM,   // GP0(A0h) data words
+  TRANSFER_FROM_VRAM, // GP0(C0h) GPUREAD words
+};
+
+typedef struct
+{
+  u32 stat;       // GPUSTAT bits kept (the ready / request / field bits are computed)
+  u32 read;       // GPUREAD latch
+
+  raster_env env;
+  u32 window;     // E2h, E3h, E4h, E5h parameters as written (for GP1(10h))
+  u32 area_tl;
+  u32 area_br;
+  u32 offset;
+  s32 offset_x;   // drawing offset
+  s32 offset_y;
+  bool flip_x;    // E1h.12-13 rectangle texture flip
+  bool flip_y;
+
+  u32 display_start; // GP1(05h), GP1(06h), GP1(07h) parameters
+  u32 h_range;
+  u32 v_range;
+
+  // GP0 packet in assembly
+  u32 packet[12]; // longest: Gouraud textured quad
+  u32 count;      // words received
+  u32 size;       // words of the packet, 0 when waiting for a command
+  u8 op;          // command of the packet (or of the polyline)
+  bool polyline;  // past the first segment of a polyline
+
+  // VRAM transfer (A0h / C0h)
+  u8 transfer;    // GPU_TRANSFER
+  u16 x, y, w, h; // rectangle (wraps around VRAM)
+  u32 pixel;      // next pixel of the rectangle
+
+  vram_row vram[VRAM_HEIGHT];
+}gpu_state;
+
+void gpu_reset(void); // GP1(00h), VRAM is kept
+
+u32 gpu_read(u32 offset);
+
+void gpu_write(u32 offset, u32 value);
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpu_thread.h"
+#include "machine.h"
+
+#define SPINS 1000 // polls of the other side before sleeping
+
+static void draw_job(vram_row *vram, const gpu_job *job)
+{
+  switch (job->type)
+  {
+  case JOB_TRIANGLE:
+    raster_triangle(vram, &job->env, &job->mode, job->v);
+    break;
+
+  case JOB_RECTANGLE:
+    raster_rectangle(vram, &job->env, &job->mode, &job->rectangle.origin, job->rectangle.w, job->rectangle.h,
+                     job->rectangle.flip_u, job->rectangle.flip_v);
+    break;
+
+  case JOB_LINE:
+    raster_line(vram, &job->env, &job->mode, &job->v[0], &job->v[1]);
+    break;
+
+  case JOB_FILL:
+    raster_fill(vram, job->fill.x, job->fill.y, job->fill.w, job->fill.h, job->fill.color);
+    break;
+
+  case JOB_COPY:
+    raster_copy(vram, &job->env, job->copy.src_x, job->copy.src_y, job->copy.dst_x, job->copy.dst_y, job->copy.w,
+                job->copy.h);
+    break;
+
+  case JOB_PIXELS:
+  {
+    u16 *row = vram[job->pixels.y];
+    const u16 set = job->env.set_mask ? 0x8000 : 0;
+
+    for (u32 i = 0; i < job->pixels.count; i++)
+    {
+      u16 *pixel = &row[job->pixels.x + i];
+
+      if (!(job->env.check_mask && (*pixel & 0x8000)))
+        *pixel = job->pixels.data[i] | set;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Rasterizer: wait for a job past tail, false when told to quit with the ring empty
+static bool wait_for_job(gpu_thread *t, u32 tail)
+{
+  for (u32 i = 0; i < SPINS; i++)
+    if (atomic_load_explicit(&t->head, memory_order_acquire) != tail)
+      return true;
+
+  pthread_mutex_lock(&t->lock);
+
+  // the CPU thread looks at sleeping after it moves head: one of the two sees the other
+  atomic_store(&t->sleeping, true);
+
+  while (atomic_load(&t->head) == tail && !atomic_load(&t->quit))
+    pthread_cond_wait(&t->work, &t->lock);
+
+  atomic_store(&t->sleeping, false);
+
+  pthread_mutex_unlock(&t->lock);
+
+  return atomic_load(&t->head) != tail;
+}
+
+static void *rasterizer_main(void *data)
+{
+  gpu_thread *t = data;
+
+  u32 tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+
+  while (wait_for_job(t, tail))
+  {
+    draw_job(t->vram, &t->ring[tail & (GPU_RING_JOBS - 1)]);
+
+    atomic_store(&t->tail, ++tail);
+
+    if (atomic_load(&t->waiting))
+    {
+      pthread_mutex_lock(&t->lock);
+      pthread_cond_signal(&t->done);
+      pthread_mutex_unlock(&t->lock);
+    }
+  }
+
+  return NULL;
+}
+
+// CPU thread: wait until at most `left` jobs are still to be drawn
+static void wait_for_rasterizer(gpu_thread *t, u32 left)
+{
+  const u32 head = atomic_load_explicit(&t->head, memory_order_relaxed);
+
+  for (u32 i = 0; i < SPINS; i++)
+    if (head - atomic_load_explicit(&t->tail, memory_order_acquire) <= left)
+      return;
+
+  pthread_mutex_lock(&t->lock);
+
+  atomic_store(&t->waiting, true);
+
+  while (head - atomic_load(&t->tail) > left)
+    pthread_cond_wait(&t->done, &t->lock);
+
+  atomic_store(&t->waiting, false);
+
+  pthread_mutex_unlock(&t->lock);
+}
+
+// Rows from top to bottom (inclusive) inside the drawing area of the job
+static void mark_clipped_rows(const raster_env *env, s32 top, s32 bottom)
+{
+  top = top > env->top ? top : env->top;
+  bottom = bottom < env->bottom ? bottom : env->bottom;
+
+  if (top < 0)
+    top = 0;
+
+  if (bottom >= VRAM_HEIGHT)
+    bottom = VRAM_HEIGHT - 1;
+
+  if (top <= bottom)
+    mark_vram_rows(top, bottom - top + 1);
+}
+
+static void mark_job_rows(const gpu_job *job)
+{
+  switch (job->type)
+  {
+  case JOB_TRIANGLE:
+  {
+    const s32 y0 = job->v[0].y, y1 = job->v[1].y, y2 = job->v[2].y;
+    const s32 top = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+    const s32 bottom = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+
+    mark_clipped_rows(&job->env, top >> RASTER_SUBPIXEL_BITS, bottom >> RASTER_SUBPIXEL_BITS);
+    break;
+  }
+  case JOB_RECTANGLE:
+  {
+    const s32 y = job->rectangle.origin.y >> RASTER_SUBPIXEL_BITS;
+
+    mark_clipped_rows(&job->env, y, y + job->rectangle.h - 1);
+    break;
+  }
+  case JOB_LINE:
+  {
+    const s32 y0 = job->v[0].y >> RASTER_SUBPIXEL_BITS, y1 = job->v[1].y >> RASTER_SUBPIXEL_BITS;
+
+    mark_clipped_rows(&job->env, y0 < y1 ? y0 : y1, y0 > y1 ? y0 : y1);
+    break;
+  }
+  // the wrapped rows of raster_fill() / raster_copy()
+  case JOB_FILL:
+    mark_vram_rows(job->fill.y & 0x1FF, job->fill.h & 0x1FF);
+    break;
+
+  case JOB_COPY:
+    mark_vram_rows(job->copy.dst_y, ((job->copy.h - 1) & 0x1FF) + 1);
+    break;
+
+  case JOB_PIXELS:
+    mark_vram_rows(job->pixels.y, 1);
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void push(gpu_thread *t, const gpu_job *job)
+{
+  mark_job_rows(job);
+
+  if (!t->ring)
+  {
+    draw_job(psx->render.vram, job);
+    return;
+  }
+
+  const u32 head = atomic_load_explicit(&t->head, memory_order_relaxed);
+
+  // ring full: wait for one slot
+  if (head - atomic_load_explicit(&t->tail, memory_order_acquire) == GPU_RING_JOBS)
+    wait_for_rasterizer(t, GPU_RING_JOBS - 1);
+
+  t->ring[head & (GPU_RING_JOBS - 1)] = *job;
+  t->jobs++;
+
+  atomic_store(&t->head, head + 1);
+
+  if (atomic_load(&t->sleeping))
+  {
+    pthread_mutex_lock(&t->lock);
+    pthread_cond_signal(&t->work);
+    pthread_mutex_unlock(&t->lock);
+  }
+}
+
+static void flush_pixels(gpu_thread *t)
+{
+  if (!t->pixels.pixels.count)
+    return;
+
+  push(t, &t->pixels);
+
+  t->pixels.pixels.count = 0;
+}
+
+bool gpu_thread_start(void)
+{
+  gpu_thread *t = &psx->render_thread;
+
+  if (t->ring)
+    return true;
+
+  gpu_sync();
+
+  gpu_job *ring = malloc(GPU_RING_JOBS * sizeof(gpu_job));
+
+  if (!ring)
+    return false;
+
+  atomic_store(&t->head, 0);
+  atomic_store(&t->tail, 0);
+  atomic_store(&t->sleeping, false);
+  atomic_store(&t->waiting, false);
+  atomic_store(&t->quit, false);
+
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->work, NULL);
+  pthread_cond_init(&t->done, NULL);
+
+  t->ring = ring;
+  t->vram = psx->render.vram;
+  t->jobs = 0;
+
+  if (pthread_create(&t->thread, NULL, rasterizer_main, t) != 0)
+  {
+    t->ring = NULL;
+
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->work);
+    pthread_cond_destroy(&t->done);
+
+    free(ring);
+    return false;
+  }
+
+  return true;
+}
+
+void gpu_thread_stop(void)
+{
+  gpu_thread *t = &psx->render_thread;
+
+  if (!t->ring)
+    return;
+
+  flush_pixels(t);
+
+  // the rasterizer only quits once the ring is empty
+  pthread_mutex_lock(&t->lock);
+  atomic_store(&t->quit, true);
+  pthread_cond_signal(&t->work);
+  pthread_mutex_unlock(&t->lock);
+
+  pthread_join(t->thread, NULL);
+
+  pthread_mutex_destroy(&t->lock);
+  pthread_cond_destroy(&t->work);
+  pthread_cond_destroy(&t->done);
+
+  free(t->ring);
+  t->ring = NULL;
+}
+
+bool gpu_thread_running(void)
+{
+  return psx->render_thread.ring != NULL;
+}
+
+void gpu_submit(const gpu_job *job)
+{
+  gpu_thread *t = &psx->render_thread;
+
+  flush_pixels(t);
+  push(t, job);
+}
+
+void gpu_submit_pixel(u32 x, u32 y, u16 value, const raster_env *env)
+{
+  gpu_thread *t = &psx->render_thread;
+  gpu_job *job = &t->pixels;
+
+  // a new run: another row, a gap (wrapped around), a full job or other mask bits
+  if (job->pixels.count && (y != job->pixels.y || x != job->pixels.x + job->pixels.count ||
+                            job->pixels.count == GPU_JOB_PIXELS || env->set_mask != job->env.set_mask ||
+                            env->check_mask != job->env.check_mask))
+    flush_pixels(t);
+
+  if (!job->pixels.count)
+  {
+    job->type = JOB_PIXELS;
+    job->env = *env;
+    job->pixels.x = x;
+    job->pixels.y = y;
+  }
+
+  job->pixels.data[job->pixels.count++] = value;
+}
+
+void gpu_sync(void)
+{
+  gpu_thread *t = &psx->render_thread;
+
+  flush_pixels(t);
+
+  if (t->ring)
+    wait_for_rasterizer(t, 0);
+}
+
+bool vram_row_dirty(u32 row)
+{
+  return (psx->render_thread.dirty_rows[row >> 5] >> (row & 31)) & 1;
+}
+
+void mark_vram_rows(u32 row, u32 count)
+{
+  u32 *dirty = psx->render_thread.dirty_rows;
+
+  for (u32 i = 0; i < count && i < VRAM_HEIGHT; i++)
+  {
+    const u32 y = (row + i) & (VRAM_HEIGHT - 1);
+
+    dirty[y >> 5] |= 1u << (y & 31);
+  }
+}
+
+void clean_vram_rows(void)
+{
+  memset(psx->render_thread.dirty_rows, 0, sizeof(psx->render_thread.dirty_rows));
+}
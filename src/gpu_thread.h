@@ -0,0 +1,101 @@
+#pragma once
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "raster.h"
+
+// Rasterizer thread (off by default)
+// GP0 keeps being decoded on the CPU thread: the packets, the drawing environment,
+// GPUSTAT, the GPU IRQ and the sub-pixel lookups of the vertices stay there, only what
+// reads or writes VRAM becomes a job. A job is drawn at once, or, once the thread of the
+// machine is started, appended to a single producer / single consumer ring that the
+// thread drains: VRAM belongs to it from then on.
+//
+// The CPU thread waits for the ring to drain (gpu_sync) before it touches VRAM itself:
+// GPUREAD during a VRAM to CPU transfer, and every save state (see map_state), so the
+// rewind buffer and the run-ahead as well. GPUSTAT never waits, all of its bits are
+// known on the CPU thread since drawing takes no time.
+//
+// Jobs carry the drawing environment of their packet. CPU to VRAM data is gathered into
+// one job per run of GPU_JOB_PIXELS pixels of a row.
+// The thread and the ring are host side only, not part of the save state.
+
+#define GPU_RING_JOBS  4096 // power of two
+#define GPU_JOB_PIXELS 32
+
+enum GPU_JOB
+{
+  JOB_TRIANGLE,
+  JOB_RECTANGLE,
+  JOB_LINE,
+  JOB_FILL,
+  JOB_COPY,
+  JOB_PIXELS,
+};
+
+typedef struct
+{
+  u8 type; // GPU_JOB
+
+  raster_env env;
+  raster_mode mode;
+
+  union
+  {
+    raster_vertex v[3]; // triangle, line (the first two)
+
+    struct { raster_vertex origin; s32 w, h; bool flip_u, flip_v; } rectangle;
+    struct { u32 x, y, w, h; u16 color; } fill;
+    struct { u32 src_x, src_y, dst_x, dst_y, w, h; } copy;
+    struct { u16 x, y, count; u16 data[GPU_JOB_PIXELS]; } pixels; // CPU to VRAM, x to x+count-1
+  };
+}gpu_job;
+
+typedef struct
+{
+  gpu_job *ring;        // GPU_RING_JOBS jobs, NULL when the jobs are drawn at once
+  vram_row *vram;
+
+  atomic_uint head;     // next job written (CPU thread)
+  atomic_uint tail;     // next job drawn (rasterizer)
+  atomic_bool sleeping; // the rasterizer waits for a job
+  atomic_bool waiting;  // the CPU thread waits for the rasterizer
+  atomic_bool quit;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;  // signalled by the CPU thread
+  pthread_cond_t done;  // signalled by the rasterizer
+
+  gpu_job pixels;       // CPU to VRAM pixels not submitted yet
+  u64 jobs;             // submitted while the thread runs
+
+  u32 dirty_rows[VRAM_HEIGHT / 32]; // VRAM rows drawn since clean_vram_rows()
+}gpu_thread;
+
+// Start the rasterizer thread of the bound machine, false when it cannot run (the jobs
+// are then drawn at once)
+bool gpu_thread_start(void);
+
+void gpu_thread_stop(void); // drains the ring first
+
+bool gpu_thread_running(void);
+
+void gpu_submit(const gpu_job *job);
+
+// One CPU to VRAM pixel at x, y (mask bits of env applied when it is drawn)
+void gpu_submit_pixel(u32 x, u32 y, u16 value, const raster_env *env);
+
+// Wait until every job submitted is drawn: VRAM is then up to date for the CPU thread
+void gpu_sync(void);
+
+// Dirty VRAM rows (see rewind.h)
+// Every job marks the rows it may draw into (its clipped bounding box) when it is
+// submitted, on the CPU thread, so the bits are up to date once the jobs are drawn: the
+// rewind buffer and the run-ahead only compare and copy these rows, as with the dirty
+// RAM pages (see bus.h).
+bool vram_row_dirty(u32 row);
+
+void mark_vram_rows(u32 row, u32 count); // wraps around
+
+void clean_vram_rows(void);
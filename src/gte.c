@@ -0,0 +1,1047 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gte.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+FLAG
+
+  12    IR0 saturated to +0000h..+1000h
+  13    SY2 saturated to -0400h..+03FFh
+  14    SX2 saturated to -0400h..+03FFh
+  15    MAC0 Result larger than 31 bits and negative
+  16    MAC0 Result larger than 31 bits and positive
+  17    Divide overflow. RTPS/RTPT division result saturated to max=1FFFFh
+  18    SZ3 or OTZ saturated to +0000h..+FFFFh
+  19    Color-FIFO-B saturated to +00h..+FFh
+  20    Color-FIFO-G saturated to +00h..+FFh
+  21    Color-FIFO-R saturated to +00h..+FFh
+  22    IR3 saturated to +0000h..+7FFFh (lm=1) or to -8000h..+7FFFh (lm=0)
+  23    IR2 saturated to +0000h..+7FFFh (lm=1) or to -8000h..+7FFFh (lm=0)
+  24    IR1 saturated to +0000h..+7FFFh (lm=1) or to -8000h..+7FFFh (lm=0)
+  25    MAC3 Result larger than 43 bits and negative
+  26    MAC2 Result larger than 43 bits and negative
+  27    MAC1 Result larger than 43 bits and negative
+  28    MAC3 Result larger than 43 bits and positive
+  29    MAC2 Result larger than 43 bits and positive
+  30    MAC1 Result larger than 43 bits and positive
+  31    Error Flag (Bit30..23, and 18..13 ORed together) (Read only)
+*/
+
+#define FLAG_IR0        (1u << 12)
+#define FLAG_SY2        (1u << 13)
+#define FLAG_SX2        (1u << 14)
+#define FLAG_MAC0_NEG   (1u << 15)
+#define FLAG_MAC0_POS   (1u << 16)
+#define FLAG_DIVIDE     (1u << 17)
+#define FLAG_SZ_OTZ     (1u << 18)
+#define FLAG_COLOR(i)   (1u << (21 - (i)))  // i = 0..2 (R, G, B)
+#define FLAG_IR(i)      (1u << (25 - (i)))  // i = 1..3
+#define FLAG_MAC_NEG(i) (1u << (28 - (i)))  // i = 1..3
+#define FLAG_MAC_POS(i) (1u << (31 - (i)))  // i = 1..3
+#define FLAG_ERROR      (1u << 31)
+
+#define FLAG_ERROR_MASK 0x7F87E000 // bits 30-23 and 18-13
+
+// Overflow flags of a sum into MAC0 (32 bits) or MAC1-3 (44 bits)
+static inline void check_mac(gte_state *gte, u32 index, s64 value)
+{
+  if (!index)
+  {
+    if (value > 0x7FFFFFFFLL)
+      gte->flag |= FLAG_MAC0_POS;
+    else if (value < -0x80000000LL)
+      gte->flag |= FLAG_MAC0_NEG;
+
+    return;
+  }
+
+  if (value > 0x7FFFFFFFFFFLL)
+    gte->flag |= FLAG_MAC_POS(index);
+  else if (value < -0x80000000000LL)
+    gte->flag |= FLAG_MAC_NEG(index);
+}
+
+// Intermediate sum of MAC1-3: checked, then wrapped to 44 bits like the accumulator
+static inline s64 mac44(gte_state *gte, u32 index, s64 value)
+{
+  check_mac(gte, index, value);
+
+  return (s64)((u64)value << 20) >> 20;
+}
+
+static inline void set_mac(gte_state *gte, u32 index, s64 value, u32 shift)
+{
+  check_mac(gte, index, value);
+
+  gte->mac[index] = (s32)(value >> shift);
+}
+
+static inline void set_ir(gte_state *gte, u32 index, s32 value, bool lm)
+{
+  const s32 min = lm ? 0 : -0x8000;
+
+  if (value < min)
+  {
+    value = min;
+    gte->flag |= FLAG_IR(index);
+  }
+  else if (value > 0x7FFF)
+  {
+    value = 0x7FFF;
+    gte->flag |= FLAG_IR(index);
+  }
+
+  gte->ir[index] = value;
+}
+
+static inline void set_ir0(gte_state *gte, s32 value)
+{
+  if (value < 0)
+  {
+    value = 0;
+    gte->flag |= FLAG_IR0;
+  }
+  else if (value > 0x1000)
+  {
+    value = 0x1000;
+    gte->flag |= FLAG_IR0;
+  }
+
+  gte->ir[0] = value;
+}
+
+static inline void set_mac_ir(gte_state *gte, u32 index, s64 value, u32 shift, bool lm)
+{
+  set_mac(gte, index, value, shift);
+  set_ir(gte, index, gte->mac[index], lm);
+}
+
+static inline void set_otz(gte_state *gte, s32 value)
+{
+  if (value < 0 || value > 0xFFFF)
+  {
+    value = value < 0 ? 0 : 0xFFFF;
+    gte->flag |= FLAG_SZ_OTZ;
+  }
+
+  gte->otz = value;
+}
+
+static inline void push_sz(gte_state *gte, s32 value)
+{
+  if (value < 0 || value > 0xFFFF)
+  {
+    value = value < 0 ? 0 : 0xFFFF;
+    gte->flag |= FLAG_SZ_OTZ;
+  }
+
+  gte->sz[0] = gte->sz[1];
+  gte->sz[1] = gte->sz[2];
+  gte->sz[2] = gte->sz[3];
+  gte->sz[3] = value;
+}
+
+static inline s16 saturate_sxy(gte_state *gte, s32 value, u32 flag)
+{
+  if (value < -0x400 || value > 0x3FF)
+  {
+    value = value < -0x400 ? -0x400 : 0x3FF;
+    gte->flag |= flag;
+  }
+
+  return value;
+}
+
+static inline void push_sxy(gte_state *gte, s32 x, s32 y)
+{
+  memmove(gte->sxy[0], gte->sxy[1], sizeof(gte->sxy[0]) * 2);
+
+  gte->sxy[2][0] = saturate_sxy(gte, x, FLAG_SX2);
+  gte->sxy[2][1] = saturate_sxy(gte, y, FLAG_SY2);
+}
+
+// Color FIFO = [MAC1/16, MAC2/16, MAC3/16, CODE]
+static inline void push_rgb(gte_state *gte)
+{
+  memmove(gte->rgb[0], gte->rgb[1], sizeof(gte->rgb[0]) * 2);
+
+  for (u32 i = 0; i < 3; i++)
+  {
+    s32 value = gte->mac[i + 1] >> 4;
+
+    if (value < 0 || value > 0xFF)
+    {
+      value = value < 0 ? 0 : 0xFF;
+      gte->flag |= FLAG_COLOR(i);
+    }
+
+    gte->rgb[2][i] = value;
+  }
+
+  gte->rgb[2][3] = gte->rgbc[3];
+}
+
+// [MAC1,MAC2,MAC3] = (T*1000h + M*V) SAR (sf*12), [IR1,IR2,IR3] saturated (t NULL = no T),
+// the sums before the shift in sum (NULL = not needed). V may be IR1-IR3.
+static void transform(gte_state *gte, const s16 m[3][3], const s32 *t, const s16 *v, u32 shift, bool lm,
+                      s64 *sum)
+{
+  const s16 in[3] = { v[0], v[1], v[2] };
+
+  for (u32 i = 0; i < 3; i++)
+  {
+    s64 value = t ? (s64)t[i] << 12 : 0;
+
+    value = mac44(gte, i + 1, value + m[i][0] * in[0]);
+    value = mac44(gte, i + 1, value + m[i][1] * in[1]);
+    value += m[i][2] * in[2];
+
+    set_mac_ir(gte, i + 1, value, shift, lm);
+
+    if (sum)
+      sum[i] = value;
+  }
+}
+
+// MVMVA with the FC translation: the sum of T and the first column only sets flags, the
+// result is M*V without T and the first column
+static void transform_bugged(gte_state *gte, const s16 m[3][3], const s32 *t, const s16 *v, u32 shift, bool lm)
+{
+  for (u32 i = 0; i < 3; i++)
+  {
+    const s64 lost = mac44(gte, i + 1, ((s64)t[i] << 12) + m[i][0] * v[0]);
+
+    set_ir(gte, i + 1, (s32)(lost >> shift), false);
+
+    const s64 sum = mac44(gte, i + 1, m[i][1] * v[1]);
+
+    set_mac_ir(gte, i + 1, sum + m[i][2] * v[2], shift, lm);
+  }
+}
+
+/*
+Perspective divide: ((H*20000h/SZ3)+1)/2, done by the hardware as an Unsigned Newton-Raphson
+(UNR) division seeded from a table
+
+  z = count_leading_zeroes(SZ3)           ;z=0..0Fh (for 16bit SZ3)
+  n = (H SHL z)                           ;n=0..7FFF8000h
+  d = (SZ3 SHL z)                         ;d=8000h..FFFFh
+  u = unr_table[(d-7FC0h) SHR 7] + 101h   ;u=200h..101h
+  d = ((2000080h - (d * u)) SHR 8)        ;d=10000h..0FF01h
+  d = ((0000080h + (d * u)) SHR 8)        ;d=20000h..10000h
+  n = min(1FFFFh, (((n*d) + 8000h) SHR 16))
+
+unr_table[i] = max(0, (40000h/(i+100h)+1)/2-101h). H >= SZ3*2 (SZ3 = 0 included) saturates
+to 1FFFFh and sets the divide flag; that case is selected without a branch, the
+normalization is kept in range for it (bit 15 of d forced, SZ3 = 0 counted as 1).
+*/
+static const u8 unr_table[257] =
+{
+  0xFF, 0xFD, 0xFB, 0xF9, 0xF7, 0xF5, 0xF3, 0xF1, 0xEF, 0xEE, 0xEC, 0xEA, 0xE8, 0xE6, 0xE4, 0xE3,
+  0xE1, 0xDF, 0xDD, 0xDC, 0xDA, 0xD8, 0xD6, 0xD5, 0xD3, 0xD1, 0xD0, 0xCE, 0xCD, 0xCB, 0xC9, 0xC8,
+  0xC6, 0xC5, 0xC3, 0xC1, 0xC0, 0xBE, 0xBD, 0xBB, 0xBA, 0xB8, 0xB7, 0xB5, 0xB4, 0xB2, 0xB1, 0xB0,
+  0xAE, 0xAD, 0xAB, 0xAA, 0xA9, 0xA7, 0xA6, 0xA4, 0xA3, 0xA2, 0xA0, 0x9F, 0x9E, 0x9C, 0x9B, 0x9A,
+  0x99, 0x97, 0x96, 0x95, 0x94, 0x92, 0x91, 0x90, 0x8F, 0x8D, 0x8C, 0x8B, 0x8A, 0x89, 0x87, 0x86,
+  0x85, 0x84, 0x83, 0x82, 0x81, 0x7F, 0x7E, 0x7D, 0x7C, 0x7B, 0x7A, 0x79, 0x78, 0x77, 0x75, 0x74,
+  0x73, 0x72, 0x71, 0x70, 0x6F, 0x6E, 0x6D, 0x6C, 0x6B, 0x6A, 0x69, 0x68, 0x67, 0x66, 0x65, 0x64,
+  0x63, 0x62, 0x61, 0x60, 0x5F, 0x5E, 0x5D, 0x5D, 0x5C, 0x5B, 0x5A, 0x59, 0x58, 0x57, 0x56, 0x55,
+  0x54, 0x53, 0x53, 0x52, 0x51, 0x50, 0x4F, 0x4E, 0x4D, 0x4D, 0x4C, 0x4B, 0x4A, 0x49, 0x48, 0x48,
+  0x47, 0x46, 0x45, 0x44, 0x43, 0x43, 0x42, 0x41, 0x40, 0x3F, 0x3F, 0x3E, 0x3D, 0x3C, 0x3C, 0x3B,
+  0x3A, 0x39, 0x39, 0x38, 0x37, 0x36, 0x36, 0x35, 0x34, 0x33, 0x33, 0x32, 0x31, 0x31, 0x30, 0x2F,
+  0x2E, 0x2E, 0x2D, 0x2C, 0x2C, 0x2B, 0x2A, 0x2A, 0x29, 0x28, 0x28, 0x27, 0x26, 0x26, 0x25, 0x24,
+  0x24, 0x23, 0x22, 0x22, 0x21, 0x20, 0x20, 0x1F, 0x1E, 0x1E, 0x1D, 0x1D, 0x1C, 0x1B, 0x1B, 0x1A,
+  0x19, 0x19, 0x18, 0x18, 0x17, 0x16, 0x16, 0x15, 0x15, 0x14, 0x14, 0x13, 0x12, 0x12, 0x11, 0x11,
+  0x10, 0x0F, 0x0F, 0x0E, 0x0E, 0x0D, 0x0D, 0x0C, 0x0C, 0x0B, 0x0A, 0x0A, 0x09, 0x09, 0x08, 0x08,
+  0x07, 0x07, 0x06, 0x06, 0x05, 0x05, 0x04, 0x04, 0x03, 0x03, 0x02, 0x02, 0x01, 0x01, 0x00, 0x00,
+  0x00,
+};
+
+static u32 divide(gte_state *gte)
+{
+  const u32 sz = gte->sz[3];
+  const u32 overflow = gte->h >= sz * 2;
+
+  const u32 z = __builtin_clz(sz | 1) - 16;
+
+  const u32 d = (sz << z) | 0x8000;
+  const u32 u = unr_table[(d - 0x7FC0) >> 7] + 0x101;
+
+  const u32 e = (0x2000080 - d * u) >> 8;
+  const u32 r = (0x0000080 + e * u) >> 8;
+
+  const u64 n = ((u64)(gte->h << z) * r + 0x8000) >> 16;
+
+  const u32 quotient = n < 0x1FFFF ? (u32)n : 0x1FFFF;
+
+  gte->flag |= overflow * FLAG_DIVIDE;
+
+  return quotient | (0x1FFFF & -overflow);
+}
+
+/*
+RTPS - Perspective Transformation (single)
+
+  IR1 = MAC1 = (TRX*1000h + RT11*VX0 + RT12*VY0 + RT13*VZ0) SAR (sf*12)
+  IR2 = MAC2 = (TRY*1000h + RT21*VX0 + RT22*VY0 + RT23*VZ0) SAR (sf*12)
+  IR3 = MAC3 = (TRZ*1000h + RT31*VX0 + RT32*VY0 + RT33*VZ0) SAR (sf*12)
+  SZ3 = MAC3 SAR ((1-sf)*12)                           ;ScreenZ FIFO 0..+FFFFh
+  MAC0=(((H*20000h/SZ3)+1)/2)*IR1+OFX, SX2=MAC0/10000h ;ScrX FIFO -400h..+3FFh
+  MAC0=(((H*20000h/SZ3)+1)/2)*IR2+OFY, SY2=MAC0/10000h ;ScrY FIFO -400h..+3FFh
+  MAC0=(((H*20000h/SZ3)+1)/2)*DQA+DQB, IR0=MAC0/1000h  ;Depth cueing 0..+1000h
+
+IR3 is saturated from MAC3 but its flag comes from MAC3 SAR 12 whatever sf is; RTPT
+only updates MAC0 / IR0 for the last vector.
+*/
+
+// SZ3, SX2, SY2 of a transformed vector, z = MAC3 SAR 12 before saturation
+static void project(gte_state *gte, s32 z, s32 ir1, s32 ir2, bool last, subpixel_cache *subpixel)
+{
+  push_sz(gte, z);
+
+  const s64 quotient = divide(gte);
+
+  const s64 sx = quotient * ir1 + gte->ofx;
+  const s64 sy = quotient * ir2 + gte->ofy;
+
+  check_mac(gte, 0, sx);
+  check_mac(gte, 0, sy);
+
+  push_sxy(gte, (s32)(sx >> 16), (s32)(sy >> 16));
+
+  // a saturated vertex has no sub-pixel position
+  if (subpixel && (sx >> 16) >= -0x400 && (sx >> 16) <= 0x3FF && (sy >> 16) >= -0x400 && (sy >> 16) <= 0x3FF)
+    subpixel_record(subpixel, gte->sxy[2][0], gte->sxy[2][1], (s32)sx, (s32)sy);
+
+  if (!last)
+    return;
+
+  const s64 depth = quotient * gte->dqa + gte->dqb;
+
+  set_mac(gte, 0, depth, 0);
+  set_ir0(gte, (s32)(depth >> 12));
+}
+
+static void rtp(gte_state *gte, const s16 *v, u32 shift, bool lm, bool last, subpixel_cache *subpixel)
+{
+  s64 sum[3];
+
+  const u32 ir3 = gte->flag & FLAG_IR(3); // the IR3 flag of the earlier vertices, see above
+
+  transform(gte, gte->rt, gte->tr, v, shift, lm, sum);
+
+  gte->flag = (gte->flag & ~FLAG_IR(3)) | ir3;
+
+  // Z as left in the 44-bit accumulator
+  const s64 z = (s64)((u64)sum[2] << 20) >> 20 >> 12;
+
+  if (z < -0x8000 || z > 0x7FFF)
+    gte->flag |= FLAG_IR(3);
+
+  project(gte, (s32)z, gte->ir[1], gte->ir[2], last, subpixel);
+}
+
+// MAC0 = SX0*SY1 + SX1*SY2 + SX2*SY0 - SX0*SY2 - SX1*SY0 - SX2*SY1
+static void nclip(gte_state *gte)
+{
+  const s16 (*s)[2] = gte->sxy;
+
+  set_mac(gte, 0, (s64)s[0][0] * s[1][1] + (s64)s[1][0] * s[2][1] + (s64)s[2][0] * s[0][1] -
+                  (s64)s[0][0] * s[2][1] - (s64)s[1][0] * s[0][1] - (s64)s[2][0] * s[1][1], 0);
+}
+
+// Outer product of [RT11,RT22,RT33] and [IR1,IR2,IR3]
+static void op(gte_state *gte, u32 shift, bool lm)
+{
+  const s32 d1 = gte->rt[0][0], d2 = gte->rt[1][1], d3 = gte->rt[2][2];
+  const s32 ir1 = gte->ir[1], ir2 = gte->ir[2], ir3 = gte->ir[3];
+
+  set_mac_ir(gte, 1, (s64)(ir3 * d2) - (s64)(ir2 * d3), shift, lm);
+  set_mac_ir(gte, 2, (s64)(ir1 * d3) - (s64)(ir3 * d1), shift, lm);
+  set_mac_ir(gte, 3, (s64)(ir2 * d1) - (s64)(ir1 * d2), shift, lm);
+}
+
+// [IR1,IR2,IR3] = (([RFC,GFC,BFC] SHL 12) - [MAC1,MAC2,MAC3]) SAR (sf*12)
+// [MAC1,MAC2,MAC3] = (([IR1,IR2,IR3] * IR0) + [MAC1,MAC2,MAC3]) SAR (sf*12)
+static void interpolate(gte_state *gte, const s32 *mac, u32 shift, bool lm)
+{
+  for (u32 i = 0; i < 3; i++)
+    set_mac_ir(gte, i + 1, ((s64)gte->fc[i] << 12) - mac[i], shift, false);
+
+  for (u32 i = 0; i < 3; i++)
+    set_mac_ir(gte, i + 1, (s64)(gte->ir[i + 1] * gte->ir[0]) + mac[i], shift, lm);
+}
+
+// [MAC1,MAC2,MAC3] = [R*IR1,G*IR2,B*IR3] SHL 4
+static void color_ir(const gte_state *gte, s32 *mac)
+{
+  for (u32 i = 0; i < 3; i++)
+    mac[i] = (s32)((u32)(gte->rgbc[i] * gte->ir[i + 1]) << 4);
+}
+
+// [IR1,IR2,IR3] = (BK*1000h + LCM*IR) SAR (sf*12)
+static void light_color(gte_state *gte, u32 shift, bool lm)
+{
+  transform(gte, gte->lcm, gte->bk, gte->ir + 1, shift, lm, NULL);
+}
+
+// NCS: LLM*V, then the light colors
+static void nc(gte_state *gte, const s16 *v, u32 shift, bool lm)
+{
+  transform(gte, gte->llm, NULL, v, shift, lm, NULL);
+  light_color(gte, shift, lm);
+  push_rgb(gte);
+}
+
+// CC and the second half of NCCS: the light color times the vertex color
+static void cc(gte_state *gte, u32 shift, bool lm)
+{
+  s32 mac[3];
+
+  color_ir(gte, mac);
+
+  for (u32 i = 0; i < 3; i++)
+    set_mac_ir(gte, i + 1, mac[i], shift, lm);
+
+  push_rgb(gte);
+}
+
+static void ncc(gte_state *gte, const s16 *v, u32 shift, bool lm)
+{
+  transform(gte, gte->llm, NULL, v, shift, lm, NULL);
+  light_color(gte, shift, lm);
+  cc(gte, shift, lm);
+}
+
+// CDP and the second half of NCDS: the light color times the vertex color, depth cued
+static void cdp(gte_state *gte, u32 shift, bool lm)
+{
+  s32 mac[3];
+
+  color_ir(gte, mac);
+  interpolate(gte, mac, shift, lm);
+  push_rgb(gte);
+}
+
+static void ncd(gte_state *gte, const s16 *v, u32 shift, bool lm)
+{
+  transform(gte, gte->llm, NULL, v, shift, lm, NULL);
+  light_color(gte, shift, lm);
+  cdp(gte, shift, lm);
+}
+
+// [MAC1,MAC2,MAC3] = [R,G,B] SHL 16, depth cued
+static void dpc(gte_state *gte, const u8 *color, u32 shift, bool lm)
+{
+  const s32 mac[3] = { color[0] << 16, color[1] << 16, color[2] << 16 };
+
+  interpolate(gte, mac, shift, lm);
+  push_rgb(gte);
+}
+
+// [MAC1,MAC2,MAC3] = [IR1,IR2,IR3] SHL 12, depth cued
+static void intpl(gte_state *gte, u32 shift, bool lm)
+{
+  const s32 mac[3] = { gte->ir[1] * 0x1000, gte->ir[2] * 0x1000, gte->ir[3] * 0x1000 };
+
+  interpolate(gte, mac, shift, lm);
+  push_rgb(gte);
+}
+
+static void sqr(gte_state *gte, u32 shift, bool lm)
+{
+  for (u32 i = 1; i <= 3; i++)
+    set_mac_ir(gte, i, gte->ir[i] * gte->ir[i], shift, lm);
+}
+
+// OTZ = (ZSF * sum of the Z) / 1000h
+static void avsz(gte_state *gte, s16 zsf, u32 sum)
+{
+  const s64 value = (s64)zsf * sum;
+
+  set_mac(gte, 0, value, 0);
+  set_otz(gte, (s32)(value >> 12));
+}
+
+// [MAC1,MAC2,MAC3] = (([IR1,IR2,IR3] * IR0) + [MAC1,MAC2,MAC3] SHL (sf*12)) SAR (sf*12),
+// from 0 for GPF
+static void gp(gte_state *gte, bool add, u32 shift, bool lm)
+{
+  for (u32 i = 1; i <= 3; i++)
+    set_mac_ir(gte, i, (s64)(gte->ir[i] * gte->ir[0]) + (add ? (s64)gte->mac[i] << shift : 0), shift, lm);
+
+  push_rgb(gte);
+}
+
+static void mvmva(gte_state *gte, u32 command, u32 shift, bool lm)
+{
+  const u32 mx = (command >> 17) & 3;
+  const u32 vx = (command >> 15) & 3;
+  const u32 cv = (command >> 13) & 3;
+
+  // matrix 3 is garbage made of RGBC, IR0, RT13 and RT22
+  const s16 r = gte->rgbc[0] << 4;
+
+  const s16 garbage[3][3] =
+  {
+    { -r, r, gte->ir[0] },
+    { gte->rt[0][2], gte->rt[0][2], gte->rt[0][2] },
+    { gte->rt[1][1], gte->rt[1][1], gte->rt[1][1] },
+  };
+
+  const s16 (*m)[3] = mx == 0 ? gte->rt : mx == 1 ? gte->llm : mx == 2 ? gte->lcm : garbage;
+
+  const s16 *v = vx < 3 ? gte->v[vx] : gte->ir + 1;
+
+  const s32 *t = cv == 0 ? gte->tr : cv == 1 ? gte->bk : cv == 2 ? gte->fc : NULL;
+
+  if (cv == 2)
+    transform_bugged(gte, m, t, v, shift, lm);
+  else
+    transform(gte, m, t, v, shift, lm, NULL);
+}
+
+static void rtpt(gte_state *gte, u32 shift, bool lm, subpixel_cache *subpixel)
+{
+  for (u32 i = 0; i < 3; i++)
+    rtp(gte, gte->v[i], shift, lm, i == 2, subpixel);
+}
+
+static void ncdt(gte_state *gte, u32 shift, bool lm, subpixel_cache *subpixel)
+{
+  for (u32 i = 0; i < 3; i++)
+    ncd(gte, gte->v[i], shift, lm);
+}
+
+// RTPT / NCDT of a host
+typedef struct
+{
+  void (*rtpt)(gte_state *gte, u32 shift, bool lm, subpixel_cache *subpixel);
+  void (*ncdt)(gte_state *gte, u32 shift, bool lm, subpixel_cache *subpixel);
+  const char *name;
+}gte_kernels;
+
+static const gte_kernels scalar_kernels = { rtpt, ncdt, "scalar" };
+
+#if defined(__x86_64__)
+
+/*
+AVX2 kernels of RTPT / NCDT, picked once when the host has it (see kernels_of_host); the
+scalar commands are the reference they match bit for bit (see gte_check). The three
+vectors are the 64-bit lanes 0-2 (lane 3 is zero): _mm256_mul_epi32 gives the exact
+products, the FLAG bits come from lane compares. The single vector commands stay scalar,
+one vector does not fill the lanes enough to pay for them.
+*/
+
+#define AVX2_FN static inline __attribute__((always_inline, target("avx2")))
+
+// Lanes of value past 44 bits into pos / neg
+AVX2_FN void check_mac44_avx2(__m256i value, __m256i *pos, __m256i *neg)
+{
+  *pos = _mm256_or_si256(*pos, _mm256_cmpgt_epi64(value, _mm256_set1_epi64x(0x7FFFFFFFFFFLL)));
+  *neg = _mm256_or_si256(*neg, _mm256_cmpgt_epi64(_mm256_set1_epi64x(-0x80000000000LL), value));
+}
+
+// ((value + 2^43) & (2^44 - 1)) - 2^43
+AVX2_FN __m256i wrap44_avx2(__m256i value)
+{
+  const __m256i half = _mm256_set1_epi64x(1LL << 43);
+
+  return _mm256_sub_epi64(_mm256_and_si256(_mm256_add_epi64(value, half), _mm256_set1_epi64x((1LL << 44) - 1)), half);
+}
+
+// mac44(): checked, then wrapped to 44 bits
+AVX2_FN __m256i mac44_avx2(__m256i value, __m256i *pos, __m256i *neg)
+{
+  check_mac44_avx2(value, pos, neg);
+
+  return wrap44_avx2(value);
+}
+
+// Low 32 bits of the lanes of value SHR shift (SAR when the result fits in 32 bits)
+AVX2_FN __m128i low32_avx2(__m256i value, u32 shift)
+{
+  const __m256i low = _mm256_permutevar8x32_epi32(_mm256_srl_epi64(value, _mm_cvtsi32_si128(shift)),
+                                                  _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+
+  return _mm256_castsi256_si128(low);
+}
+
+// Lanes of mac saturated to IR
+AVX2_FN __m128i ir_avx2(__m128i mac, bool lm)
+{
+  return _mm_min_epi32(_mm_max_epi32(mac, _mm_set1_epi32(lm ? 0 : -0x8000)), _mm_set1_epi32(0x7FFF));
+}
+
+// Lanes 0-2 of a compare mask
+AVX2_FN u32 lanes_set(__m128i mask)
+{
+  return _mm_movemask_ps(_mm_castsi128_ps(mask)) & 7;
+}
+
+AVX2_FN u32 lanes_set64(__m256i mask)
+{
+  return _mm256_movemask_pd(_mm256_castsi256_pd(mask)) & 7;
+}
+
+
+// Component c of V0-V2
+AVX2_FN __m256i vectors_avx2(const s16 v[3][3], u32 c)
+{
+  return _mm256_setr_epi64x(v[0][c], v[1][c], v[2][c], 0);
+}
+
+// Row of T*1000h + M*V for the vectors x, y, z; the lanes past 44 bits in pos / neg
+AVX2_FN __m256i row_avx2(const s16 *m, s32 t, __m256i x, __m256i y, __m256i z, __m256i *pos, __m256i *neg)
+{
+  __m256i value = _mm256_set1_epi64x((s64)t << 12);
+
+  value = mac44_avx2(_mm256_add_epi64(value, _mm256_mul_epi32(_mm256_set1_epi64x(m[0]), x)), pos, neg);
+  value = mac44_avx2(_mm256_add_epi64(value, _mm256_mul_epi32(_mm256_set1_epi64x(m[1]), y)), pos, neg);
+
+  return _mm256_add_epi64(value, _mm256_mul_epi32(_mm256_set1_epi64x(m[2]), z));
+}
+
+// set_mac_ir() of MAC / IR index (1-3) for every vector, the FLAG bits set
+AVX2_FN u32 mac_ir_avx2(u32 index, __m256i value, u32 shift, bool lm, __m256i pos, __m256i neg, __m128i *mac,
+                        __m128i *ir)
+{
+  check_mac44_avx2(value, &pos, &neg);
+
+  *mac = low32_avx2(value, shift);
+  *ir = ir_avx2(*mac, lm);
+
+  return (lanes_set64(pos) ? FLAG_MAC_POS(index) : 0) | (lanes_set64(neg) ? FLAG_MAC_NEG(index) : 0) |
+         (lanes_set(_mm_cmpeq_epi32(*mac, *ir)) != 7 ? FLAG_IR(index) : 0);
+}
+
+// MAC1-MAC3 and IR1-IR3 are left by the last vector
+AVX2_FN void set_last_avx2(gte_state *gte, const __m128i mac[3], const __m128i ir[3])
+{
+  for (u32 i = 0; i < 3; i++)
+  {
+    gte->mac[i + 1] = _mm_extract_epi32(mac[i], 2);
+    gte->ir[i + 1] = _mm_extract_epi32(ir[i], 2);
+  }
+}
+
+__attribute__((target("avx2")))
+static void rtpt_avx2(gte_state *gte, u32 shift, bool lm, subpixel_cache *subpixel)
+{
+  const __m256i x = vectors_avx2(gte->v, 0), y = vectors_avx2(gte->v, 1), z = vectors_avx2(gte->v, 2);
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m128i mac[3], ir[3], depth;
+  u32 flag = 0;
+
+  for (u32 i = 0; i < 3; i++)
+  {
+    __m256i pos = zero, neg = zero;
+
+    const __m256i value = row_avx2(gte->rt[i], gte->tr[i], x, y, z, &pos, &neg);
+
+    flag |= mac_ir_avx2(i + 1, value, shift, lm, pos, neg, &mac[i], &ir[i]);
+
+    if (i == 2)
+      depth = low32_avx2(wrap44_avx2(value), 12);
+  }
+
+  // IR3 is flagged from the depth, see rtp()
+  const __m128i inside = _mm_and_si128(_mm_cmpgt_epi32(depth, _mm_set1_epi32(-0x8001)),
+                                       _mm_cmplt_epi32(depth, _mm_set1_epi32(0x8000)));
+
+  gte->flag |= (flag & ~FLAG_IR(3)) | (lanes_set(inside) != 7 ? FLAG_IR(3) : 0);
+
+  s32 sz[4], sx[4], sy[4];
+
+  _mm_storeu_si128((__m128i *)sz, depth);
+  _mm_storeu_si128((__m128i *)sx, ir[0]);
+  _mm_storeu_si128((__m128i *)sy, ir[1]);
+
+  for (u32 i = 0; i < 3; i++)
+    project(gte, sz[i], sx[i], sy[i], i == 2, subpixel);
+
+  set_last_avx2(gte, mac, ir);
+}
+
+__attribute__((target("avx2")))
+static void ncdt_avx2(gte_state *gte, u32 shift, bool lm, subpixel_cache *subpixel)
+{
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m256i x = vectors_avx2(gte->v, 0), y = vectors_avx2(gte->v, 1), z = vectors_avx2(gte->v, 2);
+
+  __m128i mac[3], ir[3];
+  u32 flag = 0;
+
+  // LLM*V
+  for (u32 i = 0; i < 3; i++)
+  {
+    __m256i pos = zero, neg = zero;
+
+    const __m256i value = row_avx2(gte->llm[i], 0, x, y, z, &pos, &neg);
+
+    flag |= mac_ir_avx2(i + 1, value, shift, lm, pos, neg, &mac[i], &ir[i]);
+  }
+
+  // BK*1000h + LCM*IR
+  x = _mm256_cvtepi32_epi64(ir[0]);
+  y = _mm256_cvtepi32_epi64(ir[1]);
+  z = _mm256_cvtepi32_epi64(ir[2]);
+
+  for (u32 i = 0; i < 3; i++)
+  {
+    __m256i pos = zero, neg = zero;
+
+    const __m256i value = row_avx2(gte->lcm[i], gte->bk[i], x, y, z, &pos, &neg);
+
+    flag |= mac_ir_avx2(i + 1, value, shift, lm, pos, neg, &mac[i], &ir[i]);
+  }
+
+  // cdp(): the vertex color, then the far color
+  const __m256i ir0 = _mm256_set1_epi64x(gte->ir[0]);
+
+  s32 rgb[3][4];
+
+  for (u32 i = 0; i < 3; i++)
+  {
+    const __m256i color = _mm256_cvtepi32_epi64(_mm_slli_epi32(_mm_mullo_epi32(_mm_set1_epi32(gte->rgbc[i]), ir[i]), 4));
+    const __m256i far = _mm256_set1_epi64x((s64)gte->fc[i] << 12);
+
+    flag |= mac_ir_avx2(i + 1, _mm256_sub_epi64(far, color), shift, false, zero, zero, &mac[i], &ir[i]);
+
+    const __m256i cued = _mm256_add_epi64(_mm256_mul_epi32(_mm256_cvtepi32_epi64(ir[i]), ir0), color);
+
+    flag |= mac_ir_avx2(i + 1, cued, shift, lm, zero, zero, &mac[i], &ir[i]);
+
+    // push_rgb()
+    const __m128i value = _mm_srai_epi32(mac[i], 4);
+    const __m128i clamped = _mm_min_epi32(_mm_max_epi32(value, _mm_setzero_si128()), _mm_set1_epi32(0xFF));
+
+    if (lanes_set(_mm_cmpeq_epi32(value, clamped)) != 7)
+      flag |= FLAG_COLOR(i);
+
+    _mm_storeu_si128((__m128i *)rgb[i], clamped);
+  }
+
+  gte->flag |= flag;
+
+  for (u32 j = 0; j < 3; j++)
+  {
+    for (u32 i = 0; i < 3; i++)
+      gte->rgb[j][i] = rgb[i][j];
+
+    gte->rgb[j][3] = gte->rgbc[3];
+  }
+
+  set_last_avx2(gte, mac, ir);
+}
+
+static const gte_kernels avx2_kernels = { rtpt_avx2, ncdt_avx2, "avx2" };
+
+#endif
+
+// The kernels of the host, the AVX2 ones when the CPU has it. Picked on the first command:
+// pthread_once() as in raster.c costs more than a whole command, a relaxed load is a
+// plain one and the threads racing to pick store the same pointer.
+static _Atomic(const gte_kernels *) host_kernels;
+
+static const gte_kernels *kernels_of_host(void)
+{
+  const gte_kernels *kernels = atomic_load_explicit(&host_kernels, memory_order_relaxed);
+
+  if (kernels)
+    return kernels;
+
+  kernels = &scalar_kernels;
+
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+    kernels = &avx2_kernels;
+#endif
+
+  atomic_store_explicit(&host_kernels, kernels, memory_order_relaxed);
+
+  return kernels;
+}
+
+static void execute(gte_state *gte, u32 command, subpixel_cache *subpixel, const gte_kernels *kernels)
+{
+  const u32 shift = ((command >> 19) & 1) * 12;
+  const bool lm = (command >> 10) & 1;
+
+  gte->flag = 0;
+
+  switch (command & 0x3f)
+  {
+  case 0x01: rtp(gte, gte->v[0], shift, lm, true, subpixel); break;    // RTPS
+  case 0x06: nclip(gte); break;                               // NCLIP
+  case 0x0c: op(gte, shift, lm); break;                       // OP
+  case 0x10: dpc(gte, gte->rgbc, shift, lm); break;           // DPCS
+  case 0x11: intpl(gte, shift, lm); break;                    // INTPL
+  case 0x12: mvmva(gte, command, shift, lm); break;           // MVMVA
+  case 0x13: ncd(gte, gte->v[0], shift, lm); break;           // NCDS
+  case 0x14: light_color(gte, shift, lm); cdp(gte, shift, lm); break; // CDP
+  case 0x16: kernels->ncdt(gte, shift, lm, subpixel); break; // NCDT
+  case 0x1b: ncc(gte, gte->v[0], shift, lm); break;           // NCCS
+  case 0x1c: light_color(gte, shift, lm); cc(gte, shift, lm); break; // CC
+  case 0x1e: nc(gte, gte->v[0], shift, lm); break;            // NCS
+  case 0x20:                                                  // NCT
+    for (u32 i = 0; i < 3; i++)
+      nc(gte, gte->v[i], shift, lm);
+    break;
+  case 0x28: sqr(gte, shift, lm); break;                      // SQR
+  case 0x29: cdp(gte, shift, lm); break;                      // DCPL
+  case 0x2a:                                                  // DPCT
+    for (u32 i = 0; i < 3; i++)
+    {
+      const u8 color[3] = { gte->rgb[0][0], gte->rgb[0][1], gte->rgb[0][2] };
+
+      dpc(gte, color, shift, lm);
+    }
+    break;
+  case 0x2d: avsz(gte, gte->zsf3, gte->sz[1] + gte->sz[2] + gte->sz[3]); break;              // AVSZ3
+  case 0x2e: avsz(gte, gte->zsf4, gte->sz[0] + gte->sz[1] + gte->sz[2] + gte->sz[3]); break; // AVSZ4
+  case 0x30: kernels->rtpt(gte, shift, lm, subpixel); break; // RTPT
+  case 0x3d: gp(gte, false, shift, lm); break;                // GPF
+  case 0x3e: gp(gte, true, shift, lm); break;                 // GPL
+  case 0x3f:                                                  // NCCT
+    for (u32 i = 0; i < 3; i++)
+      ncc(gte, gte->v[i], shift, lm);
+    break;
+  default: break;                                             // N/A
+  }
+
+  if (gte->flag & FLAG_ERROR_MASK)
+    gte->flag |= FLAG_ERROR;
+}
+
+void gte_execute(gte_state *gte, u32 command, subpixel_cache *subpixel)
+{
+  execute(gte, command, subpixel, kernels_of_host());
+}
+
+// Registers
+
+static inline u32 pack16(s32 lo, s32 hi)
+{
+  return (u16)lo | ((u32)(u16)hi << 16);
+}
+
+// IRGB / ORGB: IR1-IR3 / 80h saturated to 5 bits each
+static u32 orgb(const gte_state *gte)
+{
+  u32 value = 0;
+
+  for (u32 i = 0; i < 3; i++)
+  {
+    const s32 c = gte->ir[i + 1] >> 7;
+
+    value |= (u32)(c < 0 ? 0 : c > 0x1f ? 0x1f : c) << (i * 5);
+  }
+
+  return value;
+}
+
+// RT / LLM / LCM: two 16-bit elements per register, the last one alone (sign extended)
+static u32 read_matrix(const s16 m[3][3], u32 index)
+{
+  const s16 *e = &m[0][0] + index * 2;
+
+  return index < 4 ? pack16(e[0], e[1]) : (u32)(s32)e[0];
+}
+
+static void write_matrix(s16 m[3][3], u32 index, u32 value)
+{
+  s16 *e = &m[0][0] + index * 2;
+
+  e[0] = value;
+
+  if (index < 4)
+    e[1] = value >> 16;
+}
+
+u32 gte_read(const gte_state *gte, u32 reg)
+{
+  u32 value;
+
+  switch (reg)
+  {
+  case 0: case 2: case 4: return pack16(gte->v[reg / 2][0], gte->v[reg / 2][1]);
+  case 1: case 3: case 5: return (s32)gte->v[reg / 2][2];
+  case 6:                 memcpy(&value, gte->rgbc, 4); return value;
+  case 7:                 return gte->otz;
+  case 8: case 9: case 10: case 11: return (s32)gte->ir[reg - 8];
+  case 12: case 13: case 14: return pack16(gte->sxy[reg - 12][0], gte->sxy[reg - 12][1]);
+  case 15:                return pack16(gte->sxy[2][0], gte->sxy[2][1]); // SXYP mirrors SXY2
+  case 16: case 17: case 18: case 19: return gte->sz[reg - 16];
+  case 20: case 21: case 22: memcpy(&value, gte->rgb[reg - 20], 4); return value;
+  case 23:                return gte->res1;
+  case 24: case 25: case 26: case 27: return gte->mac[reg - 24];
+  case 28: case 29:       return orgb(gte);
+  case 30:                return gte->lzcs;
+  case 31:                return gte->lzcr;
+
+  case 32: case 33: case 34: case 35: case 36: return read_matrix(gte->rt, reg - 32);
+  case 37: case 38: case 39: return gte->tr[reg - 37];
+  case 40: case 41: case 42: case 43: case 44: return read_matrix(gte->llm, reg - 40);
+  case 45: case 46: case 47: return gte->bk[reg - 45];
+  case 48: case 49: case 50: case 51: case 52: return read_matrix(gte->lcm, reg - 48);
+  case 53: case 54: case 55: return gte->fc[reg - 53];
+  case 56:                return gte->ofx;
+  case 57:                return gte->ofy;
+  case 58:                return (s32)(s16)gte->h; // unsigned, but reads sign extended
+  case 59:                return (s32)gte->dqa;
+  case 60:                return gte->dqb;
+  case 61:                return (s32)gte->zsf3;
+  case 62:                return (s32)gte->zsf4;
+  default:                return gte->flag;
+  }
+}
+
+void gte_write(gte_state *gte, u32 reg, u32 value)
+{
+  switch (reg)
+  {
+  case 0: case 2: case 4: gte->v[reg / 2][0] = value; gte->v[reg / 2][1] = value >> 16; break;
+  case 1: case 3: case 5: gte->v[reg / 2][2] = value; break;
+  case 6:                 memcpy(gte->rgbc, &value, 4); break;
+  case 7:                 gte->otz = value; break;
+  case 8: case 9: case 10: case 11: gte->ir[reg - 8] = value; break;
+  case 12: case 13: case 14: gte->sxy[reg - 12][0] = value; gte->sxy[reg - 12][1] = value >> 16; break;
+  case 15:                                                   // SXYP pushes the FIFO
+    memmove(gte->sxy[0], gte->sxy[1], sizeof(gte->sxy[0]) * 2);
+    gte->sxy[2][0] = value;
+    gte->sxy[2][1] = value >> 16;
+    break;
+  case 16: case 17: case 18: case 19: gte->sz[reg - 16] = value; break;
+  case 20: case 21: case 22: memcpy(gte->rgb[reg - 20], &value, 4); break;
+  case 23:                gte->res1 = value; break;
+  case 24: case 25: case 26: case 27: gte->mac[reg - 24] = value; break;
+  case 28:                                                   // IRGB sets IR1-IR3
+    for (u32 i = 0; i < 3; i++)
+      gte->ir[i + 1] = ((value >> (i * 5)) & 0x1f) << 7;
+    break;
+  case 29:                break;                             // ORGB (R)
+  case 30:                                                   // LZCS: leading zeros, or ones when negative
+    gte->lzcs = value;
+    value = (s32)value < 0 ? ~value : value;
+    gte->lzcr = value ? __builtin_clz(value) : 32;
+    break;
+  case 31:                break;                             // LZCR (R)
+
+  case 32: case 33: case 34: case 35: case 36: write_matrix(gte->rt, reg - 32, value); break;
+  case 37: case 38: case 39: gte->tr[reg - 37] = value; break;
+  case 40: case 41: case 42: case 43: case 44: write_matrix(gte->llm, reg - 40, value); break;
+  case 45: case 46: case 47: gte->bk[reg - 45] = value; break;
+  case 48: case 49: case 50: case 51: case 52: write_matrix(gte->lcm, reg - 48, value); break;
+  case 53: case 54: case 55: gte->fc[reg - 53] = value; break;
+  case 56:                gte->ofx = value; break;
+  case 57:                gte->ofy = value; break;
+  case 58:                gte->h = value; break;
+  case 59:                gte->dqa = value; break;
+  case 60:                gte->dqb = value; break;
+  case 61:                gte->zsf3 = value; break;
+  case 62:                gte->zsf4 = value; break;
+  default:                                                   // FLAG: bits 0-11 read as 0, bit 31 follows
+    gte->flag = value & 0x7FFFF000;
+
+    if (gte->flag & FLAG_ERROR_MASK)
+      gte->flag |= FLAG_ERROR;
+    break;
+  }
+}
+
+// Kernel check
+
+static u64 check_random(u64 *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+
+  return *state;
+}
+
+// Register values: any, small, signed 16-bit or two packed 13-bit halves, so the sums
+// reach both the saturations and the in-range results
+static u32 check_value(u64 *state)
+{
+  const u32 value = check_random(state);
+
+  switch (check_random(state) & 3)
+  {
+  case 0:  return value;
+  case 1:  return value & 0xFFF;
+  case 2:  return (s32)(s16)value;
+  default: return (value & 0x1FFF) | (value & 0x1FFF) << 16;
+  }
+}
+
+u64 gte_check(u64 commands, u64 seed)
+{
+  static const u8 ops[] = { 0x01, 0x06, 0x0c, 0x10, 0x11, 0x12, 0x13, 0x14, 0x16, 0x1b, 0x1c,
+                            0x1e, 0x20, 0x28, 0x29, 0x2a, 0x2d, 0x2e, 0x30, 0x3d, 0x3e, 0x3f };
+
+  const gte_kernels *kernels = kernels_of_host();
+
+  subpixel_cache *caches = calloc(2, sizeof(subpixel_cache));
+
+  if (!caches)
+    return commands;
+
+  for (u32 i = 0; i < 2; i++)
+  {
+    caches[i].enabled = true;
+    caches[i].frame = 2;
+  }
+
+  gte_state host, reference;
+  u64 state = seed | 1;
+  u64 mismatches = 0;
+
+  memset(&host, 0, sizeof(host));
+
+  for (u64 n = 0; n < commands; n++)
+  {
+    // new registers every 8 commands, the results of the others feed the next ones
+    for (u32 reg = 0; reg < 64 && n % 8 == 0; reg++)
+      if (reg != 15 && reg != 28 && reg != 30 && reg != 31 && reg != 63)
+        gte_write(&host, reg, check_value(&state));
+
+    const u32 command = ops[check_random(&state) % sizeof(ops)] | (check_random(&state) & 0xFFFC0);
+
+    reference = host;
+
+    execute(&host, command, &caches[0], kernels);
+    execute(&reference, command, &caches[1], &scalar_kernels);
+
+    bool same = caches[0].recorded == caches[1].recorded &&
+                !memcmp(caches[0].entries, caches[1].entries, sizeof(caches[0].entries));
+
+    for (u32 reg = 0; reg < 64; reg++)
+      same &= gte_read(&host, reg) == gte_read(&reference, reg);
+
+    if (!same)
+    {
+      mismatches++;
+
+      host = reference;
+      caches[0] = caches[1];
+    }
+  }
+
+  free(caches);
+
+  return mismatches;
+}
+
+const char *gte_kernels_name(void)
+{
+  return kernels_of_host()->name;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "typedef.h"
+#include "subpixel.h"
+
+// COP2 Geometry Transformation Engine (GTE)
+// 32 data registers (MFC2/MTC2, LWC2/SWC2) and 32 control registers (CFC2/CTC2),
+// numbered 0-31 and 32-63 here. Values are fixed point: matrices 1.3.12, vectors
+// 1.15.0 or 1.3.12, translations 1.31.0.
+//
+// Command (COP2 imm25)
+//   19     sf  Shift Fraction in IR registers (0=No fraction, 1=12bit fraction)
+//   17-18  MVMVA Multiply Matrix   (0=Rotation, 1=Light, 2=Color, 3=Reserved)
+//   15-16  MVMVA Multiply Vector   (0=V0, 1=V1, 2=V2, 3=IR/long)
+//   13-14  MVMVA Translation Vector (0=TR, 1=BK, 2=FC/Bugged, 3=None)
+//   10     lm  Saturate IR1,IR2,IR3 result (0=To -8000h..+7FFFh, 1=To 0..+7FFFh)
+//   0-5    Real GTE Command Number
+//
+// Every command starts with a clear FLAG and sets a bit per saturation or overflow;
+// bit 31 is the OR of bits 30-23 and 18-13.
+//
+// x64 hosts with AVX2 run RTPT / NCDT through SIMD kernels, picked once; the scalar
+// code is their reference (same results, same FLAG, same sub-pixel records).
+
+typedef struct
+{
+  // Data registers
+  s16 v[3][3];     // r0-r5    VXY0,VZ0 .. VXY2,VZ2  vectors 0-2 (X, Y, Z)
+  u8 rgbc[4];      // r6       RGBC                  color, CODE in the last byte
+  u16 otz;         // r7       OTZ                   average Z (0..FFFFh)
+  s16 ir[4];       // r8-r11   IR0                   interpolation, IR1-IR3 vector
+  s16 sxy[3][2];   // r12-r14  SXY0-SXY2             screen XY FIFO (r15 SXYP pushes)
+  u16 sz[4];       // r16-r19  SZ0-SZ3               screen Z FIFO (0..FFFFh)
+  u8 rgb[3][4];    // r20-r22  RGB0-RGB2             color FIFO
+  u32 res1;        // r23      RES1                  prohibited
+  s32 mac[4];      // r24-r27  MAC0-MAC3             sums of the last command
+  u32 lzcs;        // r30      LZCS                  leading zero count source
+  u32 lzcr;        // r31      LZCR                  leading zero count result (R)
+
+  // Control registers
+  s16 rt[3][3];    // r32-r36  RT11..RT33            rotation matrix
+  s32 tr[3];       // r37-r39  TRX, TRY, TRZ         translation vector
+  s16 llm[3][3];   // r40-r44  L11..L33              light source matrix
+  s32 bk[3];       // r45-r47  RBK, GBK, BBK         background color
+  s16 lcm[3][3];   // r48-r52  LR1..LB3              light color matrix
+  s32 fc[3];       // r53-r55  RFC, GFC, BFC         far color
+  s32 ofx, ofy;    // r56-r57  OFX, OFY              screen offset (16.16)
+  u16 h;           // r58      H                     projection plane distance
+  s16 dqa;         // r59      DQA                   depth queing coefficient
+  s32 dqb;         // r60      DQB                   depth queing offset
+  s16 zsf3, zsf4;  // r61-r62  ZSF3, ZSF4            average Z scale factors
+  u32 flag;        // r63      FLAG                  saturations of the last command
+}gte_state;
+
+u32  gte_read(const gte_state *gte, u32 reg);        // MFC2 / CFC2 / SWC2
+void gte_write(gte_state *gte, u32 reg, u32 value);  // MTC2 / CTC2 / LWC2
+
+// COP2 imm25; RTPS/RTPT record their un-rounded vertices in subpixel (NULL = off)
+void gte_execute(gte_state *gte, u32 command, subpixel_cache *subpixel);
+
+// Run commands random commands (and registers) through the kernels of the host and
+// through the scalar code, returns how many left different registers or sub-pixel records
+u64 gte_check(u64 commands, u64 seed);
+
+const char *gte_kernels_name(void); // "avx2" or "scalar"
@@ -0,0 +1,20 @@
+#pragma once
+#include "typedef.h"
+
+// FNV-1a 64, used to identify images and to compare machine state between runs
+#define HASH_INIT 0xcbf29ce484222325ull
+
+static inline u64 hash_update(u64 h, const void *data, u32 size)
+{
+  const u8 *bytes = data;
+
+  for (u32 i = 0; i < size; i++)
+    h = (h ^ bytes[i]) * 0x100000001b3ull;
+
+  return h;
+}
+
+static inline u64 hash64(const void *data, u32 size)
+{
+  return hash_update(HASH_INIT, data, size);
+}
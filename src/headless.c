@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "machine.h"
+#include "block.h"
+#include "runner.h"
+#include "hash.h"
+#include "boot.h"
+#include "exe.h"
+#include "state.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "movie.h"
+
+// Headless batch runner
+// Boots the BIOS and / or a PS-X EXE with no window, audio device or vsync throttling,
+// runs uncapped for a number of frames or cycles and prints the final RAM hash and the
+// timing stats, so runs can be compared by regression scripts and replayed in bulk on
+// servers. Several independent machines can run at once, spread over a pinned thread pool.
+
+static void usage(void)
+{
+  printf("usage: psemulator-headless -bios <file> [-exe <file>] [options]\n"
+         "       psemulator-headless -exe <file> [options]\n"
+         "  -exe <file>     PS-X EXE started at the shell entry, or at reset without -bios\n"
+         "  -bios-hash <h>  refuse a BIOS image whose hash is not h (hex, see the bios line)\n"
+         "  -frames <n>     run n NTSC frames (default 60)\n"
+         "  -cycles <n>     run n CPU cycles instead\n"
+         "  -cpu <core>     rec (recompiler, default), blocks (cached interpreter), ir (IR interpreter)\n"
+         "                  or ir-check (IR interpreter checked block by block against the interpreter)\n"
+         "  -fastmem        map the memory through the 4 GBytes host reservation\n"
+         "  -subpixel       record the sub-pixel position of the GTE vertices for the GPU\n"
+         "  -gpu-thread     draw the GP0 packets on a rasterizer thread of each machine\n"
+         "  -fastboot       start at the shell entry, the kernel is initialised once per BIOS\n"
+         "  -boot-cache <d> keep the shell entry snapshot of each BIOS in directory d for later runs\n"
+         "  -load-state <f> start from a save state (taken with the same BIOS)\n"
+         "  -save-state <f> save the state of machine 0 at the end\n"
+         "  -rewind <n>     keep a rewind buffer and step back n snapshots at the end\n"
+         "  -rewind-interval <n>  frames between snapshots (default 1)\n"
+         "  -rewind-budget <n>    MBytes of snapshots per machine (default 64)\n"
+         "  -runahead <n>   run n frames ahead of every frame (the result must not change)\n"
+         "  -record <file>  record an input movie of machine 0\n"
+         "  -play <file>    replay an input movie to its end and check its hashes\n"
+         "  -hash-interval <n>  frames between the RAM and VRAM hashes of a recording (default 60)\n"
+         "  -buttons <h>    pad buttons held in slot 0 (hex, see pad.h)\n"
+         "  -instances <n>  run n independent machines (default 1)\n"
+         "  -threads <n>    worker threads (default one per online core)\n"
+         "  -gte-check <n>  run n random GTE commands through the kernels of the host and the\n"
+         "                  scalar code and compare them, no machine is run\n");
+}
+
+// CPU loops of -cpu
+typedef struct
+{
+  const char *name;
+  cpu_loop loop;
+}cpu_core;
+
+enum CPU_CORE
+{
+  CORE_REC,
+  CORE_BLOCKS,
+  CORE_IR,
+  CORE_IR_CHECK,
+  CORE_COUNT
+};
+
+static const cpu_core cores[CORE_COUNT] =
+{
+  [CORE_REC]      = { "rec",      run_recompiler },
+  [CORE_BLOCKS]   = { "blocks",   run_blocks     },
+  [CORE_IR]       = { "ir",       run_ir         },
+  [CORE_IR_CHECK] = { "ir-check", run_ir_check   },
+};
+
+static u32 find_core(const char *name)
+{
+  u32 core = 0;
+
+  while (core < CORE_COUNT && strcmp(cores[core].name, name))
+    core++;
+
+  return core;
+}
+
+static void print_ir_check(const ir_check *check)
+{
+  static const char *const what[] = { "r", "hi", "lo", "pc", "next pc", "store" };
+
+  printf("         ir-check %llu blocks, %llu differ from the interpreter\n", (unsigned long long)check->blocks,
+         (unsigned long long)check->mismatches);
+
+  if (!check->mismatches)
+    return;
+
+  const ir_diff *d = &check->first;
+
+  if (d->what == IR_DIFF_GPR)
+    printf("         first at block %08x: r%u %08x, interpreter %08x\n", d->block, d->where, d->ir, d->interpreter);
+  else if (d->what == IR_DIFF_STORE)
+    printf("         first at block %08x: store [%08x] %08x, interpreter %08x\n", d->block, d->where, d->ir,
+           d->interpreter);
+  else
+    printf("         first at block %08x: %s %08x, interpreter %08x\n", d->block, what[d->what], d->ir, d->interpreter);
+}
+
+static double seconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Per machine results of the frame features
+typedef struct
+{
+  u32 rewind_count; // before stepping back
+  u64 rewind_usage;
+
+  bool movie;
+  u32 movie_frames;
+  u32 movie_verified;
+  bool movie_diverged;
+}run_report;
+
+typedef struct
+{
+  u64 cycles;
+  u32 core;                    // CPU_CORE
+
+  const bios_image *fast_boot; // NULL = boot through the BIOS shell
+  const char *boot_cache;      // directory of the shell entry snapshots, NULL = none
+
+  const u8 *exe;               // PS-X EXE started at the shell entry, or at reset without BIOS
+  u32 exe_size;
+
+  FILE *state;                 // save state to start from, NULL = none
+
+  u32 rewind;                  // snapshots to step back at the end, 0 = no rewind buffer
+  rewind_config rewind_config;
+
+  u32 runahead;                // frames run ahead, 0 = off
+
+  const char *record;          // input movie to record or replay, NULL = none
+  const char *play;
+  u32 hash_interval;
+  u16 buttons;                 // slot 0 input while recording
+
+  machine **machines;
+  run_report *reports;         // one per machine
+}run_options;
+
+static run_report *find_report(const run_options *options, machine *m)
+{
+  u32 i = 0;
+
+  while (options->machines[i] != m)
+    i++;
+
+  return &options->reports[i];
+}
+
+static void run_job(machine *m, void *arg)
+{
+  const run_options *options = arg;
+  run_report *report = find_report(options, m);
+
+  // the cycle budget starts at the shell entry or at the state
+  u64 deadline = options->cycles;
+
+  if (options->state)
+  {
+    if (!state_load(fileno(options->state)))
+      fprintf(stderr, "the save state does not match the machine\n");
+
+    deadline += m->cpu.cycles;
+  }
+  else if (options->fast_boot)
+  {
+    if (!fast_boot(options->fast_boot, options->boot_cache))
+      fprintf(stderr, "the BIOS did not reach the shell entry\n");
+
+    deadline += m->cpu.cycles;
+  }
+
+  if (options->exe && !options->state)
+    load_exe(&m->cpu, options->exe, options->exe_size);
+
+  const cpu_loop loop = cores[options->core].loop;
+
+  pad_set_buttons(0, options->buttons);
+
+  if (!options->rewind && !options->runahead && !options->record && !options->play)
+  {
+    run_until(&m->cpu, loop, deadline);
+    return;
+  }
+
+  rewind_buffer *rb = options->rewind ? rewind_create(&options->rewind_config) : NULL;
+  runahead *ra = options->runahead ? runahead_create(options->runahead) : NULL;
+  movie *mv = NULL;
+
+  if (options->rewind && !rb)
+    fprintf(stderr, "cannot create the rewind buffer (budget smaller than two states?)\n");
+
+  if (options->runahead && !ra)
+    fprintf(stderr, "cannot start the run-ahead\n");
+
+  if (options->record && !(mv = movie_record(options->record, options->hash_interval)))
+    fprintf(stderr, "cannot record the movie %s\n", options->record);
+
+  // the whole movie
+  if (options->play && (mv = movie_play(options->play)))
+    deadline = UINT64_MAX;
+  else if (options->play)
+    fprintf(stderr, "cannot replay the movie %s (missing, of an older format or recorded with another BIOS)\n", options->play);
+
+  // frame by frame
+  for (u64 frame = m->cpu.cycles + FRAME_CYCLES; m->cpu.cycles < deadline; frame += FRAME_CYCLES)
+  {
+    const u64 frame_end = frame < deadline ? frame : deadline;
+
+    if (mv && !movie_frame_start(mv))
+      break;
+
+    // nothing is presented: the frames ahead only cost time, the final state is the
+    // one of a run without run-ahead
+    if (ra)
+      runahead_frame(ra, &m->cpu, loop, frame_end, NULL, NULL);
+    else
+      run_until(&m->cpu, loop, frame_end);
+
+    if (rb)
+      rewind_frame(rb);
+
+    if (mv && !movie_frame_end(mv))
+      break;
+  }
+
+  if (rb)
+  {
+    report->rewind_count = rewind_count(rb);
+    report->rewind_usage = rewind_usage(rb);
+
+    if (!rewind_back(rb, options->rewind))
+      fprintf(stderr, "the rewind buffer does not hold %u snapshots\n", options->rewind);
+  }
+
+  if (mv)
+  {
+    report->movie = true;
+    report->movie_frames = movie_frames(mv);
+    report->movie_verified = movie_verified(mv);
+    report->movie_diverged = movie_diverged(mv);
+  }
+
+  movie_close(mv);
+  runahead_destroy(ra);
+  rewind_destroy(rb);
+}
+
+int main(int argc, char **argv)
+{
+  const char *bios_path = NULL;
+  u64 bios_hash = 0;
+  run_options options = { 60 * (u64)FRAME_CYCLES, CORE_REC, NULL, NULL, NULL, 0, NULL, 0, { 64ull * 1024 * 1024, 1, 60 }, 0,
+                          NULL, NULL, 60 };
+  const char *exe_path = NULL;
+  const char *load_path = NULL;
+  const char *save_path = NULL;
+  bool fastboot = false;
+  bool fastmem = false;
+  bool subpixel = false;
+  bool threaded_gpu = false;
+  u32 instances = 1;
+  u32 threads = 0;
+  u64 gte_commands = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const bool value = i + 1 < argc;
+
+    if (!strcmp(argv[i], "-bios") && value)
+      bios_path = argv[++i];
+    else if (!strcmp(argv[i], "-exe") && value)
+      exe_path = argv[++i];
+    else if (!strcmp(argv[i], "-bios-hash") && value)
+      bios_hash = strtoull(argv[++i], NULL, 16);
+    else if (!strcmp(argv[i], "-frames") && value)
+      options.cycles = strtoull(argv[++i], NULL, 0) * FRAME_CYCLES;
+    else if (!strcmp(argv[i], "-cycles") && value)
+      options.cycles = strtoull(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-cpu") && value && (options.core = find_core(argv[i + 1])) < CORE_COUNT)
+      i++;
+    else if (!strcmp(argv[i], "-fastmem"))
+      fastmem = true;
+    else if (!strcmp(argv[i], "-subpixel"))
+      subpixel = true;
+    else if (!strcmp(argv[i], "-gpu-thread"))
+      threaded_gpu = true;
+    else if (!strcmp(argv[i], "-fastboot"))
+      fastboot = true;
+    else if (!strcmp(argv[i], "-boot-cache") && value)
+      options.boot_cache = argv[++i];
+    else if (!strcmp(argv[i], "-load-state") && value)
+      load_path = argv[++i];
+    else if (!strcmp(argv[i], "-save-state") && value)
+      save_path = argv[++i];
+    else if (!strcmp(argv[i], "-rewind") && value)
+      options.rewind = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-rewind-interval") && value)
+      options.rewind_config.interval = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-rewind-budget") && value)
+      options.rewind_config.budget = strtoull(argv[++i], NULL, 0) * 1024 * 1024;
+    else if (!strcmp(argv[i], "-runahead") && value)
+      options.runahead = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-record") && value)
+      options.record = argv[++i];
+    else if (!strcmp(argv[i], "-play") && value)
+      options.play = argv[++i];
+    else if (!strcmp(argv[i], "-hash-interval") && value)
+      options.hash_interval = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-buttons") && value)
+      options.buttons = strtoul(argv[++i], NULL, 16);
+    else if (!strcmp(argv[i], "-instances") && value)
+      instances = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-threads") && value)
+      threads = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-gte-check") && value)
+      gte_commands = strtoull(argv[++i], NULL, 0);
+    else
+    {
+      usage();
+      return 1;
+    }
+  }
+
+  if (gte_commands)
+  {
+    const u64 mismatches = gte_check(gte_commands, 1);
+
+    printf("gte-check %llu commands, %s kernels, %llu differ from the scalar code\n", (unsigned long long)gte_commands,
+           gte_kernels_name(), (unsigned long long)mismatches);
+
+    return mismatches ? 3 : 0;
+  }
+
+  // rewind and run-ahead both own the dirty page tracking, a recording has one writer
+  if ((!bios_path && !exe_path) || !instances || (options.rewind && options.runahead) ||
+      (options.record && (options.play || instances > 1)))
+  {
+    usage();
+    return 1;
+  }
+
+  bios_image *bios = NULL;
+
+  if (bios_path && !(bios = bios_open(bios_path, bios_hash)))
+  {
+    fprintf(stderr, "cannot load the BIOS image %s (missing, short or wrong hash)\n", bios_path);
+    return 1;
+  }
+
+  if (exe_path && !(options.exe = read_exe(exe_path, &options.exe_size)))
+  {
+    fprintf(stderr, "cannot load the PS-X EXE %s\n", exe_path);
+    return 1;
+  }
+
+  if (load_path && !(options.state = fopen(load_path, "rb")))
+  {
+    fprintf(stderr, "cannot open the save state %s\n", load_path);
+    return 1;
+  }
+
+  // the executable replaces the shell
+  if (bios && (fastboot || exe_path))
+    options.fast_boot = bios;
+
+  machine **machines = calloc(instances, sizeof(machine *));
+  run_report *reports = calloc(instances, sizeof(run_report));
+
+  for (u32 i = 0; i < instances; i++)
+  {
+    machines[i] = machine_create(fastmem);
+
+    if (!machines[i])
+    {
+      fprintf(stderr, "cannot create machine %u\n", i);
+      return 1;
+    }
+
+    machine_bind(machines[i]);
+
+    if (bios)
+      map_bios(bios);
+
+    if (subpixel)
+      subpixel_enable(true);
+
+    if (threaded_gpu && !gpu_thread_start())
+      threaded_gpu = false;
+
+    if (options.core == CORE_REC && !rec_init())
+      options.core = CORE_BLOCKS;
+  }
+
+  options.machines = machines;
+  options.reports = reports;
+
+  const double start = seconds();
+
+  run_machines(machines, instances, threads, run_job, &options);
+
+  const double elapsed = seconds() - start;
+
+  u64 total = 0;
+  bool diverged = false;
+  bool mismatched = false;
+
+  for (u32 i = 0; i < instances; i++)
+  {
+    machine *m = machines[i];
+
+    machine_bind(m);
+
+    gpu_sync();
+
+    printf("machine %-4u cycles %llu  frames %llu  pc %08x  ram %016llx  vram %016llx\n", i,
+           (unsigned long long)m->cpu.cycles, (unsigned long long)gpu_frames(), m->cpu.pc,
+           (unsigned long long)hash64(bus_ram(), RAM_SIZE_2MB), (unsigned long long)hash64(m->render.vram, sizeof(m->render.vram)));
+
+    if (reports[i].movie)
+      printf("         movie %s at frame %u, hashes match up to frame %u\n",
+             reports[i].movie_diverged ? "DIVERGED" : "ended", reports[i].movie_frames, reports[i].movie_verified);
+
+    diverged |= reports[i].movie_diverged;
+
+    if (options.core == CORE_IR_CHECK)
+      print_ir_check(&m->ir_check);
+
+    mismatched |= m->ir_check.mismatches != 0;
+
+    total += m->cpu.cycles;
+  }
+
+  if (save_path)
+  {
+    FILE *file = fopen(save_path, "wb");
+
+    machine_bind(machines[0]);
+
+    const double save_start = seconds();
+    const bool saved = file && state_save(fileno(file));
+    const double save_time = seconds() - save_start;
+
+    if (file)
+      fclose(file);
+
+    if (saved)
+      printf("state    %s, %u bytes in %.3f ms\n", save_path, state_size(), save_time * 1e3);
+    else
+      fprintf(stderr, "cannot save the state to %s\n", save_path);
+  }
+
+  if (subpixel)
+    printf("subpixel %llu vertices recorded (machine 0)\n", (unsigned long long)machines[0]->subpixel.recorded);
+
+  if (threaded_gpu)
+    printf("gpu      rasterizer thread, %llu jobs (machine 0)\n", (unsigned long long)machines[0]->render_thread.jobs);
+
+  if (options.rewind)
+    printf("rewind   %u snapshots in %llu bytes (machine 0, before stepping back)\n", reports[0].rewind_count,
+           (unsigned long long)reports[0].rewind_usage);
+
+  if (bios)
+    printf("bios     %016llx\n", (unsigned long long)bios->hash);
+  printf("cpu      %s%s\n", cores[options.core].name, bus_fastmem() ? " fastmem" : "");
+  printf("time     %.3f s\n", elapsed);
+  printf("speed    %.1f%% of real time (all machines)\n", elapsed > 0 ? total * 100.0 / CPU_CLOCK / elapsed : 0.0);
+
+  for (u32 i = 0; i < instances; i++)
+    machine_destroy(machines[i]);
+
+  free(machines);
+  free(reports);
+
+  bios_close(bios);
+
+  free((void *)options.exe);
+
+  if (options.state)
+    fclose(options.state);
+
+  return diverged ? 2 : mismatched ? 3 : 0;
+}
@@ -0,0 +1,931 @@
+#include <string.h>
+
+#include "ir.h"
+#include "block.h"
+#include "machine.h"
+
+// Translation
+
+enum PENDING
+{
+  PENDING_NONE    = 0, // no load in cpu->slot_cur
+  PENDING_KNOWN   = 1, // load of pending_reg (value pending_value) in cpu->slot_cur
+  PENDING_DYNAMIC = 2, // unknown at translation time (block entry, after an interpreter call)
+};
+
+typedef struct
+{
+  ir_block *ir;
+
+  u16 value[32];     // value holding the GPR, IR_NONE = read it from cpu->gpr_reg
+
+  u8 pending;
+  u8 pending_reg;
+  u16 pending_value;
+
+  u8 written;        // GPR written by the current instruction, 0 = none
+  u8 loaded;         // GPR loaded by the current instruction, 0 = none
+  u16 loaded_value;
+}ir_builder;
+
+static u16 emit(ir_builder *b, u8 op, u16 x, u16 y, u32 imm)
+{
+  ir_block *ir = b->ir;
+
+  assert(ir->count < IR_MAX_OPS);
+
+  ir_op *o = &ir->ops[ir->count];
+
+  memset(o, 0, sizeof(*o));
+
+  o->op = op;
+  o->a = x;
+  o->b = y;
+  o->imm = imm;
+
+  return ir->count++;
+}
+
+static bool is_const(ir_builder *b, u16 v)
+{
+  return b->ir->ops[v].op == IR_CONST;
+}
+
+static u32 const_of(ir_builder *b, u16 v)
+{
+  return b->ir->ops[v].imm;
+}
+
+static u16 konst(ir_builder *b, u32 imm)
+{
+  return emit(b, IR_CONST, IR_NONE, IR_NONE, imm);
+}
+
+static u16 get(ir_builder *b, u8 reg)
+{
+  if (reg == 0)
+    return konst(b, 0);
+
+  if (b->value[reg] == IR_NONE)
+  {
+    b->value[reg] = emit(b, IR_GET, IR_NONE, IR_NONE, 0);
+    b->ir->ops[b->value[reg]].reg = reg;
+  }
+
+  return b->value[reg];
+}
+
+static void put(ir_builder *b, u8 reg, u16 v)
+{
+  // cpu->gpr_reg already holds it
+  if (reg == 0 || b->value[reg] == v)
+    return;
+
+  b->ir->ops[emit(b, IR_SET, v, IR_NONE, 0)].reg = reg;
+
+  b->value[reg] = v;
+}
+
+// GPR write of the instruction itself: cancels a pending load of the same register
+static void set(ir_builder *b, u8 reg, u16 v)
+{
+  put(b, reg, v);
+
+  b->written = reg;
+}
+
+static void forget(ir_builder *b)
+{
+  memset(b->value, 0xff, sizeof(b->value));
+}
+
+static u16 binary(ir_builder *b, u8 op, u16 x, u16 y)
+{
+  const bool trap = op == IR_ADD_TRAP || op == IR_SUB_TRAP;
+
+  if (is_const(b, x) && is_const(b, y))
+  {
+    // the overflow flag is known: no trap left unless it always fires
+    if (!trap || !ir_overflow(op, const_of(b, x), const_of(b, y)))
+      return konst(b, ir_alu(op, const_of(b, x), const_of(b, y)));
+  }
+  else if (is_const(b, y) && const_of(b, y) == 0)
+  {
+    switch (op)
+    {
+    case IR_ADD: case IR_SUB: case IR_OR: case IR_XOR: case IR_SHL: case IR_SHR: case IR_SAR:
+    case IR_ADD_TRAP: case IR_SUB_TRAP:
+      return x;
+    case IR_AND:
+      return y;
+    }
+  }
+  else if (is_const(b, x) && const_of(b, x) == 0)
+  {
+    switch (op)
+    {
+    case IR_ADD: case IR_OR: case IR_XOR: case IR_ADD_TRAP:
+      return y;
+    case IR_AND: case IR_SHL: case IR_SHR: case IR_SAR:
+      return x;
+    }
+  }
+
+  return emit(b, op, x, y, 0);
+}
+
+static void branch(ir_builder *b, u8 cond, u16 x, u16 y, u32 taken, u32 fall)
+{
+  const bool zero = cond >= IR_LTZ;
+
+  if (is_const(b, x) && (zero || is_const(b, y)))
+  {
+    const bool condition = ir_condition(cond, const_of(b, x), zero ? 0 : const_of(b, y));
+
+    b->ir->target = konst(b, condition ? taken : fall);
+  }
+  else if (!zero && x == y)
+  {
+    b->ir->target = konst(b, cond == IR_EQ ? taken : fall);
+  }
+  else
+  {
+    const u16 v = emit(b, IR_BRANCH, x, zero ? IR_NONE : y, taken);
+
+    b->ir->ops[v].size = cond;
+    b->ir->ops[v].imm2 = fall;
+    b->ir->target = v;
+  }
+}
+
+static void load(ir_builder *b, const instruction *in, u8 size, bool sign)
+{
+  const u16 v = emit(b, IR_LOAD, get(b, in->rs), IR_NONE, in->imm);
+
+  b->ir->ops[v].size = size;
+  b->ir->ops[v].sign = sign;
+
+  b->loaded = in->rt;
+  b->loaded_value = v;
+}
+
+static void store(ir_builder *b, const instruction *in, u8 size)
+{
+  const u16 v = emit(b, IR_STORE, get(b, in->rs), get(b, in->rt), in->imm);
+
+  b->ir->ops[v].size = size;
+}
+
+static void multiply(ir_builder *b, const instruction *in, bool sign)
+{
+  const u16 v = emit(b, IR_MULT, get(b, in->rs), get(b, in->rt), 0);
+
+  b->ir->ops[v].sign = sign;
+}
+
+// false = no translation, the interpreter handler runs it
+static bool translate(ir_builder *b, const instruction *in, u32 pc)
+{
+  if (in->handler == nop)
+    return true;
+
+  const u32 branch_target = pc + 4 + (in->imm << 2);
+
+  switch (in->opcode >> 26)
+  {
+  case 0x00: // SPECIAL
+    switch (in->opcode & 0x3f)
+    {
+    case 0x00: set(b, in->rd, binary(b, IR_SHL, get(b, in->rt), konst(b, in->shift))); return true; // SLL
+    case 0x02: set(b, in->rd, binary(b, IR_SHR, get(b, in->rt), konst(b, in->shift))); return true; // SRL
+    case 0x03: set(b, in->rd, binary(b, IR_SAR, get(b, in->rt), konst(b, in->shift))); return true; // SRA
+    case 0x04: set(b, in->rd, binary(b, IR_SHL, get(b, in->rt), get(b, in->rs)));      return true; // SLLV
+    case 0x06: set(b, in->rd, binary(b, IR_SHR, get(b, in->rt), get(b, in->rs)));      return true; // SRLV
+    case 0x07: set(b, in->rd, binary(b, IR_SAR, get(b, in->rt), get(b, in->rs)));      return true; // SRAV
+
+    case 0x08: // JR
+      b->ir->target = get(b, in->rs);
+      return true;
+
+    case 0x09: // JALR
+      b->ir->target = get(b, in->rs);
+      set(b, in->rd, konst(b, pc + 8));
+      return true;
+
+    case 0x10: set(b, in->rd, emit(b, IR_GET_HI, IR_NONE, IR_NONE, 0)); return true; // MFHI
+    case 0x11: emit(b, IR_SET_HI, get(b, in->rs), IR_NONE, 0);           return true; // MTHI
+    case 0x12: set(b, in->rd, emit(b, IR_GET_LO, IR_NONE, IR_NONE, 0)); return true; // MFLO
+    case 0x13: emit(b, IR_SET_LO, get(b, in->rs), IR_NONE, 0);           return true; // MTLO
+
+    case 0x18:multiply(b, in, true);  return true; // MULT
+    case 0x19:multiply(b, in, false); return true; // MULTU
+
+    case 0x20: set(b, in->rd, binary(b, IR_ADD_TRAP, get(b, in->rs), get(b, in->rt))); return true; // ADD
+    case 0x21: set(b, in->rd, binary(b, IR_ADD, get(b, in->rs), get(b, in->rt)));      return true; // ADDU
+    case 0x22: set(b, in->rd, binary(b, IR_SUB_TRAP, get(b, in->rs), get(b, in->rt))); return true; // SUB
+    case 0x23: set(b, in->rd, binary(b, IR_SUB, get(b, in->rs), get(b, in->rt)));      return true; // SUBU
+    case 0x24: set(b, in->rd, binary(b, IR_AND, get(b, in->rs), get(b, in->rt)));      return true; // AND
+    case 0x25: set(b, in->rd, binary(b, IR_OR, get(b, in->rs), get(b, in->rt)));       return true; // OR
+    case 0x26: set(b, in->rd, binary(b, IR_XOR, get(b, in->rs), get(b, in->rt)));      return true; // XOR
+    case 0x27: set(b, in->rd, binary(b, IR_NOR, get(b, in->rs), get(b, in->rt)));      return true; // NOR
+    case 0x2a: set(b, in->rd, binary(b, IR_SLT, get(b, in->rs), get(b, in->rt)));      return true; // SLT
+    case 0x2b: set(b, in->rd, binary(b, IR_SLTU, get(b, in->rs), get(b, in->rt)));     return true; // SLTU
+
+    default: // SYSCALL, BREAK, DIV, DIVU
+      return false;
+    }
+
+  case 0x01: // BcondZ
+    branch(b, (in->rt & 0x01) ? IR_GEZ : IR_LTZ, get(b, in->rs), IR_NONE, branch_target, pc + 8);
+
+    // BLTZAL / BGEZAL link even when the branch is not taken
+    if ((in->rt & 0x1e) == 0x10)
+      set(b, 31, konst(b, pc + 8));
+
+    return true;
+
+  case 0x02: // J
+    b->ir->target = konst(b, ((pc + 4) & 0xf0000000) | ((in->opcode & 0x3ffffff) << 2));
+    return true;
+
+  case 0x03: // JAL
+    b->ir->target = konst(b, ((pc + 4) & 0xf0000000) | ((in->opcode & 0x3ffffff) << 2));
+    set(b, 31, konst(b, pc + 8));
+    return true;
+
+  case 0x04: branch(b, IR_EQ, get(b, in->rs), get(b, in->rt), branch_target, pc + 8);  return true; // BEQ
+  case 0x05: branch(b, IR_NE, get(b, in->rs), get(b, in->rt), branch_target, pc + 8);  return true; // BNE
+  case 0x06: branch(b, IR_LEZ, get(b, in->rs), IR_NONE, branch_target, pc + 8);        return true; // BLEZ
+  case 0x07: branch(b, IR_GTZ, get(b, in->rs), IR_NONE, branch_target, pc + 8);        return true; // BGTZ
+
+  case 0x08: set(b, in->rt, binary(b, IR_ADD_TRAP, get(b, in->rs), konst(b, in->imm)));       return true; // ADDI
+  case 0x09: set(b, in->rt, binary(b, IR_ADD, get(b, in->rs), konst(b, in->imm)));            return true; // ADDIU
+  case 0x0a: set(b, in->rt, binary(b, IR_SLT, get(b, in->rs), konst(b, in->imm)));            return true; // SLTI
+  case 0x0b: set(b, in->rt, binary(b, IR_SLTU, get(b, in->rs), konst(b, in->imm)));           return true; // SLTIU
+  case 0x0c: set(b, in->rt, binary(b, IR_AND, get(b, in->rs), konst(b, in->imm & 0xffff)));   return true; // ANDI
+  case 0x0d: set(b, in->rt, binary(b, IR_OR, get(b, in->rs), konst(b, in->imm & 0xffff)));    return true; // ORI
+  case 0x0e: set(b, in->rt, binary(b, IR_XOR, get(b, in->rs), konst(b, in->imm & 0xffff)));   return true; // XORI
+  case 0x0f: set(b, in->rt, konst(b, (u32)in->imm << 16));                                    return true; // LUI
+
+  case 0x20: load(b, in, 1, true);  return true; // LB
+  case 0x21: load(b, in, 2, true);  return true; // LH
+  case 0x23: load(b, in, 4, false); return true; // LW
+  case 0x24: load(b, in, 1, false); return true; // LBU
+  case 0x25: load(b, in, 2, false); return true; // LHU
+
+  case 0x28: store(b, in, 1); return true; // SB
+  case 0x29: store(b, in, 2); return true; // SH
+  case 0x2b: store(b, in, 4); return true; // SW
+
+  default: // COP0, COP2, LWL, LWR, SWL, SWR, LWC2, SWC2
+    return false;
+  }
+}
+
+// Load delay: write back the load of the previous instruction, queue the one of this instruction
+static void retire(ir_builder *b)
+{
+  if (b->pending == PENDING_KNOWN)
+  {
+    // a write in the load delay slot wins over the pending load
+    if (b->pending_reg != b->written)
+      put(b, b->pending_reg, b->pending_value);
+
+    if (!b->loaded)
+      emit(b, IR_PENDING_CLEAR, IR_NONE, IR_NONE, 0);
+  }
+  else if (b->pending == PENDING_DYNAMIC)
+  {
+    b->ir->ops[emit(b, IR_RETIRE, IR_NONE, IR_NONE, 0)].reg = b->written;
+
+    forget(b);
+  }
+
+  b->pending = PENDING_NONE;
+
+  if (b->loaded)
+  {
+    b->ir->ops[emit(b, IR_PENDING, b->loaded_value, IR_NONE, 0)].reg = b->loaded;
+
+    b->pending = PENDING_KNOWN;
+    b->pending_reg = b->loaded;
+    b->pending_value = b->loaded_value;
+  }
+}
+
+void ir_translate(ir_block *ir, code_page *cp, u32 index, u32 pc)
+{
+  u32 count = cp->blocks[index].count;
+
+  if (!count)
+    count = build_block(cp, index, pc);
+
+  const instruction *instrs = &cp->instrs[index];
+
+  ir->exit = IR_EXIT_NEXT;
+
+  // A branch whose delay slot is missing (end of page) or is a branch itself closes
+  // the block, the interpreter runs the delay slot
+  if (count >= 2 && is_branch(instrs[count - 2].handler))
+  {
+    if (is_branch(instrs[count - 1].handler))
+    {
+      count--;
+      ir->exit = IR_EXIT_DELAY;
+    }
+    else
+    {
+      ir->exit = IR_EXIT_BRANCH;
+    }
+  }
+  else if (is_branch(instrs[count - 1].handler))
+  {
+    ir->exit = IR_EXIT_DELAY;
+  }
+
+  ir->count = 0;
+  ir->pc = pc;
+  ir->instrs = count;
+  ir->target = IR_NONE;
+
+  ir_builder builder;
+  ir_builder *b = &builder;
+
+  memset(b, 0, sizeof(*b));
+  forget(b);
+
+  b->ir = ir;
+  b->pending = PENDING_DYNAMIC;
+
+  for (u32 i = 0; i < count; i++)
+  {
+    const bool in_delay = i > 0 && is_branch(instrs[i - 1].handler);
+
+    const u16 start = emit(b, IR_INSTR, in_delay ? ir->target : IR_NONE, IR_NONE, pc + i * 4);
+
+    ir->ops[start].imm2 = i;
+    ir->ops[start].sign = in_delay;
+
+    b->written = 0;
+    b->loaded = 0;
+
+    if (translate(b, &instrs[i], pc + i * 4))
+    {
+      retire(b);
+      continue;
+    }
+
+    ir->ops[emit(b, IR_CALL, IR_NONE, IR_NONE, 0)].instr = &instrs[i];
+
+    // the handler and its load delay retire work on cpu->gpr_reg
+    forget(b);
+
+    b->pending = PENDING_DYNAMIC;
+  }
+}
+
+// Optimization
+
+u32 ir_uses(const ir_op *op, u16 uses[2])
+{
+  switch (op->op)
+  {
+  case IR_ADD: case IR_SUB: case IR_AND: case IR_OR: case IR_XOR: case IR_NOR:
+  case IR_SLT: case IR_SLTU: case IR_SHL: case IR_SHR: case IR_SAR:
+  case IR_ADD_TRAP: case IR_SUB_TRAP: case IR_MULT: case IR_STORE:
+    uses[0] = op->a;
+    uses[1] = op->b;
+    return 2;
+
+  case IR_BRANCH:
+    uses[0] = op->a;
+    uses[1] = op->b;
+    return op->b == IR_NONE ? 1 : 2;
+
+  case IR_SET: case IR_SET_HI: case IR_SET_LO: case IR_LOAD: case IR_PENDING:
+    uses[0] = op->a;
+    return 1;
+
+  case IR_INSTR:
+    uses[0] = op->a;
+    return op->a == IR_NONE ? 0 : 1;
+
+  default:
+    return 0;
+  }
+}
+
+// Operations that may leave the block or look at the whole architectural state
+static bool observes_state(u8 op)
+{
+  return op == IR_ADD_TRAP || op == IR_SUB_TRAP || op == IR_LOAD || op == IR_STORE ||
+         op == IR_CALL || op == IR_RETIRE;
+}
+
+void ir_optimize(ir_block *ir)
+{
+  // GPR writes and load delay updates overwritten before anything observes them
+  u32 live = 0xffffffff;
+
+  bool pending_live = true;
+
+  for (s32 i = ir->count - 1; i >= 0; i--)
+  {
+    ir_op *op = &ir->ops[i];
+
+    if (observes_state(op->op))
+    {
+      live = 0xffffffff;
+      pending_live = true;
+    }
+    else if (op->op == IR_GET)
+    {
+      live |= 1u << op->reg;
+    }
+    else if (op->op == IR_SET)
+    {
+      if (live & (1u << op->reg))
+        live &= ~(1u << op->reg);
+      else
+        op->op = IR_NOP;
+    }
+    else if (op->op == IR_PENDING || op->op == IR_PENDING_CLEAR)
+    {
+      if (pending_live)
+        pending_live = false;
+      else
+        op->op = IR_NOP;
+    }
+  }
+
+  // Values nobody reads
+  static _Thread_local bool used[IR_MAX_OPS];
+
+  memset(used, 0, ir->count * sizeof(bool));
+
+  if (ir->target != IR_NONE)
+    used[ir->target] = true;
+
+  for (s32 i = ir->count - 1; i >= 0; i--)
+  {
+    ir_op *op = &ir->ops[i];
+
+    const bool pure = ir_has_value(op->op) && op->op != IR_LOAD &&
+                      op->op != IR_ADD_TRAP && op->op != IR_SUB_TRAP;
+
+    if (pure && !used[i])
+      op->op = IR_NOP;
+
+    u16 uses[2];
+
+    const u32 n = ir_uses(op, uses);
+
+    for (u32 u = 0; u < n; u++)
+      used[uses[u]] = true;
+  }
+}
+
+// Register allocation (linear scan, values are defined once)
+
+u32 ir_allocate(const ir_block *ir, u32 regs, s16 *loc)
+{
+  static _Thread_local u32 last[IR_MAX_OPS];
+
+  static _Thread_local s16 free_slots[IR_MAX_OPS];
+
+  memset(last, 0, ir->count * sizeof(u32));
+
+  for (u32 i = 0; i < ir->count; i++)
+  {
+    u16 uses[2];
+
+    const u32 n = ir_uses(&ir->ops[i], uses);
+
+    for (u32 u = 0; u < n; u++)
+      last[uses[u]] = i;
+  }
+
+  // read by the exit of the block
+  if (ir->target != IR_NONE)
+    last[ir->target] = ir->count;
+
+  u32 free_regs = (regs < 32) ? (1u << regs) - 1 : 0xffffffff;
+  u32 free_count = 0;
+  u32 slots = 0;
+
+  for (u32 i = 0; i < ir->count; i++)
+  {
+    const ir_op *op = &ir->ops[i];
+
+    u16 uses[2];
+
+    const u32 n = ir_uses(op, uses);
+
+    // operands used for the last time give their location back
+    for (u32 u = 0; u < n; u++)
+    {
+      const u16 v = uses[u];
+
+      if (last[v] != i || loc[v] < 0 || (u == 1 && uses[0] == v))
+        continue;
+
+      if (loc[v] < (s16)regs)
+        free_regs |= 1u << loc[v];
+      else
+        free_slots[free_count++] = loc[v];
+    }
+
+    loc[i] = -1;
+
+    if (!ir_has_value(op->op) || op->op == IR_CONST || last[i] <= i)
+      continue;
+
+    if (free_regs)
+    {
+      loc[i] = __builtin_ctz(free_regs);
+      free_regs &= free_regs - 1;
+    }
+    else if (free_count)
+    {
+      loc[i] = free_slots[--free_count];
+    }
+    else
+    {
+      loc[i] = regs + slots++;
+    }
+  }
+
+  return slots;
+}
+
+// Runtime support
+
+// Exception raised by a translated instruction, cpu->pc_exception / pc / next_pc are set
+void ir_exception(R3000 *cpu, u32 cause, u32 addr)
+{
+  if (cause == LoadAddrError || cause == WriteAddrError)
+    cpu->m_cop0_badvaddr = addr;
+
+  signalException(cpu, cause);
+
+  retire_load(cpu);
+}
+
+// Interpreter
+
+typedef struct
+{
+  u32 addr;
+  u32 value;
+  u8 size;
+}ir_store;
+
+static _Thread_local ir_store store_log[PAGE_INSTRUCTIONS];
+
+static _Thread_local u32 store_count;
+
+static _Thread_local bool logging; // hold the stores back in store_log (see run_ir_check)
+
+static u32 ir_read(u32 addr, u32 size)
+{
+  u32 value = (size == 1) ? read8(addr) : (size == 2) ? read16(addr) : read32(addr);
+
+  if (!logging)
+    return value;
+
+  const u32 phys = region_memory(addr);
+
+  for (u32 i = 0; i < store_count; i++)
+  {
+    const ir_store *s = &store_log[i];
+
+    for (u32 byte = 0; byte < s->size; byte++)
+    {
+      const u32 offset = s->addr + byte - phys;
+
+      if (offset < size)
+        value = (value & ~(0xffu << offset * 8)) | (((s->value >> byte * 8) & 0xff) << offset * 8);
+    }
+  }
+
+  return value;
+}
+
+static void ir_write(u32 addr, u32 value, u32 size)
+{
+  if (logging)
+  {
+    store_log[store_count++] = (ir_store){ region_memory(addr), value, size };
+    return;
+  }
+
+  switch (size)
+  {
+  case 1:  write8(addr, value);  break;
+  case 2:  write16(addr, value); break;
+  default: write32(addr, value); break;
+  }
+}
+
+// pc_exception / pc / next_pc as execute_instr() leaves them for the instruction
+static void ir_pc_state(R3000 *cpu, const ir_op *instr, const u32 *v)
+{
+  cpu->pc_exception = instr->imm;
+
+  cpu->pc = instr->sign ? v[instr->a] : instr->imm + 4;
+
+  cpu->next_pc = cpu->pc + 4;
+
+  cpu->branch_delay_slot_saved = instr->sign;
+}
+
+u32 ir_execute(const ir_block *ir, R3000 *cpu)
+{
+  static _Thread_local u32 v[IR_MAX_OPS];
+
+  const ir_op *instr = NULL;
+
+  for (u32 i = 0; i < ir->count; i++)
+  {
+    const ir_op *op = &ir->ops[i];
+
+    switch (op->op)
+    {
+    case IR_CONST:  v[i] = op->imm;                  break;
+    case IR_GET:    v[i] = cpu->gpr_reg[op->reg];    break;
+    case IR_GET_HI: v[i] = cpu->hi;                  break;
+    case IR_GET_LO: v[i] = cpu->lo;                  break;
+
+    case IR_ADD: case IR_SUB: case IR_AND: case IR_OR: case IR_XOR: case IR_NOR:
+    case IR_SLT: case IR_SLTU: case IR_SHL: case IR_SHR: case IR_SAR:
+      v[i] = ir_alu(op->op, v[op->a], v[op->b]);
+      break;
+
+    case IR_ADD_TRAP:
+    case IR_SUB_TRAP:
+      if (ir_overflow(op->op, v[op->a], v[op->b]))
+      {
+        ir_pc_state(cpu, instr, v);
+        ir_exception(cpu, Overflow, 0);
+        return instr->imm2 + 1;
+      }
+
+      v[i] = ir_alu(op->op, v[op->a], v[op->b]);
+      break;
+
+    case IR_LOAD:
+    {
+      const u32 addr = v[op->a] + op->imm;
+
+      if (addr & (op->size - 1))
+      {
+        ir_pc_state(cpu, instr, v);
+        ir_exception(cpu, LoadAddrError, addr);
+        return instr->imm2 + 1;
+      }
+
+      v[i] = ir_read(addr, op->size);
+
+      if (op->sign)
+        v[i] = (op->size == 1) ? (u32)(s8)v[i] : (u32)(s16)v[i];
+
+      break;
+    }
+
+    case IR_BRANCH:
+      v[i] = ir_condition(op->size, v[op->a], (op->b == IR_NONE) ? 0 : v[op->b]) ? op->imm : op->imm2;
+      break;
+
+    case IR_SET:    cpu->gpr_reg[op->reg] = v[op->a]; break;
+    case IR_SET_HI: cpu->hi = v[op->a];               break;
+    case IR_SET_LO: cpu->lo = v[op->a];               break;
+
+    case IR_MULT:
+    {
+      const u64 res = op->sign ? (u64)((s64)(s32)v[op->a] * (s64)(s32)v[op->b])
+                               : (u64)v[op->a] * (u64)v[op->b];
+
+      cpu->lo = res & 0xffffffff;
+      cpu->hi = res >> 32;
+      break;
+    }
+
+    case IR_STORE:
+    {
+      const u32 addr = v[op->a] + op->imm;
+
+      if (addr & (op->size - 1))
+      {
+        ir_pc_state(cpu, instr, v);
+        ir_exception(cpu, WriteAddrError, addr);
+        return instr->imm2 + 1;
+      }
+
+      ir_write(addr, v[op->b], op->size);
+      break;
+    }
+
+    case IR_PENDING:
+      cpu->slot_cur.reg = op->reg;
+      cpu->slot_cur.cur = v[op->a];
+      break;
+
+    case IR_PENDING_CLEAR:
+      cpu->slot_cur.reg = 0;
+      cpu->slot_cur.cur = 0;
+      break;
+
+    case IR_RETIRE:
+      if (cpu->slot_cur.reg && cpu->slot_cur.reg != op->reg)
+        cpu->gpr_reg[cpu->slot_cur.reg] = cpu->slot_cur.cur;
+
+      cpu->slot_cur.reg = 0;
+      cpu->slot_cur.cur = 0;
+      break;
+
+    case IR_CALL:
+    {
+      // check mode: the handler would go around the store log, stop in front of it
+      if (logging)
+      {
+        cpu->pc = instr->imm;
+        cpu->next_pc = instr->sign ? v[instr->a] : instr->imm + 4;
+        return instr->imm2;
+      }
+
+      ir_pc_state(cpu, instr, v);
+
+      const u32 next = cpu->pc;
+
+      cpu->instr = op->instr;
+      cpu->opcode = op->instr->opcode;
+
+      op->instr->handler(cpu);
+
+      retire_load(cpu);
+
+      // an exception moved pc to its vector
+      if (cpu->pc != next)
+        return instr->imm2 + 1;
+
+      break;
+    }
+
+    case IR_INSTR:
+      instr = op;
+      break;
+    }
+  }
+
+  const u32 end = ir->pc + ir->instrs * 4;
+
+  switch (ir->exit)
+  {
+  case IR_EXIT_NEXT:
+    set_pc(cpu, end);
+    break;
+
+  case IR_EXIT_BRANCH:
+    set_pc(cpu, v[ir->target]);
+    break;
+
+  case IR_EXIT_DELAY:
+    cpu->pc = end;
+    cpu->next_pc = v[ir->target];
+    cpu->delay_slot = true;
+    break;
+  }
+
+  return ir->instrs;
+}
+
+// Record a difference of the checked block, returns 1
+static u32 ir_differ(const ir_block *ir, u8 what, u32 where, u32 value, u32 expected)
+{
+  ir_check *check = &psx->ir_check;
+
+  if (!check->mismatches)
+    check->first = (ir_diff){ ir->pc, what, where, value, expected };
+
+  return 1;
+}
+
+// Differences between the IR run (res) and the interpreter (cpu)
+static u32 ir_compare(const ir_block *ir, const R3000 *cpu, const R3000 *res)
+{
+  u32 diff = 0;
+
+  for (u32 r = 0; r < 32; r++)
+  {
+    if (cpu->gpr_reg[r] != res->gpr_reg[r])
+      diff += ir_differ(ir, IR_DIFF_GPR, r, res->gpr_reg[r], cpu->gpr_reg[r]);
+  }
+
+  if (cpu->hi != res->hi)
+    diff += ir_differ(ir, IR_DIFF_HI, 0, res->hi, cpu->hi);
+
+  if (cpu->lo != res->lo)
+    diff += ir_differ(ir, IR_DIFF_LO, 0, res->lo, cpu->lo);
+
+  if (cpu->pc != res->pc)
+    diff += ir_differ(ir, IR_DIFF_PC, 0, res->pc, cpu->pc);
+
+  if (cpu->next_pc != res->next_pc)
+    diff += ir_differ(ir, IR_DIFF_NEXT_PC, 0, res->next_pc, cpu->next_pc);
+
+  // the stores held back must have reached RAM through the interpreter
+  for (u32 i = 0; i < store_count; i++)
+  {
+    const ir_store *s = &store_log[i];
+
+    if (s->addr >= RAM_SIZE_8MB)
+      continue;
+
+    const u32 mask = 0xffffffff >> (32 - s->size * 8);
+
+    // not a load of the program: no wait states
+    const u64 cycles = psx->cpu.cycles;
+    const u32 value = ir_read(s->addr, s->size);
+    psx->cpu.cycles = cycles;
+
+    // a later store of the block may cover this one
+    bool covered = false;
+
+    for (u32 j = i + 1; j < store_count; j++)
+      covered |= store_log[j].addr < s->addr + s->size && s->addr < store_log[j].addr + store_log[j].size;
+
+    if (!covered && (value & mask) != (s->value & mask))
+      diff += ir_differ(ir, IR_DIFF_STORE, s->addr, s->value & mask, value & mask);
+  }
+
+  return diff;
+}
+
+static void run(R3000 *cpu, u64 deadline, bool check)
+{
+  static _Thread_local ir_block ir;
+
+  while (cpu->cycles < deadline && cpu->cycles < psx->sched.deadline)
+  {
+    check_interrupt(cpu);
+
+    // misaligned pc and a delay slot left by the previous block go through the interpreter
+    code_page *cp = (cpu->pc & 0x3 || cpu->delay_slot) ? NULL : fetch_code_page(region_memory(cpu->pc));
+
+    if (!cp)
+    {
+      step_cpu(cpu);
+      continue;
+    }
+
+    ir_translate(&ir, cp, (cpu->pc & PAGE_MASK) >> 2, cpu->pc);
+
+    ir_optimize(&ir);
+
+    const u32 pc = cpu->pc;
+
+    if (!check)
+    {
+      cpu->cycles += fetch_cycles(pc, ir_execute(&ir, cpu));
+      continue;
+    }
+
+    R3000 res = *cpu;
+
+    // the loads of the checked run charge the bound CPU, the interpreter charges them again
+    const u64 cycles = cpu->cycles;
+
+    logging = true;
+    store_count = 0;
+
+    const u32 executed = ir_execute(&ir, &res);
+
+    logging = false;
+
+    cpu->cycles = cycles;
+
+    if (!executed)
+    {
+      step_cpu(cpu);
+      continue;
+    }
+
+    for (u32 i = 0; i < executed; i++)
+      step_cpu(cpu);
+
+    psx->ir_check.blocks++;
+
+    if (ir_compare(&ir, cpu, &res))
+      psx->ir_check.mismatches++;
+  }
+}
+
+void run_ir(R3000 *cpu, u64 deadline)
+{
+  run(cpu, deadline, false);
+}
+
+void run_ir_check(R3000 *cpu, u64 deadline)
+{
+  run(cpu, deadline, true);
+}
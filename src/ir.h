@@ -0,0 +1,197 @@
+#pragma once
+#include "cpu.h"
+#include "decode.h"
+
+// Recompiler IR
+// A block (see build_block) becomes a linear list of operations, the result of
+// operation i is the value v<i>. While translating, GPR reads are forwarded from the
+// last write in the block and operations on constants are folded (an ADD / SUB whose
+// overflow flag can not be set loses its trap). ir_optimize() then drops GPR writes
+// overwritten before anything can observe them and values nobody uses.
+//
+// The backends (rec_x64.c, rec_arm64.c) lower the list to host code, ir_execute()
+// runs it on any host. GPR writes are stored to cpu->gpr_reg right away, so the
+// architectural state is exact at every exception and interpreter call.
+
+#define IR_MAX_OPS (PAGE_INSTRUCTIONS * 8)
+
+#define IR_NONE 0xffff // no value
+
+enum IR_OP
+{
+  IR_NOP,
+
+  // values
+  IR_CONST,    // v = imm
+  IR_GET,      // v = gpr[reg]
+  IR_GET_HI,   // v = hi
+  IR_GET_LO,   // v = lo
+  IR_ADD,      // v = a + b
+  IR_SUB,      // v = a - b
+  IR_AND,      // v = a & b
+  IR_OR,       // v = a | b
+  IR_XOR,      // v = a ^ b
+  IR_NOR,      // v = ~(a | b)
+  IR_SLT,      // v = (s32)a < (s32)b
+  IR_SLTU,     // v = a < b
+  IR_SHL,      // v = a << (b & 31)
+  IR_SHR,      // v = a >> (b & 31)
+  IR_SAR,      // v = (s32)a >> (b & 31)
+  IR_ADD_TRAP, // v = a + b, Overflow exception on signed overflow
+  IR_SUB_TRAP, // v = a - b, Overflow exception on signed overflow
+  IR_LOAD,     // v = [a + imm], size bytes (sign extended), address error when misaligned
+  IR_BRANCH,   // v = cond(a, b) ? imm : imm2
+
+  // effects
+  IR_SET,      // gpr[reg] = a
+  IR_SET_HI,   // hi = a
+  IR_SET_LO,   // lo = a
+  IR_MULT,     // hi:lo = a * b (sign)
+  IR_STORE,    // [a + imm] = b, size bytes, address error when misaligned
+  IR_PENDING,  // slot_cur = { reg, a }: load waiting for its delay slot
+  IR_PENDING_CLEAR, // slot_cur = { 0, 0 }
+  IR_RETIRE,   // write back slot_cur unless it loads reg (the GPR written by the instruction), clear it
+  IR_CALL,     // run the interpreter handler of instr
+  IR_INSTR,    // start of the guest instruction at imm (index imm2), a = branch target in a delay slot
+};
+
+enum IR_COND
+{
+  IR_EQ  = 0, // a == b
+  IR_NE  = 1, // a != b
+  IR_LTZ = 2, // (s32)a < 0
+  IR_GEZ = 3, // (s32)a >= 0
+  IR_LEZ = 4, // (s32)a <= 0
+  IR_GTZ = 5, // (s32)a > 0
+};
+
+enum IR_EXIT
+{
+  IR_EXIT_NEXT   = 0, // pc = end of the block
+  IR_EXIT_BRANCH = 1, // pc = target, the delay slot ran in the block
+  IR_EXIT_DELAY  = 2, // the interpreter runs the delay slot (missing from the page or a branch)
+};
+
+typedef struct
+{
+  u8 op;
+  u8 size;    // LOAD / STORE: 1, 2, 4. BRANCH: IR_COND
+  u8 sign;    // LOAD / MULT: signed. INSTR: in a branch delay slot
+  u8 reg;     // GET / SET / PENDING / RETIRE: GPR index
+  u16 a, b;   // operands (value index)
+  u32 imm;
+  u32 imm2;
+  const instruction *instr; // CALL
+}ir_op;
+
+typedef struct
+{
+  ir_op ops[IR_MAX_OPS];
+  u32 count;
+
+  u32 pc;      // first guest instruction
+  u32 instrs;  // guest instructions
+  u8 exit;     // IR_EXIT
+  u16 target;  // branch target (IR_EXIT_BRANCH / IR_EXIT_DELAY)
+}ir_block;
+
+static inline bool ir_has_value(u8 op)
+{
+  return op >= IR_CONST && op <= IR_BRANCH;
+}
+
+// ALU operations shared by the constant folding and ir_execute()
+static inline u32 ir_alu(u8 op, u32 a, u32 b)
+{
+  switch (op)
+  {
+  case IR_ADD:
+  case IR_ADD_TRAP: return a + b;
+  case IR_SUB:
+  case IR_SUB_TRAP: return a - b;
+  case IR_AND:  return a & b;
+  case IR_OR:   return a | b;
+  case IR_XOR:  return a ^ b;
+  case IR_NOR:  return ~(a | b);
+  case IR_SLT:  return (s32)a < (s32)b;
+  case IR_SLTU: return a < b;
+  case IR_SHL:  return a << (b & 31);
+  case IR_SHR:  return a >> (b & 31);
+  case IR_SAR:  return (s32)a >> (b & 31);
+  default:      return 0;
+  }
+}
+
+static inline bool ir_overflow(u8 op, u32 a, u32 b)
+{
+  const u32 res = ir_alu(op, a, b);
+
+  if (op == IR_ADD_TRAP)
+    return (~(a ^ b) & (a ^ res)) >> 31;
+
+  return ((a ^ b) & (a ^ res)) >> 31;
+}
+
+static inline bool ir_condition(u8 cond, u32 a, u32 b)
+{
+  switch (cond)
+  {
+  case IR_EQ:  return a == b;
+  case IR_NE:  return a != b;
+  case IR_LTZ: return (s32)a < 0;
+  case IR_GEZ: return (s32)a >= 0;
+  case IR_LEZ: return (s32)a <= 0;
+  default:     return (s32)a > 0;
+  }
+}
+
+// Values read by an operation, returns how many
+u32 ir_uses(const ir_op *op, u16 uses[2]);
+
+void ir_translate(ir_block *ir, code_page *cp, u32 index, u32 pc);
+
+void ir_optimize(ir_block *ir);
+
+// Host location of every value for a backend with regs allocatable registers:
+// -1 = none (constant or unused), < regs = register, >= regs = spill slot (loc - regs).
+// Returns the number of spill slots.
+u32 ir_allocate(const ir_block *ir, u32 regs, s16 *loc);
+
+// Runtime support shared by the backends and ir_execute()
+void ir_exception(R3000 *cpu, u32 cause, u32 addr);
+
+u32 ir_execute(const ir_block *ir, R3000 *cpu); // returns the guest instructions executed
+
+// IR check
+// run_ir_check() runs every block on a copy of the CPU with its stores held back, then
+// steps the plain interpreter over the same instructions and compares GPR / HI / LO / pc
+// and the stored memory. The results go to the bound machine (ir_check of machine.h),
+// the caller reports them.
+enum IR_DIFF
+{
+  IR_DIFF_GPR     = 0, // where = GPR index
+  IR_DIFF_HI      = 1,
+  IR_DIFF_LO      = 2,
+  IR_DIFF_PC      = 3,
+  IR_DIFF_NEXT_PC = 4,
+  IR_DIFF_STORE   = 5, // where = physical address
+};
+
+typedef struct
+{
+  u32 block;       // pc of the block
+  u8 what;         // IR_DIFF
+  u32 where;
+  u32 ir;          // value left by the IR
+  u32 interpreter; // value left by the interpreter
+}ir_diff;
+
+typedef struct
+{
+  u64 blocks;     // compared with the interpreter
+  u64 mismatches; // blocks with at least one difference
+  ir_diff first;  // first difference found
+}ir_check;
+
+void run_ir(R3000 *cpu, u64 deadline);       // translate and interpret every block
+void run_ir_check(R3000 *cpu, u64 deadline); // same, each block checked against the interpreter
@@ -0,0 +1,39 @@
+#include "machine.h"
+
+#define IRQ_BITS 0x7ff // bit 0-10, the upper bits are garbage / zero
+
+void irq_reset(void)
+{
+  psx->irq.stat = 0;
+  psx->irq.mask = 0;
+}
+
+void irq_raise(u8 irq)
+{
+  psx->irq.stat |= 1 << irq;
+}
+
+bool irq_pending(void)
+{
+  return (psx->irq.stat & psx->irq.mask) != 0;
+}
+
+u32 irq_read(u32 offset)
+{
+  const u32 value = (offset & ~3) ? psx->irq.mask : psx->irq.stat;
+
+  return value >> ((offset & 3) * 8);
+}
+
+void irq_write(u32 offset, u32 value, u32 size)
+{
+  const u32 shift = (offset & 3) * 8;
+  const u32 lanes = (size == 4 ? 0xffffffff : (1u << (size * 8)) - 1) << shift; // bits written
+
+  value <<= shift;
+
+  if (offset & ~3)
+    psx->irq.mask = ((psx->irq.mask & ~lanes) | (value & lanes)) & IRQ_BITS;
+  else
+    psx->irq.stat &= value | ~lanes; // 0 = clear bit, 1 = no change (so are the bytes not written)
+}
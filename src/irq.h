@@ -0,0 +1,39 @@
+#pragma once
+#include "typedef.h"
+
+// Interrupt Control
+// 1F801070h I_STAT - Interrupt status register (R=Status, W=Acknowledge)
+// 1F801074h I_MASK - Interrupt mask register (R/W)
+// Any bit set in both I_STAT and I_MASK drives cop0 CAUSE bit 10 (see check_interrupt).
+
+enum IRQ
+{
+  IRQ_VBLANK     = 0,
+  IRQ_GPU        = 1,  // GP0(1Fh)
+  IRQ_CDROM      = 2,
+  IRQ_DMA        = 3,
+  IRQ_TIMER0     = 4,  // Sysclk or Dotclock
+  IRQ_TIMER1     = 5,  // Sysclk or H-blank
+  IRQ_TIMER2     = 6,  // Sysclk or Sysclk/8
+  IRQ_CONTROLLER = 7,  // Controller and Memory Card - Byte Received
+  IRQ_SIO        = 8,
+  IRQ_SPU        = 9,
+  IRQ_LIGHTPEN   = 10, // also PIO
+};
+
+typedef struct
+{
+  u32 stat; // I_STAT
+  u32 mask; // I_MASK
+}irq_control;
+
+void irq_reset(void);
+
+// Set the I_STAT bit of the device (edge triggered: stays set until acknowledged)
+void irq_raise(u8 irq);
+
+bool irq_pending(void);
+
+u32 irq_read(u32 offset);
+
+void irq_write(u32 offset, u32 value, u32 size);
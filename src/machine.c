@@ -0,0 +1,68 @@
+#include <stdlib.h>
+
+#include "machine.h"
+
+_Thread_local machine *psx;
+
+machine *machine_create(bool fastmem)
+{
+  machine *m = calloc(1, sizeof(machine));
+
+  if (!m)
+    return NULL;
+
+  machine *prev = machine_bind(m);
+
+  if (!init_bus(fastmem))
+  {
+    machine_bind(prev);
+    free(m);
+    return NULL;
+  }
+
+  machine_reset();
+
+  machine_bind(prev);
+
+  return m;
+}
+
+void machine_destroy(machine *m)
+{
+  if (!m)
+    return;
+
+  machine *prev = machine_bind(m);
+
+  gpu_thread_stop();
+  rec_shutdown();
+  free_decode_cache();
+  shutdown_bus();
+
+  machine_bind(prev == m ? NULL : prev);
+
+  free(m);
+}
+
+machine *machine_bind(machine *m)
+{
+  machine *prev = psx;
+
+  psx = m;
+
+  return prev;
+}
+
+void machine_reset(void)
+{
+  reset_cpu(&psx->cpu);
+  reset_memory_control();
+  reset_cache();
+
+  sched_reset();
+  irq_reset();
+  timer_reset();
+  gpu_timing_init(psx->cpu.cycles);
+  gpu_reset();
+  pad_reset();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "cpu.h"
+#include "bus.h"
+#include "decode.h"
+#include "rec.h"
+#include "scheduler.h"
+#include "irq.h"
+#include "timer.h"
+#include "gpu.h"
+#include "gpu_thread.h"
+#include "pad.h"
+#include "subpixel.h"
+
+// Console instance
+// Everything one emulated console owns. The CPU state keeps being passed explicitly;
+// the bus, the decode cache, the recompiler buffer and the devices reach their state
+// through psx, the machine bound to the calling thread. A thread runs one machine at a
+// time, so independent consoles can run in parallel on separate threads (see runner.h).
+// Per-thread scratch (IR translation, host code emission) is thread local as well.
+
+typedef struct
+{
+  R3000 cpu;
+
+  Memory bus;
+  decode_cache decode;
+  rec_buffer rec;
+
+  scheduler sched;
+  irq_control irq;
+  root_counter timers[3];
+  video_timing gpu;
+  gpu_state render; // GP0 / GP1 and VRAM
+  joypad pad;
+
+  subpixel_cache subpixel;  // enhancement, not emulated state
+  gpu_thread render_thread; // draws the GP0 jobs when started
+  ir_check ir_check;        // results of run_ir_check(), not emulated state
+}machine;
+
+extern _Thread_local machine *psx; // machine bound to this thread
+
+// New machine at the reset vector (the BIOS is not loaded), NULL when out of memory
+machine *machine_create(bool fastmem);
+
+void machine_destroy(machine *m);
+
+// Bind the machine to the calling thread, returns the previous one
+machine *machine_bind(machine *m);
+
+// Reset the CPU and the devices of the bound machine, memory is kept
+void machine_reset(void);
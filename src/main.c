@@ -1,9 +1,9 @@
 #include <stdio.h>
-#include "cpu.h"
+#include "machine.h"
 
 int main(void)
 {
-   R3000 cpu;
+   machine_bind(machine_create(false));
    
    printf("%s \n",namereg(3));
    
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "machine.h"
+#include "hash.h"
+
+#define MOVIE_MAGIC "PSXMOVIE"
+
+struct movie
+{
+  FILE *file; // recording, NULL when replaying
+
+  u8 *data;   // replayed movie
+  u32 size;
+  u32 at;
+
+  u32 interval;
+  u32 frames;
+  u32 verified;
+  bool diverged;
+};
+
+// RAM and VRAM: a drift that only reaches the picture is caught as well
+static u64 state_hash(void)
+{
+  gpu_sync();
+
+  return hash_update(hash64(bus_ram(), RAM_SIZE_2MB), psx->render.vram, sizeof(psx->render.vram));
+}
+
+movie *movie_record(const char *path, u32 interval)
+{
+  movie *mv = calloc(1, sizeof(movie));
+
+  if (!mv)
+    return NULL;
+
+  mv->interval = interval ? interval : 1;
+  mv->file = fopen(path, "wb");
+
+  const movie_header header = { MOVIE_MAGIC, MOVIE_VERSION, mv->interval, psx->bus.bios_hash, state_hash() };
+
+  if (!mv->file || fwrite(&header, sizeof(header), 1, mv->file) != 1)
+  {
+    movie_close(mv);
+    return NULL;
+  }
+
+  return mv;
+}
+
+movie *movie_play(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+
+  if (!file)
+    return NULL;
+
+  movie *mv = calloc(1, sizeof(movie));
+
+  fseek(file, 0, SEEK_END);
+
+  const long size = ftell(file);
+
+  fseek(file, 0, SEEK_SET);
+
+  if (mv && size >= (long)sizeof(movie_header) && (mv->data = malloc(size)))
+    mv->size = fread(mv->data, 1, size, file);
+
+  fclose(file);
+
+  movie_header header;
+
+  if (!mv || mv->size != size || mv->size < sizeof(header))
+  {
+    movie_close(mv);
+    return NULL;
+  }
+
+  memcpy(&header, mv->data, sizeof(header));
+
+  if (memcmp(header.magic, MOVIE_MAGIC, sizeof(header.magic)) || header.version != MOVIE_VERSION ||
+      !header.interval || header.bios_hash != psx->bus.bios_hash)
+  {
+    movie_close(mv);
+    return NULL;
+  }
+
+  mv->at = sizeof(header);
+  mv->interval = header.interval;
+
+  // another starting point
+  mv->diverged = header.start_hash != state_hash();
+
+  return mv;
+}
+
+bool movie_frame_start(movie *mv)
+{
+  u16 buttons[2];
+
+  if (mv->file)
+  {
+    buttons[0] = pad_buttons(0);
+    buttons[1] = pad_buttons(1);
+
+    fwrite(buttons, sizeof(buttons), 1, mv->file);
+  }
+  else
+  {
+    if (mv->diverged || mv->size - mv->at < sizeof(buttons))
+      return false;
+
+    memcpy(buttons, mv->data + mv->at, sizeof(buttons));
+    mv->at += sizeof(buttons);
+
+    pad_set_buttons(0, buttons[0]);
+    pad_set_buttons(1, buttons[1]);
+  }
+
+  mv->frames++;
+
+  return true;
+}
+
+bool movie_frame_end(movie *mv)
+{
+  if (mv->frames % mv->interval)
+    return true;
+
+  u64 hash = state_hash();
+
+  if (mv->file)
+  {
+    fwrite(&hash, sizeof(hash), 1, mv->file);
+  }
+  else
+  {
+    u64 expected;
+
+    // a recording cut before its hash ends there
+    if (mv->size - mv->at < sizeof(expected))
+      return true;
+
+    memcpy(&expected, mv->data + mv->at, sizeof(expected));
+    mv->at += sizeof(expected);
+
+    if (hash != expected)
+    {
+      mv->diverged = true;
+      return false;
+    }
+  }
+
+  mv->verified = mv->frames;
+
+  return true;
+}
+
+u32 movie_frames(const movie *mv)
+{
+  return mv->frames;
+}
+
+u32 movie_verified(const movie *mv)
+{
+  return mv->verified;
+}
+
+bool movie_diverged(const movie *mv)
+{
+  return mv->diverged;
+}
+
+void movie_close(movie *mv)
+{
+  if (!mv)
+    return;
+
+  if (mv->file)
+    fclose(mv->file);
+
+  free(mv->data);
+  free(mv);
+}
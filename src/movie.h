@@ -0,0 +1,51 @@
+#pragma once
+#include "typedef.h"
+
+// Input movies
+// The pad input of every frame (see pad.h) and, every `interval` frames, the hash of
+// RAM and VRAM. Replaying a movie feeds the pads from it and checks the hashes: the first one
+// that differs is where the emulation drifted from the recording.
+//
+// 000h  ASCII ID "PSXMOVIE"
+// 008h  Format version (MOVIE_VERSION)
+// 00Ch  Hash interval in frames
+// 010h  Hash of the BIOS image (0 = none, see bios.h)
+// 018h  Hash of RAM and VRAM at the first frame
+// 020h  Frames: buttons of slot 0 and 1 (2 x 2 bytes), followed by the hash of RAM
+//       and VRAM (8 bytes) after every interval-th frame
+//
+// The movie does not hold the starting point: it is replayed from the same BIOS, EXE
+// or save state it was recorded from, which the first hash checks.
+
+#define MOVIE_VERSION 2
+
+typedef struct
+{
+  char magic[8];
+  u32 version;
+  u32 interval;
+  u64 bios_hash;
+  u64 start_hash;
+}movie_header;
+
+typedef struct movie movie;
+
+// Record the bound machine from now on, NULL when the file cannot be written
+movie *movie_record(const char *path, u32 interval);
+
+// Replay a movie on the bound machine from now on, NULL when it cannot be read or is
+// not a movie of this BIOS
+movie *movie_play(const char *path);
+
+// Start of a frame: log the input of the pads, or feed them from the movie (false
+// when the movie is over or has diverged)
+bool movie_frame_start(movie *mv);
+
+// End of a frame: store or check the hash of RAM and VRAM when it is due, false when it differs
+bool movie_frame_end(movie *mv);
+
+u32 movie_frames(const movie *mv);   // frames started so far
+u32 movie_verified(const movie *mv); // frames up to the last matching hash
+bool movie_diverged(const movie *mv);
+
+void movie_close(movie *mv); // flushes a recording
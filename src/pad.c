@@ -0,0 +1,197 @@
+#include "machine.h"
+
+// JOY_STAT
+#define STAT_TX_READY1 0x0001 // 0  TX Ready Flag 1   (1=Ready/Started)
+#define STAT_RX_READY  0x0002 // 1  RX FIFO Not Empty (0=Empty, 1=Not Empty)
+#define STAT_TX_READY2 0x0004 // 2  TX Ready Flag 2   (1=Ready/Finished)
+#define STAT_RX_ERROR  0x0008 // 3  RX Parity Error   (0=No, 1=Error; Wrong Parity, when enabled)
+#define STAT_IRQ       0x0200 // 9  Interrupt Request (0=None, 1=IRQ7)
+
+// JOY_CTRL
+#define CTRL_TX_ENABLE 0x0001 // 0  TX Enable (TXEN)
+#define CTRL_SELECT    0x0002 // 1  /JOYn Output (0=High, 1=Low/Select)
+#define CTRL_ACK       0x0010 // 4  Acknowledge (W: 1=Reset JOY_STAT.Bits 3,9)
+#define CTRL_RESET     0x0040 // 6  Reset (W: 1=Reset most JOY_registers to zero)
+#define CTRL_ACK_IRQ   0x1000 // 12 ACK Interrupt Enable (when /ACK goes low)
+#define CTRL_SLOT      0x2000 // 13 Desired Slot Number (0=/JOY1, 1=/JOY2)
+#define CTRL_WRITABLE  (0xffff & ~(CTRL_ACK | CTRL_RESET))
+
+#define PAD_ACK_DELAY 338 // /ACK goes low about 10 us after the byte
+
+enum PAD_STEP
+{
+  STEP_IDLE,    // waiting for the address byte
+  STEP_COMMAND, // 42h read buttons
+  STEP_ID,
+  STEP_LOW,
+  STEP_HIGH,
+  STEP_DONE,    // nothing answers until the slot is deselected
+};
+
+static void ack_event(R3000 *cpu, u64 deadline)
+{
+  psx->pad.stat |= STAT_IRQ;
+
+  if (psx->pad.ctrl & CTRL_ACK_IRQ)
+    irq_raise(IRQ_CONTROLLER);
+}
+
+// Answer of the selected pad to a byte, ack = the pad pulls /ACK low afterwards
+static u8 exchange(joypad *pad, u8 tx, bool *ack)
+{
+  const u16 buttons = ~pad->buttons[(pad->ctrl & CTRL_SLOT) ? 1 : 0];
+
+  *ack = true;
+
+  switch (pad->step)
+  {
+    case STEP_IDLE:
+      if (tx != 0x01) // 81h = memory card
+        break;
+
+      pad->step = STEP_COMMAND;
+      return 0xff;
+
+    case STEP_COMMAND:
+      if (tx != 0x42)
+        break;
+
+      pad->step = STEP_ID;
+      return 0x41; // digital pad
+
+    case STEP_ID:
+      pad->step = STEP_LOW;
+      return 0x5a;
+
+    case STEP_LOW:
+      pad->step = STEP_HIGH;
+      return buttons & 0xff;
+
+    case STEP_HIGH:
+      pad->step = STEP_DONE;
+      *ack = false;
+      return buttons >> 8;
+  }
+
+  pad->step = STEP_DONE;
+  *ack = false;
+
+  return 0xff;
+}
+
+static void write_ctrl(joypad *pad, u16 value)
+{
+  if (value & CTRL_RESET)
+  {
+    pad->mode = 0;
+    pad->baud = 0;
+    pad->stat = 0;
+    pad->rx_full = false;
+
+    sched_cancel(EVENT_PAD);
+  }
+
+  if (value & CTRL_ACK)
+    pad->stat &= ~(STAT_RX_ERROR | STAT_IRQ);
+
+  pad->ctrl = value & CTRL_WRITABLE;
+
+  if (!(pad->ctrl & CTRL_SELECT))
+    pad->step = STEP_IDLE;
+}
+
+static void transmit(joypad *pad, u8 value)
+{
+  bool ack = false;
+
+  // nothing selected: the line floats high
+  pad->rx = (pad->ctrl & CTRL_SELECT) ? exchange(pad, value, &ack) : 0xff;
+  pad->rx_full = true;
+
+  // a byte takes 8 baud periods
+  if (ack)
+    sched_add(EVENT_PAD, sched_now() + pad->baud * 8 + PAD_ACK_DELAY);
+}
+
+void pad_reset(void)
+{
+  joypad *pad = &psx->pad;
+
+  // the buttons are the frontend's
+  pad->mode = 0;
+  pad->ctrl = 0;
+  pad->baud = 0;
+  pad->stat = 0;
+  pad->rx = 0xff;
+  pad->rx_full = false;
+  pad->step = STEP_IDLE;
+
+  sched_set_handler(EVENT_PAD, ack_event);
+}
+
+u32 pad_read(u32 offset, u32 size)
+{
+  joypad *pad = &psx->pad;
+
+  switch (offset)
+  {
+    case 0x0:
+    {
+      const u8 value = pad->rx_full ? pad->rx : 0xff;
+
+      pad->rx_full = false;
+
+      return value;
+    }
+
+    case 0x4: return STAT_TX_READY1 | STAT_TX_READY2 | (pad->rx_full ? STAT_RX_READY : 0) | pad->stat;
+    case 0x8: return pad->mode | (size == 4 ? pad->ctrl << 16 : 0);
+    case 0xa: return pad->ctrl;
+    case 0xc: return size == 4 ? pad->baud << 16 : 0;
+    case 0xe: return pad->baud;
+  }
+
+  return 0;
+}
+
+void pad_write(u32 offset, u32 value, u32 size)
+{
+  joypad *pad = &psx->pad;
+
+  switch (offset)
+  {
+    case 0x0:
+      transmit(pad, value);
+      break;
+
+    case 0x8:
+      pad->mode = value;
+
+      if (size == 4)
+        write_ctrl(pad, value >> 16);
+      break;
+
+    case 0xa:
+      write_ctrl(pad, value);
+      break;
+
+    case 0xc:
+      if (size == 4)
+        pad->baud = value >> 16;
+      break;
+
+    case 0xe:
+      pad->baud = value;
+      break;
+  }
+}
+
+void pad_set_buttons(u32 slot, u16 buttons)
+{
+  psx->pad.buttons[slot & 1] = buttons;
+}
+
+u16 pad_buttons(u32 slot)
+{
+  return psx->pad.buttons[slot & 1];
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "typedef.h"
+
+// Controller port (SIO0), one digital pad per slot
+// 1F801040h JOY_TX_DATA (W) / JOY_RX_DATA (R)
+// 1F801044h JOY_STAT (R)
+// 1F801048h JOY_MODE (R/W)
+// 1F80104Ah JOY_CTRL (R/W)
+// 1F80104Eh JOY_BAUD (R/W)
+//
+// The byte sent to the selected slot is answered at once (the RX FIFO is one byte
+// deep); the /ACK of the pad raises IRQ7 a byte time later (EVENT_PAD, see scheduler.h).
+// Digital pad sequence:
+//   TX  01h  42h  00h  00h         00h
+//   RX  FFh  41h  5Ah  buttons lo  buttons hi (no /ACK after the last byte)
+// Memory cards (address 81h) are not connected.
+
+// Buttons (pressed = 1 here, the pad sends them inverted)
+enum PAD_BUTTON
+{
+  PAD_SELECT   = 0x0001,
+  PAD_START    = 0x0008,
+  PAD_UP       = 0x0010,
+  PAD_RIGHT    = 0x0020,
+  PAD_DOWN     = 0x0040,
+  PAD_LEFT     = 0x0080,
+  PAD_L2       = 0x0100,
+  PAD_R2       = 0x0200,
+  PAD_L1       = 0x0400,
+  PAD_R1       = 0x0800,
+  PAD_TRIANGLE = 0x1000,
+  PAD_CIRCLE   = 0x2000,
+  PAD_CROSS    = 0x4000,
+  PAD_SQUARE   = 0x8000,
+};
+
+typedef struct
+{
+  u16 mode;  // JOY_MODE
+  u16 ctrl;  // JOY_CTRL
+  u16 baud;  // JOY_BAUD
+  u16 stat;  // JOY_STAT bits 3 and 9 (error / IRQ latches)
+
+  u8 rx;     // RX FIFO
+  bool rx_full;
+
+  u8 step;   // position in the pad sequence of the selected slot
+
+  u16 buttons[2]; // input of the slots, set by the frontend
+}joypad;
+
+void pad_reset(void);
+
+u32 pad_read(u32 offset, u32 size);
+void pad_write(u32 offset, u32 value, u32 size);
+
+// Input the pad of the slot (0 or 1) answers from now on
+void pad_set_buttons(u32 slot, u16 buttons);
+u16 pad_buttons(u32 slot);
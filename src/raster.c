@@ -0,0 +1,285 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "raster_span.h"
+
+// The span loop of the host, the AVX2 clone when the CPU has it
+static span_fn *host_span = span;
+
+#if defined(__x86_64__)
+
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+
+static void pick_span(void)
+{
+  if (__builtin_cpu_supports("avx2"))
+    host_span = raster_span_avx2;
+}
+
+#endif
+
+static span_fn *span_of_host(void)
+{
+#if defined(__x86_64__)
+  pthread_once(&host_once, pick_span);
+#endif
+
+  return host_span;
+}
+
+static inline s64 floor_div(s64 n, s64 d) // d > 0
+{
+  return n >= 0 ? n / d : -((-n + d - 1) / d);
+}
+
+static inline s64 ceil_div(s64 n, s64 d) // d > 0
+{
+  return floor_div(n + d - 1, d);
+}
+
+static inline s32 max32(s32 a, s32 b) { return a > b ? a : b; }
+static inline s32 min32(s32 a, s32 b) { return a < b ? a : b; }
+static inline s32 abs32(s32 a)        { return a < 0 ? -a : a; }
+
+// Plane of one attribute: value at vertex 0 and the gradients per pixel (16.16)
+typedef struct
+{
+  s64 base;
+  s64 dx, dy;
+}plane;
+
+static plane make_plane(const raster_vertex v[3], s64 area, s32 a0, s32 a1, s32 a2)
+{
+  const s64 d1 = a1 - a0, d2 = a2 - a0;
+
+  const s64 dx1 = v[1].x - v[0].x, dy1 = v[1].y - v[0].y;
+  const s64 dx2 = v[2].x - v[0].x, dy2 = v[2].y - v[0].y;
+
+  const s64 unit = 1 << (16 + RASTER_SUBPIXEL_BITS);
+
+  // slivers thinner than a pixel can have any gradient, the spans step in 32 bits
+  const s64 limit = 256 << 16;
+
+  s64 dx = (d1 * dy2 - d2 * dy1) * unit / area;
+  s64 dy = (d2 * dx1 - d1 * dx2) * unit / area;
+
+  dx = dx < -limit ? -limit : dx > limit ? limit : dx;
+  dy = dy < -limit ? -limit : dy > limit ? limit : dy;
+
+  return (plane){ (s64)a0 << 16, dx, dy };
+}
+
+// Value at the pixel x, y (rounded), the plane starts at the vertex x0, y0 (1/16 pixel)
+static inline s32 plane_at(const plane *p, s32 x0, s32 y0, s32 x, s32 y)
+{
+  const s64 ox = ((s64)x << RASTER_SUBPIXEL_BITS) - x0;
+  const s64 oy = ((s64)y << RASTER_SUBPIXEL_BITS) - y0;
+
+  return p->base + ((p->dx * ox + p->dy * oy) >> RASTER_SUBPIXEL_BITS) + 0x8000;
+}
+
+void raster_triangle(vram_row *vram, const raster_env *env, const raster_mode *mode, const raster_vertex in[3])
+{
+  raster_vertex v[3] = { in[0], in[1], in[2] };
+
+  if (!mode->shaded)
+    for (u32 i = 1; i < 3; i++)
+      v[i].r = v[0].r, v[i].g = v[0].g, v[i].b = v[0].b;
+
+  s64 area = (s64)(v[1].x - v[0].x) * (v[2].y - v[0].y) - (s64)(v[2].x - v[0].x) * (v[1].y - v[0].y);
+
+  if (!area)
+    return;
+
+  // counter-clockwise on screen (Y down): every edge function is positive inside
+  if (area < 0)
+  {
+    const raster_vertex t = v[1];
+
+    v[1] = v[2];
+    v[2] = t;
+    area = -area;
+  }
+
+  const s32 min_x = min32(v[0].x, min32(v[1].x, v[2].x)), max_x = max32(v[0].x, max32(v[1].x, v[2].x));
+  const s32 min_y = min32(v[0].y, min32(v[1].y, v[2].y)), max_y = max32(v[0].y, max32(v[1].y, v[2].y));
+
+  // the GPU skips polygons larger than 1023x511
+  if (max_x - min_x > (VRAM_WIDTH - 1) << RASTER_SUBPIXEL_BITS ||
+      max_y - min_y > (VRAM_HEIGHT - 1) << RASTER_SUBPIXEL_BITS)
+    return;
+
+  const s32 first = max32(ceil_div(min_y, 1 << RASTER_SUBPIXEL_BITS), env->top);
+  const s32 last = min32(floor_div(max_y, 1 << RASTER_SUBPIXEL_BITS), env->bottom);
+
+  // edge i from v[i] to v[i+1]: E(p) = A*(px-ax) + B*(py-ay), inside when E >= bias
+  // (0 on the top / left edges, 1 on the right / bottom ones)
+  s64 edge_a[3], edge_b[3], bias[3];
+
+  for (u32 i = 0; i < 3; i++)
+  {
+    const raster_vertex *a = &v[i], *b = &v[(i + 1) % 3];
+
+    edge_a[i] = -(s64)(b->y - a->y);
+    edge_b[i] = b->x - a->x;
+    bias[i] = edge_a[i] > 0 || (edge_a[i] == 0 && edge_b[i] > 0) ? 0 : 1;
+  }
+
+  const plane pr = make_plane(v, area, v[0].r, v[1].r, v[2].r);
+  const plane pg = make_plane(v, area, v[0].g, v[1].g, v[2].g);
+  const plane pb = make_plane(v, area, v[0].b, v[1].b, v[2].b);
+  const plane pu = make_plane(v, area, v[0].u, v[1].u, v[2].u);
+  const plane pv = make_plane(v, area, v[0].v, v[1].v, v[2].v);
+
+  const span_attr step = { pr.dx, pg.dx, pb.dx, pu.dx, pv.dx };
+  span_fn *draw = span_of_host();
+
+  for (s32 y = first; y <= last; y++)
+  {
+    s64 left = env->left, right = env->right;
+
+    for (u32 i = 0; i < 3; i++)
+    {
+      // A*16*px >= bias - B*(16*py-ay) + A*ax
+      const s64 k = bias[i] - edge_b[i] * (((s64)y << RASTER_SUBPIXEL_BITS) - v[i].y) + edge_a[i] * v[i].x;
+      const s64 a = edge_a[i] << RASTER_SUBPIXEL_BITS;
+
+      if (a > 0)
+        left = left > ceil_div(k, a) ? left : ceil_div(k, a);
+      else if (a < 0)
+        right = right < floor_div(-k, -a) ? right : floor_div(-k, -a);
+      else if (k > 0)
+        right = left - 1;
+    }
+
+    if (left > right)
+      continue;
+
+    const span_attr start =
+    {
+      plane_at(&pr, v[0].x, v[0].y, left, y), plane_at(&pg, v[0].x, v[0].y, left, y),
+      plane_at(&pb, v[0].x, v[0].y, left, y), plane_at(&pu, v[0].x, v[0].y, left, y),
+      plane_at(&pv, v[0].x, v[0].y, left, y),
+    };
+
+    draw(vram, env, mode, y, left, right + 1, &start, &step);
+  }
+}
+
+void raster_rectangle(vram_row *vram, const raster_env *env, const raster_mode *mode, const raster_vertex *origin,
+                      s32 w, s32 h, bool flip_u, bool flip_v)
+{
+  const s32 x = origin->x >> RASTER_SUBPIXEL_BITS, y = origin->y >> RASTER_SUBPIXEL_BITS;
+
+  const s32 left = max32(x, env->left), right = min32(x + w - 1, env->right);
+  const s32 top = max32(y, env->top), bottom = min32(y + h - 1, env->bottom);
+
+  if (left > right || top > bottom)
+    return;
+
+  const s32 du = flip_u ? -1 : 1, dv = flip_v ? -1 : 1;
+
+  span_attr start = { origin->r << 16, origin->g << 16, origin->b << 16, (origin->u + du * (left - x)) * 0x10000, 0 };
+  const span_attr step = { 0, 0, 0, du * 0x10000, 0 };
+  span_fn *draw = span_of_host();
+
+  for (s32 row = top; row <= bottom; row++)
+  {
+    start.v = (origin->v + dv * (row - y)) * 0x10000;
+
+    draw(vram, env, mode, row, left, right + 1, &start, &step);
+  }
+}
+
+void raster_line(vram_row *vram, const raster_env *env, const raster_mode *mode, const raster_vertex *a,
+                 const raster_vertex *b)
+{
+  const s32 x0 = a->x >> RASTER_SUBPIXEL_BITS, y0 = a->y >> RASTER_SUBPIXEL_BITS;
+  const s32 dx = (b->x >> RASTER_SUBPIXEL_BITS) - x0, dy = (b->y >> RASTER_SUBPIXEL_BITS) - y0;
+
+  if (abs32(dx) >= VRAM_WIDTH || abs32(dy) >= VRAM_HEIGHT)
+    return;
+
+  // both ends are drawn
+  const s32 steps = max32(abs32(dx), abs32(dy));
+  const s32 div = steps ? steps : 1;
+
+  s32 x = x0 * 0x10000 + 0x8000, y = y0 * 0x10000 + 0x8000;
+
+  span_attr color = { a->r << 16, a->g << 16, a->b << 16, 0, 0 };
+  const span_attr none = { 0 };
+
+  const s32 sx = dx * 0x10000 / div, sy = dy * 0x10000 / div;
+
+  const span_attr step =
+  {
+    mode->shaded ? (b->r - a->r) * 0x10000 / div : 0,
+    mode->shaded ? (b->g - a->g) * 0x10000 / div : 0,
+    mode->shaded ? (b->b - a->b) * 0x10000 / div : 0,
+    0, 0,
+  };
+
+  span_fn *draw = span_of_host();
+
+  for (s32 i = 0; i <= steps; i++)
+  {
+    const s32 px = x >> 16, py = y >> 16;
+
+    if (px >= env->left && px <= env->right && py >= env->top && py <= env->bottom)
+      draw(vram, env, mode, py, px, px + 1, &color, &none);
+
+    x += sx;
+    y += sy;
+    color.r += step.r;
+    color.g += step.g;
+    color.b += step.b;
+  }
+}
+
+void raster_fill(vram_row *vram, u32 x, u32 y, u32 w, u32 h, u16 color)
+{
+  x &= 0x3F0;
+  y &= 0x1FF;
+  w = ((w & 0x3FF) + 0xF) & ~0xF;
+  h &= 0x1FF;
+
+  for (u32 row = 0; row < h; row++)
+  {
+    u16 *line = vram[(y + row) & (VRAM_HEIGHT - 1)];
+
+    for (u32 col = 0; col < w; col++)
+      line[(x + col) & (VRAM_WIDTH - 1)] = color;
+  }
+}
+
+void raster_copy(vram_row *vram, const raster_env *env, u32 src_x, u32 src_y, u32 dst_x, u32 dst_y, u32 w, u32 h)
+{
+  w = ((w - 1) & 0x3FF) + 1;
+  h = ((h - 1) & 0x1FF) + 1;
+
+  const u16 mask_bit = env->set_mask ? 0x8000 : 0;
+
+  // a row at a time through a copy, bottom up when moving down over itself
+  const bool reverse = dst_y > src_y;
+
+  u16 line[VRAM_WIDTH];
+
+  for (u32 n = 0; n < h; n++)
+  {
+    const u32 row = reverse ? h - 1 - n : n;
+
+    const u16 *src = vram[(src_y + row) & (VRAM_HEIGHT - 1)];
+    u16 *dst = vram[(dst_y + row) & (VRAM_HEIGHT - 1)];
+
+    for (u32 col = 0; col < w; col++)
+      line[col] = src[(src_x + col) & (VRAM_WIDTH - 1)];
+
+    for (u32 col = 0; col < w; col++)
+    {
+      u16 *pixel = &dst[(dst_x + col) & (VRAM_WIDTH - 1)];
+
+      if (!(env->check_mask && (*pixel & 0x8000)))
+        *pixel = line[col] | mask_bit;
+    }
+  }
+}
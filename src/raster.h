@@ -0,0 +1,93 @@
+#pragma once
+#include "typedef.h"
+
+// Software rasterizer
+// Draws the GP0 primitives into the 1024x512 VRAM (16 bits per pixel, 5:5:5 BGR and the
+// mask bit 15). Triangles are set up once (edges and attribute gradients) and filled a
+// span per scanline; a span is processed 8 pixels at a time (RASTER_LANES) with GCC vector
+// extensions: two SSE2 registers per lane vector on x64, NEON on arm64, and one AVX2
+// register in the clone of the span loop that x64 hosts with AVX2 run (its texel and CLUT
+// fetches are vpgatherdd, see raster_span.h):
+//
+//   Gouraud   R, G, B interpolated per lane (16.16)
+//   Texture   U, V per lane, texture window, then one texel load per lane (4/8-bit CLUT
+//             or 15-bit direct), texel 0000h is transparent
+//   Shading   texel*color/80h (or the raw texel), dithering (4x4 matrix), 8 to 5 bits
+//   Blending  B/2+F/2, B+F, B-F or B+F/4 against the VRAM pixel, for the texels with
+//             bit 15 set (every pixel when untextured)
+//   Mask      pixels with bit 15 set are kept (E6h.1), bit 15 forced on (E6h.0)
+//
+// Vertex coordinates are in 1/16 pixel (RASTER_SUBPIXEL_BITS) so that sub-pixel vertices
+// (see subpixel.h) are rasterized at their real position; the packets give whole pixels.
+// Pixels are sampled at their top-left corner and the right / bottom edges are excluded.
+
+#define VRAM_WIDTH  1024
+#define VRAM_HEIGHT 512
+
+#define RASTER_SUBPIXEL_BITS 4
+#define RASTER_LANES         8
+
+typedef u16 vram_row[VRAM_WIDTH];
+
+enum TEXTURE_DEPTH
+{
+  TEXTURE_4BIT  = 0, // CLUT, 16 entries
+  TEXTURE_8BIT  = 1, // CLUT, 256 entries
+  TEXTURE_15BIT = 2, // direct (3 = reserved, same)
+};
+
+enum BLEND_MODE
+{
+  BLEND_AVERAGE = 0, // B/2+F/2
+  BLEND_ADD     = 1, // B+F
+  BLEND_SUB     = 2, // B-F
+  BLEND_QUARTER = 3, // B+F/4
+  BLEND_OFF     = 4, // opaque
+};
+
+// Drawing environment (GP0 E2h-E4h, E6h)
+typedef struct
+{
+  s32 left, top, right, bottom; // drawing area, inclusive
+  u8 mask_u, mask_v;            // texture window mask (in pixels, multiple of 8)
+  u8 offset_u, offset_v;        // texture window offset (in pixels, masked)
+  bool set_mask;                // bit 15 of every drawn pixel set
+  bool check_mask;              // pixels with bit 15 set are not drawn over
+}raster_env;
+
+// Attributes of one primitive
+typedef struct
+{
+  bool shaded;    // Gouraud, otherwise the color of the first vertex
+  bool textured;
+  bool raw;       // texel drawn as is, without the color
+  bool dither;
+  u8 blend;       // BLEND_*
+  u8 depth;       // TEXTURE_*
+  u16 page_x;     // texture page, in pixels
+  u16 page_y;
+  u16 clut_x;
+  u16 clut_y;
+}raster_mode;
+
+typedef struct
+{
+  s32 x, y;      // 1/16 pixel, drawing offset included
+  u8 r, g, b;
+  u8 u, v;
+}raster_vertex;
+
+void raster_triangle(vram_row *vram, const raster_env *env, const raster_mode *mode, const raster_vertex v[3]);
+
+// Sprite at x, y (whole pixels) sampling from the U, V of origin, flipped U / V decreasing
+void raster_rectangle(vram_row *vram, const raster_env *env, const raster_mode *mode, const raster_vertex *origin,
+                      s32 w, s32 h, bool flip_u, bool flip_v);
+
+void raster_line(vram_row *vram, const raster_env *env, const raster_mode *mode, const raster_vertex *a,
+                 const raster_vertex *b);
+
+// GP0(02h): ignores the drawing area and the mask, x / w in 16 pixel steps, wraps around
+void raster_fill(vram_row *vram, u32 x, u32 y, u32 w, u32 h, u16 color);
+
+// GP0(80h), wraps around
+void raster_copy(vram_row *vram, const raster_env *env, u32 src_x, u32 src_y, u32 dst_x, u32 dst_y, u32 w, u32 h);
@@ -0,0 +1,12 @@
+#include "raster_span.h"
+
+#if defined(__x86_64__)
+
+// Built with -mavx2 (see CMakeLists.txt), only called when the host has AVX2
+void raster_span_avx2(vram_row *vram, const raster_env *env, const raster_mode *mode, s32 y, s32 x0, s32 x1,
+                      const span_attr *start, const span_attr *step)
+{
+  span(vram, env, mode, y, x0, x1, start, step);
+}
+
+#endif
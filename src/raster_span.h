@@ -0,0 +1,216 @@
+#pragma once
+#include "raster.h"
+
+// Span loop of the rasterizer, compiled twice: in raster.c for the baseline of the host
+// (SSE2 on x64, NEON on arm64) and in raster_avx2.c, built with -mavx2, where the texel
+// and CLUT fetches become vpgatherdd. raster.c picks one at run time.
+
+// Interpolated attributes (16.16)
+typedef struct
+{
+  s32 r, g, b;
+  s32 u, v;
+}span_attr;
+
+typedef void span_fn(vram_row *vram, const raster_env *env, const raster_mode *mode, s32 y, s32 x0, s32 x1,
+                     const span_attr *start, const span_attr *step);
+
+// raster_avx2.c, x64 only
+void raster_span_avx2(vram_row *vram, const raster_env *env, const raster_mode *mode, s32 y, s32 x0, s32 x1,
+                      const span_attr *start, const span_attr *step);
+
+// Helpers on lanes are always inlined into the span loop: no lanes cross a call, whatever
+// the vector ABI of the host
+#define LANE_FN static inline __attribute__((always_inline))
+
+typedef s32 lanes __attribute__((vector_size(RASTER_LANES * sizeof(s32))));
+
+static const lanes lane_index = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+_Static_assert(RASTER_LANES == 8, "lane_index has 8 lanes");
+
+// Added to the 8-bit components before they are cut to 5 bits
+static const s8 dither_matrix[4][4] =
+{
+  { -4, +0, -3, +1 },
+  { +2, -2, +3, -1 },
+  { -3, +1, -4, +0 },
+  { +3, -1, +2, -2 },
+};
+
+LANE_FN lanes splat(s32 value)
+{
+  return (lanes){ 0 } + value;
+}
+
+// a where the lanes of mask are set, b elsewhere
+LANE_FN lanes select_lanes(lanes mask, lanes a, lanes b)
+{
+  return (a & mask) | (b & ~mask);
+}
+
+LANE_FN lanes clamp_lanes(lanes value, s32 min, s32 max)
+{
+  value = select_lanes(value < splat(min), splat(min), value);
+
+  return select_lanes(value > splat(max), splat(max), value);
+}
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+// VRAM pixels at the lanes of index (y * VRAM_WIDTH + x): one vpgatherdd of the aligned
+// words holding them, so that no lane reads past the end of VRAM
+LANE_FN lanes fetch(vram_row *vram, lanes index)
+{
+  const lanes words = (lanes)_mm256_i32gather_epi32((const int *)vram, (__m256i)(index >> 1), 4);
+
+  return (words >> ((index & 1) << 4)) & 0xFFFF;
+}
+
+#else
+
+LANE_FN lanes fetch(vram_row *vram, lanes index)
+{
+  const u16 *pixels = vram[0];
+  lanes value;
+
+  for (u32 i = 0; i < RASTER_LANES; i++)
+    value[i] = pixels[index[i]];
+
+  return value;
+}
+
+#endif
+
+// Texels of the lanes, the texture window applied to U / V already
+LANE_FN lanes gather(vram_row *vram, const raster_mode *mode, lanes u, lanes v)
+{
+  const lanes row = ((splat(mode->page_y) + v) & (VRAM_HEIGHT - 1)) * VRAM_WIDTH;
+  const lanes clut = splat(mode->clut_y * VRAM_WIDTH);
+
+  switch (mode->depth)
+  {
+  case TEXTURE_4BIT:
+  {
+    const lanes word = fetch(vram, row + ((splat(mode->page_x) + (u >> 2)) & (VRAM_WIDTH - 1)));
+    const lanes index = (word >> ((u & 3) << 2)) & 0xF;
+
+    return fetch(vram, clut + ((splat(mode->clut_x) + index) & (VRAM_WIDTH - 1)));
+  }
+  case TEXTURE_8BIT:
+  {
+    const lanes word = fetch(vram, row + ((splat(mode->page_x) + (u >> 1)) & (VRAM_WIDTH - 1)));
+    const lanes index = (word >> ((u & 1) << 3)) & 0xFF;
+
+    return fetch(vram, clut + ((splat(mode->clut_x) + index) & (VRAM_WIDTH - 1)));
+  }
+  default:
+    return fetch(vram, row + ((splat(mode->page_x) + u) & (VRAM_WIDTH - 1)));
+  }
+}
+
+// Foreground component (8 bits, or the 5 bits of a raw texel) to 5 bits
+LANE_FN lanes shade(const raster_mode *mode, lanes color, lanes texel, lanes dither)
+{
+  if (mode->textured && mode->raw)
+    return texel;
+
+  if (mode->textured)
+    color = (texel * color) >> 4; // texel*color/80h in 8 bits
+
+  return clamp_lanes(color + dither, 0, 255) >> 3;
+}
+
+LANE_FN lanes blend(u8 mode, lanes back, lanes front)
+{
+  switch (mode)
+  {
+  case BLEND_AVERAGE: return (back + front) >> 1;
+  case BLEND_ADD:     return clamp_lanes(back + front, 0, 31);
+  case BLEND_SUB:     return clamp_lanes(back - front, 0, 31);
+  default:            return clamp_lanes(back + (front >> 2), 0, 31);
+  }
+}
+
+// Pixels x0 <= x < x1 of row y, inside the drawing area, the attributes at x0
+static inline void span(vram_row *vram, const raster_env *env, const raster_mode *mode, s32 y, s32 x0, s32 x1,
+                 const span_attr *start, const span_attr *step)
+{
+  u16 *row = vram[y];
+
+  // the chunks are 8 pixels apart: one dither row for all of them
+  lanes dither = splat(0);
+
+  if (mode->dither)
+    for (u32 i = 0; i < RASTER_LANES; i++)
+      dither[i] = dither_matrix[y & 3][(x0 + i) & 3];
+
+  lanes r = splat(start->r) + splat(step->r) * lane_index;
+  lanes g = splat(start->g) + splat(step->g) * lane_index;
+  lanes b = splat(start->b) + splat(step->b) * lane_index;
+  lanes u = splat(start->u) + splat(step->u) * lane_index;
+  lanes v = splat(start->v) + splat(step->v) * lane_index;
+
+  const lanes mask_bit = splat(env->set_mask ? 0x8000 : 0);
+
+  for (s32 x = x0; x < x1; x += RASTER_LANES)
+  {
+    lanes live = lane_index < splat(x1 - x);
+    lanes texel = splat(0);
+
+    if (mode->textured)
+    {
+      const lanes tu = (((u >> 16) & 0xFF) & splat(~env->mask_u)) | splat(env->offset_u);
+      const lanes tv = (((v >> 16) & 0xFF) & splat(~env->mask_v)) | splat(env->offset_v);
+
+      texel = gather(vram, mode, tu, tv);
+
+      live &= texel != splat(0);
+    }
+
+    lanes fr = shade(mode, clamp_lanes(r >> 16, 0, 255), texel & 0x1F, dither);
+    lanes fg = shade(mode, clamp_lanes(g >> 16, 0, 255), (texel >> 5) & 0x1F, dither);
+    lanes fb = shade(mode, clamp_lanes(b >> 16, 0, 255), (texel >> 10) & 0x1F, dither);
+
+    const bool inside = x + RASTER_LANES <= VRAM_WIDTH;
+
+    lanes back;
+
+    if (inside)
+      for (u32 i = 0; i < RASTER_LANES; i++)
+        back[i] = row[x + i];
+    else
+      for (u32 i = 0; i < RASTER_LANES; i++)
+        back[i] = row[(x + i) & (VRAM_WIDTH - 1)];
+
+    if (env->check_mask)
+      live &= (back & 0x8000) == splat(0);
+
+    if (mode->blend != BLEND_OFF)
+    {
+      const lanes semi = mode->textured ? (texel & 0x8000) != splat(0) : splat(-1);
+
+      fr = select_lanes(semi, blend(mode->blend, back & 0x1F, fr), fr);
+      fg = select_lanes(semi, blend(mode->blend, (back >> 5) & 0x1F, fg), fg);
+      fb = select_lanes(semi, blend(mode->blend, (back >> 10) & 0x1F, fb), fb);
+    }
+
+    const lanes out = select_lanes(live, fr | (fg << 5) | (fb << 10) | (texel & 0x8000) | mask_bit, back);
+
+    // the lanes that are not drawn store the pixel back
+    if (inside)
+      for (u32 i = 0; i < RASTER_LANES; i++)
+        row[x + i] = out[i];
+    else
+      for (u32 i = 0; i < RASTER_LANES; i++)
+        row[(x + i) & (VRAM_WIDTH - 1)] = out[i];
+
+    r += splat(step->r * RASTER_LANES);
+    g += splat(step->g * RASTER_LANES);
+    b += splat(step->b * RASTER_LANES);
+    u += splat(step->u * RASTER_LANES);
+    v += splat(step->v * RASTER_LANES);
+  }
+}
@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "machine.h"
+#include "block.h"
+
+#ifdef REC_BACKEND
+
+#include <sys/mman.h>
+
+#define REC_BUFFER_SIZE (32 * 1024 * 1024)
+
+static _Thread_local ir_block ir; // translation scratch of the thread
+
+static void *compile_block(code_page *cp, u32 index, u32 pc)
+{
+  rec_buffer *rec = &psx->rec;
+
+  ir_translate(&ir, cp, index, pc);
+
+  ir_optimize(&ir);
+
+  u8 *end = rec_emit(&ir, rec->ptr, rec->buffer + REC_BUFFER_SIZE);
+
+  if (!end)
+    return NULL;
+
+  __builtin___clear_cache((char *)rec->ptr, (char *)end);
+
+  u8 *entry = rec->ptr;
+
+  rec->ptr = end;
+
+  return entry;
+}
+
+bool rec_init(void)
+{
+  rec_buffer *rec = &psx->rec;
+
+  if (rec->buffer)
+    return true;
+
+  u8 *code = mmap(NULL, REC_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (code == MAP_FAILED)
+    return false;
+
+  rec->buffer = code;
+  rec->ptr = code;
+
+  return true;
+}
+
+void rec_shutdown(void)
+{
+  rec_buffer *rec = &psx->rec;
+
+  if (!rec->buffer)
+    return;
+
+  rec_flush();
+
+  munmap(rec->buffer, REC_BUFFER_SIZE);
+
+  rec->buffer = NULL;
+  rec->ptr = NULL;
+}
+
+void rec_flush(void)
+{
+  flush_decode_cache();
+
+  psx->rec.ptr = psx->rec.buffer;
+}
+
+void run_recompiler(R3000 *cpu, u64 deadline)
+{
+  while (cpu->cycles < deadline && cpu->cycles < psx->sched.deadline)
+  {
+    check_interrupt(cpu);
+
+    // misaligned pc and a delay slot left by the previous block go through the interpreter
+    code_page *cp = (cpu->pc & 0x3 || cpu->delay_slot) ? NULL : fetch_code_page(region_memory(cpu->pc));
+
+    if (!cp)
+    {
+      step_cpu(cpu);
+      continue;
+    }
+
+    block *b = &cp->blocks[(cpu->pc & PAGE_MASK) >> 2];
+
+    if (!b->code)
+      b->code = compile_block(cp, (cpu->pc & PAGE_MASK) >> 2, cpu->pc);
+
+    // buffer full: start over
+    if (!b->code)
+    {
+      rec_flush();
+      continue;
+    }
+
+    const u32 pc = cpu->pc;
+
+    cpu->cycles += fetch_cycles(pc, ((rec_block)b->code)(cpu));
+  }
+}
+
+#else
+
+bool rec_init(void)
+{
+  return false;
+}
+
+void rec_shutdown(void)
+{
+}
+
+void rec_flush(void)
+{
+}
+
+void run_recompiler(R3000 *cpu, u64 deadline)
+{
+  run_blocks(cpu, deadline);
+}
+
+#endif
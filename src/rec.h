@@ -0,0 +1,40 @@
+#pragma once
+#include "cpu.h"
+#include "decode.h"
+#include "ir.h"
+
+// Dynamic recompiler
+// The blocks found by build_block (see block.h) go through the IR (see ir.h) and are
+// lowered to host code by a backend; the entry is kept in block.code, so dropping a
+// code page on a RAM store (see decode.h) drops its translations too. IR values live
+// in host registers inside a block; rare instructions call the interpreter handlers.
+//
+// The load delay slot follows the interpreter: the loaded value waits in slot_cur
+// and is written back after the next instruction unless that one writes the same
+// register. A branch is resolved before its delay slot and taken after it.
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define REC_BACKEND // rec_x64.c / rec_arm64.c
+#endif
+
+// Host code buffer of a machine, filled linearly and dropped as a whole when full
+typedef struct
+{
+  u8 *buffer;
+  u8 *ptr;
+}rec_buffer;
+
+// Translated block: returns the number of instructions executed
+typedef u32 (*rec_block)(R3000 *cpu);
+
+bool rec_init(void); // false when the host cannot run generated code
+
+void rec_shutdown(void);
+
+void rec_flush(void); // drop every translation
+
+// Run translated blocks until cpu->cycles reaches the deadline or event_deadline (the last block may overshoot it)
+void run_recompiler(R3000 *cpu, u64 deadline);
+
+// Backend: host code of the block written at code, returns its end (NULL = does not fit before end)
+u8 *rec_emit(const ir_block *ir, u8 *code, u8 *end);
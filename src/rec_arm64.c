@@ -0,0 +1,476 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "rec.h"
+
+#if defined(__aarch64__) && defined(__linux__)
+
+#include "emit_arm64.h"
+
+#define REC_MAX_OP_SIZE 256 // worst case host bytes of one IR operation
+#define REC_TEMP_REGS   9
+
+#define CPU_REG 19 // x19 = R3000 * for the whole block
+
+#define CPU_OFFSET(field) ((u32)offsetof(R3000, field))
+#define GPR_OFFSET(index) (CPU_OFFSET(gpr_reg) + (index) * 4)
+#define SPILL_OFFSET(loc) (((loc) - REC_TEMP_REGS) * 4) // [sp + offset]
+
+// IR values live in callee saved w20-w28, calls into C keep them.
+// w0-w3, w9, w10 and x16 are scratch; memory accesses call the bus handlers.
+static const u8 temp_regs[REC_TEMP_REGS] = { 20, 21, 22, 23, 24, 25, 26, 27, 28 };
+
+typedef struct
+{
+  arm64_code code;
+
+  const ir_block *ir;
+  s16 loc[IR_MAX_OPS];        // see ir_allocate()
+
+  const ir_op *instr;         // IR_INSTR of the current guest instruction
+
+  u32 *exits[IR_MAX_OPS];     // jumps to the epilogue
+  u32 exit_count;
+} rec_state;
+
+static _Thread_local rec_state state; // emission scratch of the thread
+
+// Values
+
+// Host register holding value v, constants and spilled values are loaded in scratch
+static u8 value_reg(rec_state *s, u16 v, u8 scratch)
+{
+  const s16 loc = s->loc[v];
+
+  if (loc < 0)
+  {
+    if (!s->ir->ops[v].imm)
+      return ARM64_ZR;
+
+    a64_mov_imm(&s->code, scratch, s->ir->ops[v].imm);
+    return scratch;
+  }
+
+  if (loc < REC_TEMP_REGS)
+    return temp_regs[loc];
+
+  a64_load(&s->code, scratch, ARM64_SP, SPILL_OFFSET(loc));
+  return scratch;
+}
+
+static void value_to(rec_state *s, u8 dst, u16 v)
+{
+  a64_mov(&s->code, dst, value_reg(s, v, dst));
+}
+
+// [cpu + offset] = value v
+static void store_value(rec_state *s, u32 offset, u16 v)
+{
+  a64_store(&s->code, value_reg(s, v, 9), CPU_REG, offset);
+}
+
+// Host register to compute value v in: its own one, or w0 for a spilled value
+static u8 result_reg(rec_state *s, u16 v)
+{
+  const s16 loc = s->loc[v];
+
+  return (loc >= 0 && loc < REC_TEMP_REGS) ? temp_regs[loc] : 0;
+}
+
+static void put_result(rec_state *s, u16 v, u8 reg)
+{
+  const s16 loc = s->loc[v];
+
+  if (loc < 0)
+    return;
+
+  if (loc < REC_TEMP_REGS)
+    a64_mov(&s->code, temp_regs[loc], reg);
+  else
+    a64_store(&s->code, reg, ARM64_SP, SPILL_OFFSET(loc));
+}
+
+// Exits
+
+static void emit_exit(rec_state *s, u32 executed)
+{
+  a64_mov_imm(&s->code, 0, executed);
+
+  s->exits[s->exit_count++] = a64_b(&s->code);
+}
+
+// pc_exception / pc / next_pc as execute_instr() leaves them for the current instruction
+static void emit_pc_state(rec_state *s)
+{
+  arm64_code *c = &s->code;
+
+  const ir_op *instr = s->instr;
+
+  a64_mov_imm(c, 9, instr->imm);
+  a64_store(c, 9, CPU_REG, CPU_OFFSET(pc_exception));
+
+  if (instr->sign)
+  {
+    // branch target resolved by the previous instruction
+    value_to(s, 9, instr->a);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(pc));
+    a64_add_imm(c, 9, 9, 4);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(next_pc));
+  }
+  else
+  {
+    a64_mov_imm(c, 9, instr->imm + 4);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(pc));
+    a64_mov_imm(c, 9, instr->imm + 8);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(next_pc));
+  }
+
+  a64_mov_imm(c, 9, instr->sign);
+  a64_store8(c, 9, CPU_REG, CPU_OFFSET(branch_delay_slot_saved));
+}
+
+// Side exit raising an exception, the bad address (if any) is in w2
+static void emit_exception(rec_state *s, u8 cause)
+{
+  arm64_code *c = &s->code;
+
+  emit_pc_state(s);
+
+  a64_mov64(c, 0, CPU_REG);
+  a64_mov_imm(c, 1, cause);
+  a64_call(c, ir_exception);
+
+  emit_exit(s, s->instr->imm2 + 1);
+}
+
+// Operations
+
+// w2 = a + imm, with an address error exit when it is not aligned to size
+static void emit_address(rec_state *s, const ir_op *op, u8 cause)
+{
+  arm64_code *c = &s->code;
+
+  value_to(s, 2, op->a);
+
+  if (op->imm)
+  {
+    a64_mov_imm(c, 9, op->imm);
+    a64_alu(c, A64_ADD, 2, 2, 9);
+  }
+
+  if (op->size == 1)
+    return;
+
+  a64_mov_imm(c, 9, op->size - 1);
+  a64_alu(c, A64_ANDS, ARM64_ZR, 2, 9);
+
+  u32 *ok = a64_bcond(c, A64_EQ);
+
+  emit_exception(s, cause);
+
+  a64_patch_here(c, ok);
+}
+
+static const u8 branch_cond[] = { A64_EQ, A64_NE, A64_LT, A64_GE, A64_LE, A64_GT }; // IR_COND
+
+// Load delay slot of an unknown load (block entry, after an interpreter call)
+static void emit_retire(rec_state *s, u8 written)
+{
+  arm64_code *c = &s->code;
+
+  a64_load(c, 9, CPU_REG, CPU_OFFSET(slot_cur.reg));
+  a64_cmp(c, 9, ARM64_ZR);
+
+  u32 *none = a64_bcond(c, A64_EQ);
+  u32 *cancel = NULL;
+
+  if (written)
+  {
+    a64_mov_imm(c, 10, written);
+    a64_cmp(c, 9, 10);
+    cancel = a64_bcond(c, A64_EQ);
+  }
+
+  a64_load(c, 10, CPU_REG, CPU_OFFSET(slot_cur.cur));
+  a64_add_imm64(c, 3, CPU_REG, GPR_OFFSET(0));
+  a64_store_index(c, 10, 3, 9);
+
+  if (cancel)
+    a64_patch_here(c, cancel);
+
+  a64_store(c, ARM64_ZR, CPU_REG, CPU_OFFSET(slot_cur.reg));
+  a64_store(c, ARM64_ZR, CPU_REG, CPU_OFFSET(slot_cur.cur));
+
+  a64_patch_here(c, none);
+}
+
+// Rare instructions: run the interpreter handler, GPRs are already in cpu->gpr_reg
+static void emit_call_handler(rec_state *s, const instruction *in)
+{
+  arm64_code *c = &s->code;
+
+  emit_pc_state(s);
+
+  a64_mov_imm64(c, 9, (u64)in);
+  a64_store64(c, 9, CPU_REG, CPU_OFFSET(instr));
+  a64_mov_imm(c, 9, in->opcode);
+  a64_store(c, 9, CPU_REG, CPU_OFFSET(opcode));
+
+  a64_mov64(c, 0, CPU_REG);
+  a64_call(c, in->handler);
+
+  a64_mov64(c, 0, CPU_REG);
+  a64_call(c, retire_load);
+
+  // an exception moved pc to its vector
+  a64_load(c, 0, CPU_REG, CPU_OFFSET(pc));
+
+  if (s->instr->sign)
+  {
+    a64_cmp(c, 0, value_reg(s, s->instr->a, 1));
+  }
+  else
+  {
+    a64_mov_imm(c, 1, s->instr->imm + 4);
+    a64_cmp(c, 0, 1);
+  }
+
+  u32 *same = a64_bcond(c, A64_EQ);
+
+  emit_exit(s, s->instr->imm2 + 1);
+
+  a64_patch_here(c, same);
+}
+
+static void emit_op(rec_state *s, u16 i)
+{
+  arm64_code *c = &s->code;
+
+  const ir_op *op = &s->ir->ops[i];
+
+  const u8 dst = result_reg(s, i);
+
+  switch (op->op)
+  {
+  case IR_GET:
+    a64_load(c, dst, CPU_REG, GPR_OFFSET(op->reg));
+    put_result(s, i, dst);
+    break;
+
+  case IR_GET_HI:
+  case IR_GET_LO:
+    a64_load(c, dst, CPU_REG, (op->op == IR_GET_HI) ? CPU_OFFSET(hi) : CPU_OFFSET(lo));
+    put_result(s, i, dst);
+    break;
+
+  case IR_ADD: case IR_SUB: case IR_AND: case IR_OR: case IR_XOR: case IR_NOR:
+  case IR_SHL: case IR_SHR: case IR_SAR:
+  {
+    static const u32 alu[] =
+    {
+      [IR_ADD] = A64_ADD, [IR_SUB] = A64_SUB, [IR_AND] = A64_AND, [IR_OR] = A64_ORR, [IR_XOR] = A64_EOR,
+      [IR_NOR] = A64_ORR, [IR_SHL] = A64_LSLV, [IR_SHR] = A64_LSRV, [IR_SAR] = A64_ASRV,
+    };
+
+    // the variable shifts take the count modulo 32 like the R3000
+    a64_alu(c, alu[op->op], dst, value_reg(s, op->a, 0), value_reg(s, op->b, 1));
+
+    if (op->op == IR_NOR)
+      a64_alu(c, A64_ORN, dst, ARM64_ZR, dst);
+
+    put_result(s, i, dst);
+    break;
+  }
+
+  case IR_SLT:
+  case IR_SLTU:
+    a64_cmp(c, value_reg(s, op->a, 0), value_reg(s, op->b, 1));
+    a64_cset(c, dst, (op->op == IR_SLT) ? A64_LT : A64_LO);
+    put_result(s, i, dst);
+    break;
+
+  case IR_ADD_TRAP:
+  case IR_SUB_TRAP:
+  {
+    a64_alu(c, (op->op == IR_ADD_TRAP) ? A64_ADDS : A64_SUBS, dst, value_reg(s, op->a, 0), value_reg(s, op->b, 1));
+
+    u32 *ok = a64_bcond(c, A64_VC);
+
+    emit_exception(s, Overflow);
+
+    a64_patch_here(c, ok);
+
+    put_result(s, i, dst);
+    break;
+  }
+
+  case IR_LOAD:
+    emit_address(s, op, LoadAddrError);
+
+    a64_mov(c, 0, 2);
+
+    switch (op->size)
+    {
+    case 1:  a64_call(c, read8);  break;
+    case 2:  a64_call(c, read16); break;
+    default: a64_call(c, read32); break;
+    }
+
+    // the upper bits of a u8 / u16 return value are undefined
+    if (op->size < 4)
+      a64_extend(c, 0, 0, op->sign, op->size == 2);
+
+    put_result(s, i, 0);
+    break;
+
+  case IR_BRANCH:
+  {
+    const u8 a = value_reg(s, op->a, 0);
+    const u8 b = (op->b == IR_NONE) ? ARM64_ZR : value_reg(s, op->b, 1);
+
+    a64_mov_imm(c, 9, op->imm);
+    a64_mov_imm(c, 10, op->imm2);
+    a64_cmp(c, a, b);
+    a64_csel(c, dst, 9, 10, branch_cond[op->size]);
+    put_result(s, i, dst);
+    break;
+  }
+
+  case IR_SET:
+    store_value(s, GPR_OFFSET(op->reg), op->a);
+    break;
+
+  case IR_SET_HI:
+    store_value(s, CPU_OFFSET(hi), op->a);
+    break;
+
+  case IR_SET_LO:
+    store_value(s, CPU_OFFSET(lo), op->a);
+    break;
+
+  case IR_MULT:
+    a64_mull(c, 0, value_reg(s, op->a, 0), value_reg(s, op->b, 1), op->sign);
+    a64_store(c, 0, CPU_REG, CPU_OFFSET(lo));
+    a64_high32(c, 0, 0);
+    a64_store(c, 0, CPU_REG, CPU_OFFSET(hi));
+    break;
+
+  case IR_STORE:
+    emit_address(s, op, WriteAddrError);
+
+    value_to(s, 1, op->b);
+    a64_mov(c, 0, 2);
+
+    switch (op->size)
+    {
+    case 1:  a64_call(c, write8);  break;
+    case 2:  a64_call(c, write16); break;
+    default: a64_call(c, write32); break;
+    }
+    break;
+
+  case IR_PENDING:
+    store_value(s, CPU_OFFSET(slot_cur.cur), op->a);
+    a64_mov_imm(c, 9, op->reg);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(slot_cur.reg));
+    break;
+
+  case IR_PENDING_CLEAR:
+    a64_store(c, ARM64_ZR, CPU_REG, CPU_OFFSET(slot_cur.reg));
+    a64_store(c, ARM64_ZR, CPU_REG, CPU_OFFSET(slot_cur.cur));
+    break;
+
+  case IR_RETIRE:
+    emit_retire(s, op->reg);
+    break;
+
+  case IR_CALL:
+    emit_call_handler(s, op->instr);
+    break;
+
+  case IR_INSTR:
+    s->instr = op;
+    break;
+  }
+}
+
+u8 *rec_emit(const ir_block *ir, u8 *code, u8 *end)
+{
+  if (end - code < (ptrdiff_t)(ir->count * REC_MAX_OP_SIZE + 256))
+    return NULL;
+
+  rec_state *s = &state;
+  arm64_code *c = &s->code;
+
+  s->code = (arm64_code){ (u32 *)code, (u32 *)code, (u32 *)end };
+  s->ir = ir;
+  s->instr = NULL;
+  s->exit_count = 0;
+
+  const u32 spills = ir_allocate(ir, REC_TEMP_REGS, s->loc);
+
+  const s32 frame = (spills * 4 + 15) & ~15;
+
+  // x29, x30 and the callee saved x19-x28
+  a64_stp(c, ARM64_FP, ARM64_LR, -96, true);
+  a64_stp(c, 19, 20, 16, false);
+  a64_stp(c, 21, 22, 32, false);
+  a64_stp(c, 23, 24, 48, false);
+  a64_stp(c, 25, 26, 64, false);
+  a64_stp(c, 27, 28, 80, false);
+
+  if (frame)
+    a64_add_imm64(c, ARM64_SP, ARM64_SP, -frame);
+
+  a64_mov64(c, CPU_REG, 0);
+
+  for (u32 i = 0; i < ir->count; i++)
+    emit_op(s, i);
+
+  const u32 next = ir->pc + ir->instrs * 4;
+
+  switch (ir->exit)
+  {
+  case IR_EXIT_NEXT:
+    a64_mov_imm(c, 9, next);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(pc));
+    a64_mov_imm(c, 9, next + 4);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(next_pc));
+    break;
+
+  case IR_EXIT_BRANCH:
+    value_to(s, 9, ir->target);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(pc));
+    a64_add_imm(c, 9, 9, 4);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(next_pc));
+    break;
+
+  case IR_EXIT_DELAY:
+    a64_mov_imm(c, 9, next);
+    a64_store(c, 9, CPU_REG, CPU_OFFSET(pc));
+    store_value(s, CPU_OFFSET(next_pc), ir->target);
+    a64_mov_imm(c, 9, 1);
+    a64_store8(c, 9, CPU_REG, CPU_OFFSET(delay_slot));
+    break;
+  }
+
+  a64_mov_imm(c, 0, ir->instrs);
+
+  for (u32 i = 0; i < s->exit_count; i++)
+    a64_patch_here(c, s->exits[i]);
+
+  if (frame)
+    a64_add_imm64(c, ARM64_SP, ARM64_SP, frame);
+
+  a64_ldp(c, 27, 28, 80, false);
+  a64_ldp(c, 25, 26, 64, false);
+  a64_ldp(c, 23, 24, 48, false);
+  a64_ldp(c, 21, 22, 32, false);
+  a64_ldp(c, 19, 20, 16, false);
+  a64_ldp(c, ARM64_FP, ARM64_LR, 96, true);
+  a64_ret(c);
+
+  return (u8 *)c->ptr;
+}
+
+#endif
@@ -0,0 +1,557 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "rec.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include "emit_x64.h"
+
+#define REC_MAX_OP_SIZE 192 // worst case host bytes of one IR operation
+#define REC_TEMP_REGS   5
+
+#define CPU_REG R15 // R3000 * for the whole block
+
+#define CPU_OFFSET(field) ((s32)offsetof(R3000, field))
+#define GPR_OFFSET(index) (CPU_OFFSET(gpr_reg) + (index) * 4)
+#define SPILL_OFFSET(loc) (((loc) - REC_TEMP_REGS) * 4) // [rsp + offset]
+
+// IR values live in callee saved host registers, calls into C keep them.
+// rax, rcx, rdx, rsi, rdi and r8 are scratch.
+static const u8 temp_regs[REC_TEMP_REGS] = { RBX, RBP, R12, R13, R14 };
+
+typedef struct
+{
+  x64_code code;
+
+  const ir_block *ir;
+  s16 loc[IR_MAX_OPS];        // see ir_allocate()
+
+  const ir_op *instr;         // IR_INSTR of the current guest instruction
+
+  u8 *exits[IR_MAX_OPS];      // jumps to the epilogue
+  u32 exit_count;
+} rec_state;
+
+static _Thread_local rec_state state; // emission scratch of the thread
+
+// Values
+
+// Host register holding value v, constants and spilled values are loaded in scratch
+static u8 value_reg(rec_state *s, u16 v, u8 scratch)
+{
+  const s16 loc = s->loc[v];
+
+  if (loc < 0)
+  {
+    emit_mov_ri(&s->code, scratch, s->ir->ops[v].imm);
+    return scratch;
+  }
+
+  if (loc < REC_TEMP_REGS)
+    return temp_regs[loc];
+
+  emit_load(&s->code, scratch, RSP, SPILL_OFFSET(loc));
+  return scratch;
+}
+
+static void value_to(rec_state *s, u8 dst, u16 v)
+{
+  emit_mov_rr(&s->code, dst, value_reg(s, v, dst));
+}
+
+// [base + disp] = value v
+static void store_value(rec_state *s, u8 base, s32 disp, u16 v)
+{
+  if (s->loc[v] < 0)
+    emit_store_imm(&s->code, base, disp, s->ir->ops[v].imm);
+  else
+    emit_store(&s->code, base, disp, value_reg(s, v, RAX));
+}
+
+// Host register to compute value v in: its own one, or rax for a spilled value
+static u8 result_reg(rec_state *s, u16 v)
+{
+  const s16 loc = s->loc[v];
+
+  return (loc >= 0 && loc < REC_TEMP_REGS) ? temp_regs[loc] : RAX;
+}
+
+static void put_result(rec_state *s, u16 v, u8 reg)
+{
+  const s16 loc = s->loc[v];
+
+  if (loc < 0)
+    return;
+
+  if (loc < REC_TEMP_REGS)
+    emit_mov_rr(&s->code, temp_regs[loc], reg);
+  else
+    emit_store(&s->code, RSP, SPILL_OFFSET(loc), reg);
+}
+
+// Exits
+
+static void emit_exit(rec_state *s, u32 executed)
+{
+  emit_mov_ri(&s->code, RAX, executed);
+
+  s->exits[s->exit_count++] = emit_jmp(&s->code);
+}
+
+// pc_exception / pc / next_pc as execute_instr() leaves them for the current instruction
+static void emit_pc_state(rec_state *s)
+{
+  x64_code *c = &s->code;
+
+  const ir_op *instr = s->instr;
+
+  emit_store_imm(c, CPU_REG, CPU_OFFSET(pc_exception), instr->imm);
+
+  if (instr->sign)
+  {
+    // branch target resolved by the previous instruction
+    value_to(s, RAX, instr->a);
+    emit_store(c, CPU_REG, CPU_OFFSET(pc), RAX);
+    emit_alu_ri(c, ALU_ADD, RAX, 4);
+    emit_store(c, CPU_REG, CPU_OFFSET(next_pc), RAX);
+  }
+  else
+  {
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(pc), instr->imm + 4);
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(next_pc), instr->imm + 8);
+  }
+
+  emit_store8_imm(c, CPU_REG, CPU_OFFSET(branch_delay_slot_saved), instr->sign);
+}
+
+// Side exit raising an exception, the bad address (if any) is in edx
+static void emit_exception(rec_state *s, u8 cause)
+{
+  x64_code *c = &s->code;
+
+  emit_pc_state(s);
+
+  emit_mov_rr64(c, RDI, CPU_REG);
+  emit_mov_ri(c, RSI, cause);
+  emit_call(c, ir_exception);
+
+  emit_exit(s, s->instr->imm2 + 1);
+}
+
+// Operations
+
+// eax = a <alu> b
+static void emit_binary(rec_state *s, const ir_op *op, u8 alu)
+{
+  value_to(s, RAX, op->a);
+
+  if (s->loc[op->b] < 0)
+    emit_alu_ri(&s->code, alu, RAX, s->ir->ops[op->b].imm);
+  else
+    emit_alu_rr(&s->code, alu, RAX, value_reg(s, op->b, RCX));
+}
+
+static void emit_shift(rec_state *s, const ir_op *op, u8 shift)
+{
+  value_to(s, RAX, op->a);
+
+  if (s->loc[op->b] < 0)
+  {
+    emit_shift_ri(&s->code, shift, RAX, s->ir->ops[op->b].imm & 31);
+  }
+  else
+  {
+    // x86 masks the count to 5 bits like the R3000
+    value_to(s, RCX, op->b);
+    emit_shift_rcl(&s->code, shift, RAX);
+  }
+}
+
+// edx = a + imm, with an address error exit when it is not aligned to size
+static void emit_address(rec_state *s, const ir_op *op, u8 cause)
+{
+  x64_code *c = &s->code;
+
+  value_to(s, RDX, op->a);
+
+  if (op->imm)
+    emit_alu_ri(c, ALU_ADD, RDX, op->imm);
+
+  if (op->size == 1)
+    return;
+
+  emit_test_ri(c, RDX, op->size - 1);
+
+  u8 *ok = emit_jcc(c, CC_E);
+
+  emit_exception(s, cause);
+
+  patch_here(c, ok);
+}
+
+// Host access at fastmem base + region_memory(edx), in the forms the fault handler decodes
+static void emit_fastmem(rec_state *s, u8 *base)
+{
+  x64_code *c = &s->code;
+
+  emit_mov_rr(c, RCX, RDX);
+  emit_shift_ri(c, SHIFT_SHR, RCX, 29);
+  emit_mov_ri64(c, R8, (u64)region_mask);
+  emit_alu_rm_index(c, ALU_AND, RDX, R8, RCX, 0);
+  emit_mov_ri64(c, RCX, (u64)base);
+}
+
+// eax = [edx]
+static void emit_read(rec_state *s, u32 size, bool sign)
+{
+  x64_code *c = &s->code;
+
+  u8 *base = bus_fastmem();
+
+  if (base)
+  {
+    emit_fastmem(s, base);
+
+    // wait states, like read8/16/32: cpu->cycles += load_cycles[size][edx >> PAGE_SHIFT]
+    emit_mov_rr(c, R8, RDX);
+    emit_shift_ri(c, SHIFT_SHR, R8, PAGE_SHIFT);
+    emit_alu_ri(c, ALU_AND, R8, PAGE_COUNT - 1);
+    emit_mov_ri64(c, RAX, (u64)bus_load_cycles(size));
+    emit8(c, 0x46); emit8(c, 0x0f); emit8(c, 0xb6); emit8(c, 0x04); emit8(c, 0x00); // movzbl (%rax,%r8), %r8d
+    emit_op_rm(c, 0x01, true, R8, CPU_REG, CPU_OFFSET(cycles));                       // add %r8, cycles(%r15)
+
+    switch (size)
+    {
+    case 1:  emit8(c, 0x0f); emit8(c, 0xb6); emit8(c, 0x04); emit8(c, 0x11); break; // movzbl (%rcx,%rdx), %eax
+    case 2:  emit8(c, 0x0f); emit8(c, 0xb7); emit8(c, 0x04); emit8(c, 0x11); break; // movzwl (%rcx,%rdx), %eax
+    default: emit8(c, 0x8b); emit8(c, 0x04); emit8(c, 0x11);                 break; // movl   (%rcx,%rdx), %eax
+    }
+  }
+  else
+  {
+    emit_mov_rr(c, RDI, RDX);
+
+    switch (size)
+    {
+    case 1:  emit_call(c, read8);  break;
+    case 2:  emit_call(c, read16); break;
+    default: emit_call(c, read32); break;
+    }
+  }
+
+  // the upper bits of a u8 / u16 return value are undefined
+  if (size < 4 && (sign || !base))
+    emit_extend(c, RAX, RAX, sign, size == 2);
+}
+
+// [edx] = eax
+static void emit_write(rec_state *s, u32 size)
+{
+  x64_code *c = &s->code;
+
+  u8 *base = bus_fastmem();
+
+  if (base)
+  {
+    emit_fastmem(s, base);
+
+    switch (size)
+    {
+    case 1:  emit8(c, 0x88); emit8(c, 0x04); emit8(c, 0x11);                 break; // movb %al, (%rcx,%rdx)
+    case 2:  emit8(c, 0x66); emit8(c, 0x89); emit8(c, 0x04); emit8(c, 0x11); break; // movw %ax, (%rcx,%rdx)
+    default: emit8(c, 0x89); emit8(c, 0x04); emit8(c, 0x11);                 break; // movl %eax, (%rcx,%rdx)
+    }
+  }
+  else
+  {
+    emit_mov_rr(c, RDI, RDX);
+    emit_mov_rr(c, RSI, RAX);
+
+    switch (size)
+    {
+    case 1:  emit_call(c, write8);  break;
+    case 2:  emit_call(c, write16); break;
+    default: emit_call(c, write32); break;
+    }
+  }
+}
+
+static const u8 branch_cond[] = { CC_E, CC_NE, CC_L, CC_GE, CC_LE, CC_G }; // IR_COND
+
+// Load delay slot of an unknown load (block entry, after an interpreter call)
+static void emit_retire(rec_state *s, u8 written)
+{
+  x64_code *c = &s->code;
+
+  emit_load(c, RCX, CPU_REG, CPU_OFFSET(slot_cur.reg));
+  emit_test_rr(c, RCX, RCX);
+
+  u8 *none = emit_jcc(c, CC_E);
+  u8 *cancel = NULL;
+
+  if (written)
+  {
+    emit_alu_ri(c, ALU_CMP, RCX, written);
+    cancel = emit_jcc(c, CC_E);
+  }
+
+  emit_load(c, RDX, CPU_REG, CPU_OFFSET(slot_cur.cur));
+  emit_store_index(c, CPU_REG, RCX, CPU_OFFSET(gpr_reg), RDX);
+
+  if (cancel)
+    patch_here(c, cancel);
+
+  emit_store_imm(c, CPU_REG, CPU_OFFSET(slot_cur.reg), 0);
+  emit_store_imm(c, CPU_REG, CPU_OFFSET(slot_cur.cur), 0);
+
+  patch_here(c, none);
+}
+
+// Rare instructions: run the interpreter handler, GPRs are already in cpu->gpr_reg
+static void emit_call_handler(rec_state *s, const instruction *in)
+{
+  x64_code *c = &s->code;
+
+  emit_pc_state(s);
+
+  emit_mov_ri64(c, RAX, (u64)in);
+  emit_store64(c, CPU_REG, CPU_OFFSET(instr), RAX);
+  emit_store_imm(c, CPU_REG, CPU_OFFSET(opcode), in->opcode);
+
+  emit_mov_rr64(c, RDI, CPU_REG);
+  emit_call(c, in->handler);
+
+  emit_mov_rr64(c, RDI, CPU_REG);
+  emit_call(c, retire_load);
+
+  // an exception moved pc to its vector
+  emit_load(c, RAX, CPU_REG, CPU_OFFSET(pc));
+
+  if (s->instr->sign)
+  {
+    value_to(s, RCX, s->instr->a);
+    emit_alu_rr(c, ALU_CMP, RAX, RCX);
+  }
+  else
+  {
+    emit_alu_ri(c, ALU_CMP, RAX, s->instr->imm + 4);
+  }
+
+  u8 *same = emit_jcc(c, CC_E);
+
+  emit_exit(s, s->instr->imm2 + 1);
+
+  patch_here(c, same);
+}
+
+static void emit_op(rec_state *s, u16 i)
+{
+  x64_code *c = &s->code;
+
+  const ir_op *op = &s->ir->ops[i];
+
+  switch (op->op)
+  {
+  case IR_GET:
+  {
+    const u8 dst = result_reg(s, i);
+
+    emit_load(c, dst, CPU_REG, GPR_OFFSET(op->reg));
+    put_result(s, i, dst);
+    break;
+  }
+
+  case IR_GET_HI:
+  case IR_GET_LO:
+  {
+    const u8 dst = result_reg(s, i);
+
+    emit_load(c, dst, CPU_REG, (op->op == IR_GET_HI) ? CPU_OFFSET(hi) : CPU_OFFSET(lo));
+    put_result(s, i, dst);
+    break;
+  }
+
+  case IR_ADD: emit_binary(s, op, ALU_ADD); put_result(s, i, RAX); break;
+  case IR_SUB: emit_binary(s, op, ALU_SUB); put_result(s, i, RAX); break;
+  case IR_AND: emit_binary(s, op, ALU_AND); put_result(s, i, RAX); break;
+  case IR_OR:  emit_binary(s, op, ALU_OR);  put_result(s, i, RAX); break;
+  case IR_XOR: emit_binary(s, op, ALU_XOR); put_result(s, i, RAX); break;
+
+  case IR_NOR:
+    emit_binary(s, op, ALU_OR);
+    emit_not(c, RAX);
+    put_result(s, i, RAX);
+    break;
+
+  case IR_SLT:
+  case IR_SLTU:
+    emit_binary(s, op, ALU_CMP);
+    emit_setcc(c, (op->op == IR_SLT) ? CC_L : CC_B, RAX);
+    put_result(s, i, RAX);
+    break;
+
+  case IR_SHL: emit_shift(s, op, SHIFT_SHL); put_result(s, i, RAX); break;
+  case IR_SHR: emit_shift(s, op, SHIFT_SHR); put_result(s, i, RAX); break;
+  case IR_SAR: emit_shift(s, op, SHIFT_SAR); put_result(s, i, RAX); break;
+
+  case IR_ADD_TRAP:
+  case IR_SUB_TRAP:
+  {
+    emit_binary(s, op, (op->op == IR_ADD_TRAP) ? ALU_ADD : ALU_SUB);
+
+    u8 *ok = emit_jcc(c, CC_NO);
+
+    emit_exception(s, Overflow);
+
+    patch_here(c, ok);
+
+    put_result(s, i, RAX);
+    break;
+  }
+
+  case IR_LOAD:
+    emit_address(s, op, LoadAddrError);
+    emit_read(s, op->size, op->sign);
+    put_result(s, i, RAX);
+    break;
+
+  case IR_BRANCH:
+  {
+    // operands first: materializing a constant may clobber the flags
+    const u8 a = value_reg(s, op->a, RAX);
+    const u8 b = (op->b == IR_NONE) ? a : value_reg(s, op->b, RCX);
+
+    emit_mov_ri(c, RDX, op->imm2);
+    emit_mov_ri(c, RSI, op->imm);
+
+    if (op->b == IR_NONE)
+      emit_test_rr(c, a, a);
+    else
+      emit_alu_rr(c, ALU_CMP, a, b);
+
+    emit_cmov(c, branch_cond[op->size], RDX, RSI);
+    put_result(s, i, RDX);
+    break;
+  }
+
+  case IR_SET:
+    store_value(s, CPU_REG, GPR_OFFSET(op->reg), op->a);
+    break;
+
+  case IR_SET_HI:
+    store_value(s, CPU_REG, CPU_OFFSET(hi), op->a);
+    break;
+
+  case IR_SET_LO:
+    store_value(s, CPU_REG, CPU_OFFSET(lo), op->a);
+    break;
+
+  case IR_MULT:
+    value_to(s, RAX, op->a);
+    emit_mul(c, value_reg(s, op->b, RCX), op->sign);
+    emit_store(c, CPU_REG, CPU_OFFSET(lo), RAX);
+    emit_store(c, CPU_REG, CPU_OFFSET(hi), RDX);
+    break;
+
+  case IR_STORE:
+    emit_address(s, op, WriteAddrError);
+    value_to(s, RAX, op->b);
+    emit_write(s, op->size);
+    break;
+
+  case IR_PENDING:
+    store_value(s, CPU_REG, CPU_OFFSET(slot_cur.cur), op->a);
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(slot_cur.reg), op->reg);
+    break;
+
+  case IR_PENDING_CLEAR:
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(slot_cur.reg), 0);
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(slot_cur.cur), 0);
+    break;
+
+  case IR_RETIRE:
+    emit_retire(s, op->reg);
+    break;
+
+  case IR_CALL:
+    emit_call_handler(s, op->instr);
+    break;
+
+  case IR_INSTR:
+    s->instr = op;
+    break;
+  }
+}
+
+u8 *rec_emit(const ir_block *ir, u8 *code, u8 *end)
+{
+  if (end - code < (ptrdiff_t)(ir->count * REC_MAX_OP_SIZE + 256))
+    return NULL;
+
+  rec_state *s = &state;
+  x64_code *c = &s->code;
+
+  s->code = (x64_code){ code, code, end };
+  s->ir = ir;
+  s->instr = NULL;
+  s->exit_count = 0;
+
+  const u32 spills = ir_allocate(ir, REC_TEMP_REGS, s->loc);
+
+  // 6 pushes + the return address: the frame keeps calls 16 byte aligned
+  const s32 frame = 8 + ((spills * 4 + 15) & ~15);
+
+  emit_push(c, RBX);
+  emit_push(c, RBP);
+  emit_push(c, R12);
+  emit_push(c, R13);
+  emit_push(c, R14);
+  emit_push(c, R15);
+  emit_rsp_adjust(c, -frame);
+  emit_mov_rr64(c, CPU_REG, RDI);
+
+  for (u32 i = 0; i < ir->count; i++)
+    emit_op(s, i);
+
+  const u32 next = ir->pc + ir->instrs * 4;
+
+  switch (ir->exit)
+  {
+  case IR_EXIT_NEXT:
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(pc), next);
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(next_pc), next + 4);
+    break;
+
+  case IR_EXIT_BRANCH:
+    value_to(s, RAX, ir->target);
+    emit_store(c, CPU_REG, CPU_OFFSET(pc), RAX);
+    emit_alu_ri(c, ALU_ADD, RAX, 4);
+    emit_store(c, CPU_REG, CPU_OFFSET(next_pc), RAX);
+    break;
+
+  case IR_EXIT_DELAY:
+    emit_store_imm(c, CPU_REG, CPU_OFFSET(pc), next);
+    store_value(s, CPU_REG, CPU_OFFSET(next_pc), ir->target);
+    emit_store8_imm(c, CPU_REG, CPU_OFFSET(delay_slot), true);
+    break;
+  }
+
+  emit_mov_ri(c, RAX, ir->instrs);
+
+  for (u32 i = 0; i < s->exit_count; i++)
+    patch_here(c, s->exits[i]);
+
+  emit_rsp_adjust(c, frame);
+  emit_pop(c, R15);
+  emit_pop(c, R14);
+  emit_pop(c, R13);
+  emit_pop(c, R12);
+  emit_pop(c, RBP);
+  emit_pop(c, RBX);
+  emit_ret(c);
+
+  return c->ptr;
+}
+
+#endif
@@ -0,0 +1,365 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "machine.h"
+#include "state.h"
+
+// Delta record: offset in the state, size, then the XOR bytes
+typedef struct
+{
+  u32 offset;
+  u32 size;
+}delta_run;
+
+typedef struct
+{
+  u64 offset; // in the ring
+  u32 size;
+  bool keyframe;
+}snapshot;
+
+struct rewind_buffer
+{
+  rewind_config config;
+
+  u8 *ring;
+  u64 tail;            // where the next snapshot goes
+
+  snapshot *snapshots; // oldest first, snapshots[0] is a keyframe
+  u32 count;
+  u32 capacity;
+
+  u32 state_size;
+  u8 *latest;          // full state of the newest snapshot
+  u8 *delta;           // delta being encoded, state_size bytes at most
+  u32 delta_size;
+
+  u32 frames;          // since the last snapshot
+  u32 deltas;          // since the last keyframe
+};
+
+// Append the runs of changed bytes of cur against the state at offset and bring the
+// state up to date, false when the delta grows larger than a keyframe
+static bool encode_range(rewind_buffer *rb, u32 offset, const u8 *cur, u32 size)
+{
+  u8 *prev = rb->latest + offset;
+
+  for (u32 i = 0; i < size;)
+  {
+    u32 step = size - i < 8 ? size - i : 8;
+
+    if (!memcmp(cur + i, prev + i, step))
+    {
+      i += step;
+      continue;
+    }
+
+    // the run goes on up to the next unchanged word
+    u32 end = i;
+
+    while (end < size)
+    {
+      step = size - end < 8 ? size - end : 8;
+
+      if (end != i && !memcmp(cur + end, prev + end, step))
+        break;
+
+      end += step;
+    }
+
+    const delta_run run = { offset + i, end - i };
+
+    if (rb->delta_size + sizeof(run) + run.size > rb->state_size)
+      return false;
+
+    u8 *out = rb->delta + rb->delta_size;
+
+    memcpy(out, &run, sizeof(run));
+    out += sizeof(run);
+
+    for (u32 j = i; j < end; j++)
+    {
+      *out++ = cur[j] ^ prev[j];
+      prev[j] = cur[j];
+    }
+
+    rb->delta_size += sizeof(run) + run.size;
+
+    i = end;
+  }
+
+  return true;
+}
+
+static bool encode_delta(rewind_buffer *rb)
+{
+  state_map map[STATE_SECTIONS];
+
+  map_state(map);
+
+  rb->delta_size = 0;
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+  {
+    if (map[i].id == SECTION_RENDER)
+    {
+      // the GPU state, then only the VRAM rows drawn since the last snapshot
+      const u32 vram = offsetof(gpu_state, vram);
+
+      if (!encode_range(rb, map[i].offset, map[i].data, vram))
+        return false;
+
+      for (u32 row = 0; row < VRAM_HEIGHT; row++)
+      {
+        if (!vram_row_dirty(row))
+          continue;
+
+        const u32 offset = vram + row * sizeof(vram_row);
+
+        if (!encode_range(rb, map[i].offset + offset, (u8 *)map[i].data + offset, sizeof(vram_row)))
+          return false;
+      }
+
+      continue;
+    }
+
+    if (map[i].id != SECTION_RAM)
+    {
+      if (!encode_range(rb, map[i].offset, map[i].data, map[i].size))
+        return false;
+
+      continue;
+    }
+
+    // only the pages written since the last snapshot
+    for (u32 page = 0; page < RAM_PAGES; page++)
+    {
+      if (!((psx->bus.dirty_bitmap[page >> 5] >> (page & 31)) & 1))
+        continue;
+
+      const u32 offset = page << PAGE_SHIFT;
+
+      if (!encode_range(rb, map[i].offset + offset, (u8 *)map[i].data + offset, PAGE_SIZE))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+// XOR a delta into the state: the next snapshot from the previous one and back
+static void apply_delta(u8 *state, const u8 *delta, u32 size)
+{
+  for (u32 at = 0; at < size;)
+  {
+    delta_run run;
+
+    memcpy(&run, delta + at, sizeof(run));
+    at += sizeof(run);
+
+    for (u32 j = 0; j < run.size; j++)
+      state[run.offset + j] ^= delta[at + j];
+
+    at += run.size;
+  }
+}
+
+static void drop_oldest(rewind_buffer *rb)
+{
+  // a delta without its keyframe cannot be rebuilt forward: the group goes as a whole
+  do
+  {
+    memmove(rb->snapshots, rb->snapshots + 1, --rb->count * sizeof(snapshot));
+  }
+  while (rb->count && !rb->snapshots[0].keyframe);
+}
+
+// [at, at + size) intersects the snapshots held
+static bool overlaps(const rewind_buffer *rb, u64 at, u32 size)
+{
+  const u64 head = rb->snapshots[0].offset;
+
+  if (head < rb->tail)
+    return at < rb->tail && at + size > head;
+
+  // wrapped: [head, end of ring) and [0, tail)
+  return at + size > head || at < rb->tail;
+}
+
+// Store a snapshot, false when a delta would be left without a keyframe
+static bool push(rewind_buffer *rb, const u8 *data, u32 size, bool keyframe)
+{
+  if (size > rb->config.budget)
+    return false;
+
+  const u64 at = rb->tail + size <= rb->config.budget ? rb->tail : 0;
+
+  while (rb->count && overlaps(rb, at, size))
+    drop_oldest(rb);
+
+  if (!rb->count && !keyframe)
+    return false;
+
+  if (rb->count == rb->capacity)
+  {
+    const u32 capacity = rb->capacity ? rb->capacity * 2 : 256;
+
+    snapshot *snapshots = realloc(rb->snapshots, capacity * sizeof(snapshot));
+
+    if (!snapshots)
+      return false;
+
+    rb->snapshots = snapshots;
+    rb->capacity = capacity;
+  }
+
+  memcpy(rb->ring + at, data, size);
+
+  rb->snapshots[rb->count++] = (snapshot){ at, size, keyframe };
+  rb->tail = at + size;
+
+  return true;
+}
+
+static void take_snapshot(rewind_buffer *rb)
+{
+  const bool delta = rb->count && rb->deltas + 1 < rb->config.keyframes && encode_delta(rb);
+
+  if (delta && push(rb, rb->delta, rb->delta_size, false))
+  {
+    rb->deltas++;
+  }
+  else
+  {
+    state_capture(rb->latest, rb->state_size);
+
+    push(rb, rb->latest, rb->state_size, true);
+
+    rb->deltas = 0;
+  }
+
+  clean_dirty_pages();
+  clean_vram_rows();
+}
+
+rewind_buffer *rewind_create(const rewind_config *config)
+{
+  rewind_buffer *rb = calloc(1, sizeof(rewind_buffer));
+
+  if (!rb)
+    return NULL;
+
+  rb->config = *config;
+  rb->state_size = state_size();
+
+  if (!rb->config.interval)
+    rb->config.interval = 1;
+
+  if (!rb->config.keyframes)
+    rb->config.keyframes = 1;
+
+  rb->ring = malloc(rb->config.budget);
+  rb->latest = malloc(rb->state_size);
+  rb->delta = malloc(rb->state_size);
+
+  // room for two keyframes at least
+  if (!rb->ring || !rb->latest || !rb->delta || rb->config.budget < 2ull * rb->state_size)
+  {
+    rewind_destroy(rb);
+    return NULL;
+  }
+
+  track_dirty_pages(true);
+
+  take_snapshot(rb);
+
+  return rb;
+}
+
+void rewind_destroy(rewind_buffer *rb)
+{
+  if (!rb)
+    return;
+
+  if (psx->bus.track_dirty)
+    track_dirty_pages(false);
+
+  free(rb->ring);
+  free(rb->latest);
+  free(rb->delta);
+  free(rb->snapshots);
+  free(rb);
+}
+
+void rewind_frame(rewind_buffer *rb)
+{
+  if (++rb->frames < rb->config.interval)
+    return;
+
+  rb->frames = 0;
+
+  take_snapshot(rb);
+}
+
+u32 rewind_count(const rewind_buffer *rb)
+{
+  return rb->count;
+}
+
+u64 rewind_usage(const rewind_buffer *rb)
+{
+  u64 usage = 0;
+
+  for (u32 i = 0; i < rb->count; i++)
+    usage += rb->snapshots[i].size;
+
+  return usage;
+}
+
+bool rewind_back(rewind_buffer *rb, u32 back)
+{
+  if (back >= rb->count)
+    return false;
+
+  const u32 target = rb->count - 1 - back;
+
+  u32 key = target;
+
+  while (!rb->snapshots[key].keyframe)
+    key--;
+
+  // undo the newer deltas from the latest state, unless a keyframe is in the way or closer
+  bool forward = target - key < back;
+
+  for (u32 i = target + 1; i < rb->count && !forward; i++)
+    forward = rb->snapshots[i].keyframe;
+
+  if (forward)
+  {
+    memcpy(rb->latest, rb->ring + rb->snapshots[key].offset, rb->state_size);
+
+    for (u32 i = key + 1; i <= target; i++)
+      apply_delta(rb->latest, rb->ring + rb->snapshots[i].offset, rb->snapshots[i].size);
+  }
+  else
+  {
+    for (u32 i = rb->count - 1; i > target; i--)
+      apply_delta(rb->latest, rb->ring + rb->snapshots[i].offset, rb->snapshots[i].size);
+  }
+
+  if (!state_restore(rb->latest, rb->state_size))
+    return false;
+
+  rb->count = target + 1;
+  rb->tail = rb->snapshots[target].offset + rb->snapshots[target].size;
+
+  rb->frames = 0;
+  rb->deltas = target - key;
+
+  clean_dirty_pages();
+  clean_vram_rows();
+
+  return true;
+}
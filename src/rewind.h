@@ -0,0 +1,42 @@
+#pragma once
+#include "typedef.h"
+
+// Rewind buffer
+// Snapshots of the bound machine taken every `interval` frames, kept in a ring of
+// `budget` bytes: the oldest are dropped to make room. One snapshot in `keyframes` is a
+// full state (see state.h), the others are deltas against the previous snapshot.
+//
+// A delta is the XOR of the state with the previous one, run length encoded: only the
+// runs of changed bytes are kept, as (offset, size, bytes) records. RAM is compared
+// page by page through the dirty page tracking of the bus (see bus.h), and VRAM row by
+// row through the rows marked by the GPU jobs (see gpu_thread.h), so the pages and rows
+// that were not written since the last snapshot are not even read.
+//
+// The XOR goes both ways: the latest state is kept in full, rewinding a few snapshots
+// undoes the deltas from there, further away the state is rebuilt forward from the
+// closest keyframe. The ring always starts with a keyframe.
+
+typedef struct
+{
+  u64 budget;    // bytes for the snapshots
+  u32 interval;  // frames between snapshots (rewind granularity)
+  u32 keyframes; // one keyframe every n snapshots
+}rewind_config;
+
+typedef struct rewind_buffer rewind_buffer;
+
+// Start rewinding the bound machine (enables its dirty page tracking), NULL when out of memory
+rewind_buffer *rewind_create(const rewind_config *config);
+
+void rewind_destroy(rewind_buffer *rb); // machine still bound, the tracking is stopped
+
+// Call once per emulated frame, takes a snapshot every interval frames
+void rewind_frame(rewind_buffer *rb);
+
+u32 rewind_count(const rewind_buffer *rb); // snapshots held
+
+u64 rewind_usage(const rewind_buffer *rb); // bytes of the ring in use
+
+// Restore the snapshot `back` steps before the latest one (0 = the latest) and drop the
+// newer ones, false when the buffer does not reach that far
+bool rewind_back(rewind_buffer *rb, u32 back);
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+
+#include "runahead.h"
+#include "machine.h"
+#include "state.h"
+
+struct runahead
+{
+  u32 frames;
+
+  u8 *state; // end of the last real frame
+};
+
+runahead *runahead_create(u32 frames)
+{
+  runahead *ra = calloc(1, sizeof(runahead));
+
+  if (!ra)
+    return NULL;
+
+  ra->frames = frames;
+  ra->state = malloc(state_size());
+
+  if (!ra->state)
+  {
+    free(ra);
+    return NULL;
+  }
+
+  state_capture(ra->state, state_size());
+
+  track_dirty_pages(true);
+
+  return ra;
+}
+
+void runahead_destroy(runahead *ra)
+{
+  if (!ra)
+    return;
+
+  track_dirty_pages(false);
+
+  free(ra->state);
+  free(ra);
+}
+
+void runahead_frame(runahead *ra, R3000 *cpu, cpu_loop loop, u64 frame_end, frame_present present, void *arg)
+{
+  run_until(cpu, loop, frame_end);
+
+  if (!ra->frames)
+  {
+    if (present)
+      present(arg);
+
+    return;
+  }
+
+  state_update(ra->state);
+
+  for (u32 i = 1; i <= ra->frames; i++)
+    run_until(cpu, loop, frame_end + i * (u64)FRAME_CYCLES);
+
+  if (present)
+    present(arg);
+
+  state_revert(ra->state);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "scheduler.h"
+
+// Run-ahead
+// Games react to the pad a few frames after reading it. Run-ahead hides that lag: each
+// real frame is followed by `frames` speculative ones run with the same input, the
+// last of which is presented, then the machine goes back to the end of the real frame.
+//
+// The speculative frames produce no output: the frontend only presents through the
+// callback, which is called after the last of them. Going back uses the incremental
+// states (see state_update / state_revert in state.h), so a frame ahead costs the
+// pages it writes rather than the whole RAM, and the decoded / recompiled code of the
+// other pages survives.
+//
+// The dirty page tracking of the machine belongs to the run-ahead while it is active
+// (a rewind buffer cannot run at the same time).
+
+// Called on the last speculative frame, the machine is still bound
+typedef void (*frame_present)(void *arg);
+
+typedef struct runahead runahead;
+
+// Start running the bound machine ahead by `frames` frames, NULL when out of memory
+runahead *runahead_create(u32 frames);
+
+void runahead_destroy(runahead *ra); // machine still bound, the tracking is stopped
+
+// Run the real frame up to cycle frame_end then the frames ahead, present the last one
+// and come back to frame_end
+void runahead_frame(runahead *ra, R3000 *cpu, cpu_loop loop, u64 frame_end, frame_present present, void *arg);
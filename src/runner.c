@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/sysinfo.h>
+
+#include "runner.h"
+
+typedef struct
+{
+  machine **machines;
+  u32 count;
+  atomic_uint next; // next machine to run
+
+  machine_job job;
+  void *arg;
+}pool;
+
+typedef struct
+{
+  pool *pool;
+  u32 core;
+}worker;
+
+static void *worker_main(void *data)
+{
+  worker *w = data;
+  pool *p = w->pool;
+
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(w->core, &set);
+
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // best effort
+
+  for (u32 i; (i = atomic_fetch_add(&p->next, 1)) < p->count;)
+  {
+    machine_bind(p->machines[i]);
+
+    p->job(p->machines[i], p->arg);
+  }
+
+  machine_bind(NULL);
+
+  return NULL;
+}
+
+void run_machines(machine **machines, u32 count, u32 threads, machine_job job, void *arg)
+{
+  const u32 cores = get_nprocs();
+
+  if (!threads)
+    threads = cores;
+
+  if (threads > count)
+    threads = count;
+
+  pool p = { machines, count, 0, job, arg };
+
+  pthread_t *ids = calloc(threads, sizeof(pthread_t));
+  worker *workers = calloc(threads, sizeof(worker));
+
+  u32 started = 0;
+
+  for (; ids && workers && started < threads; started++)
+  {
+    workers[started] = (worker){ &p, started % cores };
+
+    if (pthread_create(&ids[started], NULL, worker_main, &workers[started]) != 0)
+      break;
+  }
+
+  // no worker could start: run everything here
+  if (!started)
+  {
+    machine *prev = psx;
+
+    for (u32 i = 0; i < count; i++)
+    {
+      machine_bind(machines[i]);
+      job(machines[i], arg);
+    }
+
+    machine_bind(prev);
+  }
+
+  for (u32 i = 0; i < started; i++)
+    pthread_join(ids[i], NULL);
+
+  free(ids);
+  free(workers);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "machine.h"
+
+// Thread pool driving independent machines
+// Each worker is pinned to a core and takes the machines one by one; a job runs with its
+// machine bound to the worker (machine_bind), so the machines share nothing but
+// read-only data and scale with the cores.
+
+typedef void (*machine_job)(machine *m, void *arg);
+
+// Run job on every machine using threads workers (0 = one per online core), returns
+// when all the jobs are done
+void run_machines(machine **machines, u32 count, u32 threads, machine_job job, void *arg);
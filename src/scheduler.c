@@ -0,0 +1,171 @@
+#include <assert.h>
+
+#include "machine.h"
+
+static inline bool before(scheduler *s, u32 a, u32 b)
+{
+  return s->deadlines[s->heap[a]] < s->deadlines[s->heap[b]];
+}
+
+static inline void swap(scheduler *s, u32 a, u32 b)
+{
+  const u8 event = s->heap[a];
+
+  s->heap[a] = s->heap[b];
+  s->heap[b] = event;
+
+  s->slot[s->heap[a]] = a + 1;
+  s->slot[s->heap[b]] = b + 1;
+}
+
+static void sift_up(scheduler *s, u32 i)
+{
+  while (i && before(s, i, (i - 1) / 2))
+  {
+    swap(s, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void sift_down(scheduler *s, u32 i)
+{
+  for (;;)
+  {
+    const u32 left = i * 2 + 1;
+    const u32 right = left + 1;
+
+    u32 first = i;
+
+    if (left < s->count && before(s, left, first))
+      first = left;
+
+    if (right < s->count && before(s, right, first))
+      first = right;
+
+    if (first == i)
+      return;
+
+    swap(s, i, first);
+    i = first;
+  }
+}
+
+static inline void update_deadline(scheduler *s)
+{
+  s->deadline = s->count ? s->deadlines[s->heap[0]] : UINT64_MAX;
+}
+
+static void remove_at(scheduler *s, u32 i)
+{
+  s->slot[s->heap[i]] = 0;
+
+  if (i != --s->count)
+  {
+    const u8 moved = s->heap[s->count];
+
+    s->heap[i] = moved;
+    s->slot[moved] = i + 1;
+
+    sift_up(s, i);
+    sift_down(s, s->slot[moved] - 1);
+  }
+}
+
+void sched_reset(void)
+{
+  scheduler *s = &psx->sched;
+
+  for (u32 i = 0; i < EVENT_COUNT; i++)
+    s->slot[i] = 0;
+
+  s->count = 0;
+
+  update_deadline(s);
+}
+
+u64 sched_now(void)
+{
+  return psx->cpu.cycles;
+}
+
+void sched_set_handler(u8 event, event_handler handler)
+{
+  scheduler *s = &psx->sched;
+
+  assert(event < EVENT_COUNT);
+
+  s->handlers[event] = handler;
+}
+
+void sched_add(u8 event, u64 deadline)
+{
+  scheduler *s = &psx->sched;
+
+  assert(event < EVENT_COUNT);
+
+  if (!s->slot[event])
+  {
+    s->heap[s->count++] = event;
+    s->slot[event] = s->count;
+  }
+
+  s->deadlines[event] = deadline;
+
+  sift_up(s, s->slot[event] - 1);
+  sift_down(s, s->slot[event] - 1);
+
+  update_deadline(s);
+}
+
+void sched_cancel(u8 event)
+{
+  scheduler *s = &psx->sched;
+
+  if (!s->slot[event])
+    return;
+
+  remove_at(s, s->slot[event] - 1);
+
+  update_deadline(s);
+}
+
+bool sched_pending(u8 event)
+{
+  scheduler *s = &psx->sched;
+
+  return s->slot[event] != 0;
+}
+
+u64 sched_deadline(u8 event)
+{
+  scheduler *s = &psx->sched;
+
+  return s->deadlines[event];
+}
+
+void run_events(R3000 *cpu)
+{
+  scheduler *s = &psx->sched;
+
+  while (s->count && s->deadlines[s->heap[0]] <= cpu->cycles)
+  {
+    const u8 event = s->heap[0];
+
+    remove_at(s, 0);
+
+    update_deadline(s);
+
+    // the handler may post the event again
+    s->handlers[event](cpu, s->deadlines[event]);
+  }
+}
+
+void run_until(R3000 *cpu, cpu_loop loop, u64 deadline)
+{
+  while (cpu->cycles < deadline)
+  {
+    loop(cpu, deadline);
+
+    run_events(cpu);
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "cpu.h"
+
+// Event scheduler
+// Devices post events at absolute cpu->cycles deadlines instead of being ticked per
+// instruction. The pending events are a binary min-heap; scheduler.deadline mirrors its
+// top and the CPU loops (run_blocks, run_recompiler, run_ir) return once it is reached, so
+// run_until() can dispatch the due events and resume. A block may run past the
+// deadline: events fire late by less than one block.
+
+#define CPU_CLOCK 33868800 // Hz
+
+// One slot per source: posting an event that is already pending moves it
+enum EVENT
+{
+  EVENT_VBLANK, // GPU: start of vertical blank
+  EVENT_TIMER0, // Root counters: next target / overflow IRQ
+  EVENT_TIMER1,
+  EVENT_TIMER2,
+  EVENT_CDROM,  // sector arrival / command response
+  EVENT_DMA,    // transfer done
+  EVENT_PAD,    // controller /ACK
+  EVENT_COUNT
+};
+
+// Called with the cycle the event was due at, which can be earlier than cpu->cycles
+typedef void (*event_handler)(R3000 *cpu, u64 deadline);
+
+// CPU loop running until a deadline (run_blocks, run_recompiler, ...)
+typedef void (*cpu_loop)(R3000 *cpu, u64 deadline);
+
+typedef struct
+{
+  u64 deadline; // next event, UINT64_MAX when there is none
+
+  u64 deadlines[EVENT_COUNT];
+
+  u8 heap[EVENT_COUNT]; // events ordered by deadline, heap[0] is the next one
+  u8 slot[EVENT_COUNT]; // index of the event in heap + 1, 0 when not posted
+  u32 count;
+
+  event_handler handlers[EVENT_COUNT]; // host pointers, last so save states stop before them
+}scheduler;
+
+void sched_reset(void); // cancel every event
+
+// Current cycle (the machine's cpu->cycles) for devices accessed through the bus. The CPU
+// loops account cycles once per block, so inside a block this is the cycle the block
+// started at.
+u64 sched_now(void);
+
+void sched_set_handler(u8 event, event_handler handler);
+
+// Post the event at an absolute cycle, replacing its pending deadline
+void sched_add(u8 event, u64 deadline);
+
+void sched_cancel(u8 event);
+
+bool sched_pending(u8 event);
+
+u64 sched_deadline(u8 event); // only meaningful when pending
+
+// Dispatch every event due at cpu->cycles, in deadline order
+void run_events(R3000 *cpu);
+
+// Run the CPU loop and the events until cpu->cycles reaches the deadline
+void run_until(R3000 *cpu, cpu_loop loop, u64 deadline);
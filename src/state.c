@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "state.h"
+#include "machine.h"
+
+#define STATE_MAGIC "PSXSTATE"
+
+void map_state(state_map *map)
+{
+  gpu_sync(); // VRAM is read and written in place
+
+  map[0] = (state_map){ SECTION_CPU,        sizeof(R3000),                 &psx->cpu };
+  map[1] = (state_map){ SECTION_SCHEDULER,  offsetof(scheduler, handlers), &psx->sched };
+  map[2] = (state_map){ SECTION_IRQ,        sizeof(irq_control),           &psx->irq };
+  map[3] = (state_map){ SECTION_TIMERS,     sizeof(psx->timers),           psx->timers };
+  map[4] = (state_map){ SECTION_GPU,        sizeof(video_timing),          &psx->gpu };
+  map[5] = (state_map){ SECTION_RAM,        RAM_SIZE_2MB,                  psx->bus.ram };
+  map[6] = (state_map){ SECTION_SCRATCHPAD, SCRATCHPAD_SIZE,               psx->bus.scratchpad };
+  map[7] = (state_map){ SECTION_PAD,        sizeof(joypad),                &psx->pad };
+  map[8] = (state_map){ SECTION_MEMCTRL,    sizeof(psx->bus.mem_control),  psx->bus.mem_control };
+  map[9] = (state_map){ SECTION_CACHE,      sizeof(icache),                &psx->bus.cache };
+  map[10] = (state_map){ SECTION_RENDER,    sizeof(gpu_state),             &psx->render };
+
+  u32 offset = sizeof(state_header);
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+  {
+    offset += sizeof(state_section);
+
+    map[i].offset = offset;
+
+    offset += map[i].size;
+  }
+}
+
+static state_header make_header(void)
+{
+  state_header header = { STATE_MAGIC, STATE_VERSION, STATE_SECTIONS, psx->bus.bios_hash };
+
+  return header;
+}
+
+u32 state_size(void)
+{
+  state_map map[STATE_SECTIONS];
+
+  map_state(map);
+
+  return map[STATE_SECTIONS - 1].offset + map[STATE_SECTIONS - 1].size;
+}
+
+u32 state_capture(u8 *buffer, u32 size)
+{
+  const u32 total = state_size();
+
+  if (size < total)
+    return 0;
+
+  state_map map[STATE_SECTIONS];
+
+  map_state(map);
+
+  const state_header header = make_header();
+
+  memcpy(buffer, &header, sizeof(header));
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+  {
+    const state_section section = { map[i].id, map[i].size };
+
+    memcpy(buffer + map[i].offset - sizeof(section), &section, sizeof(section));
+    memcpy(buffer + map[i].offset, map[i].data, map[i].size);
+  }
+
+  return total;
+}
+
+// Locate every known section of the state (found[i] for map[i]), false when it is not
+// a valid state for the bound machine
+static bool find_sections(const u8 *data, u32 size, const state_map *map, const u8 **found)
+{
+  state_header header;
+
+  if (size < sizeof(header))
+    return false;
+
+  memcpy(&header, data, sizeof(header));
+
+  if (memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) || header.version != STATE_VERSION)
+    return false;
+
+  if (header.bios_hash != psx->bus.bios_hash)
+    return false;
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+    found[i] = NULL;
+
+  u32 offset = sizeof(header);
+
+  for (u32 n = 0; n < header.sections; n++)
+  {
+    state_section section;
+
+    if (size - offset < sizeof(section))
+      return false;
+
+    memcpy(&section, data + offset, sizeof(section));
+    offset += sizeof(section);
+
+    if (size - offset < section.size)
+      return false;
+
+    for (u32 i = 0; i < STATE_SECTIONS; i++)
+    {
+      if (map[i].id != section.id)
+        continue;
+
+      if (map[i].size != section.size)
+        return false;
+
+      found[i] = data + offset;
+    }
+
+    offset += section.size;
+  }
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+    if (!found[i])
+      return false;
+
+  return true;
+}
+
+bool state_restore(const u8 *data, u32 size)
+{
+  state_map map[STATE_SECTIONS];
+  const u8 *found[STATE_SECTIONS];
+
+  map_state(map);
+
+  if (!find_sections(data, size, map, found))
+    return false;
+
+  // RAM is rewritten behind the bus: drop every decoded page first
+  flush_decode_cache();
+  rec_flush();
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+    memcpy(map[i].data, found[i], map[i].size);
+
+  mark_dirty_range(0, RAM_SIZE_2MB);
+  mark_vram_rows(0, VRAM_HEIGHT);
+
+  update_wait_states();
+  isolate_cache(psx->cpu.m_cop0_sr.isolate_cache);
+
+  psx->cpu.instr = NULL;
+
+  return true;
+}
+
+void state_update(u8 *state)
+{
+  state_map map[STATE_SECTIONS];
+
+  map_state(map);
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+  {
+    if (map[i].id == SECTION_RENDER)
+    {
+      memcpy(state + map[i].offset, map[i].data, offsetof(gpu_state, vram));
+
+      for (u32 row = 0; row < VRAM_HEIGHT; row++)
+        if (vram_row_dirty(row))
+          memcpy(state + map[i].offset + offsetof(gpu_state, vram[row]), psx->render.vram[row], sizeof(vram_row));
+
+      continue;
+    }
+
+    if (map[i].id != SECTION_RAM)
+    {
+      memcpy(state + map[i].offset, map[i].data, map[i].size);
+      continue;
+    }
+
+    for (u32 page = 0; page < RAM_PAGES; page++)
+      if ((psx->bus.dirty_bitmap[page >> 5] >> (page & 31)) & 1)
+        memcpy(state + map[i].offset + (page << PAGE_SHIFT), psx->bus.ram + (page << PAGE_SHIFT), PAGE_SIZE);
+  }
+
+  clean_dirty_pages();
+  clean_vram_rows();
+}
+
+void state_revert(const u8 *state)
+{
+  state_map map[STATE_SECTIONS];
+
+  map_state(map);
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+  {
+    if (map[i].id == SECTION_RENDER)
+    {
+      memcpy(map[i].data, state + map[i].offset, offsetof(gpu_state, vram));
+
+      for (u32 row = 0; row < VRAM_HEIGHT; row++)
+        if (vram_row_dirty(row))
+          memcpy(psx->render.vram[row], state + map[i].offset + offsetof(gpu_state, vram[row]), sizeof(vram_row));
+
+      continue;
+    }
+
+    if (map[i].id != SECTION_RAM)
+    {
+      memcpy(map[i].data, state + map[i].offset, map[i].size);
+      continue;
+    }
+
+    // through the DMA path, which drops the decoded instructions of the page
+    for (u32 page = 0; page < RAM_PAGES; page++)
+      if ((psx->bus.dirty_bitmap[page >> 5] >> (page & 31)) & 1)
+        dma_write_ram(page << PAGE_SHIFT, state + map[i].offset + (page << PAGE_SHIFT), PAGE_SIZE);
+  }
+
+  update_wait_states();
+  isolate_cache(psx->cpu.m_cop0_sr.isolate_cache);
+
+  psx->cpu.instr = NULL;
+
+  clean_dirty_pages();
+  clean_vram_rows();
+}
+
+bool state_save(int fd)
+{
+  state_map map[STATE_SECTIONS];
+
+  map_state(map);
+
+  const state_header header = make_header();
+  state_section sections[STATE_SECTIONS];
+
+  struct iovec iov[1 + STATE_SECTIONS * 2];
+  u32 count = 0;
+
+  iov[count++] = (struct iovec){ (void *)&header, sizeof(header) };
+
+  for (u32 i = 0; i < STATE_SECTIONS; i++)
+  {
+    sections[i] = (state_section){ map[i].id, map[i].size };
+
+    iov[count++] = (struct iovec){ &sections[i], sizeof(state_section) };
+    iov[count++] = (struct iovec){ map[i].data, map[i].size };
+  }
+
+  // a single call unless the write is cut short
+  struct iovec *next = iov;
+
+  while (count)
+  {
+    ssize_t written = writev(fd, next, count);
+
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    while (count && (size_t)written >= next->iov_len)
+    {
+      written -= next->iov_len;
+      next++;
+      count--;
+    }
+
+    if (count)
+    {
+      next->iov_base = (u8 *)next->iov_base + written;
+      next->iov_len -= written;
+    }
+  }
+
+  return true;
+}
+
+bool state_load(int fd)
+{
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(state_header) || st.st_size > UINT32_MAX)
+    return false;
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (data == MAP_FAILED)
+    return false;
+
+  const bool loaded = state_restore(data, st.st_size);
+
+  munmap(data, st.st_size);
+
+  return loaded;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "typedef.h"
+
+// Save states
+// A state is a header followed by sections, each one the raw bytes of a piece of the
+// machine (see machine.h) behind an id and a size:
+//
+// 000h  ASCII ID "PSXSTATE"
+// 008h  Format version (STATE_VERSION)
+// 00Ch  Number of sections
+// 010h  Hash of the BIOS image the state was taken with (0 = none, see bios.h)
+// 018h  Sections: id (4 bytes), size (4 bytes), data
+//
+// Nothing is converted: saving gathers the sections with a single writev(), loading
+// validates the whole state first and then copies every section into place. Unknown
+// sections are skipped, a known one with another size refuses the state (the layout of
+// the structure changed: bump STATE_VERSION).
+//
+// Host pointers are not state: the event handlers stay out of the scheduler section
+// and the decoded instruction of the CPU is cleared. The decode cache and the
+// recompiled code are dropped on load, they are rebuilt from RAM. The wait state tables
+// of the bus are rebuilt from the Memory Control registers, the cache isolation from SR.
+// The rasterizer thread is drained whenever the state is mapped (see gpu_thread.h).
+
+#define STATE_VERSION 6
+
+enum STATE_SECTION
+{
+  SECTION_CPU        = 1, // R3000
+  SECTION_SCHEDULER  = 2, // pending events, up to the handlers
+  SECTION_IRQ        = 3,
+  SECTION_TIMERS     = 4, // root counters
+  SECTION_GPU        = 5, // video timing
+  SECTION_RAM        = 6, // 2 MBytes
+  SECTION_SCRATCHPAD = 7, // 1 KByte
+  SECTION_PAD        = 8, // controller port
+  SECTION_MEMCTRL    = 9, // Memory Control 1 (wait states)
+  SECTION_CACHE      = 10, // Cache Control and instruction cache tags
+  SECTION_RENDER     = 11, // GP0 / GP1 state and the 1 MByte of VRAM
+};
+
+typedef struct
+{
+  char magic[8];
+  u32 version;
+  u32 sections;
+  u64 bios_hash;
+}state_header;
+
+typedef struct
+{
+  u32 id;
+  u32 size;
+}state_section;
+
+#define STATE_SECTIONS 11
+
+// Where a section lives in the bound machine and where its data sits in a state
+typedef struct
+{
+  u32 id;
+  u32 size;
+  void *data;
+  u32 offset; // from the start of the state
+}state_map;
+
+void map_state(state_map *map); // STATE_SECTIONS entries, in state order
+
+u32 state_size(void); // bytes of a state of the bound machine
+
+// Write the state of the bound machine into buffer, the bytes written or 0 when it is too small
+u32 state_capture(u8 *buffer, u32 size);
+
+// Load a state into the bound machine, false (and the machine untouched) when it is
+// invalid, of another version or taken with another BIOS
+bool state_restore(const u8 *data, u32 size);
+
+// Incremental forms for a state kept by the caller (from state_capture()) while the
+// dirty pages are tracked (see bus.h): only the RAM pages and VRAM rows (see
+// gpu_thread.h) written since the state and the machine last matched are copied, and
+// only the decoded instructions of those pages are dropped on revert. Both leave every
+// page and row clean.
+void state_update(u8 *state);       // bring the state up to the machine
+void state_revert(const u8 *state); // bring the machine back to the state
+
+// Same through a file: saving writes at the current offset, loading maps the whole file
+bool state_save(int fd);
+bool state_load(int fd);
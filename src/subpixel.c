@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "subpixel.h"
+#include "machine.h"
+
+static inline u32 make_key(s16 sx, s16 sy)
+{
+  return (u16)sx | (u32)(u16)sy << 16;
+}
+
+// Fibonacci hashing of the key to the first slot of its run
+static inline u32 slot(u32 key)
+{
+  return (key * 0x9E3779B1u) >> (32 - 12);
+}
+
+_Static_assert(SUBPIXEL_ENTRIES == 1 << 12, "slot() hashes to 12 bits");
+
+// Frames since the entry was recorded, live up to 1
+static inline u32 age(const subpixel_cache *cache, const subpixel_entry *e)
+{
+  return cache->frame - e->frame;
+}
+
+void subpixel_enable(bool enabled)
+{
+  subpixel_cache *cache = &psx->subpixel;
+
+  memset(cache->entries, 0, sizeof(cache->entries));
+
+  cache->enabled = enabled;
+  cache->frame = 2; // the cleared entries are stale
+  cache->recorded = 0;
+}
+
+subpixel_cache *subpixel_active(void)
+{
+  return psx->subpixel.enabled ? &psx->subpixel : NULL;
+}
+
+void subpixel_reset(subpixel_cache *cache)
+{
+  // the frame tag wraps after 2^32 frames, a stale entry could then match again
+  if (!++cache->frame)
+  {
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->frame = 2;
+  }
+}
+
+void subpixel_record(subpixel_cache *cache, s16 sx, s16 sy, s32 x, s32 y)
+{
+  const u32 key = make_key(sx, sy);
+  const u32 first = slot(key);
+
+  subpixel_entry *victim = NULL;
+
+  for (u32 i = 0; i < SUBPIXEL_PROBES; i++)
+  {
+    subpixel_entry *e = &cache->entries[(first + i) & (SUBPIXEL_ENTRIES - 1)];
+
+    // the same vertex again
+    if (e->key == key && age(cache, e) <= 1)
+    {
+      victim = e;
+      break;
+    }
+
+    // otherwise the oldest slot, stale ones first
+    if (!victim || age(cache, e) > age(cache, victim))
+      victim = e;
+  }
+
+  *victim = (subpixel_entry){ key, cache->frame, x, y };
+
+  cache->recorded++;
+}
+
+bool subpixel_lookup(const subpixel_cache *cache, s16 sx, s16 sy, s32 *x, s32 *y)
+{
+  const u32 key = make_key(sx, sy);
+  const u32 first = slot(key);
+
+  for (u32 i = 0; i < SUBPIXEL_PROBES; i++)
+  {
+    const subpixel_entry *e = &cache->entries[(first + i) & (SUBPIXEL_ENTRIES - 1)];
+
+    if (e->key == key && age(cache, e) <= 1)
+    {
+      *x = e->x;
+      *y = e->y;
+      return true;
+    }
+  }
+
+  return false;
+}
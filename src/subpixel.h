@@ -0,0 +1,47 @@
+#pragma once
+#include "typedef.h"
+
+// Sub-pixel vertex cache (enhancement, off by default)
+// RTPS/RTPT round the projected vertices to whole pixels (SX2/SY2 = MAC0 SAR 16), which
+// makes 3D geometry wobble. With the cache on, the GTE also records the un-rounded 16.16
+// screen XY of every vertex it projects, keyed by the rounded 16-bit XY the game reads
+// back; the GPU looks a vertex up by the coordinates of its packet and draws it at the
+// sub-pixel position on a hit.
+//
+// The table is a bounded open-addressing hash: SUBPIXEL_PROBES slots per key, the first
+// oldest one of the run is replaced when they are all taken, so recording and lookups are
+// O(1). Entries are tagged with the frame they were recorded in: the reset at VBlank only
+// bumps the frame. Entries of the current and the previous frame are live, a double
+// buffered game builds its ordering table before VSync and sends it to GP0 after.
+// It is host side only, not part of the save state.
+
+#define SUBPIXEL_ENTRIES 4096 // power of two
+#define SUBPIXEL_PROBES  4
+
+typedef struct
+{
+  u32 key;    // rounded XY, (u16)SX | (u16)SY << 16
+  u32 frame;  // frame of the entry, stale when older than the previous one
+  s32 x, y;   // un-rounded XY (16.16)
+}subpixel_entry;
+
+typedef struct
+{
+  bool enabled;
+  u32 frame;
+
+  u64 recorded; // vertices recorded since the cache was enabled
+
+  subpixel_entry entries[SUBPIXEL_ENTRIES];
+}subpixel_cache;
+
+void subpixel_enable(bool enabled); // bound machine, empties the cache
+
+subpixel_cache *subpixel_active(void); // cache of the bound machine, NULL when off
+
+void subpixel_reset(subpixel_cache *cache); // new frame: the entries of the previous one go stale
+
+void subpixel_record(subpixel_cache *cache, s16 sx, s16 sy, s32 x, s32 y);
+
+// Un-rounded XY of the vertex drawn at sx, sy in this frame or the previous one, false when unknown
+bool subpixel_lookup(const subpixel_cache *cache, s16 sx, s16 sy, s32 *x, s32 *y);
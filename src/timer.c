@@ -0,0 +1,255 @@
+#include "machine.h"
+
+// Counter Mode
+#define MODE_SYNC_ENABLE   0x0001 // 0      Synchronization Enable (0=Free Run, 1=Synchronize via Bit1-2)
+#define MODE_SYNC          0x0006 // 1-2    Synchronization Mode   (0-3, see lists below)
+#define MODE_RESET_TARGET  0x0008 // 3      Reset counter to 0000h  (0=After Counter=FFFFh, 1=After Counter=Target)
+#define MODE_IRQ_TARGET    0x0010 // 4      IRQ when Counter=Target (0=Disable, 1=Enable)
+#define MODE_IRQ_FFFF      0x0020 // 5      IRQ when Counter=FFFFh  (0=Disable, 1=Enable)
+#define MODE_IRQ_REPEAT    0x0040 // 6      IRQ Once/Repeat Mode    (0=One-shot, 1=Repeatedly)
+#define MODE_IRQ_TOGGLE    0x0080 // 7      IRQ Pulse/Toggle Mode   (0=Short Bit10=0 Pulse, 1=Toggle Bit10 on/off)
+#define MODE_CLOCK         0x0300 // 8-9    Clock Source (0-3, see list below)
+#define MODE_NO_IRQ        0x0400 // 10     Interrupt Request       (0=Yes, 1=No) (Set after Writing)    (W=1) (R)
+#define MODE_REACHED_TARGET 0x0800 // 11    Reached Target Value    (0=No, 1=Yes) (Reset after Reading)        (R)
+#define MODE_REACHED_FFFF  0x1000 // 12     Reached FFFFh Value     (0=No, 1=Yes) (Reset after Reading)        (R)
+#define MODE_WRITABLE      0x03ff
+
+enum CLOCK { CLOCK_SYSTEM, CLOCK_SYSTEM8, CLOCK_DOT, CLOCK_HBLANK };
+
+// Clock Source (Bit8-9): Counter 0: 0 or 2 = System Clock, 1 or 3 = Dotclock
+//                        Counter 1: 0 or 2 = System Clock, 1 or 3 = Hblank
+//                        Counter 2: 0 or 1 = System Clock, 2 or 3 = System Clock/8
+static u8 clock_source(u32 n, u16 mode)
+{
+  const u32 source = (mode & MODE_CLOCK) >> 8;
+
+  switch (n)
+  {
+    case 0: return (source & 1) ? CLOCK_DOT : CLOCK_SYSTEM;
+    case 1: return (source & 1) ? CLOCK_HBLANK : CLOCK_SYSTEM;
+    default: return (source & 2) ? CLOCK_SYSTEM8 : CLOCK_SYSTEM;
+  }
+}
+
+// Clocks elapsed at a cycle
+static u64 clock_ticks(u8 clock, u64 cycle)
+{
+  switch (clock)
+  {
+    case CLOCK_SYSTEM8: return cycle / 8;
+    case CLOCK_DOT:     return gpu_dots(cycle);
+    case CLOCK_HBLANK:  return gpu_hblanks(cycle);
+    default:            return cycle;
+  }
+}
+
+// First cycle at which the clock count is reached
+static u64 tick_cycle(u8 clock, u64 tick)
+{
+  switch (clock)
+  {
+    case CLOCK_SYSTEM8: return tick * 8;
+    case CLOCK_DOT:     return gpu_dot_cycle(tick);
+    case CLOCK_HBLANK:  return gpu_hblank_cycle(tick);
+    default:            return tick;
+  }
+}
+
+static inline bool stopped(u32 n, const root_counter *t)
+{
+  // Synchronization Modes for Counter 2: 0 or 3 = Stop counter at current value
+  return n == 2 && (t->mode & MODE_SYNC_ENABLE) && ((t->mode & MODE_SYNC) >> 1) % 3 == 0;
+}
+
+// Last value before the counter goes back to 0000h
+static inline u32 wrap_value(const root_counter *t, u32 value)
+{
+  return ((t->mode & MODE_RESET_TARGET) && value <= t->target) ? t->target : 0xffff;
+}
+
+// Ticks until the counter next equals goal (at least 1), UINT64_MAX when it never does
+static u64 ticks_until(const root_counter *t, u32 goal)
+{
+  const u32 wrap = wrap_value(t, t->value);
+
+  if (t->value < goal && goal <= wrap)
+    return goal - t->value;
+
+  if (goal > wrap_value(t, 0))
+    return UINT64_MAX;
+
+  return wrap - t->value + 1 + goal;
+}
+
+// Bring the counter to the clock count at cycle
+static void sync(u32 n, u64 cycle)
+{
+  root_counter *t = &psx->timers[n];
+
+  const u64 tick = clock_ticks(t->clock, cycle);
+  const u64 elapsed = tick - t->tick;
+
+  t->tick = tick;
+
+  if (!elapsed || stopped(n, t))
+    return;
+
+  if (ticks_until(t, t->target) <= elapsed)
+    t->mode |= MODE_REACHED_TARGET;
+
+  if (ticks_until(t, 0xffff) <= elapsed)
+    t->mode |= MODE_REACHED_FFFF;
+
+  const u32 first = wrap_value(t, t->value) - t->value + 1; // ticks to the first wrap
+
+  if (elapsed < first)
+    t->value += elapsed;
+  else
+    t->value = (elapsed - first) % (wrap_value(t, 0) + 1);
+}
+
+// Post the next target / FFFFh IRQ of the counter
+static void schedule(u32 n)
+{
+  const root_counter *t = &psx->timers[n];
+
+  u64 ticks = UINT64_MAX;
+
+  if (!stopped(n, t) && !t->irq_done)
+  {
+    if (t->mode & MODE_IRQ_TARGET)
+      ticks = ticks_until(t, t->target);
+
+    if (t->mode & MODE_IRQ_FFFF)
+    {
+      const u64 ffff = ticks_until(t, 0xffff);
+
+      if (ffff < ticks)
+        ticks = ffff;
+    }
+  }
+
+  if (ticks == UINT64_MAX)
+    sched_cancel(EVENT_TIMER0 + n);
+  else
+    sched_add(EVENT_TIMER0 + n, tick_cycle(t->clock, t->tick + ticks));
+}
+
+static void timer_event(u32 n, u64 deadline)
+{
+  root_counter *t = &psx->timers[n];
+
+  sync(n, deadline);
+
+  if (t->mode & MODE_IRQ_TOGGLE)
+    t->mode ^= MODE_NO_IRQ;
+  else
+    t->mode &= ~MODE_NO_IRQ; // short pulse, back to 1 a few cycles later
+
+  if (!(t->mode & MODE_NO_IRQ))
+    irq_raise(IRQ_TIMER0 + n);
+
+  if (!(t->mode & MODE_IRQ_TOGGLE))
+    t->mode |= MODE_NO_IRQ;
+
+  if (!(t->mode & MODE_IRQ_REPEAT))
+    t->irq_done = true;
+
+  schedule(n);
+}
+
+static void timer0_event(R3000 *cpu, u64 deadline) { timer_event(0, deadline); }
+static void timer1_event(R3000 *cpu, u64 deadline) { timer_event(1, deadline); }
+static void timer2_event(R3000 *cpu, u64 deadline) { timer_event(2, deadline); }
+
+void timer_reset(void)
+{
+  for (u32 n = 0; n < 3; n++)
+  {
+    psx->timers[n] = (root_counter){ .mode = MODE_NO_IRQ, .clock = clock_source(n, 0) };
+    psx->timers[n].tick = clock_ticks(psx->timers[n].clock, sched_now());
+
+    sched_cancel(EVENT_TIMER0 + n);
+  }
+
+  sched_set_handler(EVENT_TIMER0, timer0_event);
+  sched_set_handler(EVENT_TIMER1, timer1_event);
+  sched_set_handler(EVENT_TIMER2, timer2_event);
+}
+
+u32 timer_read(u32 offset)
+{
+  const u32 n = offset >> 4;
+
+  if (n > 2)
+    return 0;
+
+  root_counter *t = &psx->timers[n];
+
+  u32 value = 0;
+
+  switch (offset & 0xc)
+  {
+    case 0x0:
+      sync(n, sched_now());
+      value = t->value;
+      break;
+
+    case 0x4:
+      sync(n, sched_now());
+      value = t->mode;
+      t->mode &= ~(MODE_REACHED_TARGET | MODE_REACHED_FFFF);
+      break;
+
+    case 0x8:
+      value = t->target;
+      break;
+  }
+
+  return value >> ((offset & 3) * 8);
+}
+
+void timer_write(u32 offset, u32 value, u32 size)
+{
+  const u32 n = offset >> 4;
+
+  if (n > 2)
+    return;
+
+  root_counter *t = &psx->timers[n];
+
+  const u32 shift = (offset & 3) * 8;
+  const u32 lanes = ((size == 4 ? 0xffffffff : (1u << (size * 8)) - 1) << shift) & 0xffff; // bits written
+
+  // the registers are 16 bits wide, bytes 2-3 are not connected
+  if (!lanes)
+    return;
+
+  value <<= shift;
+
+  sync(n, sched_now());
+
+  switch (offset & 0xc)
+  {
+    case 0x0:
+      t->value = (t->value & ~lanes) | (value & lanes);
+      break;
+
+    case 0x4:
+      // the write resets the counter to 0000h and sets bit 10
+      value = (t->mode & ~lanes) | (value & lanes);
+
+      t->mode = (t->mode & ~MODE_WRITABLE) | (value & MODE_WRITABLE) | MODE_NO_IRQ;
+      t->value = 0;
+      t->irq_done = false;
+      t->clock = clock_source(n, t->mode);
+      t->tick = clock_ticks(t->clock, sched_now());
+      break;
+
+    case 0x8:
+      t->target = (t->target & ~lanes) | (value & lanes);
+      break;
+  }
+
+  schedule(n);
+}
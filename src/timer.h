@@ -0,0 +1,31 @@
+#pragma once
+#include "cpu.h"
+
+// Timers (aka Root counters)
+// 1F801100h+N*10h - Timer 0..2 Current Counter Value (R/W)
+// 1F801104h+N*10h - Timer 0..2 Counter Mode (R/W)
+// 1F801108h+N*10h - Timer 0..2 Counter Target Value (R/W)
+//
+// The counters are never ticked: each one keeps its value at the last synchronisation
+// and the clock count it was taken at, and the current value is derived from the clock
+// source when a register is read or written. Only the target / FFFFh IRQs are events
+// (EVENT_TIMER0..2, see scheduler.h).
+//
+// Timer 2 sync modes 0 and 3 stop the counter; the sync modes of timers 0 and 1
+// (pause / reset on H-Blank and V-Blank) are not modelled, they count freely.
+
+typedef struct
+{
+  u16 value;  // counter value at tick
+  u16 mode;
+  u16 target;
+  u8 clock;
+  bool irq_done; // one-shot IRQ already fired since the mode write
+  u64 tick;      // clock count of the last synchronisation
+}root_counter;
+
+void timer_reset(void);
+
+u32 timer_read(u32 offset);
+
+void timer_write(u32 offset, u32 value, u32 size);